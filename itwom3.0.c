@@ -48,6 +48,18 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+/* Optional vectorization of the terrain kernels. Nothing is selected at
+ * runtime; we just key off the compiler's target macros, so building with
+ * -mavx2 (see the SIMD knob in the Makefile) or on any AArch64 machine is
+ * all that's needed to enable the fast paths. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ITWOM_HAVE_SIMD 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define ITWOM_HAVE_SIMD 1
+#endif
+
 #ifdef ITM_ELEV_DOUBLE
 #define elev_t double
 #else
@@ -2014,6 +2026,225 @@ double avar(double zzt, double zzl, double zzc, prop_type *prop, propv_type *pro
     return avarv;
 }
 
+/***************************************************************************************
+ * Vectorized terrain kernels
+ *
+ * The profile scans below (the hzns() horizon walks, the z1sq() least-squares
+ * fits and the d1thx() detrending pass) are tight loops over the contiguous
+ * pfl[] array with simple arithmetic, and they dominate the cycles inside
+ * every point_to_point() call. The helpers here provide hand-vectorized
+ * versions of their inner loops for AVX2 and AArch64 NEON, with a scalar
+ * fallback that performs the same operations as the original code.
+ *
+ * The horizon block test and the detrending pass carry their running values
+ * from lane to lane with the same sequence of floating point operations as
+ * the scalar loops, so they change no results. The least-squares accumulator
+ * uses per-lane partial sums, which reorders its additions slightly; with
+ * -ffast-math the compiler is already free to do the same to the scalar loop.
+ *
+ * qtile() and the d1thx() resampling loop are left alone: quickselect's
+ * swaps and the resampler's variable-rate walk are both data-dependent and
+ * don't vectorize.
+ ***************************************************************************************/
+
+/*
+ * Sight-line block test for the horizon scans in hzns() and hzns2().
+ *
+ * d[] holds the along-path distances of four consecutive profile points and
+ * h[] their heights, in scan order. Returns nonzero if all four points stay
+ * at or below the sight line described by qc (half the earth's curvature),
+ * the (take-off angle) and zref (antenna height) -- i.e. if the scalar scan
+ * would take no action anywhere in the block.
+ */
+int hzns_block_clear(const double d[4], const elev_t h[4], double qc, double the, double zref)
+{
+#if defined(__AVX2__)
+    __m256d dv=_mm256_loadu_pd(d);
+    __m256d hv=_mm256_set_pd((double)h[3],(double)h[2],(double)h[1],(double)h[0]);
+    __m256d qv=_mm256_sub_pd(_mm256_sub_pd(hv,
+               _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(qc),dv),
+               _mm256_set1_pd(the)),dv)),_mm256_set1_pd(zref));
+
+    return _mm256_movemask_pd(_mm256_cmp_pd(qv,_mm256_setzero_pd(),_CMP_GT_OQ))==0;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    double hd[4]={(double)h[0],(double)h[1],(double)h[2],(double)h[3]};
+    float64x2_t qcv=vdupq_n_f64(qc), thev=vdupq_n_f64(the), zv=vdupq_n_f64(zref);
+    float64x2_t d0=vld1q_f64(d), d1=vld1q_f64(d+2);
+    float64x2_t h0=vld1q_f64(hd), h1=vld1q_f64(hd+2);
+    float64x2_t q0=vsubq_f64(vsubq_f64(h0,vmulq_f64(vaddq_f64(vmulq_f64(qcv,d0),thev),d0)),zv);
+    float64x2_t q1=vsubq_f64(vsubq_f64(h1,vmulq_f64(vaddq_f64(vmulq_f64(qcv,d1),thev),d1)),zv);
+    uint64x2_t m=vorrq_u64(vcgtq_f64(q0,vdupq_n_f64(0.0)),vcgtq_f64(q1,vdupq_n_f64(0.0)));
+
+    return (vgetq_lane_u64(m,0)|vgetq_lane_u64(m,1))==0;
+#else
+    int i;
+
+    for (i=0; i<4; i++)
+        if ((double)h[i]-((qc*d[i]+the)*d[i])-zref>0.0)
+            return 0;
+
+    return 1;
+#endif
+}
+
+/*
+ * Least-squares accumulation loop shared by z1sq1() and z1sq2(). Adds the
+ * heights of cnt consecutive profile points starting at p[0] to *a, their
+ * height-times-offset products to *b and, when bn is non-NULL, the squared
+ * offsets to *bn. The offset of p[0] is x0; each following point is one
+ * unit further along.
+ */
+void z1sq_accum(const elev_t p[], int cnt, double x0, double *a, double *b, double *bn)
+{
+#if defined(__AVX2__)
+    __m256d av=_mm256_setzero_pd(), bv=_mm256_setzero_pd(), cv=_mm256_setzero_pd();
+    __m256d xv=_mm256_add_pd(_mm256_set1_pd(x0),_mm256_set_pd(3.0,2.0,1.0,0.0));
+    __m256d step=_mm256_set1_pd(4.0);
+    double lanes[4];
+    int i=0;
+
+    for (; i+4<=cnt; i+=4)
+    {
+        __m256d pv=_mm256_set_pd((double)p[i+3],(double)p[i+2],(double)p[i+1],(double)p[i]);
+
+        av=_mm256_add_pd(av,pv);
+        bv=_mm256_add_pd(bv,_mm256_mul_pd(pv,xv));
+        cv=_mm256_add_pd(cv,_mm256_mul_pd(xv,xv));
+        xv=_mm256_add_pd(xv,step);
+    }
+
+    _mm256_storeu_pd(lanes,av);
+    *a+=lanes[0]+lanes[1]+lanes[2]+lanes[3];
+    _mm256_storeu_pd(lanes,bv);
+    *b+=lanes[0]+lanes[1]+lanes[2]+lanes[3];
+
+    if (bn!=NULL)
+    {
+        _mm256_storeu_pd(lanes,cv);
+        *bn+=lanes[0]+lanes[1]+lanes[2]+lanes[3];
+    }
+
+    for (; i<cnt; i++)
+    {
+        double x=x0+(double)i;
+
+        *a+=p[i];
+        *b+=p[i]*x;
+
+        if (bn!=NULL)
+            *bn+=x*x;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t av=vdupq_n_f64(0.0), bv=vdupq_n_f64(0.0), cv=vdupq_n_f64(0.0);
+    float64x2_t step=vdupq_n_f64(2.0);
+    double xx[2]={x0,x0+1.0};
+    float64x2_t xv=vld1q_f64(xx);
+    int i=0;
+
+    for (; i+2<=cnt; i+=2)
+    {
+        double pp[2]={(double)p[i],(double)p[i+1]};
+        float64x2_t pv=vld1q_f64(pp);
+
+        av=vaddq_f64(av,pv);
+        bv=vaddq_f64(bv,vmulq_f64(pv,xv));
+        cv=vaddq_f64(cv,vmulq_f64(xv,xv));
+        xv=vaddq_f64(xv,step);
+    }
+
+    *a+=vaddvq_f64(av);
+    *b+=vaddvq_f64(bv);
+
+    if (bn!=NULL)
+        *bn+=vaddvq_f64(cv);
+
+    for (; i<cnt; i++)
+    {
+        double x=x0+(double)i;
+
+        *a+=p[i];
+        *b+=p[i]*x;
+
+        if (bn!=NULL)
+            *bn+=x*x;
+    }
+#else
+    double x=x0;
+    int i;
+
+    for (i=0; i<cnt; i++, x+=1.0)
+    {
+        *a+=p[i];
+        *b+=p[i]*x;
+
+        if (bn!=NULL)
+            *bn+=x*x;
+    }
+#endif
+}
+
+/*
+ * Detrending pass shared by d1thx_s() and d1thx2_s(): subtracts the fitted
+ * line a + j*b from the n smoothed heights in s[]. The line heights are
+ * carried from lane to lane by the same sequential additions the scalar
+ * loop performs, so the results are identical.
+ */
+void detrend_block(elev_t s[], int n, double a, double b)
+{
+#if defined(__AVX2__)
+    int j=0;
+
+    for (; j+4<=n; j+=4)
+    {
+        double a1=a+b, a2=a1+b, a3=a2+b;
+        __m256d lv=_mm256_set_pd(a3,a2,a1,a);
+
+#ifdef ITM_ELEV_DOUBLE
+        _mm256_storeu_pd(s+j,_mm256_sub_pd(_mm256_loadu_pd(s+j),lv));
+#else
+        _mm_storeu_ps(s+j,_mm256_cvtpd_ps(_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(s+j)),lv)));
+#endif
+        a=a3+b;
+    }
+
+    for (; j<n; j++)
+    {
+        s[j]-=a;
+        a=a+b;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    int j=0;
+
+    for (; j+2<=n; j+=2)
+    {
+        double aa[2]={a,a+b};
+        float64x2_t lv=vld1q_f64(aa);
+
+#ifdef ITM_ELEV_DOUBLE
+        vst1q_f64(s+j,vsubq_f64(vld1q_f64(s+j),lv));
+#else
+        vst1_f32(s+j,vcvt_f32_f64(vsubq_f64(vcvt_f64_f32(vld1_f32(s+j)),lv)));
+#endif
+        a=aa[1]+b;
+    }
+
+    for (; j<n; j++)
+    {
+        s[j]-=a;
+        a=a+b;
+    }
+#else
+    int j;
+
+    for (j=0; j<n; j++)
+    {
+        s[j]-=a;
+        a=a+b;
+    }
+#endif
+}
+
+
 /*
  * Horizon calculations.
  *
@@ -2061,7 +2292,60 @@ void hzns(const elev_t pfl[], prop_type *prop)
     sb=prop->dist;                      /* sb is at rx loc                                      */
     wq=true;                            /* line-of-sight study ok?                              */
 
-    for (int i=1; i<np; i++)
+    int i=1;
+
+#ifdef ITWOM_HAVE_SIMD
+    /* Obstructions are sparse compared to the number of points scanned, so
+     * test whole blocks of the profile against the current sight lines and
+     * drop to the scalar update only for blocks that poke above one. While
+     * the path is still clear (wq), the rx line isn't examined, matching
+     * the scalar loop below. */
+
+    while (i+4<=np)
+    {
+        double d4[4], e4[4];
+
+        d4[0]=sa+xi; d4[1]=d4[0]+xi; d4[2]=d4[1]+xi; d4[3]=d4[2]+xi;
+        e4[0]=sb-xi; e4[1]=e4[0]-xi; e4[2]=e4[1]-xi; e4[3]=e4[2]-xi;
+
+        if (hzns_block_clear(d4,pfl+i+2,qc,prop->the[0],za) &&
+            (wq || hzns_block_clear(e4,pfl+i+2,qc,prop->the[1],zb)))
+        {
+            sa=d4[3];
+            sb=e4[3];
+            i+=4;
+            continue;
+        }
+
+        for (int ii=0; ii<4; ii++, i++)
+        {
+            sa+=xi;
+            sb-=xi;
+
+            q=pfl[i+2] - ((qc*sa+prop->the[0])*sa) - za;
+
+            if (q>0.0)
+            {
+                prop->the[0]+=q/sa;
+                prop->dl[0]=sa;
+                wq=false;
+            }
+
+            if (!wq)
+            {
+                q=pfl[i+2] - ((qc*sb+prop->the[1])*sb) - zb;
+
+                if (q>0.0)
+                {
+                    prop->the[1]+=q/sb;
+                    prop->dl[1]=sb;
+                }
+            }
+        }
+    }
+#endif
+
+    for (; i<np; i++)
     {
         sa+=xi;                                         /* move sa towards rx loc               */
         sb-=xi;                                         /* move sb towards tx loc               */
@@ -2142,7 +2426,44 @@ void hzns2(const elev_t pfl[], prop_type *prop)
         sb=prop->dist;                  /* sb is at rx loc                                     */
         wq=true;                        /* assume entire path is Line-Of-Sight                 */
 
-        for(j=1; j<np; j++)
+        j=1;
+
+#ifdef ITWOM_HAVE_SIMD
+        /* As in hzns(): skip whole blocks of the profile that stay below the
+         * current sight line and redo only the dirty blocks scalar. */
+
+        while (j+4<=np)
+        {
+            double d4[4];
+
+            d4[0]=sa+xi; d4[1]=d4[0]+xi; d4[2]=d4[1]+xi; d4[3]=d4[2]+xi;
+
+            if (hzns_block_clear(d4,pfl+j+2,qc,prop->the[0],za))
+            {
+                sa=d4[3];
+                j+=4;
+                continue;
+            }
+
+            for (int jj=0; jj<4; jj++, j++)
+            {
+                sa+=xi;
+                q=pfl[j+2] - ((qc*sa+prop->the[0])*sa) - za;
+
+                if(q>0.0)
+                {
+                    prop->los=false;
+                    prop->the[0]+=q/sa;
+                    prop->dl[0]=sa;
+                    prop->the[0]=min(prop->the[0],1.569);
+                    prop->hht=pfl[j+2];
+                    wq=false;
+                }
+            }
+        }
+#endif
+
+        for(; j<np; j++)
         {
             sa+=xi;                                       /* add to the distance from tx       */
             q=pfl[j+2] - ((qc*sa+prop->the[0])*sa) - za;  /* height diff from pfl pt to sa,    */
@@ -2161,7 +2482,45 @@ void hzns2(const elev_t pfl[], prop_type *prop)
 
         if(!wq)                               /* we know it's not LOS so examine the rx end   */
         {
-            for(i=1; i<np; i++)
+            i=1;
+
+#ifdef ITWOM_HAVE_SIMD
+            while (i+4<=np)
+            {
+                double e4[4], t4[4];
+                elev_t h4[4];
+
+                e4[0]=sb-xi; e4[1]=e4[0]-xi; e4[2]=e4[1]-xi; e4[3]=e4[2]-xi;
+                t4[0]=prop->dist-e4[0]; t4[1]=prop->dist-e4[1];
+                t4[2]=prop->dist-e4[2]; t4[3]=prop->dist-e4[3];
+                h4[0]=pfl[np+2-i]; h4[1]=pfl[np+1-i];
+                h4[2]=pfl[np-i];   h4[3]=pfl[np-1-i];
+
+                if (hzns_block_clear(t4,h4,qc,prop->the[1],zb))
+                {
+                    sb=e4[3];
+                    i+=4;
+                    continue;
+                }
+
+                for (int ii=0; ii<4; ii++, i++)
+                {
+                    sb-=xi;
+                    q=pfl[np+2-i] - ((qc*(prop->dist-sb)+prop->the[1]) * (prop->dist-sb)) - zb;
+
+                    if(q>0.0)
+                    {
+                        prop->the[1]+=q/(prop->dist-sb);
+                        prop->the[1]=min(prop->the[1],1.57);
+                        prop->the[1]=max(prop->the[1],-1.568);
+                        prop->hhr=pfl[np+2-i];
+                        prop->dl[1]=max(0.0,prop->dist-sb);
+                    }
+                }
+            }
+#endif
+
+            for(; i<np; i++)
             {
                 sb-=xi;                          /* move sb towards tx                        */
 
@@ -2280,13 +2639,9 @@ void z1sq1 (const elev_t z[], const double x1, const double x2, double *z0, doub
     a=0.5*(z[ja+2]+z[jb+2]);   /* avg of the start and end heights, i.e. initial intercept, a */
     b=0.5*(z[ja+2]-z[jb+2])*x; /* avg of the start/end height difference times the run, i.e initial slope */
 
-    for (int i=2; i<=n; ++i)
-    {
-        ++ja;
-        x+=1.0;                /* we're moving from -x to +x, one by one      */
-        a+=z[ja+2];               /* a=sum(y)                                 */
-        b+=z[ja+2]*x;           /* b=sum(x*y)                                 */
-    }
+    /* accumulate a=sum(y) and b=sum(x*y) over the interior points, moving
+       from -x to +x past the middle at 0 */
+    z1sq_accum(z+ja+3,n-1,x+1.0,&a,&b,NULL);
 
     a/=xa;                        /* a = sum(y)/numpoints                     */
 
@@ -2362,14 +2717,9 @@ void z1sq2(const elev_t z[], const double x1, const double x2, double *z0, doubl
 
     bn=2*(x*x);                /* initial value for our slope denominator, sum(x*x)   */
 
-    for (int i=2; i<=n; ++i)
-    {
-        ++ja;
-        x+=1.0;            /* we're moving from -x to +x, one by one            */
-        bn+=(x*x);         /* bn = sum(x*x)                                     */
-        a+=z[ja+2];           /* a = sum(y)                                        */
-        b+=z[ja+2]*x;      /* b = sum(x*y)                                      */
-    }
+    /* accumulate a=sum(y), b=sum(x*y) and bn=sum(x*x) over the interior
+       points, moving from -x to +x past the middle at 0 */
+    z1sq_accum(z+ja+3,n-1,x+1.0,&a,&b,&bn);
 
     a/=(xa+2);                /* a = sum(y)/numpoints                                */
     b=b/bn;                    /* b = sum(x*y)/sum(x*x)                            */
@@ -2523,8 +2873,14 @@ double qerf(const double z)
  * See notes for d1thx2(), the newer version, below. This version is only used
  * with ITM 1.2.2 and is limited to using a maximum of 245 pfl array elements.
  * It is thus faster but slightly less accurate.
+ *
+ * This is the core version. The caller supplies a growable scratch buffer
+ * through sp/snp (buffer pointer and its allocated element count); the buffer
+ * is enlarged as needed and left allocated on return so that sweep-style
+ * callers can reuse it from one profile to the next. Use d1thx() if you don't
+ * want to manage the buffer yourself.
  */
-double d1thx(const elev_t pfl[], const double x1, const double x2)
+double d1thx_s(const elev_t pfl[], const double x1, const double x2, elev_t **sp, int *snp)
 {
     int np, ka, kb, n, k, j;
     double d1thxv, sn, xa, xb;
@@ -2535,7 +2891,7 @@ double d1thx(const elev_t pfl[], const double x1, const double x2)
     xb=x2/pfl[1];                  /* end point's array element */
     d1thxv=0.0;
 
-    if (xb-xa<2.0) 
+    if (xb-xa<2.0)
         return d1thxv;
 
     ka=(int)(0.1*(xb-xa+8.0));     /* from 32 to 242 points */
@@ -2544,8 +2900,14 @@ double d1thx(const elev_t pfl[], const double x1, const double x2)
     kb=n-ka+1;                     /* kb can range from 32-221 */
     sn=n-1;                        /* index of last path element to consider */
 
-    s = (elev_t*)calloc(n+2, sizeof(elev_t));
-    assert(s!=NULL);
+    if (*sp==NULL || *snp<n+2)
+    {
+        free(*sp);
+        *sp = (elev_t*)malloc((n+2)*sizeof(elev_t));
+        assert(*sp!=NULL);
+        *snp = n+2;
+    }
+    s = *sp;
     s[0]=sn;
     s[1]=1.0;
 
@@ -2573,11 +2935,9 @@ double d1thx(const elev_t pfl[], const double x1, const double x2)
 
     xb=(xb-xa)/sn;      /* xa and xb are now heights, so xb is now a slope */
 
-    for (j=0; j<n; j++)
-    {
-        s[j+2]-=xa; /* difference between the original height and new slope */
-        xa=xa+xb;
-    }
+    /* subtract the fitted line from the smoothed heights, leaving the
+       difference between the original height and the new slope */
+    detrend_block(s+2,n,xa,xb);
 
     /* Now find the difference between the 90% and 10% heights.
      * These two qtiles calls take a (relatively) enormous amount of
@@ -2588,6 +2948,20 @@ double d1thx(const elev_t pfl[], const double x1, const double x2)
     /* apply empirical data matching magic scaling. See ITWOM p124. */
     d1thxv/=1.0-0.8*exp(-(x2-x1)/50.0e3);
 
+    return d1thxv;
+}
+
+/*
+ * Delta h, experimental. One-shot wrapper around d1thx_s() that manages its
+ * own scratch buffer. Only used with ITM 1.2.2.
+ */
+double d1thx(const elev_t pfl[], const double x1, const double x2)
+{
+    elev_t *s=NULL;
+    int sn=0;
+    double d1thxv;
+
+    d1thxv=d1thx_s(pfl,x1,x2,&s,&sn);
     free(s);
 
     return d1thxv;
@@ -2610,8 +2984,15 @@ double d1thx(const elev_t pfl[], const double x1, const double x2)
  *
  * See ITWOM-SUB-ROUTINES.pdf p125. This version has been modified by Sid
  * Shumate to use the entire range of the pfl array if needed.
+ *
+ * This is the core version. As with d1thx_s() above, the caller supplies a
+ * growable scratch buffer through sp/snp so that sweep-style callers can
+ * reuse it from one profile to the next. This matters here: with Sid's fix
+ * the buffer can run to tens of kilobytes at -hd resolutions, and allocating
+ * and freeing it for every sample along a radial is measurable. Use d1thx2()
+ * if you don't want to manage the buffer yourself.
  */
-double d1thx2(const elev_t pfl[], const double x1, const double x2)
+double d1thx2_s(const elev_t pfl[], const double x1, const double x2, elev_t **sp, int *snp)
 {
     int np, ka, kb, n, k, kmx, j;
     double d1thx2v, sn, xa, xb, xc;
@@ -2625,7 +3006,7 @@ double d1thx2(const elev_t pfl[], const double x1, const double x2)
     if (xb-xa<2.0)
         return d1thx2v;
 
-    /* Compare this section to d1thx() above. */
+    /* Compare this section to d1thx_s() above. */
     ka=(int)(0.1*(xb-xa+8.0));
     kmx=max(25,(int)(83350/(pfl[1]))); /* Sid's fix: dynamically figure out the max elements */
     ka=min(max(4,ka),kmx);         /* range from 4 to kmax */
@@ -2633,8 +3014,14 @@ double d1thx2(const elev_t pfl[], const double x1, const double x2)
     kb=n-ka+1;
     sn=n-1;
 
-    s = (elev_t*)calloc(n+2, sizeof(elev_t));
-    assert(s!=NULL);
+    if (*sp==NULL || *snp<n+2)
+    {
+        free(*sp);
+        *sp = (elev_t*)malloc((n+2)*sizeof(elev_t));
+        assert(*sp!=NULL);
+        *snp = n+2;
+    }
+    s = *sp;
     s[0]=sn;
     s[1]=1.0;
 
@@ -2667,11 +3054,9 @@ double d1thx2(const elev_t pfl[], const double x1, const double x2)
 
     xb=(xb-xa)/sn;      /* xa and xb are now heights, so xb is now a slope */
 
-    for (j=0; j<n; j++)
-    {
-        s[j+2]-=xa; /* difference between the original height and new slope */
-        xa=xa+xb;
-    }
+    /* subtract the fitted line from the smoothed heights, leaving the
+       difference between the original height and the new slope */
+    detrend_block(s+2,n,xa,xb);
 
     /* Now find the difference between the 90% and 10% heights.
      * These two qtiles calls take a (relatively) enormous amount of
@@ -2681,6 +3066,20 @@ double d1thx2(const elev_t pfl[], const double x1, const double x2)
     /* apply empirical data matching magic scaling. See ITWOM p124. */
     d1thx2v/=1.0-0.8*exp(-(x2-x1)/50.0e3);
 
+    return d1thx2v;
+}
+
+/*
+ * Delta h, experimental. One-shot wrapper around d1thx2_s() that manages its
+ * own scratch buffer.
+ */
+double d1thx2(const elev_t pfl[], const double x1, const double x2)
+{
+    elev_t *s=NULL;
+    int sn=0;
+    double d1thx2v;
+
+    d1thx2v=d1thx2_s(pfl,x1,x2,&s,&sn);
     free(s);
 
     return d1thx2v;
@@ -2700,11 +3099,12 @@ double d1thx2(const elev_t pfl[], const double x1, const double x2)
  * propa: propa_type state variable
  * propv: propv_type state variable
  *
- *
+ * The sp/snp pair is a growable scratch buffer handed down to d1thx_s();
+ * see the notes there. Use qlrpfl() if you don't want to manage it.
  *
  * See ITWOM-SUB-ROUTINES.pdf p233
  */
-void qlrpfl(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_type *propa, propv_type *propv)
+void qlrpfl_s(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_type *propa, propv_type *propv, elev_t **sp, int *snp)
 {
     int np, j;
     double xl[2], q, za, zb, temp;
@@ -2719,7 +3119,7 @@ void qlrpfl(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_ty
 
     xl[1]=prop->dist-xl[1]; /* adjust the rx distance to be from the far end */
 
-    prop->dh=d1thx(pfl,xl[0],xl[1]);  /* calculate the terrain irregularity factor */
+    prop->dh=d1thx_s(pfl,xl[0],xl[1],sp,snp);  /* calculate the terrain irregularity factor */
 
     if (prop->dl[0]+prop->dl[1] > 1.5*prop->dist)
     {
@@ -2784,6 +3184,19 @@ void qlrpfl(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_ty
     lrprop(0.0,prop,propa);
 }
 
+/*
+ * Quick Longley-Rice Profile. One-shot wrapper around qlrpfl_s() that manages
+ * its own scratch buffer.
+ */
+void qlrpfl(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_type *propa, propv_type *propv)
+{
+    elev_t *s=NULL;
+    int sn=0;
+
+    qlrpfl_s(pfl,klimx,mdvarx,prop,propa,propv,&s,&sn);
+    free(s);
+}
+
 
 /*
  * qlrpfl2()
@@ -2799,9 +3212,12 @@ void qlrpfl(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_ty
  * propa: propa_type state variable
  * propv: propv_type state variable
  *
+ * The sp/snp pair is a growable scratch buffer handed down to d1thx2_s();
+ * see the notes there. Use qlrpfl2() if you don't want to manage it.
+ *
  * See ITWOM-SUB-ROUTINES.pdf p247
  */
-void qlrpfl2(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_type *propa, propv_type *propv)
+void qlrpfl2_s(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_type *propa, propv_type *propv, elev_t **sp, int *snp)
 {
     int np, j;
     double xl[2], dlb, za, zb, temp, rad, rae1, rae2;
@@ -2819,8 +3235,8 @@ void qlrpfl2(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_t
     for (j=0; j<2; j++)                              /* for both tx and rx... */
         xl[j]=min(15.0*prop->hg[j],0.1*prop->dl[j]); /* ...set xl to min of 15x ant height or 1/10 horizon dist */
 
-    xl[1]=prop->dist-xl[1];           /* adjust the rx distance to be from the far end */
-    prop->dh=d1thx2(pfl,xl[0],xl[1]); /* calculate the terrain irregularity factor */
+    xl[1]=prop->dist-xl[1];              /* adjust the rx distance to be from the far end */
+    prop->dh=d1thx2_s(pfl,xl[0],xl[1],sp,snp); /* calculate the terrain irregularity factor */
 
     /* The first branch of this if statement is for when there are no points in array (e.g. called in the now-deprecated
      * "area" mode, or when the distance between points is very large.
@@ -2929,9 +3345,22 @@ void qlrpfl2(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_t
     lrprop2(0.0,prop,propa);
 }
 
+/*
+ * Quick Longley-Rice Profile. One-shot wrapper around qlrpfl2_s() that manages
+ * its own scratch buffer.
+ */
+void qlrpfl2(const elev_t pfl[], int klimx, int mdvarx, prop_type *prop, propa_type *propa, propv_type *propv)
+{
+    elev_t *s=NULL;
+    int sn=0;
+
+    qlrpfl2_s(pfl,klimx,mdvarx,prop,propa,propv,&s,&sn);
+    free(s);
+}
+
 
 /***************************************************************************************
- * Point-To-Point Mode Calculations 
+ * Point-To-Point Mode Calculations
  ***************************************************************************************/
 
 
@@ -3173,6 +3602,229 @@ void point_to_point(const elev_t elev[], double tht_m, double rht_m, double eps_
 }
 
 
+/***************************************************************************************
+ * Sweep Mode Calculations
+ *
+ * PlotLRPath() in splat.cpp walks a radial outward from the transmitter and calls
+ * point_to_point() once per elevation sample, each time with the same profile
+ * extended by one point. Some of the per-call work is identical from one sample
+ * to the next: the confidence and reliability quantiles never change along the
+ * radial, and d1thx2() allocates and frees a smoothing buffer (up to tens of
+ * kilobytes per call at -hd resolutions) every time.
+ *
+ * The sweep API factors that invariant work out of the per-sample loop. Call
+ * point_to_point_sweep_init() once per radial, point_to_point_sweep() (or the
+ * _ITM variant) once per sample, and point_to_point_sweep_done() when the radial
+ * is finished. Results are identical to the equivalent one-shot calls.
+ *
+ * Note that the horizon scan (hzns2) and the terrain roughness statistics
+ * (d1thx2/qtile) still walk the full profile on every call. Their results depend
+ * on the endpoint geometry -- the initial line-of-sight slope and the rescaled
+ * smoothing grid both change whenever the receiver moves -- so they cannot be
+ * extended one sample at a time without changing the model's output.
+ ***************************************************************************************/
+
+/*
+ * Per-radial state for the sweep calls. Initialize with point_to_point_sweep_init()
+ * and release with point_to_point_sweep_done().
+ */
+typedef struct p2p_sweep_state
+{
+    double tht_m;              /* tx antenna height, AGL (meters)               */
+    double rht_m;              /* rx antenna height, AGL (meters)               */
+    double eps_dielect;
+    double sgm_conductivity;
+    double eno_ns_surfref;
+    double frq_mhz;
+    int radio_climate;
+    int pol;
+    double zc;                 /* qerfi(conf), cached                           */
+    double zr;                 /* qerfi(rel), cached                            */
+    elev_t *s;                 /* scratch buffer for d1thx_s()/d1thx2_s()       */
+    int ssize;                 /* allocated size of s, in elements              */
+} p2p_sweep_state;
+
+/*
+ * Capture the per-radial invariants. Arguments are as for point_to_point().
+ */
+void point_to_point_sweep_init(p2p_sweep_state *sw, double tht_m, double rht_m, double eps_dielect, double sgm_conductivity, double eno_ns_surfref, double frq_mhz, int radio_climate, int pol, double conf, double rel)
+{
+    sw->tht_m=tht_m;
+    sw->rht_m=rht_m;
+    sw->eps_dielect=eps_dielect;
+    sw->sgm_conductivity=sgm_conductivity;
+    sw->eno_ns_surfref=eno_ns_surfref;
+    sw->frq_mhz=frq_mhz;
+    sw->radio_climate=radio_climate;
+    sw->pol=pol;
+    sw->zc=qerfi(conf);
+    sw->zr=qerfi(rel);
+    sw->s=NULL;
+    sw->ssize=0;
+}
+
+/*
+ * Release the scratch storage held by a sweep state.
+ */
+void point_to_point_sweep_done(p2p_sweep_state *sw)
+{
+    free(sw->s);
+    sw->s=NULL;
+    sw->ssize=0;
+}
+
+/*
+ * Sweep version of point_to_point(). Identical to the one-shot call except that
+ * the per-radial invariants come from the sweep state and the d1thx2_s() scratch
+ * buffer is reused from one sample to the next.
+ */
+void point_to_point_sweep(p2p_sweep_state *sw, const elev_t elev[], double *dbloss, char *strmode, int *errnum)
+{
+    prop_type   prop = {0};
+    propv_type  propv = {0};
+    propa_type  propa = {0};
+
+    double zsys=0;
+    double eno, enso, q;
+    long ja, jb, i, np;
+    double tpd, fs;
+
+    prop.hg[0]=sw->tht_m;
+    prop.hg[1]=sw->rht_m;
+    propv.klim=sw->radio_climate;
+    prop.kwx=0;
+    prop.mdp=-1;
+    prop.ptx=sw->pol;
+    prop.thera=0.0;
+    prop.thenr=0.0;
+    np=(long)elev[0];
+    eno=sw->eno_ns_surfref;
+    enso=0.0;
+    q=enso;
+
+    /* PRESET VALUES for Basic Version w/o additional inputs active */
+
+    prop.encc = 1000.00;        /*  double enc_ncc_clcref preset  */
+    prop.cch = 22.5;           /* double clutter_height preset to ILLR calibration.;
+                                  use 25.3 for ITU-P1546-2 calibration */
+    prop.cd = 1.00;                 /* double clutter_density preset */
+    int mode_var = 1;         /* int mode_var set to 1 for FCC compatibility;
+                                 normally, SPLAT presets this to 12 */
+    prop.dhd= 0.0;            /* delta_h_diff preset */
+
+    if (q<=0.0)
+    {
+        ja=(long)(3.0+0.1*elev[0]);
+        jb=np-ja+6;
+
+        for (i=ja-1; i<jb; ++i)
+            zsys+=elev[i];
+
+        zsys/=(jb-ja+1);
+        q=eno;
+    }
+
+    propv.mdvar=mode_var;
+    qlrps(sw->frq_mhz,zsys,q,sw->pol,sw->eps_dielect,sw->sgm_conductivity,&prop);
+    qlrpfl2_s(elev,propv.klim,propv.mdvar,&prop,&propa,&propv,&sw->s,&sw->ssize);
+    tpd=sqrt((prop.he[0]-prop.he[1])*(prop.he[0]-prop.he[1])+(prop.dist)*(prop.dist));
+    fs=32.45+20.0*log10(sw->frq_mhz)+20.0*log10(tpd/1000.0);
+    q=prop.dist-propa.dla;
+
+    if (trunc(q)<0.0)
+        strcpy(strmode,"L-o-S");
+    else
+    {
+        if (trunc(q)==0.0)
+            strcpy(strmode,"1_Hrzn");
+
+        else if (trunc(q)>0.0)
+            strcpy(strmode,"2_Hrzn");
+
+        if (prop.dist<=propa.dlsa || prop.dist<=propa.dx)
+
+            if(trunc(prop.dl[1])==0.0)
+                strcat(strmode,"_Peak");
+
+            else
+                strcat(strmode,"_Diff");
+
+        else if (prop.dist>propa.dx)
+            strcat(strmode, "_Tropo");
+    }
+
+    *dbloss=avar(sw->zr,0.0,sw->zc,&prop,&propv)+fs;
+    *errnum=prop.kwx;
+}
+
+/*
+ * Sweep version of point_to_point_ITM(). Identical to the one-shot call except
+ * that the per-radial invariants come from the sweep state and the d1thx_s()
+ * scratch buffer is reused from one sample to the next.
+ */
+void point_to_point_ITM_sweep(p2p_sweep_state *sw, const elev_t elev[], double *dbloss, char *strmode, int *errnum)
+{
+    prop_type   prop = {0};
+    propv_type  propv = {0};
+    propa_type  propa = {0};
+    double zsys=0;
+    double eno, enso, q;
+    long ja, jb, i, np;
+    double fs;
+
+    prop.hg[0]=sw->tht_m;
+    prop.hg[1]=sw->rht_m;
+    propv.klim=sw->radio_climate;
+    prop.kwx=0;
+    prop.mdp=-1;
+    np=(long)elev[0];
+    eno=sw->eno_ns_surfref;
+    enso=0.0;
+    q=enso;
+
+    if (q<=0.0)
+    {
+        ja=(long)(3.0+0.1*elev[0]);  /* added (long) to correct */
+        jb=np-ja+6;
+
+        for (i=ja-1; i<jb; ++i)
+            zsys+=elev[i];
+
+        zsys/=(jb-ja+1);
+        q=eno;
+    }
+
+    propv.mdvar=12;
+
+    qlrps(sw->frq_mhz,zsys,q,sw->pol,sw->eps_dielect,sw->sgm_conductivity,&prop); /* quick longley rice - setup */
+
+    qlrpfl_s(elev,propv.klim,propv.mdvar,&prop,&propa,&propv,&sw->s,&sw->ssize);  /* quick longley-rice, do the calculation */
+
+    fs=32.45+20.0*log10(sw->frq_mhz)+20.0*log10(prop.dist/1000.0);
+    q=prop.dist-propa.dla;
+
+    if (trunc(q)<0.0)
+        strcpy(strmode,"Line-Of-Sight Mode");
+    else
+    {
+        if (trunc(q)==0.0)
+            strcpy(strmode,"Single Horizon");
+
+        else if (trunc(q)>0.0)
+            strcpy(strmode,"Double Horizon");
+
+        if (prop.dist<=propa.dlsa || prop.dist <= propa.dx)
+            strcat(strmode,", Diffraction Dominant");
+
+        else if (prop.dist>propa.dx)
+            strcat(strmode, ", Troposcatter Dominant");
+    }
+
+    *dbloss=avar(sw->zr,0.0,sw->zc,&prop,&propv)+fs; /* analysis of variants */
+    *errnum=prop.kwx;
+}
+
+
 /*************************************************************************************************
   point_to_pointMDH_two()
 
@@ -26,10 +26,14 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdarg.h>
 #ifndef _WIN32
 #include <unistd.h>
 #include <limits.h>
 #include <libgen.h> /* dirname() and basename() */
+#include <sys/mman.h> /* mmap() for binary SDF tiles */
+#include <sys/stat.h>
 #else
 #define unlink _unlink
 #endif
@@ -37,6 +41,10 @@
 #include "bzlib.h"
 #include "zip.h"
 
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
 #define HAVE_LIBPNG
 #ifndef _WIN32
 #define HAVE_LIBJPEG
@@ -50,6 +58,10 @@
 #endif
 
 #include "fontdata.h"
+#include <mutex>
+#include <atomic>
+#include <set>
+#include <chrono>
 #include "workqueue.hpp"
 
 #ifdef _WIN32
@@ -97,20 +109,142 @@
 
 #define DO_KMZ 1
 
-/* avg must be a float or double or you get rounding down because of truncation
- * ignores values if n == 0 to avoid a divide-by-zero error
+/* Lightweight always-on run statistics. Each thread counts into its own
+ * RunStats -- an address computation and an add on the hot paths -- and
+ * the totals are folded into runStatsTotal when the thread exits or at a
+ * phase boundary. The -stats flag prints one "stats: name=value" line
+ * per counter at exit, so a slow run can be broken down by stage after
+ * the fact instead of being profiled live.
+ */
+typedef struct RunStats {
+    long long paths;            /* profiles plotted by PlotPath()/PlotLRPath() */
+    long long path_samples;     /* elevation samples across those profiles */
+    long long p2p_calls;        /* propagation model invocations */
+    long long p2p_points;       /* profile points across those calls */
+    long long dem_last;         /* FindDEM() resolved by the last-tile probe */
+    long long dem_index;        /* FindDEM() resolved by the degree index */
+    long long dem_miss;         /* FindDEM() found no tile */
+    long long dem_evict;        /* pages spilled by the -memlimit cache */
+    long long dem_fault;        /* pages reloaded by the -memlimit cache */
+    long long pool_tasks;       /* tasks executed by worker pools */
+    double tile_load_s;         /* in LoadSDF(), summed across threads */
+    double plot_s;              /* in the Plot*Map() drivers (wall time) */
+    double image_s;             /* in the WriteImage*() encoders (wall time) */
+    double pool_busy_s;         /* thread-seconds workers spent running tasks */
+    int pool_workers;           /* size of the largest pool seen */
+    int pool_depth_max;         /* deepest a pool's queues ever got */
+} RunStats;
+
+static RunStats runStatsTotal;
+static std::mutex runStatsMutex;
+
+static double StatsSeconds()
+{
+    static std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+}
+
+static void AccumulateStats(RunStats *s)
+{
+    std::lock_guard<std::mutex> lock(runStatsMutex);
+
+    runStatsTotal.paths += s->paths;
+    runStatsTotal.path_samples += s->path_samples;
+    runStatsTotal.p2p_calls += s->p2p_calls;
+    runStatsTotal.p2p_points += s->p2p_points;
+    runStatsTotal.dem_last += s->dem_last;
+    runStatsTotal.dem_index += s->dem_index;
+    runStatsTotal.dem_miss += s->dem_miss;
+    runStatsTotal.dem_evict += s->dem_evict;
+    runStatsTotal.dem_fault += s->dem_fault;
+    runStatsTotal.pool_tasks += s->pool_tasks;
+    runStatsTotal.tile_load_s += s->tile_load_s;
+    runStatsTotal.plot_s += s->plot_s;
+    runStatsTotal.image_s += s->image_s;
+    runStatsTotal.pool_busy_s += s->pool_busy_s;
+
+    if (s->pool_workers > runStatsTotal.pool_workers)
+        runStatsTotal.pool_workers = s->pool_workers;
+
+    if (s->pool_depth_max > runStatsTotal.pool_depth_max)
+        runStatsTotal.pool_depth_max = s->pool_depth_max;
+
+    memset(s, 0, sizeof(RunStats));
+}
+
+/* Each thread's counters ride in a thread_local whose destructor folds
+ * them into the total when the thread exits (the PathScratch trick).
+ */
+typedef struct ThreadStats {
+    RunStats s;
+
+    ~ThreadStats() {
+        AccumulateStats(&s);
+    }
+} ThreadStats;
+
+static thread_local ThreadStats threadStats;
+
+/* Folds a pool's lifetime numbers into the totals. Call after
+ * waitForCompletion(), when the workers have flushed their own
+ * counters and their busy clocks have stopped.
  */
-#define UPDATE_RUNNING_AVG(avg, latest, n) do { \
-    (n) && ((avg) = (avg) + ((float)((latest) - (avg)))/(float)(n)); \
-} while (0)
+static void RecordPoolStats(WorkQueue &wq)
+{
+    threadStats.s.pool_tasks += wq.tasksRun();
+    threadStats.s.pool_busy_s += wq.busySeconds();
+
+    if (wq.numWorkers() > threadStats.s.pool_workers)
+        threadStats.s.pool_workers = wq.numWorkers();
 
-static double avgpathlen = 0.0;
-static int totalpaths = 0;
+    if (wq.maxQueueDepth() > threadStats.s.pool_depth_max)
+        threadStats.s.pool_depth_max = wq.maxQueueDepth();
+}
+
+static void PrintRunStats()
+{
+    RunStats *t=&runStatsTotal;
+
+    AccumulateStats(&threadStats.s);
+
+    fprintf(stdout,"\nstats: tile_load_s=%.3f\n",t->tile_load_s);
+    fprintf(stdout,"stats: plot_s=%.3f\n",t->plot_s);
+    fprintf(stdout,"stats: image_encode_s=%.3f\n",t->image_s);
+    fprintf(stdout,"stats: paths=%lld\n",t->paths);
+    fprintf(stdout,"stats: path_avg_samples=%.1f\n",
+            t->paths?(double)t->path_samples/(double)t->paths:0.0);
+    fprintf(stdout,"stats: p2p_calls=%lld\n",t->p2p_calls);
+    fprintf(stdout,"stats: p2p_avg_profile=%.1f\n",
+            t->p2p_calls?(double)t->p2p_points/(double)t->p2p_calls:0.0);
+    fprintf(stdout,"stats: finddem_last=%lld\n",t->dem_last);
+    fprintf(stdout,"stats: finddem_index=%lld\n",t->dem_index);
+    fprintf(stdout,"stats: finddem_miss=%lld\n",t->dem_miss);
+    fprintf(stdout,"stats: page_evict=%lld\n",t->dem_evict);
+    fprintf(stdout,"stats: page_fault=%lld\n",t->dem_fault);
+    fprintf(stdout,"stats: pool_workers=%d\n",t->pool_workers);
+    fprintf(stdout,"stats: pool_tasks=%lld\n",t->pool_tasks);
+    fprintf(stdout,"stats: pool_busy_s=%.3f\n",t->pool_busy_s);
+    fprintf(stdout,"stats: pool_max_depth=%d\n",t->pool_depth_max);
+    fflush(stdout);
+}
 
 /*****************************
  * Typedefs
  *****************************/
 
+/* Numeric type of the terrain profiles fed to the ITWOM/ITM pipeline;
+ * must match the definition in itwom3.0.c. Path elevations share it so
+ * the staging loops in PlotPath()/PlotLRPath() copy profile samples
+ * without a width conversion per point, and so a Path is half the size
+ * it would be with doubles. Build with ITM_DOUBLE=1 (see the Makefile)
+ * to run the whole pipeline at the original model's width instead.
+ */
+#ifdef ITM_ELEV_DOUBLE
+#define elev_t double
+#else
+#define elev_t float
+#endif
+
 typedef struct Site {
     double lat;
     double lon;
@@ -130,7 +264,7 @@ typedef struct Path {
     unsigned long arysize;
     double *lat;
     double *lon;
-    double *elevation;
+    elev_t *elevation;
     double *distance;
     int length;
 } Path;
@@ -144,14 +278,42 @@ typedef struct DEM {
     int max_el;
     int min_el;
     unsigned long arysize;
-    short **data;
-    unsigned char **mask;
-    unsigned char **signal;
+    short *data;
+    unsigned char *mask;
+    unsigned char *signal;
+    void *mapbase;	/* non-NULL if the data plane points into an mmap'd .bsdf */
+    unsigned long maplen;
+
+    /* LRU page cache state; see DEMCacheEnforce(). Only -memlimit runs
+       ever clear resident. */
+    FILE *spill;	/* temp file holding the planes of an evicted page */
+    bool resident;
+    int lastphase;	/* compute phase that last touched this page */
+    long long lastuse;	/* LRU clock tick of the last touch */
 } DEM;
 
+/* Each DEM plane is a single contiguous allocation indexed with a
+ * computed stride, so sample access is one multiply-add instead of a
+ * pointer chase through a row table.
+ */
+static inline short &DEMData(DEM *dem, int x, int y)
+{
+    return dem->data[(unsigned long)x*dem->arysize + y];
+}
+
+static inline unsigned char &DEMMask(DEM *dem, int x, int y)
+{
+    return dem->mask[(unsigned long)x*dem->arysize + y];
+}
+
+static inline unsigned char &DEMSignal(DEM *dem, int x, int y)
+{
+    return dem->signal[(unsigned long)x*dem->arysize + y];
+}
+
 #define ANTENNA_RADIALS 361
 #define ANTENNA_ANGLES 1001
-#define NO_ANTENNA_DATA (-1.0)
+#define ANTENNA_NULL_DB 9999.0f
 typedef struct LongleyRiceData {
     double eps_dielect;
     double sgm_conductivity;
@@ -162,7 +324,15 @@ typedef struct LongleyRiceData {
     double erp;
     int radio_climate;
     int pol;
-    double antenna_pattern[ANTENNA_RADIALS][ANTENNA_ANGLES];
+    /* Antenna gain indexed [azimuth][elevation], precomputed in dB by
+       LoadPAT() so the plotting loops subtract one float per point
+       instead of running 20*log10() on the same cells billions of
+       times. Elevation is the contiguous axis and azimuth is constant
+       along a ray, so each ray walks a single row linearly. Cells
+       default to 0 dB (no pattern); a pattern null holds
+       ANTENNA_NULL_DB, whose subtraction reproduces the historical
+       loss-=9999 behavior. */
+    float antenna_pattern[ANTENNA_RADIALS][ANTENNA_ANGLES];
 } LongleyRice;
 
 typedef struct Region {
@@ -183,7 +353,9 @@ typedef enum ImageType {
 
 typedef enum SDFCompressType {
     SDF_COMPRESSTYPE_NONE = 0,
-    SDF_COMPRESSTYPE_BZIP2
+    SDF_COMPRESSTYPE_BZIP2,
+    SDF_COMPRESSTYPE_ZSTD,
+    SDF_COMPRESSTYPE_BINARY
 } SDFCompressType;
 
 struct SDFCompressFormat {
@@ -191,6 +363,25 @@ struct SDFCompressFormat {
     const char* suffix;
 };
 
+/* Header for the binary SDF (.bsdf) tile variant. The header is followed
+ * immediately by ippd*ippd little-endian int16 elevation samples in the
+ * same [x][y] order the ASCII format uses (y varies fastest). All of our
+ * supported platforms are little-endian, so samples are written natively;
+ * the magic check will reject a foreign-endian file.
+ */
+#define BSDF_MAGIC   0x46445342 /* "BSDF" */
+#define BSDF_VERSION 1
+typedef struct BSDFHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t max_west;
+    int32_t min_north;
+    int32_t min_west;
+    int32_t max_north;
+    int32_t ippd;
+    int32_t pad; /* keeps the sample grid 8-byte aligned */
+} BSDFHeader;
+
 
 /*****************************
  * Globals
@@ -215,21 +406,37 @@ double	earthradius, max_range=0.0, forced_erp=-1.0, dpp, ppd,
 int	min_north=90, max_north=-90, min_west=360, max_west=-1;
 int max_elevation=-32768, min_elevation=32768;
 int ippd, mpi, maxpagesides = MAXPAGESIDES;
-int bzerror, contour_threshold;
+int contour_threshold;
+int pnglevel=6;     /* zlib effort for PNG output; see -pnglevel */
 
 bool got_elevation_pattern = false, got_azimuth_pattern = false;
 bool metric = false, dbm = false, smooth_contours = false;
-bool gpsav=false, itwom=false;
+bool gpsav=false, itwom=false, tiled=false;
 
 int verbose=1;
 
-bool opened=false; /* BZip file flag */
-
 LongleyRiceData LR;
 Region region;
 
 DEM **aDEM = NULL;
 int demCount = 0;
+std::mutex demMutex; /* guards aDEM/demCount and the global elevation/boundary extremes */
+
+/* Direct-addressed tile index, keyed by integer degree: [min_north+90][min_west].
+ * Built by AppendDEM() so FindDEM() can resolve a coordinate with an array
+ * lookup instead of scanning every loaded page. */
+DEM *demIndex[180][360];
+
+/* LRU page cache bookkeeping, all guarded by demMutex. With -memlimit,
+ * pages beyond the budget are evicted least-recently-used -- their
+ * planes spilled to a temp file -- and faulted back in through
+ * FindDEM(). Pages touched in the current compute phase are never
+ * evicted; DEMCacheNewPhase() marks the boundaries. */
+long long demMemBudget=0;	/* bytes of resident DEM planes allowed; 0 = unlimited */
+long long demClock=0;		/* ticks on every page touch */
+int demPhase=0;
+int demResidentCount=0;
+bool demLoadActive=false;	/* inside LoadTopoData(): nothing traverses, all pages evictable */
 
 /****************************
  * Color handling stuff
@@ -278,13 +485,8 @@ typedef uint32_t Pixel;
 
 /*****************************
  * External stuff for ITWOM. I don't know why we don't just include a .h file.
+ * (elev_t is defined up with the typedefs, since Path uses it too.)
  *****************************/
-#ifdef ITM_ELEV_DOUBLE
-#define elev_t double
-#else
-#define elev_t float
-#endif
-
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -298,6 +500,37 @@ extern "C" {
                         double frq_mhz, int radio_climate, int pol, double conf,
                         double rel, double *dbloss, char *strmode, int *errnum);
 
+    /* Per-radial state for the sweep versions of the point-to-point calls.
+       Must match the definition in itwom3.0.c. */
+    typedef struct p2p_sweep_state
+    {
+        double tht_m;
+        double rht_m;
+        double eps_dielect;
+        double sgm_conductivity;
+        double eno_ns_surfref;
+        double frq_mhz;
+        int radio_climate;
+        int pol;
+        double zc;
+        double zr;
+        elev_t *s;
+        int ssize;
+    } p2p_sweep_state;
+
+    void point_to_point_sweep_init(p2p_sweep_state *sw, double tht_m, double rht_m,
+                        double eps_dielect, double sgm_conductivity, double eno_ns_surfref,
+                        double frq_mhz, int radio_climate, int pol, double conf,
+                        double rel);
+
+    void point_to_point_sweep(p2p_sweep_state *sw, elev_t elev[], double *dbloss,
+                        char *strmode, int *errnum);
+
+    void point_to_point_ITM_sweep(p2p_sweep_state *sw, elev_t elev[], double *dbloss,
+                        char *strmode, int *errnum);
+
+    void point_to_point_sweep_done(p2p_sweep_state *sw);
+
     double ITWOMVersion();
 #ifdef __cplusplus
 }
@@ -333,11 +566,115 @@ unsigned long long getTotalSystemMemory()
  * Image writing functions. This should just be a class.
  *****************************/
 
-typedef struct ImageWriter_st
+typedef struct ImageWriter_st ImageWriter;
+
+static void ImageWriterEncodeRow(ImageWriter *iw, unsigned char *row);
+
+/* Bounded ring of finished scanlines drained by a dedicated encoder
+ * thread, so the raster loop hands off a row and moves on instead of
+ * stalling on deflate. Same single-writer pattern as the AnoWriter;
+ * push() only blocks when the encoder falls ROWENC_DEPTH rows behind.
+ */
+#define ROWENC_DEPTH 64
+
+class RowEncoder {
+public:
+    RowEncoder(ImageWriter *iw, int width) : m_iw(iw), m_rowbytes(3*(size_t)width) {
+        m_ring = (unsigned char*)malloc(ROWENC_DEPTH*m_rowbytes);
+        assert(m_ring != NULL);
+        m_encoder = std::thread(&RowEncoder::encodeLoop, this);
+    }
+
+    ~RowEncoder() {
+        close();
+        free(m_ring);
+    }
+
+    /* Queue one finished row (3*width bytes) for encoding. */
+    void push(const unsigned char *row) {
+        std::unique_lock<std::mutex> ul(m_mutex);
+
+        while (m_count == ROWENC_DEPTH)
+            m_notFull.wait(ul);
+
+        memcpy(m_ring + (m_head % ROWENC_DEPTH)*m_rowbytes, row, m_rowbytes);
+        m_head++;
+        m_count++;
+        m_notEmpty.notify_one();
+    }
+
+    /* Wait for the backlog to drain and retire the encoder thread. */
+    void close() {
+        if (!m_encoder.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_exit = true;
+            m_notEmpty.notify_one();
+        }
+
+        m_encoder.join();
+    }
+
+private:
+    void encodeLoop() {
+        int tail = 0;
+        std::unique_lock<std::mutex> ul(m_mutex);
+
+        for (;;) {
+            while (m_count == 0 && !m_exit)
+                m_notEmpty.wait(ul);
+
+            if (m_count == 0)
+                break;
+
+            /* The slot stays counted until the row is encoded, so push()
+               can't recycle it while we're outside the lock. */
+
+            unsigned char *row = m_ring + (tail % ROWENC_DEPTH)*m_rowbytes;
+
+            ul.unlock();
+            ImageWriterEncodeRow(m_iw, row);
+            ul.lock();
+
+            tail++;
+            m_count--;
+            m_notFull.notify_one();
+        }
+    }
+
+    ImageWriter *m_iw;
+    size_t m_rowbytes;
+    unsigned char *m_ring;
+    std::thread m_encoder;
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    int m_head = 0;
+    int m_count = 0;
+    bool m_exit = false;
+};
+
+#ifdef HAVE_LIBJPEG
+/* libjpeg destination manager that hands the codec's output to the
+ * currently-open entry of a zip archive instead of a stdio stream.
+ */
+#define JPEG_ZIP_BUFSIZE 16384
+
+typedef struct JpegZipDest {
+    struct jpeg_destination_mgr pub;
+    struct zip_t *zip;
+    unsigned char buf[JPEG_ZIP_BUFSIZE];
+} JpegZipDest;
+#endif
+
+struct ImageWriter_st
 {
     bool initialized;
 
     FILE *fp;
+    struct zip_t *zip;  /* non-NULL: write into the open zip entry, not fp */
     ImageType imagetype;
     int width;
     int height;
@@ -346,6 +683,8 @@ typedef struct ImageWriter_st
 
     unsigned char *imgline;
 
+    RowEncoder *enc;
+
 #ifdef HAVE_LIBPNG
     png_structp png_ptr;
     png_infop info_ptr;
@@ -353,17 +692,50 @@ typedef struct ImageWriter_st
 #ifdef HAVE_LIBJPEG
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
+    JpegZipDest jzdst;
 #endif
-} ImageWriter;
+};
 
-int ImageWriterInit(ImageWriter *iw, const char* filename, ImageType imagetype, int width, int height)
+#ifdef HAVE_LIBPNG
+static void PngZipWrite(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-    memset(iw, 0, sizeof(ImageWriter));
+    ImageWriter *iw = (ImageWriter*)png_get_io_ptr(png_ptr);
+    zip_entry_write(iw->zip, data, length);
+}
 
-    if ( (iw->fp=fopen(filename,"wb")) == NULL) {
-        return -1;
-    }
+static void PngZipFlush(png_structp png_ptr)
+{
+    (void)png_ptr;  /* the zip writer buffers internally */
+}
+#endif
+
+#ifdef HAVE_LIBJPEG
+static void JpegZipInitDest(j_compress_ptr cinfo)
+{
+    JpegZipDest *dst = (JpegZipDest*)cinfo->dest;
+    dst->pub.next_output_byte = dst->buf;
+    dst->pub.free_in_buffer = JPEG_ZIP_BUFSIZE;
+}
+
+static boolean JpegZipEmptyBuffer(j_compress_ptr cinfo)
+{
+    JpegZipDest *dst = (JpegZipDest*)cinfo->dest;
+    zip_entry_write(dst->zip, dst->buf, JPEG_ZIP_BUFSIZE);
+    dst->pub.next_output_byte = dst->buf;
+    dst->pub.free_in_buffer = JPEG_ZIP_BUFSIZE;
+    return TRUE;
+}
+
+static void JpegZipTermDest(j_compress_ptr cinfo)
+{
+    JpegZipDest *dst = (JpegZipDest*)cinfo->dest;
+    zip_entry_write(dst->zip, dst->buf, JPEG_ZIP_BUFSIZE - dst->pub.free_in_buffer);
+}
+#endif
 
+/* Common codec setup; the sink (iw->fp or iw->zip) is already set. */
+static int ImageWriterSetup(ImageWriter *iw, ImageType imagetype, int width, int height)
+{
     iw->imagetype = imagetype;
     iw->width = width;
     iw->height = height;
@@ -378,7 +750,10 @@ int ImageWriterInit(ImageWriter *iw, const char* filename, ImageType imagetype,
         case IMAGETYPE_PNG:
             iw->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
             iw->info_ptr = png_create_info_struct(iw->png_ptr);
-            png_init_io(iw->png_ptr, iw->fp);
+            if (iw->zip)
+                png_set_write_fn(iw->png_ptr, iw, PngZipWrite, PngZipFlush);
+            else
+                png_init_io(iw->png_ptr, iw->fp);
             png_set_IHDR(iw->png_ptr, iw->info_ptr,
                          iw->width, iw->height,
                          8, /* 8 bits per color or 24 bits per pixel for RGB */
@@ -386,7 +761,7 @@ int ImageWriterInit(ImageWriter *iw, const char* filename, ImageType imagetype,
                          PNG_INTERLACE_NONE,
                          PNG_COMPRESSION_TYPE_DEFAULT,
                          PNG_FILTER_TYPE_BASE);
-            png_set_compression_level(iw->png_ptr, 6);  /* default is Z_DEFAULT_COMPRESSION; see zlib.h */
+            png_set_compression_level(iw->png_ptr, pnglevel);  /* zlib effort, 0-9; see -pnglevel */
             png_write_info(iw->png_ptr, iw->info_ptr);
             break;
 #endif
@@ -394,7 +769,14 @@ int ImageWriterInit(ImageWriter *iw, const char* filename, ImageType imagetype,
         case IMAGETYPE_JPG:
             iw->cinfo.err = jpeg_std_error(&iw->jerr);
             jpeg_create_compress(&iw->cinfo);
-            jpeg_stdio_dest(&iw->cinfo, iw->fp);
+            if (iw->zip) {
+                iw->jzdst.pub.init_destination = JpegZipInitDest;
+                iw->jzdst.pub.empty_output_buffer = JpegZipEmptyBuffer;
+                iw->jzdst.pub.term_destination = JpegZipTermDest;
+                iw->jzdst.zip = iw->zip;
+                iw->cinfo.dest = &iw->jzdst.pub;
+            } else
+                jpeg_stdio_dest(&iw->cinfo, iw->fp);
             iw->cinfo.image_width = iw->width;
             iw->cinfo.image_height = iw->height;
             iw->cinfo.input_components = 3;	   /* # of color components per pixel */
@@ -405,13 +787,45 @@ int ImageWriterInit(ImageWriter *iw, const char* filename, ImageType imagetype,
             break;
 #endif
         case IMAGETYPE_PPM:
-            fprintf(iw->fp,"P6\n%u %u\n255\n",iw->width,iw->height);
+            if (iw->zip) {
+                char hdr[32];
+                int n=snprintf(hdr,sizeof(hdr),"P6\n%u %u\n255\n",iw->width,iw->height);
+                zip_entry_write(iw->zip,hdr,(size_t)n);
+            } else
+                fprintf(iw->fp,"P6\n%u %u\n255\n",iw->width,iw->height);
     }
 
+    iw->enc = new RowEncoder(iw, width);
+
     iw->initialized = true;
     return 0;
 }
 
+int ImageWriterInit(ImageWriter *iw, const char* filename, ImageType imagetype, int width, int height)
+{
+    memset(iw, 0, sizeof(ImageWriter));
+
+    if ( (iw->fp=fopen(filename,"wb")) == NULL) {
+        return -1;
+    }
+
+    return ImageWriterSetup(iw, imagetype, width, height);
+}
+
+/* Stream the image into the currently-open entry of a zip archive
+ * instead of a file. The caller opens the entry before this and closes
+ * it after ImageWriterFinish(); nothing else may write to the archive
+ * in between.
+ */
+int ImageWriterInitZip(ImageWriter *iw, struct zip_t *zip, ImageType imagetype, int width, int height)
+{
+    memset(iw, 0, sizeof(ImageWriter));
+
+    iw->zip = zip;
+
+    return ImageWriterSetup(iw, imagetype, width, height);
+}
+
 void ImageWriterAppendPixel(ImageWriter *iw, Pixel pixel)
 {
     if (!iw->initialized)
@@ -431,23 +845,47 @@ void ImageWriterEmitLine(ImageWriter *iw)
     if (!iw->initialized)
         return;
 
+    iw->enc->push(iw->imgline);
+    iw->xoffset = 0;
+}
+
+/* Emits a prebuilt RGB scanline (3*width bytes). Used by the parallel
+ * raster renderer, which colorizes rows on worker threads and hands
+ * them over here in order.
+ */
+void ImageWriterEmitRow(ImageWriter *iw, unsigned char *row)
+{
+    if (!iw->initialized)
+        return;
+
+    iw->enc->push(row);
+}
+
+/* Feed one row to the codec. Runs on the RowEncoder thread; everything
+ * else (init, finish) stays on the caller's thread, which is fine as
+ * long as the calls are serialized, and close() guarantees that.
+ */
+static void ImageWriterEncodeRow(ImageWriter *iw, unsigned char *row)
+{
     switch (iw->imagetype) {
         default:
 #ifdef HAVE_LIBPNG
         case IMAGETYPE_PNG:
-            png_write_row(iw->png_ptr, (png_bytep)(iw->imgline));
+            png_write_row(iw->png_ptr, (png_bytep)row);
             break;
 #endif
 #ifdef HAVE_LIBJPEG
         case IMAGETYPE_JPG:
-            jpeg_write_scanlines(&iw->cinfo, &iw->imgline, 1);
+            jpeg_write_scanlines(&iw->cinfo, &row, 1);
             break;
 #endif
         case IMAGETYPE_PPM:
-            fwrite(iw->imgline, 3, iw->width, iw->fp);
+            if (iw->zip)
+                zip_entry_write(iw->zip, row, 3*(size_t)iw->width);
+            else
+                fwrite(row, 3, iw->width, iw->fp);
             break;
     }
-    iw->xoffset = 0;
 }
 
 void ImageWriterFinish(ImageWriter *iw)
@@ -455,6 +893,12 @@ void ImageWriterFinish(ImageWriter *iw)
     if (!iw->initialized)
         return;
 
+    /* Let the encoder catch up before closing out the stream */
+
+    iw->enc->close();
+    delete iw->enc;
+    iw->enc = NULL;
+
     switch (iw->imagetype) {
         default:
 #ifdef HAVE_LIBPNG
@@ -474,10 +918,84 @@ void ImageWriterFinish(ImageWriter *iw)
             ;
     }
 
-    fclose(iw->fp);
+    if (iw->fp)
+        fclose(iw->fp);
     free(iw->imgline);
 }
 
+/* Sink for the KML documents the WriteImage* functions emit: either a
+ * standalone .kml file or an entry streamed straight into an open .kmz
+ * archive, so the KMZ path never writes the intermediate file at all.
+ */
+typedef struct KmlSink {
+    FILE *fd;
+    struct zip_t *zip;
+} KmlSink;
+
+static int KmlOpen(KmlSink *ks, struct zip_t *zip, const char *kmlfile)
+{
+    ks->zip=zip;
+    ks->fd=NULL;
+
+    if (zip)
+        return (zip_entry_open(zip,kmlfile)==0 ? 0 : -1);
+
+    ks->fd=fopen(kmlfile,"wb");
+    return (ks->fd!=NULL ? 0 : -1);
+}
+
+static void KmlPrintf(KmlSink *ks, const char *fmt, ...)
+{
+    char buf[MAX_LINE_LEN*4];
+    int n;
+    va_list ap;
+
+    va_start(ap,fmt);
+    n=vsnprintf(buf,sizeof(buf),fmt,ap);
+    va_end(ap);
+
+    if (n<0)
+        return;
+    if (n>(int)sizeof(buf)-1)
+        n=(int)sizeof(buf)-1;
+
+    if (ks->zip)
+        zip_entry_write(ks->zip,buf,(size_t)n);
+    else
+        fwrite(buf,1,(size_t)n,ks->fd);
+}
+
+static void KmlClose(KmlSink *ks)
+{
+    if (ks->zip)
+        zip_entry_close(ks->zip);
+    else
+        fclose(ks->fd);
+}
+
+/* Open the sink for a map image: the named file or, when streaming a
+ * KMZ, an entry of the same name in the archive.
+ */
+static int MapImageInit(ImageWriter *iw, struct zip_t *kmz, const char *mapfile, ImageType imagetype, int width, int height)
+{
+    if (kmz)
+    {
+        if (zip_entry_open(kmz,mapfile)!=0)
+            return -1;
+        return ImageWriterInitZip(iw,kmz,imagetype,width,height);
+    }
+
+    return ImageWriterInit(iw,mapfile,imagetype,width,height);
+}
+
+static void MapImageFinish(ImageWriter *iw, struct zip_t *kmz)
+{
+    ImageWriterFinish(iw);
+
+    if (kmz)
+        zip_entry_close(kmz);
+}
+
 /*****************************
  * Functions for allocating Paths
  ****************************/
@@ -500,7 +1018,7 @@ Path *AllocatePath()
 
     path->lat=(double*)malloc(path->arysize*sizeof(double));
     path->lon=(double*)malloc(path->arysize*sizeof(double));
-    path->elevation=(double*)malloc(path->arysize*sizeof(double));
+    path->elevation=(elev_t*)malloc(path->arysize*sizeof(elev_t));
     path->distance=(double*)malloc(path->arysize*sizeof(double));
 
     if (path->lat && path->lon && path->elevation && path->distance) {
@@ -530,7 +1048,44 @@ void DestroyPath(Path *path)
 unsigned long SizeofPath(AppMode mode, int pagesides)
 {
     unsigned long arysize = appArraySize[mode][pagesides-1];
-    return sizeof(Path) + (sizeof(double)*arysize*4);
+    return sizeof(Path) + (sizeof(double)*arysize*3) + (sizeof(elev_t)*arysize);
+}
+
+/* Per-thread scratch buffers for the plotting hot path. PlotPath() and
+ * PlotLRPath() run tens of thousands of times per map from many worker
+ * threads; giving each thread one reusable Path and elevation-profile
+ * buffer keeps the plot loop free of heap traffic (and of contention on
+ * the allocator lock). The buffers are released when the worker exits.
+ */
+typedef struct PathScratch {
+    Path *path;
+    elev_t *elev;
+    unsigned long elevsize;
+
+    ~PathScratch() {
+        if (path) DestroyPath(path);
+        if (elev) free(elev);
+    }
+} PathScratch;
+
+static thread_local PathScratch pathScratch;
+
+Path *GetThreadPath()
+{
+    if (!pathScratch.path)
+        pathScratch.path = AllocatePath();
+    return pathScratch.path;
+}
+
+elev_t *GetThreadElev(unsigned long size)
+{
+    if (pathScratch.elevsize < size) {
+        if (pathScratch.elev)
+            free(pathScratch.elev);
+        pathScratch.elev = (elev_t*)calloc(size, sizeof(elev_t));
+        pathScratch.elevsize = pathScratch.elev ? size : 0;
+    }
+    return pathScratch.elev;
 }
 
 /*****************************
@@ -862,20 +1417,13 @@ DEM *AllocateDEM()
     if (dem->arysize < 1) dem->arysize = 1;
 
     do {
-        dem->data=(short**)malloc(dem->arysize*sizeof(short*));
-        dem->mask=(unsigned char**)malloc(dem->arysize*sizeof(unsigned char*));
-        dem->signal=(unsigned char**)malloc(dem->arysize*sizeof(unsigned char*));
+        dem->data=(short*)malloc(dem->arysize*dem->arysize*sizeof(short));
+        dem->mask=(unsigned char*)malloc(dem->arysize*dem->arysize*sizeof(unsigned char));
+        dem->signal=(unsigned char*)malloc(dem->arysize*dem->arysize*sizeof(unsigned char));
         if (!dem->data || !dem->mask || !dem->signal) {
             break;
         }
 
-        for (unsigned long i = 0; i<dem->arysize; ++i) {
-            dem->data[i]=(short*)malloc(dem->arysize*sizeof(short));
-            dem->mask[i]=(unsigned char*)malloc(dem->arysize*sizeof(unsigned char));
-            dem->signal[i]=(unsigned char*)malloc(dem->arysize*sizeof(unsigned char));
-            // XXX TODO: error check these allocations
-        }
-
         dem->min_el=32768;
         dem->max_el=-32768;
         dem->min_north=90;
@@ -898,14 +1446,16 @@ DEM *AllocateDEM()
 
 void DestroyDEM(DEM *dem)
 {
-    for (unsigned long i = 0; i<dem->arysize; ++i) {
-        free(dem->data[i]);
-        free(dem->mask[i]);
-        free(dem->signal[i]);
-    }
+#ifndef _WIN32
+    if (dem->mapbase)
+        munmap(dem->mapbase, dem->maplen);
+#endif
     if (dem->signal) free(dem->signal);
     if (dem->mask) free(dem->mask);
-    if (dem->data) free(dem->data);
+    if (dem->data && !dem->mapbase) /* the data plane may live in the mapping */
+        free(dem->data);
+    if (dem->spill)
+        fclose(dem->spill);
     free(dem);
 }
 
@@ -913,9 +1463,7 @@ unsigned long SizeofDEM(AppMode mode)
 {
     unsigned long arysize = AppArraySize(mode);
     return sizeof(DEM) + 
-        (sizeof(short*)*arysize) +
         (sizeof(short)*arysize*arysize) + 
-        (sizeof(unsigned char*)*arysize*2) +
         (sizeof(unsigned char)*arysize*arysize*2);
 }
 
@@ -933,98 +1481,380 @@ void FreeDEMs()
     }
     free(aDEM);
     aDEM = NULL;
-}
+    demCount = 0;
+    demResidentCount = 0;
+    memset(demIndex, 0, sizeof(demIndex));
 
-/* Appends a DEM to the global adem[] array.u
- */
-int AppendDEM(DEM *dem)
-{
-    if (aDEM == NULL || (demCount > (maxpagesides*maxpagesides)) ) {
-        return -1;
+    /* Park every thread's cached FindDEM() pointer: the page it names
+       is gone. Unconditional, unlike DEMCacheNewPhase() -- the fast
+       path must stop trusting its pointer even when no -memlimit is in
+       effect (e.g. the resolution-change reload between daemon jobs). */
+
+    {
+        std::lock_guard<std::mutex> lock(demMutex);
+        demPhase++;
     }
-    aDEM[demCount++] = dem;
-    return 0;
 }
 
-/* Returns a DEM whose boundaries are exactly on the given boundaries,
- * or NULL if not found.
+/* Bytes of plane memory a resident page costs: the data, mask and
+ * signal planes. The DEM struct itself always stays resident.
  */
-DEM *FindDEM_Explicit(double minlat, double minlon, double maxlat, double maxlon)
+static unsigned long DEMPageBytes(DEM *dem)
 {
-    for (int i=0; i<demCount; ++i) {
-        if (minlat==aDEM[i]->min_north &&
-            minlon==aDEM[i]->min_west &&
-            maxlat==aDEM[i]->max_north &&
-            maxlon==aDEM[i]->max_west)
-            return aDEM[i];
-    }
-    return NULL;
+    return dem->arysize*dem->arysize*(sizeof(short)+2*sizeof(unsigned char));
 }
 
-/* Returns the first DEM containing the lat/long,
- * or -1 if not found.
- *
- * x and y will contain the offsets into the DEM array of
- * the coordinate.
+/* Spills a page's planes to its temp file and frees them. Caller holds
+ * demMutex and has verified nothing in the current phase uses the page.
  */
-DEM *FindDEM(double lat, double lon, int &x, int &y)
+static void DEMCacheEvict(DEM *dem)
 {
-    for (int i=0; i<demCount; ++i)
-    {
-        x=(int)rint(ppd*(lat-aDEM[i]->min_north));
-        y=mpi-(int)rint(ppd*(LonDiff(aDEM[i]->max_west,lon)));
+    unsigned long n=dem->arysize*dem->arysize;
 
-        if (x>=0 && x<=mpi && y>=0 && y<=mpi)
-            return aDEM[i];
+    if (dem->spill==NULL)
+        dem->spill=tmpfile();
+
+    if (dem->spill==NULL) {
+        fprintf(stderr,"*** ERROR: Couldn't create a DEM spill file!\n");
+        exit(-1);
     }
-    return NULL;
-}
 
+    rewind(dem->spill);
 
-/* Lines, text, markings, and coverage areas are stored in a
- * mask that is combined with topology data when topographic
- * maps are generated by SPLAT!.  This function sets and resets
- * bits in the mask based on the latitude and longitude of the
- * area pointed to.
- */
-int PutMask(double lat, double lon, int value)
-{
-    int	x, y;
-    DEM *dem; 
+    if (fwrite(dem->data,sizeof(short),n,dem->spill)!=n ||
+        fwrite(dem->mask,sizeof(unsigned char),n,dem->spill)!=n ||
+        fwrite(dem->signal,sizeof(unsigned char),n,dem->spill)!=n) {
+        fprintf(stderr,"*** ERROR: Couldn't spill a DEM page (disk full?)\n");
+        exit(-1);
+    }
 
-    dem = FindDEM(lat, lon, x, y);
-    if (!dem)
-        return -1;
+#ifndef _WIN32
+    if (dem->mapbase) {
+        /* the data plane lived in the mapping; it has a spill copy now */
+        munmap(dem->mapbase, dem->maplen);
+        dem->mapbase=NULL;
+        dem->data=NULL;
+    }
+#endif
 
-    dem->mask[x][y]=value;
-    return ((int)dem->mask[x][y]);
+    if (dem->data)
+        free(dem->data);
+    free(dem->mask);
+    free(dem->signal);
+
+    dem->data=NULL;
+    dem->mask=NULL;
+    dem->signal=NULL;
+    dem->resident=false;
+    demResidentCount--;
+    threadStats.s.dem_evict++;
 }
 
-/* Lines, text, markings, and coverage areas are stored in a
- * mask that is combined with topology data when topographic
- * maps are generated by SPLAT!.  This function sets bits in
- * the mask based on the latitude and longitude of the area
- * pointed to.
+/* Reloads an evicted page's planes from its spill file. Caller holds
+ * demMutex.
  */
-int OrMask(double lat, double lon, int value)
+static void DEMCacheFault(DEM *dem)
 {
-    int	x, y;
-    DEM *dem;
+    unsigned long n=dem->arysize*dem->arysize;
 
-    dem = FindDEM(lat, lon, x, y);
-    if (!dem)
-        return -1;
+    dem->data=(short*)malloc(n*sizeof(short));
+    dem->mask=(unsigned char*)malloc(n*sizeof(unsigned char));
+    dem->signal=(unsigned char*)malloc(n*sizeof(unsigned char));
 
-    dem->mask[x][y]|=value;
-    return ((int)dem->mask[x][y]);
-}
+    if (dem->data==NULL || dem->mask==NULL || dem->signal==NULL) {
+        fprintf(stderr,"*** ERROR: Out of memory faulting a DEM page back in!\n");
+        exit(-1);
+    }
+
+    rewind(dem->spill);
+
+    if (fread(dem->data,sizeof(short),n,dem->spill)!=n ||
+        fread(dem->mask,sizeof(unsigned char),n,dem->spill)!=n ||
+        fread(dem->signal,sizeof(unsigned char),n,dem->spill)!=n) {
+        fprintf(stderr,"*** ERROR: Couldn't reload a spilled DEM page!\n");
+        exit(-1);
+    }
+
+    dem->resident=true;
+    demResidentCount++;
+    threadStats.s.dem_fault++;
+}
+
+/* Evicts least-recently-used pages until the resident set fits the
+ * -memlimit budget. Pages touched in the current compute phase stand in
+ * for per-ray pins and are never evicted (during the load phase nothing
+ * traverses, so everything appended is fair game). If every resident
+ * page is in use the set is left over budget rather than stalling.
+ * Caller holds demMutex.
+ */
+static void DEMCacheEnforce(void)
+{
+    int i, budget;
+    DEM *d, *victim;
+
+    if (demMemBudget==0 || demCount==0)
+        return;
+
+    budget=(int)(demMemBudget/(long long)DEMPageBytes(aDEM[0]));
+
+    if (budget<1)
+        budget=1;
+
+    while (demResidentCount>budget)
+    {
+        victim=NULL;
+
+        for (i=0; i<demCount; i++)
+        {
+            d=aDEM[i];
+
+            if (!d->resident)
+                continue;
+
+            if (!demLoadActive && d->lastphase==demPhase)
+                continue;
+
+            if (victim==NULL || d->lastuse<victim->lastuse)
+                victim=d;
+        }
+
+        if (victim==NULL)
+            break;
+
+        DEMCacheEvict(victim);
+    }
+}
+
+/* Marks a compute phase boundary for the page cache: everything touched
+ * before this call becomes evictable again. Call only from points where
+ * no worker thread is traversing DEM pages (pool start/join boundaries).
+ */
+void DEMCacheNewPhase(void)
+{
+    if (demMemBudget!=0)
+    {
+        std::lock_guard<std::mutex> lock(demMutex);
+        demPhase++;
+    }
+}
+
+/* Appends a DEM to the global adem[] array.u
+ */
+int AppendDEM(DEM *dem)
+{
+    if (aDEM == NULL || (demCount > (maxpagesides*maxpagesides)) ) {
+        return -1;
+    }
+    aDEM[demCount++] = dem;
+
+    /* Register the tile in the degree-keyed index */
+
+    int ilat = dem->min_north+90;
+    int ilon = dem->min_west;
+
+    while (ilon < 0)
+        ilon += 360;
+
+    while (ilon >= 360)
+        ilon -= 360;
+
+    if (ilat >= 0 && ilat < 180)
+        demIndex[ilat][ilon] = dem;
+
+    dem->resident = true;
+    dem->lastuse = ++demClock;
+    dem->lastphase = demPhase;
+    demResidentCount++;
+    DEMCacheEnforce();
+
+    return 0;
+}
+
+/* Returns a DEM whose boundaries are exactly on the given boundaries,
+ * or NULL if not found.
+ */
+DEM *FindDEM_Explicit(double minlat, double minlon, double maxlat, double maxlon)
+{
+    for (int i=0; i<demCount; ++i) {
+        if (minlat==aDEM[i]->min_north &&
+            minlon==aDEM[i]->min_west &&
+            maxlat==aDEM[i]->max_north &&
+            maxlon==aDEM[i]->max_west)
+            return aDEM[i];
+    }
+    return NULL;
+}
+
+/* Checks whether the tile registered under the given integer-degree key
+ * contains the coordinate, filling in x and y if it does.
+ */
+static inline DEM *DEMIndexLookup(int ilat, int ilon, double lat, double lon, int &x, int &y)
+{
+    DEM *dem;
+
+    if (ilat < -90 || ilat > 89)
+        return NULL;
+
+    while (ilon < 0)
+        ilon += 360;
+
+    while (ilon >= 360)
+        ilon -= 360;
+
+    dem = demIndex[ilat+90][ilon];
+    if (!dem)
+        return NULL;
+
+    x=(int)rint(ppd*(lat-dem->min_north));
+    y=mpi-(int)rint(ppd*(LonDiff(dem->max_west,lon)));
+
+    if (x>=0 && x<=mpi && y>=0 && y<=mpi)
+        return dem;
+
+    return NULL;
+}
+
+/* Returns the DEM containing the lat/long, or NULL if not found.
+ *
+ * x and y will contain the offsets into the DEM array of
+ * the coordinate.
+ *
+ * Resolution is O(1): paths have strong spatial locality, so the tile
+ * this thread hit last is tried first, then the degree-keyed index.
+ * Rounding at tile edges means the containing tile's keys can be one
+ * off from the floor of the coordinate, hence the neighbor probes.
+ *
+ * The lock-free fast path is only trusted within the phase in which the
+ * page's touch was last registered under demMutex. DEMCacheNewPhase()
+ * makes pages from earlier phases evictable again, and the workers (and
+ * their thread-local pointers) outlive phase boundaries, so the first
+ * hit after a phase change falls through to the locked path below and
+ * re-pins the page before it is dereferenced unlocked again -- the same
+ * generation trick that parks AnoWriter's leftover buffers. Without a
+ * -memlimit nothing is ever evicted and the phase never advances.
+ */
+DEM *FindDEM(double lat, double lon, int &x, int &y)
+{
+    static thread_local DEM *lastDEM = NULL;
+    static thread_local int lastPhase = 0;
+    DEM *dem;
+    int flat, flon, phase;
+
+    if (lastDEM && lastPhase==__atomic_load_n(&demPhase,__ATOMIC_RELAXED)) {
+        x=(int)rint(ppd*(lat-lastDEM->min_north));
+        y=mpi-(int)rint(ppd*(LonDiff(lastDEM->max_west,lon)));
+
+        if (x>=0 && x<=mpi && y>=0 && y<=mpi) {
+            threadStats.s.dem_last++;
+            return lastDEM;
+        }
+    }
+
+    flat=(int)floor(lat);
+    flon=(int)floor(lon);
+
+    if ((dem=DEMIndexLookup(flat,   flon,   lat, lon, x, y)) == NULL &&
+        (dem=DEMIndexLookup(flat,   flon-1, lat, lon, x, y)) == NULL &&
+        (dem=DEMIndexLookup(flat+1, flon,   lat, lon, x, y)) == NULL &&
+        (dem=DEMIndexLookup(flat+1, flon-1, lat, lon, x, y)) == NULL) {
+        threadStats.s.dem_miss++;
+        return NULL;
+    }
+
+    /* Page-crossings are rare enough that the cache can afford a lock
+       here; the fast path above never takes one. */
+
+    phase=__atomic_load_n(&demPhase,__ATOMIC_RELAXED);
+
+    if (demMemBudget!=0) {
+        std::lock_guard<std::mutex> lock(demMutex);
+
+        dem->lastuse=++demClock;
+        dem->lastphase=demPhase;
+        phase=demPhase;
+
+        if (!dem->resident) {
+            DEMCacheFault(dem);
+            DEMCacheEnforce();
+        }
+    }
+
+    threadStats.s.dem_index++;
+    lastDEM = dem;
+    lastPhase = phase;
+    return dem;
+}
+
+
+/* Lines, text, markings, and coverage areas are stored in a
+ * mask that is combined with topology data when topographic
+ * maps are generated by SPLAT!.  This function sets and resets
+ * bits in the mask based on the latitude and longitude of the
+ * area pointed to.
+ *
+ * The mask and signal planes are shared by every worker during the
+ * multithreaded coverage sweeps, and concurrent rays do land on the
+ * same pixels (every boundary ray crosses the near-transmitter cells),
+ * so the accessors below go through relaxed atomic byte operations.
+ * Rays from one transmitter always write the same value to a shared
+ * pixel -- the sweeps for different transmitters stay ordered -- which
+ * is why plain bytes ever appeared to work, but the |= in OrMask() is
+ * a read-modify-write that can drop another thread's bit, and mixed
+ * unsynchronized access is a data race regardless of the values. The
+ * alternative, a private copy of the planes per worker merged at the
+ * end of each sweep, costs two bytes per pixel per worker on every
+ * resident page and doesn't fit the -memlimit eviction machinery;
+ * relaxed byte atomics compile to the plain load or store everywhere
+ * it matters (only the rarer fetch-or pays for a locked instruction),
+ * so the readers in the image writers stay as cheap as before.
+ */
+int PutMask(double lat, double lon, int value)
+{
+    int	x, y;
+    DEM *dem;
+
+    dem = FindDEM(lat, lon, x, y);
+    if (!dem)
+        return -1;
+
+    __atomic_store_n(&DEMMask(dem,x,y),(unsigned char)value,__ATOMIC_RELAXED);
+    return ((int)(unsigned char)value);
+}
 
-/* Returns the mask bits based on the latitude and
- * longitude given.
+/* Lines, text, markings, and coverage areas are stored in a
+ * mask that is combined with topology data when topographic
+ * maps are generated by SPLAT!.  This function sets bits in
+ * the mask based on the latitude and longitude of the area
+ * pointed to.
+ */
+int OrMask(double lat, double lon, int value)
+{
+    int	x, y;
+    DEM *dem;
+
+    dem = FindDEM(lat, lon, x, y);
+    if (!dem)
+        return -1;
+
+    return ((int)(__atomic_fetch_or(&DEMMask(dem,x,y),(unsigned char)value,__ATOMIC_RELAXED)|(unsigned char)value));
+}
+
+/* Returns the mask bits based on the latitude and longitude given.
+ * A pure load rather than OrMask(lat,lon,0): the sweeps poll the mask
+ * far more often than they write it (the "already processed" test runs
+ * per pixel per ray), and a load leaves the cache line shared between
+ * cores where a read-modify-write would bounce it.
  */
 int GetMask(double lat, double lon)
 {
-    return (OrMask(lat,lon,0));
+    int	x, y;
+    DEM *dem;
+
+    dem = FindDEM(lat, lon, x, y);
+    if (!dem)
+        return -1;
+
+    return ((int)__atomic_load_n(&DEMMask(dem,x,y),__ATOMIC_RELAXED));
 }
 
 /* Writes a signal level (0-255) at the specified location
@@ -1040,8 +1870,8 @@ int PutSignal(double lat, double lon, unsigned char signal)
     if (!dem)
         return 0;
 
-    dem->signal[x][y]=signal;
-    return (dem->signal[x][y]);
+    __atomic_store_n(&DEMSignal(dem,x,y),signal,__ATOMIC_RELAXED);
+    return (signal);
 }
 
 /* This function reads the signal level (0-255) at the
@@ -1057,7 +1887,7 @@ unsigned char GetSignal(double lat, double lon)
     if (!dem)
         return 0;
 
-    return (dem->signal[x][y]);
+    return (__atomic_load_n(&DEMSignal(dem,x,y),__ATOMIC_RELAXED));
 }
 
 /* This function returns the elevation (in feet) of any location
@@ -1073,7 +1903,7 @@ double GetElevation(Site location)
     if (!dem)
         return -5000.0;
 
-    return (3.28084*(double)(dem->data[x][y]));
+    return (3.28084*(double)(DEMData(dem,x,y)));
 }
 
 /* This function adds a user-defined terrain feature
@@ -1090,7 +1920,7 @@ int AddElevation(double lat, double lon, double height)
     if (!dem)
         return 0;
 
-    dem->data[x][y]+=(short)rint(height);
+    DEMData(dem,x,y)+=(short)rint(height);
     return 1;
 }
 
@@ -1110,7 +1940,7 @@ int SetElevation(double lat, double lon, double height)
     if (!dem)
         return 0;
 
-    dem->data[x][y]=(short)rint(height);
+    DEMData(dem,x,y)=(short)rint(height);
     return 1;
 }
 
@@ -1222,12 +2052,14 @@ double ElevationAngle(Site source, Site destination)
  * stores elevation and distance information for points along that
  * path in the "path" structure.
  */
-void ReadPath(Site &source, Site &destination, Path *path)
+void ReadPath(const Site &source, const Site &destination, Path *path)
 {
     int	c;
-    double	azimuth, distance, lat1, lon1, beta, den, num,
+    double	azimuth, distance, lat1, lon1, beta, num,
             lat2, lon2, total_distance, dx, dy, path_length,
             miles_per_sample, samples_per_radian=68755.0;
+    double	sin_lat1, cos_lat1, sin_az, cos_az, sin_lat2,
+            step, sin_step, cos_step, sin_beta, cos_beta;
     Site tempsite;
 
     lat1=source.lat*DEG2RAD;
@@ -1274,30 +2106,55 @@ void ReadPath(Site &source, Site &destination, Path *path)
         path->distance[c]=0.0;
     }
 
-    for (distance=0.0, c=0; (total_distance!=0.0 && distance<=total_distance && c<(int)path->arysize); c++, distance=miles_per_sample*(double)c)
-    {
-        beta=distance/3959.0;
-        lat2=asin(sin(lat1)*cos(beta)+cos(azimuth)*sin(beta)*cos(lat1));
-        num=cos(beta)-(sin(lat1)*sin(lat2));
-        den=cos(lat1)*cos(lat2);
+    /* One ray is thousands of samples and PlotLRMap() shoots tens of
+       thousands of rays, so the per-sample work is kept down to one
+       asin() and one atan2(): the great-circle point at arc distance
+       beta from the source satisfies
 
-        if (azimuth==0.0 && (beta>HALFPI-lat1))
-            lon2=lon1+PI;
+           sin(lat2) = sin(lat1)cos(beta)+cos(lat1)sin(beta)cos(az)
+           dlon      = atan2(sin(az)sin(beta)cos(lat1),
+                             cos(beta)-sin(lat1)sin(lat2))
 
-        else if (azimuth==HALFPI && (beta>HALFPI+lat1))
-            lon2=lon1+PI;
+       (longitude grows westward here, so dlon is subtracted), and the
+       sin/cos of the uniformly stepped beta come from the angle-sum
+       recurrence rather than a sincos() call per sample. The recurrence
+       drifts on the order of an ulp per step, so it is re-seeded from
+       libm every 256 samples, keeping the accumulated error many orders
+       of magnitude below the sample spacing. The atan2() form also
+       covers the pole crossings that previously needed explicit
+       special cases. */
 
-        else if (fabs(num/den)>1.0)
-            lon2=lon1;
+    sin_lat1=sin(lat1);
+    cos_lat1=cos(lat1);
+    sin_az=sin(azimuth);
+    cos_az=cos(azimuth);
 
-        else
+    step=miles_per_sample/3959.0;
+    sin_step=sin(step);
+    cos_step=cos(step);
+    sin_beta=0.0;
+    cos_beta=1.0;
+
+    for (distance=0.0, c=0; (total_distance!=0.0 && distance<=total_distance && c<(int)path->arysize); c++, distance=miles_per_sample*(double)c)
+    {
+        if ((c&255)==0)
         {
-            if ((PI-azimuth)>=0.0)
-                lon2=lon1-arccos(num,den);
-            else
-                lon2=lon1+arccos(num,den);
+            beta=distance/3959.0;
+            sin_beta=sin(beta);
+            cos_beta=cos(beta);
         }
 
+        sin_lat2=sin_lat1*cos_beta+cos_az*sin_beta*cos_lat1;
+
+        if (sin_lat2>1.0)
+            sin_lat2=1.0;
+
+        if (sin_lat2<-1.0)
+            sin_lat2=-1.0;
+
+        lat2=asin(sin_lat2);
+        lon2=lon1-atan2(sin_az*sin_beta*cos_lat1,cos_beta-(sin_lat1*sin_lat2));
+
         if (lon2<0.0)
         {
             while (lon2<0.0)
@@ -1320,6 +2177,12 @@ void ReadPath(Site &source, Site &destination, Path *path)
 
         path->elevation[c]=GetElevation(tempsite);
         path->distance[c]=distance;
+
+        /* Advance beta by one sample spacing */
+
+        num=cos_beta*cos_step-sin_beta*sin_step;
+        sin_beta=sin_beta*cos_step+cos_beta*sin_step;
+        cos_beta=num;
     }
 
     /* Make sure exact destination point is recorded at path.length-1 */
@@ -1339,6 +2202,78 @@ void ReadPath(Site &source, Site &destination, Path *path)
         path->length=path->arysize-1;
 }
 
+/* Cached point-to-point profiles for the report writers.
+ *
+ * A single point-to-point invocation walks the same transmitter-to-
+ * receiver profile many times over: the KML track, the path report, the
+ * obstruction analysis, and each of the gnuplot products begin by
+ * re-running ReadPath() on the same pair of endpoints (the graphing
+ * functions in the receiver-to-transmitter direction).  ReadPath()
+ * samples the terrain once per pixel of path, so on long paths those
+ * repeats dominate the report stage.  Keep the two most recent profiles
+ * -- one per direction of the current site pair -- and hand back the
+ * cached copy when the endpoints match.  ReadPath()'s output depends
+ * only on the endpoint coordinates, so those are the whole key.
+ *
+ * The report writers all run sequentially on the main thread (the plot
+ * workers keep their own per-thread scratch paths), so no locking is
+ * needed.  FlushReportPaths() discards the slots between daemon jobs,
+ * which may swap the terrain (or the app mode, and with it the Path
+ * array size) underneath them.
+ */
+typedef struct ReportPathSlot {
+    Path	*path;
+    double	lat1, lon1, lat2, lon2;
+    char	valid;
+} ReportPathSlot;
+
+static ReportPathSlot reportPath[2];
+static int reportPathNext=0;
+
+static Path *GetReportPath(const Site &source, const Site &destination)
+{
+    int i;
+
+    for (i=0; i<2; i++)
+        if (reportPath[i].valid &&
+            reportPath[i].lat1==source.lat && reportPath[i].lon1==source.lon &&
+            reportPath[i].lat2==destination.lat && reportPath[i].lon2==destination.lon)
+            return reportPath[i].path;
+
+    i=reportPathNext;
+    reportPathNext^=1;
+
+    if (reportPath[i].path==NULL)
+        reportPath[i].path=AllocatePath();
+
+    if (reportPath[i].path==NULL)
+        return NULL;
+
+    ReadPath(source,destination,reportPath[i].path);
+
+    reportPath[i].lat1=source.lat;
+    reportPath[i].lon1=source.lon;
+    reportPath[i].lat2=destination.lat;
+    reportPath[i].lon2=destination.lon;
+    reportPath[i].valid=1;
+
+    return reportPath[i].path;
+}
+
+static void FlushReportPaths(void)
+{
+    int i;
+
+    for (i=0; i<2; i++)
+    {
+        if (reportPath[i].path)
+            DestroyPath(reportPath[i].path);
+
+        reportPath[i].path=NULL;
+        reportPath[i].valid=0;
+    }
+}
+
 /* Returns the angle of elevation (in degrees) of the destination as
  * seen from the source location, UNLESS the path between the sites is
  * obstructed, in which case it returns the elevation angle to the first
@@ -1353,13 +2288,12 @@ double ElevationAngle2(Site source, Site destination, double er)
             cos_test_angle, test_alt, elevation, distance,
             source_alt2, first_obstruction_angle=0.0;
 
-    Path *path = AllocatePath();
+    Path *path = GetReportPath(source,destination);
     if (!path) {
         fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
         /* XXX What to return? */
         return 0.0;
     }
-    ReadPath(source,destination,path);
 
     distance=5280.0*Distance(source,destination);
     source_alt=er+source.alt+GetElevation(source);
@@ -1406,8 +2340,6 @@ double ElevationAngle2(Site source, Site destination, double er)
     else
         elevation=((acos(cos_xmtr_angle))/DEG2RAD)-90.0;
 
-    DestroyPath(path);
-
     return elevation;
 }
 
@@ -1418,12 +2350,73 @@ double ElevationAngle2(Site source, Site destination, double er)
  * memory to complete the survey (critical error), then -9999.0 is
  * returned.
  */
+/* Cache of AverageTerrain() results. haat() computes the same eight
+ * radials SiteReport() then prints, and PathReport() runs haat() again
+ * for both ends of every path, so in a multi-site audit each radial
+ * would otherwise be re-sampled two or three times with a fresh Path
+ * each time. An entry is one double per (site, azimuth, span), so the
+ * cache just grows for the life of a job; DaemonResetState() empties
+ * it, since a warm daemon can swap the terrain or clutter under it.
+ */
+typedef struct RadialTerrain {
+    double lat;
+    double lon;
+    double azimuth;
+    double start;
+    double end;
+    double terrain;
+} RadialTerrain;
+
+static RadialTerrain *radialCache=NULL;
+static int radialCount=0, radialSize=0;
+static std::mutex radialMutex;
+
+static int RadialLookup(const Site &source, double azimuth, double start, double end, double *terrain)
+{
+    int i;
+    std::lock_guard<std::mutex> lock(radialMutex);
+
+    for (i=0; i<radialCount; i++)
+        if (radialCache[i].lat==source.lat && radialCache[i].lon==source.lon &&
+            radialCache[i].azimuth==azimuth &&
+            radialCache[i].start==start && radialCache[i].end==end)
+        {
+            *terrain=radialCache[i].terrain;
+            return 1;
+        }
+
+    return 0;
+}
+
+static void RadialStore(const Site &source, double azimuth, double start, double end, double terrain)
+{
+    std::lock_guard<std::mutex> lock(radialMutex);
+
+    if (radialCount==radialSize)
+    {
+        radialSize=(radialSize==0?64:radialSize*2);
+        radialCache=(RadialTerrain *)realloc(radialCache,radialSize*sizeof(RadialTerrain));
+        assert(radialCache!=NULL);
+    }
+
+    radialCache[radialCount].lat=source.lat;
+    radialCache[radialCount].lon=source.lon;
+    radialCache[radialCount].azimuth=azimuth;
+    radialCache[radialCount].start=start;
+    radialCache[radialCount].end=end;
+    radialCache[radialCount].terrain=terrain;
+    radialCount++;
+}
+
 double AverageTerrain(Site source, double azimuthx, double start_distance, double end_distance)
 {
     int	c, samples, endpoint;
     double	beta, lat1, lon1, lat2, lon2, num, den, azimuth, terrain=0.0;
     Site destination;
 
+    if (RadialLookup(source,azimuthx,start_distance,end_distance,&terrain))
+        return terrain;
+
     lat1=source.lat*DEG2RAD;
     lon1=source.lon*DEG2RAD;
 
@@ -1476,10 +2469,13 @@ double AverageTerrain(Site source, double azimuthx, double start_distance, doubl
        be accurately calculated.  Return -9999.0 */
 
     if (GetElevation(destination)<-4999.0)
+    {
+        RadialStore(source,azimuthx,start_distance,end_distance,-9999.0);
         return (-9999.0);
+    }
     else
     {
-        Path *path = AllocatePath();
+        Path *path = GetThreadPath();
         if (!path) {
             fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
             return (-9999.0);
@@ -1509,7 +2505,7 @@ double AverageTerrain(Site source, double azimuthx, double start_distance, doubl
         else
             terrain=(terrain/(double)samples);
 
-        DestroyPath(path);
+        RadialStore(source,azimuthx,start_distance,end_distance,terrain);
         return terrain;
     }
 }
@@ -1565,6 +2561,49 @@ double haat(Site antenna)
  * map to place the marker and its associated text, then the marker and
  * text are not written to the map.
  */
+/* ORs together the mask bytes of a run of pixels at constant latitude,
+ * walking west to east one column at a time. One map row is contiguous
+ * in the mask plane, so the page is resolved once per run (and again at
+ * a page edge) instead of once per pixel through GetMask(). Samples
+ * falling off the loaded pages read as all-ones, matching GetMask()'s
+ * -1 return.
+ */
+static int GetMaskRow(double lat, double lon, int count)
+{
+    int x, y, bits=0;
+    DEM *dem;
+
+    while (count>0)
+    {
+        dem=FindDEM(lat,lon,x,y);
+
+        if (dem==NULL)
+            return (bits|-1);
+
+        for (; count>0 && y>=0; count--, y--, lon-=dpp)
+            bits|=(int)__atomic_load_n(&DEMMask(dem,x,y),__ATOMIC_RELAXED);
+    }
+
+    return bits;
+}
+
+/* Is the 16-pixel-high, "pixels"-wide text box with its top-east corner
+ * at (lat,lon) clear of text and other markers? This is the hot part of
+ * marker placement: the box is probed at up to four candidate positions
+ * per label, and at every position before a collision the old code paid
+ * a full coordinate resolution per pixel.
+ */
+static char TextOccupied(double lat, double lon, int pixels)
+{
+    int a;
+    char occupied=0;
+
+    for (a=0; a<16; a++, lat-=dpp)
+        occupied|=(char)(GetMaskRow(lat,lon,pixels)&2);
+
+    return occupied;
+}
+
 void PlaceMarker(Site location)
 {
     int	a, b, c, byte;
@@ -1619,23 +2658,10 @@ void PlaceMarker(Site location)
 
                     textx=lat-p8;
 
-                    x=textx;
-                    y=texty;
-
                     /* Is This Position Clear Of
                        Text Or Other Markers? */
 
-                    for (a=0, occupied=0; a<16; a++)
-                    {
-                        for (b=0; b<(int)strlen(location.name); b++)
-                            for (c=0; c<8; c++, y-=p1)
-                                occupied|=(GetMask(x,y)&2);
-                        x-=p1;
-                        y=texty;
-                    }
-
-                    x=textx;
-                    y=texty;
+                    occupied=TextOccupied(textx,texty,(int)strlen(location.name)<<3);
 
                     if (occupied==0)
                         ok2print=1;
@@ -1647,23 +2673,10 @@ void PlaceMarker(Site location)
 
                     textx=lat+p24;
 
-                    x=textx;
-                    y=texty;
-
                     /* Is This Position Clear Of
                        Text Or Other Markers? */
 
-                    for (a=0, occupied=0; a<16; a++)
-                    {
-                        for (b=0; b<(int)strlen(location.name); b++)
-                            for (c=0; c<8; c++, y-=p1)
-                                occupied|=(GetMask(x,y)&2);
-                        x-=p1;
-                        y=texty;
-                    }
-
-                    x=textx;
-                    y=texty;
+                    occupied=TextOccupied(textx,texty,(int)strlen(location.name)<<3);
 
                     if (occupied==0)
                         ok2print=1;
@@ -1680,23 +2693,10 @@ void PlaceMarker(Site location)
                     textx=lat+p6;
                     texty=lon-p12;
 
-                    x=textx;
-                    y=texty;
-
                     /* Is This Position Clear Of
                        Text Or Other Markers? */
 
-                    for (a=0, occupied=0; a<16; a++)
-                    {
-                        for (b=0; b<(int)strlen(location.name); b++)
-                            for (c=0; c<8; c++, y-=p1)
-                                occupied|=(GetMask(x,y)&2);
-                        x-=p1;
-                        y=texty;
-                    }
-
-                    x=textx;
-                    y=texty;
+                    occupied=TextOccupied(textx,texty,(int)strlen(location.name)<<3);
 
                     if (occupied==0)
                         ok2print=1;
@@ -1710,23 +2710,10 @@ void PlaceMarker(Site location)
                     textx=lat+p6;
                     texty=lon+p8+(label_length);
 
-                    x=textx;
-                    y=texty;
-
                     /* Is This Position Clear Of
                        Text Or Other Markers? */
 
-                    for (a=0, occupied=0; a<16; a++)
-                    {
-                        for (b=0; b<(int)strlen(location.name); b++)
-                            for (c=0; c<8; c++, y-=p1)
-                                occupied|=(GetMask(x,y)&2);
-                        x-=p1;
-                        y=texty;
-                    }
-
-                    x=textx;
-                    y=texty;
+                    occupied=TextOccupied(textx,texty,(int)strlen(location.name)<<3);
 
                     if (occupied==0)
                         ok2print=1;
@@ -2331,7 +3318,10 @@ void LoadPAT(char *filename)
             else
                 az=1.0;
 
-            LR.antenna_pattern[x][y]=az*elevation;
+            if (az*elevation>0.0)
+                LR.antenna_pattern[x][y]=(float)(20.0*log10(az*elevation));
+            else
+                LR.antenna_pattern[x][y]=ANTENNA_NULL_DB;
         }
     }
 
@@ -2343,64 +3333,341 @@ void LoadPAT(char *filename)
     free(read_count);
 }
 
-/* Returns at most one less than 'length' number of characters
- * from * a bz2 compressed file whose file descriptor is pointed
- * to by *bzfp. In operation, a buffer is filled with uncompressed
- * data (size = BZBUFFER), which is then parsed and doled out
- * as NULL-terminated character bufs every time this function is
- * invoked. A NULL buf indicates an EOF or error condition.
+/* Streaming line reader for ASCII tiles, plain or compressed. Allocate
+ * one (zeroed) per open file; multiple tiles can be read concurrently.
  *
- * Uses internal static buffers. NOT THREADSAFE.
+ * Decompressed data lands in a large reusable block buffer and lines are
+ * scanned out of it in place with memchr(), so the per-line cost is a
+ * couple of pointer updates rather than the byte-at-a-time copy loop of
+ * the old BZfgets(). Only a line that straddles a block boundary is ever
+ * copied.
  */
-char *BZfgets(BZFILE *bzfp, unsigned length)
+typedef struct TileReader {
+    SDFCompressType type;
+    FILE *fp;
+    BZFILE *bzfp;
+    int bzerror;
+#ifdef HAVE_LIBZSTD
+    ZSTD_DStream *zds;
+    ZSTD_inBuffer zin;
+    char zinbuf[BZBUFFER];
+#endif
+    bool eof;
+    int nBuf, pos;      /* decompressed bytes in buffer, scan cursor */
+    int outlen;         /* partial line carried across a refill */
+    char buffer[BZBUFFER+1];
+    char output[256];
+} TileReader;
+
+/* Prepares a zeroed TileReader to stream lines from fp, which was opened
+ * in binary mode and remains owned by the caller. Returns 0 on success.
+ */
+int TileReaderOpen(TileReader *tr, FILE *fp, SDFCompressType type)
 {
-    static int x, y, nBuf;
-    static char buffer[BZBUFFER+1], output[BZBUFFER+1];
-    char done=0;
+    tr->type=type;
+    tr->fp=fp;
+
+    switch (type) {
+        case SDF_COMPRESSTYPE_BZIP2:
+            tr->bzfp=BZ2_bzReadOpen(&tr->bzerror,fp,0,0,NULL,0);
+            if (tr->bzfp==NULL || tr->bzerror!=BZ_OK)
+                return -1;
+            break;
+#ifdef HAVE_LIBZSTD
+        case SDF_COMPRESSTYPE_ZSTD:
+            tr->zds=ZSTD_createDStream();
+            if (tr->zds==NULL)
+                return -1;
+            ZSTD_initDStream(tr->zds);
+            tr->zin.src=tr->zinbuf;
+            tr->zin.size=0;
+            tr->zin.pos=0;
+            break;
+#endif
+        default:
+            break;
+    }
 
-    if (!opened && bzerror==BZ_OK)
-    {
-        /* First time through.  Initialize everything! */
+    return 0;
+}
 
-        x=0;
-        y=0;
-        nBuf=0;
-        opened=true;
-        output[0]=0;
+void TileReaderClose(TileReader *tr)
+{
+    if (tr->type==SDF_COMPRESSTYPE_BZIP2 && tr->bzfp!=NULL)
+        BZ2_bzReadClose(&tr->bzerror,tr->bzfp);
+#ifdef HAVE_LIBZSTD
+    if (tr->type==SDF_COMPRESSTYPE_ZSTD && tr->zds!=NULL)
+        ZSTD_freeDStream(tr->zds);
+#endif
+}
+
+/* Refills the block buffer with the next BZBUFFER or so of decompressed
+ * data and resets the scan cursor. Returns the number of bytes now in
+ * the buffer; 0 means end of stream (or a decode error, which we treat
+ * the same way the old reader did: as a short file).
+ */
+static int TileReaderFill(TileReader *tr)
+{
+    tr->pos=0;
+    tr->nBuf=0;
+
+    if (tr->eof) {
+        tr->buffer[0]=0;
+        return 0;
     }
 
-    do
-    {
-        if (x==nBuf && bzerror!=BZ_STREAM_END && bzerror==BZ_OK && opened)
-        {
-            /* Uncompress data into a static buffer */
+    switch (tr->type) {
+        case SDF_COMPRESSTYPE_BZIP2:
+            tr->nBuf=BZ2_bzRead(&tr->bzerror,tr->bzfp,tr->buffer,BZBUFFER);
+            if (tr->bzerror!=BZ_OK) {
+                tr->eof=true;
+                if (tr->bzerror!=BZ_STREAM_END)
+                    tr->nBuf=0;
+            }
+            break;
+
+#ifdef HAVE_LIBZSTD
+        case SDF_COMPRESSTYPE_ZSTD: {
+            ZSTD_outBuffer zout;
+
+            zout.dst=tr->buffer;
+            zout.size=BZBUFFER;
+            zout.pos=0;
+
+            while (zout.pos==0) {
+                if (tr->zin.pos==tr->zin.size) {
+                    size_t n=fread(tr->zinbuf,1,sizeof(tr->zinbuf),tr->fp);
+                    if (n==0) {
+                        tr->eof=true;
+                        break;
+                    }
+                    tr->zin.size=n;
+                    tr->zin.pos=0;
+                }
+
+                if (ZSTD_isError(ZSTD_decompressStream(tr->zds,&zout,&tr->zin))) {
+                    tr->eof=true;
+                    break;
+                }
+            }
 
-            nBuf=BZ2_bzRead(&bzerror, bzfp, buffer, BZBUFFER);
-            buffer[nBuf]=0;
-            x=0;
+            tr->nBuf=(int)zout.pos;
+            break;
         }
+#endif
+
+        case SDF_COMPRESSTYPE_NONE:
+        default:
+            tr->nBuf=(int)fread(tr->buffer,1,BZBUFFER,tr->fp);
+            if (tr->nBuf<BZBUFFER)
+                tr->eof=true;
+    }
+
+    tr->buffer[tr->nBuf]=0;
+    return tr->nBuf;
+}
 
-        /* Build a buf from buffer contents */
+/* Returns the next newline-terminated line as a NUL-terminated string of
+ * at most length-1 characters. When the whole line is already in the
+ * block buffer -- the overwhelmingly common case -- the returned pointer
+ * aims directly into that buffer and nothing is copied. The string is
+ * only valid until the next TileReaderGets() call. At end of file an
+ * empty string is returned, which atoi() reads as 0 just as the old
+ * BZfgets() callers expected.
+ */
+char *TileReaderGets(TileReader *tr, unsigned length)
+{
+    if (length>sizeof(tr->output))
+        length=sizeof(tr->output);
+
+    for (;;) {
+        if (tr->pos<tr->nBuf) {
+            char *start=tr->buffer+tr->pos;
+            char *nl=(char*)memchr(start,'\n',tr->nBuf-tr->pos);
+            int n=(nl!=NULL)?(int)(nl-start):tr->nBuf-tr->pos;
+            int room=(int)length-1-tr->outlen;
+
+            if (nl!=NULL && tr->outlen==0 && n<(int)length-1) {
+                /* Whole line in the buffer: terminate it in place */
+                *nl=0;
+                tr->pos=(int)(nl+1-tr->buffer);
+                return start;
+            }
 
-        output[y]=buffer[x];
+            if (n>=room) {
+                /* Longer than the caller wants; dole it out in chunks */
+                memcpy(tr->output+tr->outlen,start,room);
+                tr->pos+=room;
+                tr->output[length-1]=0;
+                tr->outlen=0;
+                return tr->output;
+            }
 
-        if (output[y]=='\n' || output[y]==0 || y==(int)length-1)
-        {
-            output[y+1]=0;
-            done=1;
-            y=0;
+            memcpy(tr->output+tr->outlen,start,n);
+            tr->outlen+=n;
+
+            if (nl!=NULL) {
+                tr->pos=(int)(nl+1-tr->buffer);
+                tr->output[tr->outlen]=0;
+                tr->outlen=0;
+                return tr->output;
+            }
+
+            tr->pos=tr->nBuf;   /* line continues in the next block */
         }
 
-        else
-            y++;
-        x++;
+        if (TileReaderFill(tr)==0) {
+            tr->output[tr->outlen]=0;
+            tr->outlen=0;
+            return tr->output;
+        }
+    }
+}
+
+/* Folds one page's bounds and elevation extremes into the global
+ * region. Called for every page a run requests, including pages that
+ * were already in memory, so the region always describes the current
+ * job rather than everything ever loaded. Caller holds demMutex.
+ */
+static void MergeRegionBounds(DEM *dem)
+{
+    if (dem->min_el<min_elevation)
+        min_elevation=dem->min_el;
+
+    if (dem->max_el>max_elevation)
+        max_elevation=dem->max_el;
+
+    if (max_north==-90)
+        max_north=dem->max_north;
+
+    else if (dem->max_north>max_north)
+        max_north=dem->max_north;
+
+    if (min_north==90)
+        min_north=dem->min_north;
+
+    else if (dem->min_north<min_north)
+        min_north=dem->min_north;
+
+    if (max_west==-1) {
+        max_west=dem->max_west;
+    } else {
+        if (abs(dem->max_west-max_west)<180) {
+            if (dem->max_west>max_west)
+                max_west=dem->max_west;
+        } else {
+            if (dem->max_west<max_west)
+                max_west=dem->max_west;
+        }
+    }
+
+    if (min_west==360) {
+        min_west=dem->min_west;
+    } else {
+        if (abs(dem->min_west-min_west)<180) {
+            if (dem->min_west<min_west)
+                min_west=dem->min_west;
+        } else {
+            if (dem->min_west>min_west)
+                min_west=dem->min_west;
+        }
+    }
+}
+
+/* Loads a binary (.bsdf) tile into a freshly allocated DEM. On POSIX
+ * systems the file is mmap'd MAP_PRIVATE and the DEM's data rows are
+ * pointed directly into the mapping, so no elevation samples are ever
+ * copied; writes from LoadUDT()/AddElevation() land in copy-on-write
+ * pages and never touch the tile on disk. Windows falls back to fread().
+ *
+ * Returns 0 on success, or -1 if the file is malformed or was written
+ * for a different resolution than the current mode.
+ */
+int LoadSDF_BSDF(DEM *dem, FILE *fp)
+{
+    int x, y;
+    BSDFHeader hdr;
+
+    if (fread(&hdr, sizeof(BSDFHeader), 1, fp) != 1)
+        return -1;
+
+    if (hdr.magic!=BSDF_MAGIC || hdr.version!=BSDF_VERSION || hdr.ippd!=ippd)
+        return -1;
+
+    dem->max_west=hdr.max_west;
+    dem->min_north=hdr.min_north;
+    dem->min_west=hdr.min_west;
+    dem->max_north=hdr.max_north;
+
+#ifndef _WIN32
+    struct stat sb;
+    if (fstat(fileno(fp), &sb) != 0 ||
+        (unsigned long long)sb.st_size < sizeof(BSDFHeader)+(unsigned long long)ippd*ippd*sizeof(short))
+        return -1;
+
+    void *base = mmap(NULL, sb.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+    if (base == MAP_FAILED)
+        return -1;
+
+    free(dem->data);
+    dem->data = (short*)((char*)base + sizeof(BSDFHeader));
+    dem->mapbase = base;
+    dem->maplen = sb.st_size;
+#else
+    if (fread(dem->data, sizeof(short), (size_t)ippd*ippd, fp) != (size_t)ippd*ippd)
+        return -1;
+#endif
+
+    memset(dem->mask, 0, (size_t)ippd*ippd);
+    memset(dem->signal, 0, (size_t)ippd*ippd);
+
+    for (x=0; x<ippd; x++) {
+        for (y=0; y<ippd; y++) {
+            int data = DEMData(dem, x, y);
+
+            if (data>dem->max_el)
+                dem->max_el=data;
+
+            if (data<dem->min_el)
+                dem->min_el=data;
+        }
+    }
+
+    return 0;
+}
 
-    } while (done==0);
+/* Writes a DEM back out as a binary (.bsdf) tile. Used by the
+ * -sdf2bsdf converter mode. Returns 0 on success.
+ */
+int WriteBSDF(DEM *dem, const char *filename)
+{
+    BSDFHeader hdr;
+    FILE *fp;
+
+    if ((fp=fopen(filename,"wb")) == NULL)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic=BSDF_MAGIC;
+    hdr.version=BSDF_VERSION;
+    hdr.max_west=dem->max_west;
+    hdr.min_north=dem->min_north;
+    hdr.min_west=dem->min_west;
+    hdr.max_north=dem->max_north;
+    hdr.ippd=ippd;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        fclose(fp);
+        return -1;
+    }
 
-    if (output[0]==0)
-        opened=false;
+    if (fwrite(dem->data, sizeof(short), (size_t)ippd*ippd, fp) != (size_t)ippd*ippd) {
+        fclose(fp);
+        return -1;
+    }
 
-    return (output);
+    fclose(fp);
+    return 0;
 }
 
 /* Reads SPLAT Data Files (.sdf) containing digital elevation model data
@@ -2410,32 +3677,46 @@ char *BZfgets(BZFILE *bzfp, unsigned length)
 int LoadSDF(int minlat, int maxlat, int minlon, int maxlon, bool hidef)
 {
     int	x, y, data;
-    char line[64];
     char sdf_file[MAX_PATH_LEN*2];
     SDFCompressType compressType = SDF_COMPRESSTYPE_NONE;
     DEM *dem;
     FILE *fp = NULL;
-    BZFILE *bzfp = NULL;
+    TileReader *tr = NULL;
 
     /* this sets both the kinds of formats we understand and the priority */
     SDFCompressFormat formats[] = {
+        { SDF_COMPRESSTYPE_BINARY, "bsdf" },
         { SDF_COMPRESSTYPE_NONE, "sdf" },
+#ifdef HAVE_LIBZSTD
+        { SDF_COMPRESSTYPE_ZSTD, "sdf.zst" },
+#endif
         { SDF_COMPRESSTYPE_BZIP2, "sdf.bz2" },
     };
     const int known_formats = sizeof(formats)/sizeof(SDFCompressFormat);
 
-    /* Is it already in memory? */
+    /* Is it already in memory? Merge its bounds into the region even
+       so: in daemon mode the region globals are reset between jobs and
+       rebuilt from whichever pages -- warm or freshly read -- the
+       current job asks for. */
 
-    dem = FindDEM_Explicit(minlat, minlon, maxlat, maxlon);
-    if (dem != NULL) {
-        return 0;
+    {
+        std::lock_guard<std::mutex> lock(demMutex);
+
+        dem = FindDEM_Explicit(minlat, minlon, maxlat, maxlon);
+        if (dem != NULL) {
+            MergeRegionBounds(dem);
+            return 0;
+        }
+
+        dem = AllocateDEM();
     }
 
-    dem = AllocateDEM();
     if (dem == NULL) {
         return -1;
     }
 
+    double t0=StatsSeconds();
+
     /* Rearranged priority! Old way was:
      *	1) look in current workdir first
      *	2) look in directory specified by -d argument or .splat_path files
@@ -2510,58 +3791,58 @@ int LoadSDF(int minlat, int maxlat, int minlon, int maxlon, bool hidef)
         }
     }
 
-    if (fp) {
-        fprintf(stdout,"Loading \"%s\"...", sdf_file);
-        fflush(stdout);
+    bool loaded = false;
 
-        if (compressType == SDF_COMPRESSTYPE_BZIP2) {
-            bzfp=BZ2_bzReadOpen(&bzerror,fp,0,0,NULL,0);
+    if (fp) {
+        if (compressType == SDF_COMPRESSTYPE_BINARY) {
+            if (LoadSDF_BSDF(dem, fp) == 0) {
+                loaded = true;
+            } else {
+                fprintf(stderr,"\n*** ERROR: \"%s\" is not a usable binary SDF file. Ignoring it.\n",
+                        sdf_file);
+            }
+            fclose(fp); /* the mmap (if any) survives the close */
+            fp=NULL;
         }
+    }
 
-        switch (compressType) {
-            case SDF_COMPRESSTYPE_BZIP2:
-                dem->max_west = atoi(BZfgets(bzfp, 64));
-                dem->min_north = atoi(BZfgets(bzfp, 64));
-                dem->min_west = atoi(BZfgets(bzfp, 64));
-                dem->max_north = atoi(BZfgets(bzfp, 64));
-                break;
-            case SDF_COMPRESSTYPE_NONE:
-            default:
-                dem->max_west = atoi(fgets(line, 64, fp));
-                dem->min_north = atoi(fgets(line, 64, fp));
-                dem->min_west = atoi(fgets(line, 64, fp));
-                dem->max_north = atoi(fgets(line, 64, fp));
-        }
+    if (fp) {
+        tr = (TileReader*)calloc(1, sizeof(TileReader));
 
-        for (x=0; x<ippd; x++) {
-            for (y=0; y<ippd; y++) {
-                switch (compressType) {
-                    case SDF_COMPRESSTYPE_BZIP2:
-                        data = atoi(BZfgets(bzfp, 64));
-                        break;
-                    case SDF_COMPRESSTYPE_NONE:
-                    default:
-                        data = atoi(fgets(line, 64, fp));
-                }
+        if (TileReaderOpen(tr, fp, compressType) == 0) {
+            dem->max_west = atoi(TileReaderGets(tr, 64));
+            dem->min_north = atoi(TileReaderGets(tr, 64));
+            dem->min_west = atoi(TileReaderGets(tr, 64));
+            dem->max_north = atoi(TileReaderGets(tr, 64));
 
-                dem->data[x][y]=data;
-                dem->signal[x][y]=0;
-                dem->mask[x][y]=0;
+            for (x=0; x<ippd; x++) {
+                for (y=0; y<ippd; y++) {
+                    data = atoi(TileReaderGets(tr, 64));
 
-                if (data>dem->max_el)
-                    dem->max_el=data;
+                    DEMData(dem,x,y)=data;
+                    DEMSignal(dem,x,y)=0;
+                    DEMMask(dem,x,y)=0;
 
-                if (data<dem->min_el)
-                    dem->min_el=data;
+                    if (data>dem->max_el)
+                        dem->max_el=data;
+
+                    if (data<dem->min_el)
+                        dem->min_el=data;
+                }
             }
-        }
 
-        if (compressType == SDF_COMPRESSTYPE_BZIP2) {
-            BZ2_bzReadClose(&bzerror,bzfp);
+            loaded = true;
+        } else {
+            fprintf(stderr,"\n*** ERROR: Couldn't initialize the decompressor for \"%s\". Ignoring it.\n",
+                    sdf_file);
         }
+
+        TileReaderClose(tr);
+        free(tr);
         fclose(fp);
+    }
 
-    } else {
+    if (!loaded) {
         fprintf(stdout,"Can't find file for region %d_%d_%d_%d. Assuming as sea-level.\n",
                 minlat, maxlat, minlon, maxlon);
         fflush(stdout);
@@ -2575,62 +3856,130 @@ int LoadSDF(int minlat, int maxlat, int minlon, int maxlon, bool hidef)
 
         for (x=0; x<ippd; x++) {
             for (y=0; y<ippd; y++) {
-                dem->data[x][y]=0;
-                dem->signal[x][y]=0;
-                dem->mask[x][y]=0;
+                DEMData(dem,x,y)=0;
+                DEMSignal(dem,x,y)=0;
+                DEMMask(dem,x,y)=0;
             }
         }
 
     }
 
-    if (dem->min_el<min_elevation)
-        min_elevation=dem->min_el;
+    {
+        std::lock_guard<std::mutex> lock(demMutex);
 
-    if (dem->max_el>max_elevation)
-        max_elevation=dem->max_el;
+        MergeRegionBounds(dem);
 
-    if (max_north==-90)
-        max_north=dem->max_north;
+        AppendDEM(dem); /* append to global array */
+    }
 
-    else if (dem->max_north>max_north)
-        max_north=dem->max_north;
+    if (loaded) {
+        /* Printed as one line so concurrent loads don't interleave */
+        fprintf(stdout,"Loading \"%s\"... Done!\n", sdf_file);
+        fflush(stdout);
+    }
 
-    if (min_north==90)
-        min_north=dem->min_north;
+    threadStats.s.tile_load_s += StatsSeconds()-t0;
 
-    else if (dem->min_north<min_north)
-        min_north=dem->min_north;
+    return 1;
+}
 
-    if (max_west==-1) {
-        max_west=dem->max_west;
-    } else {
-        if (abs(dem->max_west-max_west)<180) {
-            if (dem->max_west>max_west)
-                max_west=dem->max_west;
-        } else {
-            if (dem->max_west<max_west)
-                max_west=dem->max_west;
+/* Converter entry point for the -sdf2bsdf option. Each argument is an
+ * existing ASCII .sdf, .sdf.bz2 or .sdf.zst tile whose name encodes its
+ * region (e.g. 46_47_122_123.sdf or 46_47_122_123-hd.sdf.bz2); a .bsdf tile
+ * with the same basename is written alongside it. Returns the number
+ * of tiles that could not be converted.
+ */
+int ConvertSDFtoBSDF(int argc, char *argv[], int firstarg)
+{
+    int errcount=0;
+
+    for (int i=firstarg; i<argc && argv[i][0] && argv[i][0]!='-'; i++) {
+        int minlat, maxlat, minlon, maxlon;
+        char stem[MAX_PATH_LEN], outfile[MAX_PATH_LEN*2+8];	/* dir + stem + ".bsdf" */
+        char *base, *dot;
+        bool hidef;
+        FILE *fp;
+
+        base = strrchr(argv[i], PATHSEP);
+        base = base ? base+1 : argv[i];
+
+        if (sscanf(base,"%d_%d_%d_%d",&minlat,&maxlat,&minlon,&maxlon)!=4
+#ifndef _WIN32
+            && sscanf(base,"%d:%d:%d:%d",&minlat,&maxlat,&minlon,&maxlon)!=4
+#endif
+           ) {
+            fprintf(stderr,"*** ERROR: \"%s\" doesn't look like an SDF tile name. Skipping it.\n",
+                    argv[i]);
+            errcount++;
+            continue;
         }
-    }
 
-    if (min_west==360) {
-        min_west=dem->min_west;
-    } else {
-        if (abs(dem->min_west-min_west)<180) {
-            if (dem->min_west<min_west)
-                min_west=dem->min_west;
+        hidef = (strstr(base,"-hd")!=NULL);
+
+        /* Refuse to convert a tile that's already binary: LoadSDF()
+           prefers .bsdf, so we'd end up truncating the very file we're
+           reading the samples out of. */
+        if (strstr(base,".bsdf")!=NULL) {
+            fprintf(stderr,"\"%s\" is already a binary SDF tile. Skipping it.\n", argv[i]);
+            continue;
+        }
+
+        /* Point the SDF search path at the tile's directory so LoadSDF()
+           finds exactly the file we were given. */
+        size_t dirlen = (size_t)(base-argv[i]);
+        if (dirlen >= MAX_PATH_LEN-1) {
+            fprintf(stderr,"*** ERROR: Path \"%s\" is too long. Skipping it.\n", argv[i]);
+            errcount++;
+            continue;
+        }
+        memcpy(sdf_path, argv[i], dirlen);
+        sdf_path[dirlen]=0;
+
+        strncpy(stem, base, MAX_PATH_LEN-1);
+        stem[MAX_PATH_LEN-1]=0;
+        if ((dot=strchr(stem,'.')) != NULL)
+            *dot=0;
+
+        snprintf(outfile, sizeof(outfile), "%s%s.bsdf", sdf_path, stem);
+
+        /* Same reasoning as above: if the target already exists, LoadSDF()
+           would read it in preference to the tile we were given. */
+        if ((fp=fopen(outfile,"rb")) != NULL) {
+            fclose(fp);
+            fprintf(stdout,"\"%s\" already exists. Skipping \"%s\".\n", outfile, argv[i]);
+            continue;
+        }
+
+        appmode = hidef ? APPMODE_HD : APPMODE_NORMAL;
+        ippd=AppArraySize(appmode);
+        ppd=(double)ippd;
+        dpp=1.0/ppd;
+        mpi=ippd-1;
+
+        if (InitDEMs() < 0) {
+            fprintf(stderr,"Couldn't allocate Digital Elevation Model array!\n");
+            return errcount+1;
+        }
+
+        if (LoadSDF(minlat, maxlat, minlon, maxlon, hidef) < 0 || demCount == 0) {
+            fprintf(stderr,"*** ERROR: Couldn't load \"%s\".\n", argv[i]);
+            errcount++;
+            FreeDEMs();
+            continue;
+        }
+
+        if (WriteBSDF(aDEM[demCount-1], outfile) == 0) {
+            fprintf(stdout,"Wrote \"%s\"\n", outfile);
         } else {
-            if (dem->min_west>min_west)
-                min_west=dem->min_west;
+            fprintf(stderr,"*** ERROR: Couldn't write \"%s\".\n", outfile);
+            errcount++;
         }
-    }
 
-    AppendDEM(dem); /* append to global array */
+        FreeDEMs();
+    }
 
-    fprintf(stdout," Done!\n");
     fflush(stdout);
-
-    return 1;
+    return errcount;
 }
 
 /* This function reads SPLAT! city/site files, and plots the locations
@@ -2695,34 +4044,53 @@ void LoadCities(char *filename)
         fprintf(stderr,"\n*** ERROR: \"%s\": not found!",filename);
 }
 
-#ifndef _WIN32
+/* One parsed User-Defined Terrain feature, reduced to pixel indices.
+ * The sequence number keeps qsort()'s ordering of duplicates stable so
+ * the last entry in the file wins, as it did with the old scan.
+ */
+typedef struct UDTRecord {
+    int xpix;
+    int ypix;
+    int seq;
+    double height;
+} UDTRecord;
+
+static int UDTCompare(const void *a, const void *b)
+{
+    const UDTRecord *p=(const UDTRecord *)a;
+    const UDTRecord *q=(const UDTRecord *)b;
+
+    if (p->xpix!=q->xpix)
+        return (p->xpix<q->xpix ? -1 : 1);
+
+    if (p->ypix!=q->ypix)
+        return (p->ypix<q->ypix ? -1 : 1);
+
+    return (p->seq<q->seq ? -1 : 1);
+}
+
 /* Reads a file containing User-Defined Terrain features for their
- * addition to the digital elevation model data used by SPLAT!. 
- * Elevations in the UDT file are evaluated and then copied into a
- * temporary file under /tmp. Then the contents of the temp file are
- * scanned, and if found to be unique, are added to the ground
+ * addition to the digital elevation model data used by SPLAT!.
+ * The features are parsed into pixel-space records, sorted, and the
+ * surviving entry for each unique pixel is added to the ground
  * elevations described by the digital elevation data already loaded
- * into memory.
- *
- * Doesn't currently work on Windows, primiarly because of the use
- * of mkstemp.
+ * into memory. (This used to stage the records through a temp file
+ * under /tmp and de-duplicate them with a quadratic rescan of that
+ * file, which took minutes on large clutter sets -- and kept the
+ * function off Windows, because of mkstemp.)
  */
 void LoadUDT(char *filename)
 {
-    int	i, x, y, z, ypix, xpix, tempxpix, tempypix, fd=0;
-    char	input[MAX_LINE_LEN], str[3][MAX_LINE_LEN], tempname[15], *pointer=NULL;
-    double	latitude, longitude, height, tempheight;
-    FILE	*fd1=NULL, *fd2=NULL;
-
-    strcpy(tempname,"/tmp/XXXXXX\0");
+    int	i, x, y, z, n=0, size=0;
+    char	input[MAX_LINE_LEN], str[3][MAX_LINE_LEN], *pointer=NULL;
+    double	latitude, longitude, height;
+    UDTRecord	*records=NULL;
+    FILE	*fd1=NULL;
 
     fd1=fopen(filename,"r");
 
     if (fd1!=NULL)
     {
-        fd=mkstemp(tempname);
-        fd2=fopen(tempname,"w");
-
         fgets(input,MAX_LINE_LEN,fd1);
 
         pointer=strchr(input,';');
@@ -2787,7 +4155,20 @@ void LoadUDT(char *filename)
             }
 
             if (height>0.0)
-                fprintf(fd2,"%d, %d, %f\n",(int)rint(latitude/dpp), (int)rint(longitude/dpp), height);
+            {
+                if (n==size)
+                {
+                    size=(size==0?256:size*2);
+                    records=(UDTRecord *)realloc(records,size*sizeof(UDTRecord));
+                    assert(records!=NULL);
+                }
+
+                records[n].xpix=(int)rint(latitude/dpp);
+                records[n].ypix=(int)rint(longitude/dpp);
+                records[n].seq=n;
+                records[n].height=height;
+                n++;
+            }
 
             fgets(input,MAX_LINE_LEN,fd1);
 
@@ -2798,65 +4179,140 @@ void LoadUDT(char *filename)
         }
 
         fclose(fd1);
-        fclose(fd2);
-        close(fd);
 
         fprintf(stdout,"Done!");
         fflush(stdout);
 
-        fd1=fopen(tempname,"r");
-        fd2=fopen(tempname,"r");
-
-        y=0;
+        /* Sort the records by pixel, and add the last-read entry for
+           each unique pixel to the terrain. */
 
-        fscanf(fd1,"%d, %d, %lf", &xpix, &ypix, &height);
+        qsort(records,n,sizeof(UDTRecord),UDTCompare);
 
-        do
+        for (x=0; x<n; x=z)
         {
-            x=0;
-            z=0;
+            for (z=x+1; z<n && records[z].xpix==records[x].xpix && records[z].ypix==records[x].ypix; z++);
 
-            fscanf(fd2,"%d, %d, %lf", &tempxpix, &tempypix, &tempheight);
+            AddElevation(records[x].xpix*dpp, records[x].ypix*dpp, records[z-1].height);
+        }
 
-            do
-            {
-                if (x>y && xpix==tempxpix && ypix==tempypix)
-                {
-                    z=1;  /* Dupe! */
+        free(records);
+    }
 
-                    if (tempheight>height)
-                        height=tempheight;
-                }
+    else
+        fprintf(stderr,"\n*** ERROR: \"%s\": not found!",filename);
 
-                else
-                {
-                    fscanf(fd2,"%d, %d, %lf", &tempxpix, &tempypix, &tempheight);
-                    x++;
-                }
+    fprintf(stdout,"\n");
+}
+
+/* ORs a mask bit along the great circle between source and destination.
+ * Same sampler as ReadPath() -- identical sample positions, so overlays
+ * land on exactly the same pixels -- but without building the Path
+ * arrays or fetching an elevation per sample, neither of which line
+ * drawing needs. A county-level boundary set is tens of thousands of
+ * tiny segments, and the old route through AllocatePath()/ReadPath()
+ * paid a heap allocation and a full terrain lookup per sample for every
+ * one of them.
+ */
+static void RasterLine(const Site &source, const Site &destination, int value)
+{
+    int	c, arysize;
+    double	azimuth, distance, lat1, lon1, beta, num,
+            lat2, lon2, total_distance, dx, dy, path_length,
+            miles_per_sample, samples_per_radian=68755.0;
+    double	sin_lat1, cos_lat1, sin_az, cos_az, sin_lat2,
+            step, sin_step, cos_step, sin_beta, cos_beta;
+
+    arysize=appArraySize[appmode][maxpagesides-1];
+
+    lat1=source.lat*DEG2RAD;
+    lon1=source.lon*DEG2RAD;
 
-            } while (feof(fd2)==0 && z==0);
+    lat2=destination.lat*DEG2RAD;
+    lon2=destination.lon*DEG2RAD;
 
-            if (z==0)  /* No duplicate found */
-                AddElevation(xpix*dpp, ypix*dpp, height);
+    if (ppd==1200.0)
+        samples_per_radian=68755.0;
 
-            fscanf(fd1,"%d, %d, %lf", &xpix, &ypix, &height);
-            y++;
+    if (ppd==3600.0)
+        samples_per_radian=206265.0;
 
-            rewind(fd2);
+    azimuth=Azimuth(source,destination)*DEG2RAD;
 
-        } while (feof(fd1)==0);
+    total_distance=Distance(source,destination);
 
-        fclose(fd1);
-        fclose(fd2);
-        unlink(tempname);
+    if (total_distance>(30.0/ppd))		/* > 0.5 pixel distance */
+    {
+        dx=samples_per_radian*acos(cos(lon1-lon2));
+        dy=samples_per_radian*acos(cos(lat1-lat2));
+
+        path_length=sqrt((dx*dx)+(dy*dy));		/* Total number of samples */
+
+        miles_per_sample=total_distance/path_length;	/* Miles per sample */
     }
 
     else
-        fprintf(stderr,"\n*** ERROR: \"%s\": not found!",filename);
+    {
+        miles_per_sample=0.0;
+        total_distance=0.0;
+    }
 
-    fprintf(stdout,"\n");
+    sin_lat1=sin(lat1);
+    cos_lat1=cos(lat1);
+    sin_az=sin(azimuth);
+    cos_az=cos(azimuth);
+
+    step=miles_per_sample/3959.0;
+    sin_step=sin(step);
+    cos_step=cos(step);
+    sin_beta=0.0;
+    cos_beta=1.0;
+
+    for (distance=0.0, c=0; (total_distance!=0.0 && distance<=total_distance && c<arysize); c++, distance=miles_per_sample*(double)c)
+    {
+        if ((c&255)==0)
+        {
+            beta=distance/3959.0;
+            sin_beta=sin(beta);
+            cos_beta=cos(beta);
+        }
+
+        sin_lat2=sin_lat1*cos_beta+cos_az*sin_beta*cos_lat1;
+
+        if (sin_lat2>1.0)
+            sin_lat2=1.0;
+
+        if (sin_lat2<-1.0)
+            sin_lat2=-1.0;
+
+        lat2=asin(sin_lat2);
+        lon2=lon1-atan2(sin_az*sin_beta*cos_lat1,cos_beta-(sin_lat1*sin_lat2));
+
+        if (lon2<0.0)
+        {
+            while (lon2<0.0)
+                lon2+=TWOPI;
+        }
+
+        if (lon2>TWOPI)
+        {
+            while (lon2>TWOPI)
+                lon2-=TWOPI;
+        }
+
+        OrMask(lat2/DEG2RAD,lon2/DEG2RAD,value);
+
+        /* Advance beta by one sample spacing */
+
+        num=cos_beta*cos_step-sin_beta*sin_step;
+        sin_beta=sin_beta*cos_step+cos_beta*sin_step;
+        cos_beta=num;
+    }
+
+    /* Make sure the exact destination point is marked */
+
+    if (c<arysize)
+        OrMask(destination.lat,destination.lon,value);
 }
-#endif
 
 /* Reads Cartographic Boundary Files available from the U.S. Census Bureau,
  * and plots the data contained in those files on the map images generated
@@ -2865,7 +4321,6 @@ void LoadUDT(char *filename)
  */
 void LoadBoundaries(char *filename)
 {
-    int	x;
     double	lat0, lon0, lat1, lon1;
     char	buf[MAX_LINE_LEN];
     Site    source, destination;
@@ -2895,17 +4350,7 @@ void LoadBoundaries(char *filename)
                 destination.lat=lat1;
                 destination.lon=(lon1>0.0 ? 360.0-lon1 : -lon1);
 
-                Path *path = AllocatePath();
-                if (!path) {
-                    fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
-                    return;
-                }
-                ReadPath(source,destination,path);
-
-                for (x=0; x<path->length; x++)
-                    OrMask(path->lat[x],path->lon[x],4);
-
-                DestroyPath(path);
+                RasterLine(source,destination,4);
 
                 lat0=lat1;
                 lon0=lon1;
@@ -2957,7 +4402,7 @@ char LoadLRP(Site txsite, char forced_read)
 
     for (int i = 0; i < ANTENNA_RADIALS; ++i) {
         for (int j = 0; j < ANTENNA_ANGLES; ++j) {
-            LR.antenna_pattern[i][j] = NO_ANTENNA_DATA;
+            LR.antenna_pattern[i][j] = 0.0f;
         }
     }
 
@@ -3195,20 +4640,23 @@ char LoadLRP(Site txsite, char forced_read)
  * location are stored by setting bit 1 in the mask[][] array, which
  * are displayed in green when PPM maps are later generated by SPLAT!.
  */
-int PlotPath(Site source, Site destination, char mask_value)
+int PlotPath(const Site &source, const Site &destination, char mask_value)
 {
     char block;
     int x, y;
     double cos_xmtr_angle, cos_test_angle, test_alt;
     double distance, rx_alt, tx_alt;
 
-    Path *path = AllocatePath();
+    Path *path = GetThreadPath();
     if (!path) {
         fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
         return -1;
     }
     ReadPath(source,destination,path);
 
+    threadStats.s.paths++;
+    threadStats.s.path_samples += path->length;
+
     for (y=0; y<path->length; y++)
     {
         /* Test this point only if it hasn't been already
@@ -3258,19 +4706,173 @@ int PlotPath(Site source, Site destination, char mask_value)
         }
     }
 
-    DestroyPath(path);
     return 0;
 }
 
+/* Binary variant of the alphanumeric (.ano) output format, selected by
+ * giving the -ano file a ".bano" suffix. The text format costs a snprintf()
+ * per computed point and hundreds of MB of ASCII on HD maps; the binary form
+ * stores the same fields as fixed-width native-endian records behind a magic
+ * header that LoadANO() recognizes on input.
+ */
+
+#define ANO_MAGIC   0x4F4E4142u     /* reads as "BANO" on little-endian disk */
+#define ANO_VERSION 1
+#define ANO_BUFRECS 4096
+
+typedef struct AnoHeader {
+    unsigned int magic;
+    unsigned int version;
+    int max_west;
+    int min_west;
+    int max_north;
+    int min_north;
+} AnoHeader;
+
+typedef struct AnoRecord {
+    double lat;
+    double lon;
+    float azimuth;
+    float elevation;
+    float value;            /* path loss, dBm or field strength, as in the text format */
+    unsigned char block;    /* nonzero if the path is obstructed ("*" in the text format) */
+    unsigned char pad[3];
+} AnoRecord;
+
+/* A ".bano" suffix on the -ano filename selects the binary record format. */
+int AnoIsBinary(const char *filename)
+{
+    size_t len=strlen(filename);
+
+    return (len>5 && strcmp(filename+len-5,".bano")==0);
+}
+
+/* Buffered asynchronous writer for binary .ano files. PlotLRPath() runs on
+ * many workers at once, and funneling every point's formatted text through
+ * one FILE* serializes the hot loop behind the stdio lock. Here each worker
+ * appends records to a private buffer and only takes the writer lock once
+ * every ANO_BUFRECS records, handing the full buffer to a single writer
+ * thread that streams buffers to disk in arrival order. Like the other
+ * per-thread plot scratch, buffers are found through thread-local pointers;
+ * the generation count parks pointers left over from an earlier writer.
+ */
+class AnoWriter {
+public:
+    AnoWriter(FILE *fd) : m_fd(fd), m_exit(false) {
+        s_gen++;
+        m_writer = std::thread(&AnoWriter::writeLoop, this);
+    }
+
+    ~AnoWriter() {
+        close();
+    }
+
+    /* Append one record; called from the worker threads. */
+    void write(const AnoRecord &rec) {
+        Buf *b = t_buf;
+
+        if (t_gen != s_gen || b == NULL)
+            b = newBuf();
+
+        b->recs[b->n++] = rec;
+
+        if (b->n == ANO_BUFRECS) {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_live.erase(b);
+            m_full.push_back(b);
+            t_buf = NULL;
+            m_cv.notify_one();
+        }
+    }
+
+    /* Flush everything and retire the writer thread. Call only after the
+       workers have drained; the partial per-thread buffers are collected
+       here. */
+    void close() {
+        if (!m_writer.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+
+            for (std::set<Buf*>::iterator it = m_live.begin(); it != m_live.end(); ++it)
+                m_full.push_back(*it);
+
+            m_live.clear();
+            m_exit = true;
+            m_cv.notify_one();
+        }
+
+        m_writer.join();
+    }
+
+private:
+    struct Buf {
+        AnoRecord recs[ANO_BUFRECS];
+        int n;
+    };
+
+    FILE *m_fd;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Buf*> m_full;
+    std::set<Buf*> m_live;      /* partially filled buffers still owned by workers */
+    std::thread m_writer;
+    bool m_exit;
+
+    static thread_local Buf *t_buf;
+    static thread_local int t_gen;
+    static int s_gen;
+
+    Buf *newBuf() {
+        Buf *b = (Buf *)malloc(sizeof(Buf));
+        assert(b != NULL);
+        b->n = 0;
+
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_live.insert(b);
+        t_buf = b;
+        t_gen = s_gen;
+        return b;
+    }
+
+    void writeLoop() {
+        std::unique_lock<std::mutex> ul(m_mutex);
+
+        while (!m_exit || !m_full.empty()) {
+            if (m_full.empty()) {
+                m_cv.wait(ul);
+                continue;
+            }
+
+            Buf *b = m_full.front();
+            m_full.pop_front();
+
+            ul.unlock();
+            if (b->n > 0)
+                fwrite(b->recs, sizeof(AnoRecord), b->n, m_fd);
+            free(b);
+            ul.lock();
+        }
+    }
+
+    AnoWriter(const AnoWriter&) = delete;
+    void operator=(const AnoWriter&) = delete;
+};
+
+thread_local AnoWriter::Buf *AnoWriter::t_buf = NULL;
+thread_local int AnoWriter::t_gen = 0;
+int AnoWriter::s_gen = 0;
+
 /* Plots the RF path loss between source and destination points based on the
  * ITM/ITWOM propagation model, taking into account antenna pattern data if
  * available.
  */
-int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd)
+int PlotLRPath(const Site &source, const Site &destination, unsigned char mask_value, FILE *fd, AnoWriter *bw)
 {
     int	x, y, ifs, ofs, errnum;
     char	block=0, strmode[100];
-    double	loss, azimuth, pattern=0.0, xmtr_alt,
+    double	loss, azimuth, xmtr_alt,
             dest_alt, xmtr_alt2, dest_alt2, cos_rcvr_angle,
             cos_test_angle=0.0, test_alt, elevation=0.0,
             distance=0.0, four_thirds_earth, rxp, dBm,
@@ -3279,20 +4881,24 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
     Site temp;
     char textout[MAX_LINE_LEN];
     size_t textlen = 0;
+    AnoRecord rec;
 
-    Path *path = AllocatePath();
+    Path *path = GetThreadPath();
     if (!path) {
         fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
         return -1;
     }
     ReadPath(source,destination,path);
 
-    /* XXX debug */
-    totalpaths++;
-    UPDATE_RUNNING_AVG(avgpathlen, path->length, totalpaths);
+    threadStats.s.paths++;
+    threadStats.s.path_samples += path->length;
 
     /* XXX why +10? should it just be +2? Better yet, path->length+2? */
-    elev_t *elev = (elev_t*)calloc(path->arysize + 10, sizeof(elev_t));
+    elev_t *elev = GetThreadElev(path->arysize + 10);
+    if (!elev) {
+        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for elevation profile");
+        return -1;
+    }
 
     four_thirds_earth=FOUR_THIRDS*EARTHRADIUS;
 
@@ -3306,6 +4912,15 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
     elev[2]=(elev_t)(path->elevation[0]*METERS_PER_FOOT);
     elev[path->length+1]=(elev_t)(path->elevation[path->length-1]*METERS_PER_FOOT);
 
+    /* Capture the per-path invariants (quantiles, model scratch storage) once
+       rather than on every point_to_point call along the path. */
+
+    p2p_sweep_state sweep;
+    point_to_point_sweep_init(&sweep,source.alt*METERS_PER_FOOT,
+                              destination.alt*METERS_PER_FOOT, LR.eps_dielect,
+                              LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
+                              LR.radio_climate, LR.pol, LR.conf, LR.rel);
+
     /* Since the only energy the propagation model considers
        reaching the destination is based on what is scattered
        or deflected from the first obstruction along the path,
@@ -3318,8 +4933,13 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
 
     for (y=2; (y<(path->length-1) && path->distance[y]<=max_range); y++)
     {
-        /* Process this point only if it
-           has not already been processed. */
+        /* Process this point only if it has not already been
+           processed. Two concurrent rays can both pass this test for
+           the same pixel and duplicate the model work -- the ownership
+           bits go in only after the signal below, so a pixel is never
+           skipped on the strength of a half-finished neighbor -- but
+           both compute identical values, so the overlap costs time,
+           not correctness. */
 
         if ((GetMask(path->lat[y],path->lon[y])&248)!=(mask_value<<3))
         {
@@ -3408,17 +5028,12 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
             elev[1]=(elev_t)(METERS_PER_MILE*(path->distance[y]-path->distance[y-1]));
 
             if (itwom)
-                point_to_point(elev,source.alt*METERS_PER_FOOT,
-                               destination.alt*METERS_PER_FOOT, LR.eps_dielect,
-                               LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
-                               LR.radio_climate, LR.pol, LR.conf, LR.rel, &loss,
-                               strmode, &errnum);
+                point_to_point_sweep(&sweep,elev,&loss,strmode,&errnum);
             else
-                point_to_point_ITM(elev,source.alt*METERS_PER_FOOT, 
-                                   destination.alt*METERS_PER_FOOT, LR.eps_dielect,
-                                   LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
-                                   LR.radio_climate, LR.pol, LR.conf, LR.rel, &loss,
-                                   strmode, &errnum);
+                point_to_point_ITM_sweep(&sweep,elev,&loss,strmode,&errnum);
+
+            threadStats.s.p2p_calls++;
+            threadStats.s.p2p_points += y-1;
 
             temp.lat=path->lat[y];
             temp.lon=path->lon[y];
@@ -3426,8 +5041,16 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
             azimuth=(Azimuth(source,temp));
 
             if (fd!=NULL) {
-                textlen = snprintf(textout, MAX_LINE_LEN, "%.7f, %.7f, %.3f, %.3f, ",
-                                   path->lat[y], path->lon[y], azimuth, elevation);
+                if (bw!=NULL) {
+                    memset(&rec,0,sizeof(rec));
+                    rec.lat=path->lat[y];
+                    rec.lon=path->lon[y];
+                    rec.azimuth=(float)azimuth;
+                    rec.elevation=(float)elevation;
+                } else {
+                    textlen = snprintf(textout, MAX_LINE_LEN, "%.7f, %.7f, %.3f, %.3f, ",
+                                       path->lat[y], path->lon[y], azimuth, elevation);
+                }
             }
 
             /* If ERP==0, write path loss to alphanumeric
@@ -3435,11 +5058,14 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
                or received power level (below), as appropriate. */
 
             if (fd!=NULL && LR.erp==0.0) {
-                textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.2f",loss);
+                if (bw!=NULL)
+                    rec.value=(float)loss;
+                else
+                    textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.2f",loss);
             }
 
-            /* Integrate the antenna's radiation
-               pattern into the overall path loss. */
+            /* Integrate the antenna's radiation pattern (already in dB;
+               see LoadPAT()) into the overall path loss. */
 
             x=(int)rint(10.0*(10.0-elevation));
 
@@ -3447,14 +5073,7 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
             {
                 azimuth=rint(azimuth);
 
-                pattern=(double)LR.antenna_pattern[(int)azimuth][x];
-
-                if (pattern > 0.0) {
-                    pattern=20.0*log10(pattern);
-                    loss-=pattern;
-                } else if (pattern != NO_ANTENNA_DATA) {
-                    loss-=9999;
-                }
+                loss-=(double)LR.antenna_pattern[(int)azimuth][x];
             }
 
             if (LR.erp!=0.0)
@@ -3468,7 +5087,10 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
                     dBm=10.0*(log10(rxp*1000.0));
 
                     if (fd!=NULL) {
-                        textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.3f",dBm);
+                        if (bw!=NULL)
+                            rec.value=(float)dBm;
+                        else
+                            textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.3f",dBm);
                     }
 
                     /* Scale roughly between 0 and 255 */
@@ -3510,7 +5132,10 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
                     PutSignal(path->lat[y],path->lon[y],(unsigned char)ifs);
 
                     if (fd!=NULL) {
-                        textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.3f",field_strength);
+                        if (bw!=NULL)
+                            rec.value=(float)field_strength;
+                        else
+                            textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.3f",field_strength);
                     }
                 }
             }
@@ -3531,39 +5156,53 @@ int PlotLRPath(Site source, Site destination, unsigned char mask_value, FILE *fd
             }
 
             if (fd!=NULL) {
-                textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%s",
-                                    block ? " *\n" : "\n");
+                if (bw!=NULL) {
+                    rec.block=(unsigned char)(block?1:0);
+                    bw->write(rec);
+                } else {
+                    textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%s",
+                                        block ? " *\n" : "\n");
+                    fwrite(textout, 1, textlen, fd);
+                }
             }
 
-            fwrite(textout, 1, textlen, fd);
-
             /* Mark this point as having been analyzed */
 
             PutMask(path->lat[y],path->lon[y],(GetMask(path->lat[y],path->lon[y])&7)+(mask_value<<3));
         }
     }
 
-    free(elev);
-    DestroyPath(path);
+    point_to_point_sweep_done(&sweep);
 
     return 0;
 }
 
 
+/* Per-run mask ownership counters: PlotLOSMap() walks its OR-bit
+ * progression (1, 8, 16, 32) across successive transmitters, and the
+ * two -L engines share a sequential site id stored in the top five
+ * mask bits. File scope (rather than function statics) so daemon mode
+ * can reset them between jobs.
+ */
+static unsigned char losMaskValue=1;
+static unsigned char lrMaskValue=1;
+
 /* Performs a 360 degree sweep around the transmitter site (source location), and
  * plots the line-of-sight coverage of the transmitter on the SPLAT! generated
  * topographic map based on a receiver located at the specified altitude (in feet
  * AGL). Results are stored in memory, and written out in the form of a topographic
  * map when the WriteImage() function is later invoked.
  */
-void PlotLOSMap(Site source, double altitude, bool multithread)
+void PlotLOSMap(Site source, double altitude, WorkQueue &wq, bool multithread)
 {
     int y, z, count;
     Site edge;
     unsigned char x;
     double lat, lon, minwest, maxnorth, th;
-    static unsigned char mask_value=1;
     char symbol[4] = {'.', 'o', 'O', 'o' };
+    double stats_t0=StatsSeconds();
+
+    DEMCacheNewPhase();
 
     minwest=dpp+(double)min_west;
     maxnorth=(double)max_north-dpp;
@@ -3587,193 +5226,347 @@ void PlotLOSMap(Site source, double altitude, bool multithread)
 
     fprintf(stdout, "\n\n");
 
-    WorkQueue wq;
+    if (multithread)
+    {
+        int n[4];
+        std::atomic<int> rays(0);
+        std::atomic<int> *done=&rays;
 
-    if (verbose) {
-        if (multithread) {
+        /* Size the four map edges up front so that each one can be
+           handed to the workers as a single range rather than as one
+           queued job (and two copied Site structures) per pixel. */
+
+        for (n[0]=0; LonDiff(minwest+(dpp*(double)n[0]),(double)max_west)<=0.0; n[0]++);
+        for (n[1]=0; maxnorth-(dpp*(double)n[1])>=(double)min_north; n[1]++);
+        n[2]=n[0];
+        for (n[3]=0; (double)min_north+(dpp*(double)n[3])<(double)max_north; n[3]++);
+
+        /* The four edges are processed concurrently, so the sequential
+           "quarter" banners no longer apply. Progress is reported by the
+           workers themselves: one symbol for every z rays completed,
+           about 256 across the whole sweep. */
+
+        z=(n[0]+n[1]+n[2]+n[3])/256;
+
+        if (z<1)
+            z=1;
+
+        if (verbose) {
             fprintf(stdout,"Using %d threads...\n\n", wq.maxWorkers());
+            fprintf(stdout," 0%c to 100%c ",37,37);
+            fflush(stdout);
         }
-        fprintf(stdout," 0%c to  25%c ",37,37);
-        fflush(stdout);
-    }
 
-    for (lon=minwest, x=0, y=0; (LonDiff(lon,(double)max_west)<=0.0); y++, lon=minwest+(dpp*(double)y))
-    {
-        if (lon>=360.0)
-            lon-=360.0;
+        wq.submitRange(0, n[0], [=](int i) {
+            double lon=minwest+(dpp*(double)i);
 
-        edge.lat=max_north;
-        edge.lon=lon;
-        edge.alt=altitude;
+            if (lon>=360.0)
+                lon-=360.0;
 
-        if (multithread) {
-            wq.submit(std::bind(PlotPath, source, edge, mask_value));
-        } else {
-            PlotPath(source,edge,mask_value);
-        }
+            Site edge;
+            edge.lat=max_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-        if (verbose) {
-            if (++count==z) 
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+            PlotPath(source,edge,losMaskValue);
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+            if (verbose) {
+                int c=++(*done);
+
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
             }
-        }
-    }
+        });
 
-    if (verbose) {
-        count=0;
-        fprintf(stdout,"\n25%c to  50%c ",37,37);
-        fflush(stdout);
-    }
+        wq.submitRange(0, n[1], [=](int i) {
+            Site edge;
+            edge.lat=maxnorth-(dpp*(double)i);
+            edge.lon=min_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-    z=(int)(th*(double)(max_north-min_north));
+            PlotPath(source,edge,losMaskValue);
 
-    for (lat=maxnorth, x=0, y=0; lat>=(double)min_north; y++, lat=maxnorth-(dpp*(double)y))
-    {
-        edge.lat=lat;
-        edge.lon=min_west;
-        edge.alt=altitude;
+            if (verbose) {
+                int c=++(*done);
 
-        if (multithread) {
-            wq.submit(std::bind(PlotPath, source, edge, mask_value));
-        } else {
-            PlotPath(source,edge,mask_value);
-        }
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
+            }
+        });
 
-        if (verbose) {
-            if (++count==z) 
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+        wq.submitRange(0, n[2], [=](int i) {
+            double lon=minwest+(dpp*(double)i);
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+            if (lon>=360.0)
+                lon-=360.0;
+
+            Site edge;
+            edge.lat=min_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
+
+            PlotPath(source,edge,losMaskValue);
+
+            if (verbose) {
+                int c=++(*done);
+
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
             }
-        }
-    }
+        });
 
-    if (verbose) {
-        count=0;
-        fprintf(stdout,"\n50%c to  75%c ",37,37);
-        fflush(stdout);
-    }
+        wq.submitRange(0, n[3], [=](int i) {
+            Site edge;
+            edge.lat=(double)min_north+(dpp*(double)i);
+            edge.lon=max_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-    z=(int)(th*ReduceAngle(max_west-min_west));
+            PlotPath(source,edge,losMaskValue);
+
+            if (verbose) {
+                int c=++(*done);
+
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
+            }
+        });
+
+        wq.drain();
+    }
 
-    for (lon=minwest, x=0, y=0; (LonDiff(lon,(double)max_west)<=0.0); y++, lon=minwest+(dpp*(double)y))
+    else
     {
-        if (lon>=360.0)
-            lon-=360.0;
+        if (verbose) {
+            fprintf(stdout," 0%c to  25%c ",37,37);
+            fflush(stdout);
+        }
+
+        for (lon=minwest, x=0, y=0; (LonDiff(lon,(double)max_west)<=0.0); y++, lon=minwest+(dpp*(double)y))
+        {
+            if (lon>=360.0)
+                lon-=360.0;
 
-        edge.lat=min_north;
-        edge.lon=lon;
-        edge.alt=altitude;
+            edge.lat=max_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-        if (multithread) {
-            wq.submit(std::bind(PlotPath, source, edge, mask_value));
-        } else {
-            PlotPath(source,edge,mask_value);
+            PlotPath(source,edge,losMaskValue);
+
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
+
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
+            }
         }
 
         if (verbose) {
-            if (++count==z)
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+            count=0;
+            fprintf(stdout,"\n25%c to  50%c ",37,37);
+            fflush(stdout);
+        }
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+        z=(int)(th*(double)(max_north-min_north));
+
+        for (lat=maxnorth, x=0, y=0; lat>=(double)min_north; y++, lat=maxnorth-(dpp*(double)y))
+        {
+            edge.lat=lat;
+            edge.lon=min_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
+
+            PlotPath(source,edge,losMaskValue);
+
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
+
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
             }
         }
-    }
 
-    if (verbose) {
-        count=0;
-        fprintf(stdout,"\n75%c to 100%c ",37,37);
-        fflush(stdout);
-    }
+        if (verbose) {
+            count=0;
+            fprintf(stdout,"\n50%c to  75%c ",37,37);
+            fflush(stdout);
+        }
 
-    z=(int)(th*(double)(max_north-min_north));
+        z=(int)(th*ReduceAngle(max_west-min_west));
 
-    for (lat=(double)min_north, x=0, y=0; lat<(double)max_north; y++, lat=(double)min_north+(dpp*(double)y))
-    {
-        edge.lat=lat;
-        edge.lon=max_west;
-        edge.alt=altitude;
+        for (lon=minwest, x=0, y=0; (LonDiff(lon,(double)max_west)<=0.0); y++, lon=minwest+(dpp*(double)y))
+        {
+            if (lon>=360.0)
+                lon-=360.0;
 
-        if (multithread) {
-            wq.submit(std::bind(PlotPath, source, edge, mask_value));
-        } else {
-            PlotPath(source,edge,mask_value);
+            edge.lat=min_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
+
+            PlotPath(source,edge,losMaskValue);
+
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
+
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
+            }
         }
 
         if (verbose) {
-            if (++count==z)
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+            count=0;
+            fprintf(stdout,"\n75%c to 100%c ",37,37);
+            fflush(stdout);
+        }
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+        z=(int)(th*(double)(max_north-min_north));
+
+        for (lat=(double)min_north, x=0, y=0; lat<(double)max_north; y++, lat=(double)min_north+(dpp*(double)y))
+        {
+            edge.lat=lat;
+            edge.lon=max_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
+
+            PlotPath(source,edge,losMaskValue);
+
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
+
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
             }
         }
     }
 
-    wq.waitForCompletion();
-
     if (verbose) {
         fprintf(stdout,"\nDone!\n");
         fflush(stdout);
     }
 
+    threadStats.s.plot_s += StatsSeconds()-stats_t0;
+
     /* Assign next mask value */
 
-    switch (mask_value)
+    switch (losMaskValue)
     {
         case 1:
-            mask_value=8;
+            losMaskValue=8;
             break;
 
         case 8:
-            mask_value=16;
+            losMaskValue=16;
             break;
 
         case 16:
-            mask_value=32;
+            losMaskValue=32;
     }
 }
 
-/* Performs a 360 degree sweep around the transmitter site (source location),
- * and plots the ITM/ITWOM attenuation on the SPLAT! generated topographic map
+/* Shard support (-shard i/n) for spreading one -L region across several
+ * machines. The boundary sweep shoots one independent ray per perimeter
+ * pixel, so shard i of n simply computes the i-th contiguous slice of
+ * the perimeter -- roughly a wedge of the map -- against the full
+ * region bounds, and saves its planes as an ordinary -ckpt grid.
+ * -mergegrids folds any number of such grids back together before the
+ * output stages run once over the union. Zero (the default) means no
+ * sharding. File scope so daemon mode can reset them between jobs.
+ */
+static int shardIndex=0;
+static int shardCount=0;
+
+/* Clips edge e's ray indices [0,n[e]) to this shard's slice of the
+ * whole perimeter: the four edge ranges are treated as one concatenated
+ * index space and divided into shardCount near-equal pieces. With
+ * sharding off the edge is returned whole.
+ */
+static void ShardEdgeRange(int n[4], int e, int *lo, int *hi)
+{
+    int i;
+    long long total=0, base=0, start, end;
+
+    *lo=0;
+    *hi=n[e];
+
+    if (shardCount<2)
+        return;
+
+    for (i=0; i<4; i++)
+        total+=n[i];
+
+    for (i=0; i<e; i++)
+        base+=n[i];
+
+    start=(((long long)(shardIndex-1)*total)/shardCount)-base;
+    end=(((long long)shardIndex*total)/shardCount)-base;
+
+    if (start>0)
+        *lo=(start>n[e]?n[e]:(int)start);
+
+    if (end<n[e])
+        *hi=(end<0?0:(int)end);
+}
+
+/* Performs a 360 degree sweep around the transmitter site (source location),
+ * and plots the ITM/ITWOM attenuation on the SPLAT! generated topographic map
  * based on a receiver located at the specified altitude (in feet AGL).  Results
  * are stored in memory, and written out in the form of a topographic map when
  * the WriteImageLR() or WriteImageSS() functions are later invoked.
  */
-void PlotLRMap(Site source, double altitude, char *plo_filename, bool multithread)
+void PlotLRMap(Site source, double altitude, char *plo_filename, WorkQueue &wq, bool multithread)
 {
     int y, z, count;
+    int n[4], elo[4], ehi[4];
     Site edge;
     double lat, lon, minwest, maxnorth, th;
     unsigned char x;
-    static unsigned char mask_value=1;
     FILE *fd=NULL;
+    AnoWriter *bw=NULL;
     char symbol[4] = {'.', 'o', 'O', 'o' };
+    double stats_t0=StatsSeconds();
+
+    DEMCacheNewPhase();
 
     minwest=dpp+(double)min_west;
     maxnorth=(double)max_north-dpp;
@@ -3810,7 +5603,24 @@ void PlotLRMap(Site source, double altitude, char *plo_filename, bool multithrea
     {
         /* Write header information to output file */
 
-        fprintf(fd,"%d, %d\t; max_west, min_west\n%d, %d\t; max_north, min_north\n",max_west, min_west, max_north, min_north);
+        if (AnoIsBinary(plo_filename))
+        {
+            AnoHeader hdr;
+
+            hdr.magic=ANO_MAGIC;
+            hdr.version=ANO_VERSION;
+            hdr.max_west=max_west;
+            hdr.min_west=min_west;
+            hdr.max_north=max_north;
+            hdr.min_north=min_north;
+
+            fwrite(&hdr,sizeof(hdr),1,fd);
+
+            bw=new AnoWriter(fd);
+        }
+
+        else
+            fprintf(fd,"%d, %d\t; max_west, min_west\n%d, %d\t; max_north, min_north\n",max_west, min_west, max_north, min_north);
     }
 
     /* th=pixels/degree divided by 64 loops per
@@ -3822,1076 +5632,2849 @@ void PlotLRMap(Site source, double altitude, char *plo_filename, bool multithrea
 
     fprintf(stdout, "\n\n");
 
-    WorkQueue wq;
+    /* Size the four map edges up front: the multithread path hands each
+       one to the workers as a single range rather than as one queued
+       job (and two copied Site structures) per pixel, and a -shard run
+       clips each edge to its slice of the whole perimeter. */
 
-    if (verbose) {
-        if (multithread) {
-            fprintf(stdout,"Using %d threads...\n\n", wq.maxWorkers());
-        }
-        fprintf(stdout," 0%c to  25%c ",37,37);
-        fflush(stdout);
-    }
+    for (n[0]=0; LonDiff(minwest+(dpp*(double)n[0]),(double)max_west)<=0.0; n[0]++);
+    for (n[1]=0; maxnorth-(dpp*(double)n[1])>=(double)min_north; n[1]++);
+    n[2]=n[0];
+    for (n[3]=0; (double)min_north+(dpp*(double)n[3])<(double)max_north; n[3]++);
+
+    for (y=0; y<4; y++)
+        ShardEdgeRange(n,y,&elo[y],&ehi[y]);
 
-    for (lon=minwest, x=0, y=0; (LonDiff(lon,(double)max_west)<=0.0); y++, lon=minwest+(dpp*(double)y))
+    if (shardCount>1)
+        fprintf(stdout,"Shard %d of %d: computing %d of %d boundary rays.\n\n",
+                shardIndex,shardCount,
+                (ehi[0]-elo[0])+(ehi[1]-elo[1])+(ehi[2]-elo[2])+(ehi[3]-elo[3]),
+                n[0]+n[1]+n[2]+n[3]);
+
+    if (multithread)
     {
-        if (lon>=360.0)
-            lon-=360.0;
+        std::atomic<int> rays(0);
+        std::atomic<int> *done=&rays;
 
-        edge.lat=max_north;
-        edge.lon=lon;
-        edge.alt=altitude;
+        /* The four edges are processed concurrently, so the sequential
+           "quarter" banners no longer apply. Progress is reported by the
+           workers themselves: one symbol for every z rays completed,
+           about 256 across the whole sweep. */
 
-        if (multithread) {
-            wq.submit(std::bind(PlotLRPath, source, edge, mask_value, fd));
-        } else {
-            PlotLRPath(source,edge,mask_value,fd);
-        }
+        z=((ehi[0]-elo[0])+(ehi[1]-elo[1])+(ehi[2]-elo[2])+(ehi[3]-elo[3]))/256;
 
-        if (verbose) {
-            if (++count==z) 
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+        if (z<1)
+            z=1;
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
-            }
+        if (verbose) {
+            fprintf(stdout,"Using %d threads...\n\n", wq.maxWorkers());
+            fprintf(stdout," 0%c to 100%c ",37,37);
+            fflush(stdout);
         }
-    }
 
-    if (verbose) {
-        count=0;
-        fprintf(stdout,"\n25%c to  50%c ",37,37);
-        fflush(stdout);
-    }
+        wq.submitRange(elo[0], ehi[0], [=](int i) {
+            double lon=minwest+(dpp*(double)i);
 
-    z=(int)(th*(double)(max_north-min_north));
+            if (lon>=360.0)
+                lon-=360.0;
 
-    for (lat=maxnorth, x=0, y=0; lat>=(double)min_north; y++, lat=maxnorth-(dpp*(double)y))
-    {
-        edge.lat=lat;
-        edge.lon=min_west;
-        edge.alt=altitude;
+            Site edge;
+            edge.lat=max_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-        if (multithread) {
-            wq.submit(std::bind(PlotLRPath, source, edge, mask_value, fd));
-        } else {
-            PlotLRPath(source,edge,mask_value,fd);
-        }
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-        if (verbose) {
-            if (++count==z) 
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+            if (verbose) {
+                int c=++(*done);
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
             }
-        }
-    }
-
-    if (verbose) {
-        count=0;
-        fprintf(stdout,"\n50%c to  75%c ",37,37);
-        fflush(stdout);
-    }
-
-    z=(int)(th*ReduceAngle(max_west-min_west));
-
-    for (lon=minwest, x=0, y=0; (LonDiff(lon,(double)max_west)<=0.0); y++, lon=minwest+(dpp*(double)y))
-    {
-        if (lon>=360.0)
-            lon-=360.0;
+        });
 
-        edge.lat=min_north;
-        edge.lon=lon;
-        edge.alt=altitude;
+        wq.submitRange(elo[1], ehi[1], [=](int i) {
+            Site edge;
+            edge.lat=maxnorth-(dpp*(double)i);
+            edge.lon=min_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-        if (multithread) {
-            wq.submit(std::bind(PlotLRPath, source, edge, mask_value, fd));
-        } else {
-            PlotLRPath(source,edge,mask_value,fd);
-        }
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-        if (verbose) {
-            if (++count==z)
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+            if (verbose) {
+                int c=++(*done);
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
             }
-        }
-    }
+        });
 
-    if (verbose) {
-        count=0;
-        fprintf(stdout,"\n75%c to 100%c ",37,37);
-        fflush(stdout);
-    }
+        wq.submitRange(elo[2], ehi[2], [=](int i) {
+            double lon=minwest+(dpp*(double)i);
 
-    z=(int)(th*(double)(max_north-min_north));
+            if (lon>=360.0)
+                lon-=360.0;
 
-    for (lat=(double)min_north, x=0, y=0; lat<(double)max_north; y++, lat=(double)min_north+(dpp*(double)y))
-    {
-        edge.lat=lat;
-        edge.lon=max_west;
-        edge.alt=altitude;
+            Site edge;
+            edge.lat=min_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-        if (multithread) {
-            wq.submit(std::bind(PlotLRPath, source, edge, mask_value, fd));
-        } else {
-            PlotLRPath(source,edge,mask_value,fd);
-        }
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-        if (verbose) {
-            if (++count==z)
-            {
-                fprintf(stdout,"%c",symbol[x]);
-                fflush(stdout);
-                count=0;
+            if (verbose) {
+                int c=++(*done);
 
-                if (x==3)
-                    x=0;
-                else
-                    x++;
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
             }
-        }
-    }
+        });
 
-    wq.waitForCompletion();
+        wq.submitRange(elo[3], ehi[3], [=](int i) {
+            Site edge;
+            edge.lat=(double)min_north+(dpp*(double)i);
+            edge.lon=max_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-    if (fd!=NULL)
-        fclose(fd);
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-    if (verbose) {
-        fprintf(stdout,"\nDone!\n");
-        fprintf(stdout,"\nThere were %d paths with an average length of %d elements.\n", totalpaths, (int)avgpathlen);
-        fflush(stdout);
+            if (verbose) {
+                int c=++(*done);
+
+                if (c%z==0) {
+                    fprintf(stdout,"%c",symbol[((c/z)-1)&3]);
+                    fflush(stdout);
+                }
+            }
+        });
+
+        wq.drain();
     }
 
-    if (mask_value<30)
-        mask_value++;
-}
+    else
+    {
+        if (verbose) {
+            fprintf(stdout," 0%c to  25%c ",37,37);
+            fflush(stdout);
+        }
 
-/* Load signal-strength color values for use when plotting maps.
- */
-void LoadSignalColors(Site xmtr)
-{
-    int x, y, ok, val[4];
-    char *filename, buf[MAX_LINE_LEN], *pointer=NULL;
-    FILE *fd=NULL;
+        for (y=elo[0], x=0; y<ehi[0]; y++)
+        {
+            lon=minwest+(dpp*(double)y);
 
-    filename = copyFilename(xmtr.filename, "scf");
+            if (lon>=360.0)
+                lon-=360.0;
 
-    /* Default values */
+            edge.lat=max_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-    region.level[0]=128;
-    region.color[0][0]=255;
-    region.color[0][1]=0;
-    region.color[0][2]=0;
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-    region.level[1]=118;
-    region.color[1][0]=255;
-    region.color[1][1]=165;
-    region.color[1][2]=0;
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
 
-    region.level[2]=108;
-    region.color[2][0]=255;
-    region.color[2][1]=206;
-    region.color[2][2]=0;
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
+            }
+        }
 
-    region.level[3]=98;
-    region.color[3][0]=255;
-    region.color[3][1]=255;
-    region.color[3][2]=0;
+        if (verbose) {
+            count=0;
+            fprintf(stdout,"\n25%c to  50%c ",37,37);
+            fflush(stdout);
+        }
 
-    region.level[4]=88;
-    region.color[4][0]=184;
-    region.color[4][1]=255;
-    region.color[4][2]=0;
+        z=(int)(th*(double)(max_north-min_north));
 
-    region.level[5]=78;
-    region.color[5][0]=0;
-    region.color[5][1]=255;
-    region.color[5][2]=0;
+        for (y=elo[1], x=0; y<ehi[1]; y++)
+        {
+            lat=maxnorth-(dpp*(double)y);
 
-    region.level[6]=68;
-    region.color[6][0]=0;
-    region.color[6][1]=208;
-    region.color[6][2]=0;
+            edge.lat=lat;
+            edge.lon=min_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-    region.level[7]=58;
-    region.color[7][0]=0;
-    region.color[7][1]=196;
-    region.color[7][2]=196;
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-    region.level[8]=48;
-    region.color[8][0]=0;
-    region.color[8][1]=148;
-    region.color[8][2]=255;
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
 
-    region.level[9]=38;
-    region.color[9][0]=80;
-    region.color[9][1]=80;
-    region.color[9][2]=255;
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
+            }
+        }
 
-    region.level[10]=28;
-    region.color[10][0]=0;
-    region.color[10][1]=38;
-    region.color[10][2]=255;
+        if (verbose) {
+            count=0;
+            fprintf(stdout,"\n50%c to  75%c ",37,37);
+            fflush(stdout);
+        }
 
-    region.level[11]=18;
-    region.color[11][0]=142;
-    region.color[11][1]=63;
-    region.color[11][2]=255;
+        z=(int)(th*ReduceAngle(max_west-min_west));
 
-    region.level[12]=8;
-    region.color[12][0]=140;
-    region.color[12][1]=0;
-    region.color[12][2]=128;
+        for (y=elo[2], x=0; y<ehi[2]; y++)
+        {
+            lon=minwest+(dpp*(double)y);
 
-    region.levels=13;
+            if (lon>=360.0)
+                lon-=360.0;
 
-    fd=fopen("splat.scf","r");
+            edge.lat=min_north;
+            edge.lon=lon;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-    if (fd==NULL)
-        fd=fopen(filename,"r");
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-    if (fd==NULL)
-    {
-        fd=fopen(filename,"w");
+            if (verbose) {
+                if (++count==z)
+                {
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
 
-        fprintf(fd,"; SPLAT! Auto-generated Signal Color Definition (\"%s\") File\n",filename);
-        fprintf(fd,";\n; Format for the parameters held in this file is as follows:\n;\n");
-        fprintf(fd,";	dBuV/m: red, green, blue\n;\n");
-        fprintf(fd,"; ...where \"dBuV/m\" is the signal strength (in dBuV/m) and\n");
-        fprintf(fd,"; \"red\", \"green\", and \"blue\" are the corresponding RGB color\n");
-        fprintf(fd,"; definitions ranging from 0 to 255 for the region specified.\n");
-        fprintf(fd,";\n; The following parameters may be edited and/or expanded\n");
-        fprintf(fd,"; for future runs of SPLAT!  A total of 32 contour regions\n");
-        fprintf(fd,"; may be defined in this file.\n;\n;\n");
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
+                }
+            }
+        }
 
-        for (x=0; x<region.levels; x++)
-            fprintf(fd,"%3d: %3d, %3d, %3d\n",region.level[x], region.color[x][0], region.color[x][1], region.color[x][2]);
+        if (verbose) {
+            count=0;
+            fprintf(stdout,"\n75%c to 100%c ",37,37);
+            fflush(stdout);
+        }
 
-        fclose(fd);
-    }
-    else
-    {
-        x=0;
-        fgets(buf,MAX_LINE_LEN,fd);
+        z=(int)(th*(double)(max_north-min_north));
 
-        while (x<32 && feof(fd)==0)
+        for (y=elo[3], x=0; y<ehi[3]; y++)
         {
-            pointer=strchr(buf,';');
+            lat=(double)min_north+(dpp*(double)y);
 
-            if (pointer!=NULL)
-                *pointer=0;
+            edge.lat=lat;
+            edge.lon=max_west;
+            edge.alt=altitude;
+            edge.amsl_flag=0;   /* altitude is given in feet AGL */
 
-            ok=sscanf(buf,"%d: %d, %d, %d", &val[0], &val[1], &val[2], &val[3]);
+            PlotLRPath(source,edge,lrMaskValue,fd,bw);
 
-            if (ok==4)
-            {
-                for (y=0; y<4; y++)
+            if (verbose) {
+                if (++count==z)
                 {
-                    if (val[y]>255)
-                        val[y]=255;
+                    fprintf(stdout,"%c",symbol[x]);
+                    fflush(stdout);
+                    count=0;
 
-                    if (val[y]<0)
-                        val[y]=0;
+                    if (x==3)
+                        x=0;
+                    else
+                        x++;
                 }
-
-                region.level[x]=val[0];
-                region.color[x][0]=val[1];
-                region.color[x][1]=val[2];
-                region.color[x][2]=val[3];
-                x++;
             }
-
-            fgets(buf,MAX_LINE_LEN,fd);
         }
+    }
+
+    if (bw!=NULL)
+    {
+        bw->close();    /* the workers are drained; flush their buffers */
+        delete bw;
+    }
 
+    if (fd!=NULL)
         fclose(fd);
-        region.levels=x;
+
+    if (verbose) {
+        fprintf(stdout,"\nDone!\n");
+        fflush(stdout);
     }
 
-    free(filename);
+    threadStats.s.plot_s += StatsSeconds()-stats_t0;
+
+    if (lrMaskValue<30)
+        lrMaskValue++;
 }
 
-/* Load signal-loss color values for use when plotting maps.
+/* Per-thread propagation-model sweep state for the tiled engine. The model
+ * parameters are fixed for an entire map pass, so each worker initializes
+ * its state the first time it touches a pass and reuses it for every pixel
+ * afterwards; the generation count detects the start of a new pass (a new
+ * transmitter or receiver altitude) and forces a re-initialization.
  */
-void LoadLossColors(Site xmtr)
-{
-    int x, y, ok, val[4];
-    char *filename, buf[MAX_LINE_LEN], *pointer=NULL;
-    FILE *fd=NULL;
+typedef struct TiledSweep {
+    p2p_sweep_state sw;
+    int gen;
 
-    filename = copyFilename(xmtr.filename, "lcf");
+    TiledSweep() : gen(-1) {}
+    ~TiledSweep() {
+        if (gen>=0)
+            point_to_point_sweep_done(&sw);
+    }
+} TiledSweep;
 
-    /* Default values */
+static thread_local TiledSweep tiledSweep;
+static int tiledSweepGen=0;
 
-    region.level[0]=80;
-    region.color[0][0]=255;
-    region.color[0][1]=0;
-    region.color[0][2]=0;
+p2p_sweep_state *GetTiledSweep(const Site &source, double altitude)
+{
+    if (tiledSweep.gen!=tiledSweepGen)
+    {
+        if (tiledSweep.gen>=0)
+            point_to_point_sweep_done(&tiledSweep.sw);
 
-    region.level[1]=90;
-    region.color[1][0]=255;
-    region.color[1][1]=128;
-    region.color[1][2]=0;
+        point_to_point_sweep_init(&tiledSweep.sw,source.alt*METERS_PER_FOOT,
+                                  altitude*METERS_PER_FOOT, LR.eps_dielect,
+                                  LR.sgm_conductivity, LR.eno_ns_surfref,
+                                  LR.frq_mhz, LR.radio_climate, LR.pol,
+                                  LR.conf, LR.rel);
+        tiledSweep.gen=tiledSweepGen;
+    }
 
-    region.level[2]=100;
-    region.color[2][0]=255;
-    region.color[2][1]=165;
-    region.color[2][2]=0;
+    return &tiledSweep.sw;
+}
 
-    region.level[3]=110;
-    region.color[3][0]=255;
-    region.color[3][1]=206;
-    region.color[3][2]=0;
+/* Index of pixel offset (dx,dy) along the square ring max(|dx|,|dy|)==r,
+ * counted 0 through 8r-1 (a ring of radius zero is the single index 0).
+ */
+int RingIndex(int r, int dx, int dy)
+{
+    if (r==0)
+        return 0;
 
-    region.level[4]=120;
-    region.color[4][0]=255;
-    region.color[4][1]=255;
-    region.color[4][2]=0;
+    if (dy==r)
+        return dx+r;
 
-    region.level[5]=130;
-    region.color[5][0]=184;
-    region.color[5][1]=255;
-    region.color[5][2]=0;
+    if (dx==r)
+        return 3*r-dy;
 
-    region.level[6]=140;
-    region.color[6][0]=0;
-    region.color[6][1]=255;
-    region.color[6][2]=0;
+    if (dy==-r)
+        return 5*r-dx;
 
-    region.level[7]=150;
-    region.color[7][0]=0;
-    region.color[7][1]=208;
-    region.color[7][2]=0;
+    return 7*r+dy;
+}
 
-    region.level[8]=160;
-    region.color[8][0]=0;
-    region.color[8][1]=196;
-    region.color[8][2]=196;
+/* Alternative coverage engine for the -tiled option. PlotLRMap() shoots one
+ * ray from the transmitter to every boundary pixel, and every one of those
+ * rays re-traverses the same near-transmitter pixels: the mask guard in
+ * PlotLRPath() skips the model call for pixels that are already done, but
+ * the full spherical trigonometry of ReadPath() and the per-sample mask
+ * probes are still paid for the whole overlapping prefix of each ray.
+ *
+ * This engine instead walks the map as concentric square rings of pixels
+ * around the transmitter. Each pixel's terrain profile is formed by
+ * extending the profile of its parent -- the ring-(r-1) pixel nearest the
+ * straight line from the transmitter -- by a single elevation sample, so
+ * every pixel is profiled and modeled exactly once. The profiles are
+ * grid-walk approximations of the great-circle radials the classic engine
+ * samples, so the two engines produce close but not bit-identical maps.
+ * Ring r buffers 8r profiles of r+1 samples each, which is fine for typical
+ * ranges but grows with the square of the radius in pixels.
+ *
+ * Pixels within one ring are independent, so each ring is fanned out to the
+ * worker pool and drained before the next ring builds on its profiles.
+ */
+void PlotLRMapTiled(Site source, double altitude, char *plo_filename, WorkQueue &wq, bool multithread)
+{
+    int r, rmax, i, z;
+    double tx_lat, tx_lon, four_thirds_earth, extent, e;
+    elev_t *prev;
+    unsigned char *prevv;
+    Site temp;
+    FILE *fd=NULL;
+    AnoWriter *bw=NULL;
+    char symbol[4] = {'.', 'o', 'O', 'o' };
+    double stats_t0=StatsSeconds();
 
-    region.level[9]=170;
-    region.color[9][0]=0;
-    region.color[9][1]=148;
-    region.color[9][2]=255;
+    DEMCacheNewPhase();
 
-    region.level[10]=180;
-    region.color[10][0]=80;
-    region.color[10][1]=80;
-    region.color[10][2]=255;
+    if (itwom)
+        fprintf(stdout,"\nComputing ITWOM ");
+    else
+        fprintf(stdout,"\nComputing ITM ");
 
-    region.level[11]=190;
-    region.color[11][0]=0;
-    region.color[11][1]=38;
-    region.color[11][2]=255;
+    if (LR.erp==0.0)
+        fprintf(stdout,"path loss");
+    else
+    {
+        if (dbm)
+            fprintf(stdout,"signal power level");
+        else
+            fprintf(stdout,"field strength");
+    }
 
-    region.level[12]=200;
-    region.color[12][0]=142;
-    region.color[12][1]=63;
-    region.color[12][2]=255;
+    fprintf(stdout," contours of \"%s\"\nout to a radius of %.2f %s with an RX antenna at %.2f %s AGL\nusing the tiled sweep engine",
+            source.name, (metric?max_range*KM_PER_MILE:max_range), (metric?"kilometers":"miles"),
+            (metric?altitude*METERS_PER_FOOT:altitude),(metric?"meters":"feet"));
 
-    region.level[13]=210;
-    region.color[13][0]=196;
-    region.color[13][1]=54;
-    region.color[13][2]=255;
+    if (clutter>0.0)
+        fprintf(stdout,"\nand %.2f %s of ground clutter",
+                (metric?clutter*METERS_PER_FOOT:clutter), (metric?"meters":"feet"));
 
-    region.level[14]=220;
-    region.color[14][0]=255;
-    region.color[14][1]=0;
-    region.color[14][2]=255;
+    if (plo_filename[0]!=0)
+        fd=fopen(plo_filename,"wb");
 
-    region.level[15]=230;
-    region.color[15][0]=255;
-    region.color[15][1]=194;
-    region.color[15][2]=204;
+    if (fd!=NULL)
+    {
+        /* Write header information to output file */
 
-    region.levels=16;
+        if (AnoIsBinary(plo_filename))
+        {
+            AnoHeader hdr;
 
-    fd=fopen("splat.lcf","r");
+            hdr.magic=ANO_MAGIC;
+            hdr.version=ANO_VERSION;
+            hdr.max_west=max_west;
+            hdr.min_west=min_west;
+            hdr.max_north=max_north;
+            hdr.min_north=min_north;
 
-    if (fd==NULL)
-        fd=fopen(filename,"r");
+            fwrite(&hdr,sizeof(hdr),1,fd);
 
-    if (fd==NULL)
-    {
-        fd=fopen(filename,"w");
+            bw=new AnoWriter(fd);
+        }
 
-        fprintf(fd,"; SPLAT! Auto-generated Path-Loss Color Definition (\"%s\") File\n",filename);
-        fprintf(fd,";\n; Format for the parameters held in this file is as follows:\n;\n");
-        fprintf(fd,";	dB: red, green, blue\n;\n");
-        fprintf(fd,"; ...where \"dB\" is the path loss (in dB) and\n");
-        fprintf(fd,"; \"red\", \"green\", and \"blue\" are the corresponding RGB color\n");
-        fprintf(fd,"; definitions ranging from 0 to 255 for the region specified.\n");
-        fprintf(fd,";\n; The following parameters may be edited and/or expanded\n");
-        fprintf(fd,"; for future runs of SPLAT!  A total of 32 contour regions\n");
-        fprintf(fd,"; may be defined in this file.\n;\n;\n");
+        else
+            fprintf(fd,"%d, %d\t; max_west, min_west\n%d, %d\t; max_north, min_north\n",max_west, min_west, max_north, min_north);
+    }
 
-        for (x=0; x<region.levels; x++)
-            fprintf(fd,"%3d: %3d, %3d, %3d\n",region.level[x], region.color[x][0], region.color[x][1], region.color[x][2]);
+    fprintf(stdout, "\n\n");
 
-        fclose(fd);
-    }
+    tx_lat=source.lat;
+    tx_lon=source.lon;
+    four_thirds_earth=FOUR_THIRDS*EARTHRADIUS;
 
-    else
-    {
-        x=0;
-        fgets(buf,MAX_LINE_LEN,fd);
+    tiledSweepGen++;    /* invalidate sweep states left over from earlier passes */
 
-        while (x<32 && feof(fd)==0)
-        {
-            pointer=strchr(buf,';');
+    /* Ring radius, in pixels, needed to reach the edges of the loaded
+       region from the transmitter. Longitudes wrap, so measure them
+       with LonDiff(). */
 
-            if (pointer!=NULL)
-                *pointer=0;
+    extent=((double)max_north-tx_lat)*ppd;
 
-            ok=sscanf(buf,"%d: %d, %d, %d", &val[0], &val[1], &val[2], &val[3]);
+    e=(tx_lat-(double)min_north)*ppd;
+    if (e>extent)
+        extent=e;
 
-            if (ok==4)
-            {
-                for (y=0; y<4; y++)
-                {
-                    if (val[y]>255)
-                        val[y]=255;
+    e=LonDiff((double)max_west,tx_lon)*ppd;
+    if (e>extent)
+        extent=e;
 
-                    if (val[y]<0)
-                        val[y]=0;
-                }
+    e=LonDiff(tx_lon,(double)min_west)*ppd;
+    if (e>extent)
+        extent=e;
 
-                region.level[x]=val[0];
-                region.color[x][0]=val[1];
-                region.color[x][1]=val[2];
-                region.color[x][2]=val[3];
-                x++;
-            }
+    rmax=(int)ceil(extent);
 
-            fgets(buf,MAX_LINE_LEN,fd);
-        }
+    if (rmax<2)
+        rmax=2;
 
-        fclose(fd);
-        region.levels=x;
-    }
+    /* Seed ring zero: a single profile holding the terrain sample at the
+       transmitter itself (no clutter on an endpoint sample). */
 
-    free(filename);
-}
+    prev=(elev_t *)malloc(sizeof(elev_t));
+    prevv=(unsigned char *)malloc(1);
+    assert(prev!=NULL && prevv!=NULL);
 
-/* Load signal-strength (dBm) color values for use when plotting maps.
- */
-void LoadDBMColors(Site xmtr)
-{
-    int x, y, ok, val[4];
-    char *filename, buf[MAX_LINE_LEN], *pointer=NULL;
-    FILE *fd=NULL;
+    temp.lat=tx_lat;
+    temp.lon=tx_lon;
+    prev[0]=(elev_t)(GetElevation(temp)*METERS_PER_FOOT);
+    prevv[0]=1;
 
-    filename = copyFilename(xmtr.filename, "dcf");
+    /* One progress symbol for every z rings completed, about 256 across
+       the whole sweep. */
 
-    /* Default values */
+    z=rmax/256;
 
-    region.level[0]=0;
-    region.color[0][0]=255;
-    region.color[0][1]=0;
-    region.color[0][2]=0;
+    if (z<1)
+        z=1;
 
-    region.level[1]=-10;
-    region.color[1][0]=255;
-    region.color[1][1]=128;
-    region.color[1][2]=0;
+    if (verbose) {
+        if (multithread) {
+            fprintf(stdout,"Using %d threads...\n\n", wq.maxWorkers());
+        }
+        fprintf(stdout," 0%c to 100%c ",37,37);
+        fflush(stdout);
+    }
 
-    region.level[2]=-20;
-    region.color[2][0]=255;
-    region.color[2][1]=165;
-    region.color[2][2]=0;
+    for (r=1; r<=rmax; r++)
+    {
+        elev_t *cur=(elev_t *)malloc((size_t)(8*r)*(size_t)(r+1)*sizeof(elev_t));
+        unsigned char *curv=(unsigned char *)calloc((size_t)(8*r),1);
+        assert(cur!=NULL && curv!=NULL);
+
+        std::atomic<int> active(0);
+
+        elev_t *prv=prev;
+        unsigned char *prvv=prevv;
+        std::atomic<int> *any=&active;
+
+        auto fn=[=](int i) {
+            int dx, dy, px, py, pi, x, ifs, ofs, errnum;
+            char block=0, strmode[100];
+            double lat, lon, dist, xi, terrain, azimuth, elevation=0.0,
+                   distance, xmtr_alt, dest_alt, xmtr_alt2, dest_alt2,
+                   cos_rcvr_angle, cos_test_angle=0.0, test_alt, loss,
+                   rxp, dBm, field_strength;
+            Site pixel;
+            char textout[MAX_LINE_LEN];
+            size_t textlen=0;
+            AnoRecord rec;
+
+            if (i<=2*r) {
+                dx=i-r;
+                dy=r;
+            } else if (i<=4*r) {
+                dx=r;
+                dy=3*r-i;
+            } else if (i<=6*r) {
+                dx=5*r-i;
+                dy=-r;
+            } else {
+                dx=-r;
+                dy=i-7*r;
+            }
 
-    region.level[3]=-30;
-    region.color[3][0]=255;
-    region.color[3][1]=206;
-    region.color[3][2]=0;
+            /* Parent: this pixel scaled back onto ring r-1, which is the
+               ring pixel nearest the straight line back to the transmitter. */
 
-    region.level[4]=-40;
-    region.color[4][0]=255;
-    region.color[4][1]=255;
-    region.color[4][2]=0;
+            px=(int)rint((double)dx*(double)(r-1)/(double)r);
+            py=(int)rint((double)dy*(double)(r-1)/(double)r);
+            pi=RingIndex(r-1,px,py);
 
-    region.level[5]=-50;
-    region.color[5][0]=184;
-    region.color[5][1]=255;
-    region.color[5][2]=0;
+            if (!prvv[pi])
+                return;
 
-    region.level[6]=-60;
-    region.color[6][0]=0;
-    region.color[6][1]=255;
-    region.color[6][2]=0;
+            lat=tx_lat+((double)dy*dpp);
+            lon=tx_lon+((double)dx*dpp);
 
-    region.level[7]=-70;
-    region.color[7][0]=0;
-    region.color[7][1]=208;
-    region.color[7][2]=0;
+            if (lon<0.0)
+                lon+=360.0;
 
-    region.level[8]=-80;
-    region.color[8][0]=0;
-    region.color[8][1]=196;
-    region.color[8][2]=196;
+            if (lon>=360.0)
+                lon-=360.0;
 
-    region.level[9]=-90;
-    region.color[9][0]=0;
-    region.color[9][1]=148;
-    region.color[9][2]=255;
+            pixel.lat=lat;
+            pixel.lon=lon;
 
-    region.level[10]=-100;
-    region.color[10][0]=80;
-    region.color[10][1]=80;
-    region.color[10][2]=255;
+            dist=Distance(source,pixel);
 
-    region.level[11]=-110;
-    region.color[11][0]=0;
-    region.color[11][1]=38;
-    region.color[11][2]=255;
+            if (dist>max_range)
+                return;     /* nothing beyond this pixel is in range either */
 
-    region.level[12]=-120;
-    region.color[12][0]=142;
-    region.color[12][1]=63;
-    region.color[12][2]=255;
+            /* Extend the parent ray's profile with this pixel's terrain
+               sample. Interior samples carry clutter; the sample is only an
+               endpoint for this pixel itself, where it is excluded from the
+               model input below, exactly as in PlotLRPath(). */
 
-    region.level[13]=-130;
-    region.color[13][0]=196;
-    region.color[13][1]=54;
-    region.color[13][2]=255;
+            terrain=GetElevation(pixel);
 
-    region.level[14]=-140;
-    region.color[14][0]=255;
-    region.color[14][1]=0;
-    region.color[14][2]=255;
+            elev_t *prof=cur+(size_t)i*(size_t)(r+1);
 
-    region.level[15]=-150;
-    region.color[15][0]=255;
-    region.color[15][1]=194;
-    region.color[15][2]=204;
+            memcpy(prof,prv+(size_t)pi*(size_t)r,(size_t)r*sizeof(elev_t));
+            prof[r]=(elev_t)((terrain==0.0?terrain:terrain+clutter)*METERS_PER_FOOT);
+            curv[i]=1;
+            ++(*any);
 
-    region.levels=16;
+            if (r<2)
+                return;     /* same minimum hop count as PlotLRPath()'s y=2 start */
 
-    fd=fopen("splat.dcf","r");
+            if (lat<(double)min_north || lat>(double)max_north ||
+                LonDiff(lon,(double)max_west)>0.0 ||
+                LonDiff(lon,(double)min_west)<0.0)
+                return;     /* outside the loaded region */
 
-    if (fd==NULL)
-        fd=fopen(filename,"r");
+            /* Process this point only if it
+               has not already been processed. */
 
-    if (fd==NULL)
-    {
-        fd=fopen(filename,"w");
+            if ((GetMask(lat,lon)&248)==(lrMaskValue<<3))
+                return;
 
-        fprintf(fd,"; SPLAT! Auto-generated DBM Signal Level Color Definition (\"%s\") File\n",filename);
-        fprintf(fd,";\n; Format for the parameters held in this file is as follows:\n;\n");
-        fprintf(fd,";	dBm: red, green, blue\n;\n");
-        fprintf(fd,"; ...where \"dBm\" is the received signal power level between +40 dBm\n");
-        fprintf(fd,"; and -200 dBm, and \"red\", \"green\", and \"blue\" are the corresponding\n");
-        fprintf(fd,"; RGB color definitions ranging from 0 to 255 for the region specified.\n");
-        fprintf(fd,";\n; The following parameters may be edited and/or expanded\n");
-        fprintf(fd,"; for future runs of SPLAT!  A total of 32 contour regions\n");
-        fprintf(fd,"; may be defined in this file.\n;\n;\n");
+            xi=dist/(double)r;      /* miles between profile samples */
 
-        for (x=0; x<region.levels; x++)
-            fprintf(fd,"%+4d: %3d, %3d, %3d\n",region.level[x], region.color[x][0], region.color[x][1], region.color[x][2]);
+            xmtr_alt=four_thirds_earth+source.alt+((double)prof[0]/METERS_PER_FOOT);
+            dest_alt=four_thirds_earth+altitude+terrain;
 
-        fclose(fd);
-    }
+            dest_alt2=dest_alt*dest_alt;
+            xmtr_alt2=xmtr_alt*xmtr_alt;
 
-    else
-    {
-        x=0;
-        fgets(buf,MAX_LINE_LEN,fd);
+            distance=5280.0*dist;
 
-        while (x<32 && feof(fd)==0)
-        {
-            pointer=strchr(buf,';');
+            /* Calculate the cosine of the elevation of
+               the receiver as seen by the transmitter. */
 
-            if (pointer!=NULL)
-                *pointer=0;
+            cos_rcvr_angle=((xmtr_alt2)+(distance*distance)-(dest_alt2))/(2.0*xmtr_alt*distance);
 
-            ok=sscanf(buf,"%d: %d, %d, %d", &val[0], &val[1], &val[2], &val[3]);
+            if (cos_rcvr_angle>1.0)
+                cos_rcvr_angle=1.0;
 
-            if (ok==4)
+            if (cos_rcvr_angle<-1.0)
+                cos_rcvr_angle=-1.0;
+
+            if (got_elevation_pattern || fd!=NULL)
             {
-                if (val[0]<-200)
-                    val[0]=-200;
+                /* Determine the elevation angle to the first obstruction
+                   along the path IF elevation pattern data is available
+                   or an output (.ano) file has been designated. */
 
-                if (val[0]>+40)
-                    val[0]=+40;
+                for (x=2, block=0; (x<r && block==0); x++)
+                {
+                    distance=5280.0*(double)x*xi;
 
-                region.level[x]=val[0];
+                    /* prof[] already carries clutter on interior samples */
 
-                for (y=1; y<4; y++)
-                {
-                    if (val[y]>255)
-                        val[y]=255;
+                    test_alt=four_thirds_earth+(prof[x]==0.0?0.0:((double)prof[x]/METERS_PER_FOOT));
 
-                    if (val[y]<0)
-                        val[y]=0;
+                    cos_test_angle=((xmtr_alt2)+(distance*distance)-(test_alt*test_alt))/(2.0*xmtr_alt*distance);
+
+                    if (cos_test_angle>1.0)
+                        cos_test_angle=1.0;
+
+                    if (cos_test_angle<-1.0)
+                        cos_test_angle=-1.0;
+
+                    if (cos_rcvr_angle>=cos_test_angle)
+                        block=1;
                 }
 
-                region.color[x][0]=val[1];
-                region.color[x][1]=val[2];
-                region.color[x][2]=val[3];
-                x++;
+                if (block)
+                    elevation=((acos(cos_test_angle))/DEG2RAD)-90.0;
+                else
+                    elevation=((acos(cos_rcvr_angle))/DEG2RAD)-90.0;
             }
 
-            fgets(buf,MAX_LINE_LEN,fd);
-        }
-
-        fclose(fd);
-        region.levels=x;
-    }
+            elev_t *elev=GetThreadElev((unsigned long)r+10);
+            if (!elev) {
+                fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for elevation profile");
+                return;
+            }
 
-    free(filename);
-}
+            elev[0]=(elev_t)(r-1);  /* (number of points - 1) */
+            elev[1]=(elev_t)(METERS_PER_MILE*xi);
 
-/* Generates a topographic map image based on logarithmically scaled
- * topology data as well as the content of flags held in the mask[][] array.
- * The image created is rotated counter-clockwise 90 degrees from its
- * representation in DEM[][] so that north points up and east points right.
- */
-void WriteImage(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites)
-{
-    const char *suffix;
-    char *mapfile, *geofile, *kmlfile;
-#if DO_KMZ
-    char *kmzfile;
-#endif
-    unsigned char mask;
-    unsigned width, height, terrain;
-    int x0=0, y0=0;
-    DEM *dem;
-    double conversion, one_over_gamma,
-           north, south, east, west, minwest;
-    FILE *fd;
+            memcpy(elev+2,prof,(size_t)r*sizeof(elev_t));
 
-    Pixel pixel = 0;
-    ImageWriter iw;
+            p2p_sweep_state *sweep=GetTiledSweep(source,altitude);
 
-    one_over_gamma=1.0/GAMMA;
-    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+            if (itwom)
+                point_to_point_sweep(sweep,elev,&loss,strmode,&errnum);
+            else
+                point_to_point_ITM_sweep(sweep,elev,&loss,strmode,&errnum);
 
-    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
-    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+            threadStats.s.p2p_calls++;
+            threadStats.s.p2p_points += r-1;
 
-    if (!filename || filename[0]=='\0')
-    {
-        filename = xmtr[0].filename;
-    }
+            azimuth=(Azimuth(source,pixel));
 
-    switch (imagetype) {
-        default:
-#ifdef HAVE_LIBPNG
-        case IMAGETYPE_PNG:
-            suffix = "png";
-            break;
-#endif
-#ifdef HAVE_LIBJPEG
-        case IMAGETYPE_JPG:
-            suffix = "jpg";
-            break;
-#endif
-        case IMAGETYPE_PPM:
-            suffix = "ppm";
-            break;
-    }
-    mapfile = copyFilename(filename, suffix);
-    geofile = copyFilename(filename, "geo");
-    kmlfile = copyFilename(filename, "kml");
-#if DO_KMZ
-    kmzfile = copyFilename(filename, "kmz");
-#endif
+            if (fd!=NULL) {
+                if (bw!=NULL) {
+                    memset(&rec,0,sizeof(rec));
+                    rec.lat=lat;
+                    rec.lon=lon;
+                    rec.azimuth=(float)azimuth;
+                    rec.elevation=(float)elevation;
+                } else {
+                    textlen = snprintf(textout, MAX_LINE_LEN, "%.7f, %.7f, %.3f, %.3f, ",
+                                       lat, lon, azimuth, elevation);
+                }
+            }
 
-    minwest=((double)min_west)+dpp;
+            /* If ERP==0, write path loss to alphanumeric
+               output file.  Otherwise, write field strength
+               or received power level (below), as appropriate. */
 
-    if (minwest>360.0)
-        minwest-=360.0;
+            if (fd!=NULL && LR.erp==0.0) {
+                if (bw!=NULL)
+                    rec.value=(float)loss;
+                else
+                    textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.2f",loss);
+            }
 
-    north=(double)max_north-dpp;
-    south=(double)min_north;
-    east=(minwest<180.0?-minwest:360.0-min_west);
-    west=(double)(max_west<180?-max_west:360-max_west);
+            /* Integrate the antenna's radiation pattern (already in dB;
+               see LoadPAT()) into the overall path loss. */
 
-    if (!kml && geo)
-    {
-        fd=fopen(geofile,"wb");
+            x=(int)rint(10.0*(10.0-elevation));
 
-        fprintf(fd,"FILENAME\t%s\n",mapfile);
-        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
-        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
-        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
-        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
-        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+            if (x>=0 && x<=1000)
+            {
+                azimuth=rint(azimuth);
 
-        fclose(fd);
-    }
+                loss-=(double)LR.antenna_pattern[(int)azimuth][x];
+            }
 
-    if (kml && !geo)
-    {
-        fd=fopen(kmlfile,"wb");
+            if (LR.erp!=0.0)
+            {
+                if (dbm)
+                {
+                    /* dBm is based on EIRP (ERP + 2.14) */
 
-        fprintf(fd,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-        fprintf(fd,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
-        fprintf(fd,"  <Folder>\n");
-        fprintf(fd,"   <name>%s</name>\n",SPLAT_NAME);
-        fprintf(fd,"	 <description>Line-of-Sight Contour</description>\n");
-        fprintf(fd,"	   <GroundOverlay>\n");
-        fprintf(fd,"		  <name>%s Line-of-Sight Contour</name>\n",SPLAT_NAME);
-        fprintf(fd,"		  <description>SPLAT! Coverage</description>\n");
-        fprintf(fd,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
-        fprintf(fd,"		  <Icon>\n");
-        fprintf(fd,"			  <href>%s</href>\n",mapfile);
-        fprintf(fd,"		</Icon>\n");
-        /* fprintf(fd,"			<opacity>128</opacity>\n"); */
-        fprintf(fd,"			<LatLonBox>\n");
-        fprintf(fd,"			   <north>%.5f</north>\n",north);
-        fprintf(fd,"			   <south>%.5f</south>\n",south);
-        fprintf(fd,"			   <east>%.5f</east>\n",east);
-        fprintf(fd,"			   <west>%.5f</west>\n",west);
-        fprintf(fd,"			   <rotation>0.0</rotation>\n");
-        fprintf(fd,"			</LatLonBox>\n");
-        fprintf(fd,"	   </GroundOverlay>\n");
+                    rxp=LR.erp/(pow(10.0,(loss-2.14)/10.0));
 
-        for (unsigned int x=0; x<txsites; x++)
-        {
-            fprintf(fd,"	 <Placemark>\n");
-            fprintf(fd,"	   <name>%s</name>\n",xmtr[x].name);
-            fprintf(fd,"	   <visibility>1</visibility>\n");
-            fprintf(fd,"	   <Style>\n");
-            fprintf(fd,"	   <IconStyle>\n");
-            fprintf(fd,"		<Icon>\n");
-            fprintf(fd,"		  <href>root://icons/palette-5.png</href>\n");
-            fprintf(fd,"		  <x>224</x>\n");
-            fprintf(fd,"		  <y>224</y>\n");
-            fprintf(fd,"		  <w>32</w>\n");
-            fprintf(fd,"		  <h>32</h>\n");
-            fprintf(fd,"		</Icon>\n");
-            fprintf(fd,"	   </IconStyle>\n");
-            fprintf(fd,"	   </Style>\n");
-            fprintf(fd,"	  <Point>\n");
-            fprintf(fd,"		<extrude>1</extrude>\n");
-            fprintf(fd,"		<altitudeMode>relativeToGround</altitudeMode>\n");
-            fprintf(fd,"		<coordinates>%f,%f,%f</coordinates>\n",(xmtr[x].lon<180.0?-xmtr[x].lon:360.0-xmtr[x].lon), xmtr[x].lat, xmtr[x].alt);
-            fprintf(fd,"	  </Point>\n");
-            fprintf(fd,"	 </Placemark>\n");
-        }
+                    dBm=10.0*(log10(rxp*1000.0));
 
-        fprintf(fd,"  </Folder>\n");
-        fprintf(fd,"</kml>\n");
+                    if (fd!=NULL) {
+                        if (bw!=NULL)
+                            rec.value=(float)dBm;
+                        else
+                            textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.3f",dBm);
+                    }
 
-        fclose(fd);
-    }
+                    /* Scale roughly between 0 and 255 */
 
-    fprintf(stdout,"Writing \"%s\" (%ux%u image)...\n",mapfile,width,height);
-    fflush(stdout);
+                    ifs=200+(int)rint(dBm);
 
-    if (ImageWriterInit(&iw,mapfile,imagetype,width,height)<0) {
-        fprintf(stdout,"\nError writing \"%s\"!\n",mapfile);
-        fflush(stdout);
-        return;
-    }
+                    if (ifs<0)
+                        ifs=0;
 
-    for (int y=0, lat=north; y<(int)height; y++, lat=north-(dpp*(double)y))
-    {
-        for (int x=0, lon=max_west; x<(int)width; x++, lon=(double)max_west-(dpp*(double)x))
-        {
-            if (lon<0.0)
-                lon+=360.0;
+                    if (ifs>255)
+                        ifs=255;
 
-            dem = FindDEM(lat, lon, x0, y0);
-            if (dem)
-            {
-                mask=dem->mask[x0][y0];
+                    ofs=GetSignal(lat,lon);
 
-                if (mask&2)
-                    /* Text Labels: Red */
-                    pixel=COLOR_RED;
+                    if (ofs>ifs)
+                        ifs=ofs;
 
-                else if (mask&4)
-                    /* County Boundaries: Light Cyan */
-                    pixel=COLOR_LIGHTCYAN;
+                    PutSignal(lat,lon,(unsigned char)ifs);
+                }
 
-                else switch (mask&57)
+                else
                 {
-                    case 1:
-                        /* TX1: Green */
-                        pixel=COLOR_GREEN;
-                        break;
+                    field_strength=(139.4+(20.0*log10(LR.frq_mhz))-loss)+(10.0*log10(LR.erp/1000.0));
 
-                    case 8:
-                        /* TX2: Cyan */
-                        pixel=COLOR_CYAN;
-                        break;
+                    ifs=100+(int)rint(field_strength);
 
-                    case 9:
-                        /* TX1 + TX2: Yellow */
-                        pixel=COLOR_YELLOW;
-                        break;
+                    if (ifs<0)
+                        ifs=0;
 
-                    case 16:
-                        /* TX3: Medium Violet */
-                        pixel=COLOR_MEDIUMVIOLET;
-                        break;
+                    if (ifs>255)
+                        ifs=255;
 
-                    case 17:
-                        /* TX1 + TX3: Pink */
-                        pixel=COLOR_PINK;
-                        break;
+                    ofs=GetSignal(lat,lon);
 
-                    case 24:
-                        /* TX2 + TX3: Orange */
-                        pixel=COLOR_ORANGE;
-                        break;
+                    if (ofs>ifs)
+                        ifs=ofs;
 
-                    case 25:
-                        /* TX1 + TX2 + TX3: Dark Green */
-                        pixel=COLOR_DARKGREEN;
-                        break;
+                    PutSignal(lat,lon,(unsigned char)ifs);
 
-                    case 32:
-                        /* TX4: Sienna 1 */
-                        pixel=COLOR_SIENNA;
-                        break;
+                    if (fd!=NULL) {
+                        if (bw!=NULL)
+                            rec.value=(float)field_strength;
+                        else
+                            textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%.3f",field_strength);
+                    }
+                }
+            }
 
-                    case 33:
-                        /* TX1 + TX4: Green Yellow */
-                        pixel=COLOR_GREENYELLOW;
-                        break;
+            else
+            {
+                if (loss>255)
+                    ifs=255;
+                else
+                    ifs=(int)rint(loss);
 
-                    case 40:
-                        /* TX2 + TX4: Dark Sea Green 1 */
-                        pixel=COLOR_DARKSEAGREEN1;
-                        break;
+                ofs=GetSignal(lat,lon);
 
-                    case 41:
-                        /* TX1 + TX2 + TX4: Blanched Almond */
-                        pixel=COLOR_BLANCHEDALMOND;
-                        break;
+                if (ofs<ifs && ofs!=0)
+                    ifs=ofs;
 
-                    case 48:
-                        /* TX3 + TX4: Dark Turquoise */
-                        pixel=COLOR_DARKTURQUOISE;
-                        break;
+                PutSignal(lat,lon,(unsigned char)ifs);
+            }
 
-                    case 49:
-                        /* TX1 + TX3 + TX4: Medium Spring Green */
-                        pixel=COLOR_MEDIUMSPRINGGREEN;
-                        break;
+            if (fd!=NULL) {
+                if (bw!=NULL) {
+                    rec.block=(unsigned char)(block?1:0);
+                    bw->write(rec);
+                } else {
+                    textlen += snprintf(textout + textlen, MAX_LINE_LEN - textlen, "%s",
+                                        block ? " *\n" : "\n");
+                    fwrite(textout, 1, textlen, fd);
+                }
+            }
 
-                    case 56:
-                        /* TX2 + TX3 + TX4: Tan */
-                        pixel=COLOR_TAN;
-                        break;
+            /* Mark this point as having been analyzed */
 
-                    case 57:
-                        /* TX1 + TX2 + TX3 + TX4: Gold2 */
-                        pixel=COLOR_GOLD2;
-                        break;
+            PutMask(lat,lon,(GetMask(lat,lon)&7)+(lrMaskValue<<3));
+        };
 
-                    default:
-                        if (ngs)  /* No terrain */
-                            pixel=COLOR_WHITE;
-                        else
-                        {
-                            /* Sea-level: Medium Blue */
-                            if (dem->data[x0][y0]==0)
-                                pixel = COLOR_MEDIUMBLUE;
-                            else
-                            {
-                                /* Elevation: Greyscale */
-                                terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
-                                pixel=RGB(terrain,terrain,terrain);
-                            }
-                        }
-                }
-            }
-            else
-            {
-                /* We should never get here, but if */
-                /* we do, display the region as black */
+        if (multithread) {
+            wq.submitRange(0,8*r,fn);
+            wq.drain();     /* the next ring extends this ring's profiles */
+        } else {
+            for (i=0; i<8*r; i++)
+                fn(i);
+        }
 
-                pixel=COLOR_BLACK;
-            }
+        free(prev);
+        free(prevv);
+        prev=cur;
+        prevv=curv;
 
-            ImageWriterAppendPixel(&iw, pixel);
+        if (verbose && (r%z)==0) {
+            fprintf(stdout,"%c",symbol[((r/z)-1)&3]);
+            fflush(stdout);
         }
 
-        ImageWriterEmitLine(&iw);
+        if (active==0)
+            break;      /* every surviving ray has passed max_range */
     }
 
-    ImageWriterFinish(&iw);
+    wq.drain();
 
-#if DO_KMZ
-    if (kml) {
-        bool success = false;
-        struct zip_t *zip = zip_open(kmzfile, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
-        if (zip) {
-            /* Pack the KML */
-            if (zip_entry_open(zip, kmlfile) == 0) {
-                if (zip_entry_fwrite(zip, kmlfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            /* Pack the map image */
-            if (zip_entry_open(zip, mapfile) == 0) {
-                if (zip_entry_fwrite(zip, mapfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            zip_close(zip);
-        }
+    free(prev);
+    free(prevv);
 
-        if (success) {
-            unlink(mapfile);
-            unlink(kmlfile);
-            fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
-        } else {
-            unlink(kmzfile);
-            fprintf(stdout, "\nCouldn't create KMZ file.\n");
-        }
-        free(kmzfile);
+    if (bw!=NULL)
+    {
+        bw->close();    /* the rings are drained; flush the worker buffers */
+        delete bw;
     }
-#endif
 
-    free(mapfile);
-    free(geofile);
-    free(kmlfile);
+    if (fd!=NULL)
+        fclose(fd);
 
-    fprintf(stdout,"Done!\n");
-    fflush(stdout);
+    if (verbose) {
+        fprintf(stdout,"\nDone!\n");
+        fflush(stdout);
+    }
+
+    threadStats.s.plot_s += StatsSeconds()-stats_t0;
+
+    if (lrMaskValue<30)
+        lrMaskValue++;
 }
 
-/* Generates a topographic map based on the content of flags held in the mask[][] 
- * array (only). The image created is rotated counter-clockwise 90 degrees from
- * its representation in DEM[][] so that north points up and east points right.
+/* Load signal-strength color values for use when plotting maps.
  */
-void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites)
+void LoadSignalColors(Site xmtr)
 {
-    const char *suffix;
-    char *mapfile, *geofile, *kmlfile, *ckfile;
-#if DO_KMZ
-    char *kmzfile;
-#endif
-    unsigned int width, height, red, green, blue, terrain=0;
-    unsigned int imgheight, imgwidth;
-    unsigned char mask;
-    int indx, x, y, z, colorwidth, x0, y0, loss, level,
-        hundreds, tens, units, match;
-    DEM *dem;
-    double lat, lon, conversion, one_over_gamma,
-           north, south, east, west, minwest;
-    FILE *fd;
-
-    Pixel pixel = 0;
-    ImageWriter iw;
+    int x, y, ok, val[4];
+    char *filename, buf[MAX_LINE_LEN], *pointer=NULL;
+    FILE *fd=NULL;
 
-    one_over_gamma=1.0/GAMMA;
-    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+    filename = copyFilename(xmtr.filename, "scf");
 
-    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
-    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+    /* Default values */
 
-    LoadLossColors(xmtr[0]);
+    region.level[0]=128;
+    region.color[0][0]=255;
+    region.color[0][1]=0;
+    region.color[0][2]=0;
 
-    if (!filename || filename[0]=='\0')
-    {
-        filename = xmtr[0].filename;
-    }
+    region.level[1]=118;
+    region.color[1][0]=255;
+    region.color[1][1]=165;
+    region.color[1][2]=0;
 
-    switch (imagetype) {
-        default:
-#ifdef HAVE_LIBPNG
-        case IMAGETYPE_PNG:
-            suffix = "png";
-            break;
-#endif
-#ifdef HAVE_LIBJPEG
-        case IMAGETYPE_JPG:
-            suffix = "jpg";
-            break;
-#endif
-        case IMAGETYPE_PPM:
-            suffix = "ppm";
-            break;
-    }
-    mapfile = copyFilename(filename, suffix);
-    geofile = copyFilename(filename, "geo");
-    kmlfile = copyFilename(filename, "kml");
-#if DO_KMZ
-    kmzfile = copyFilename(filename, "kmz");
-#endif
+    region.level[2]=108;
+    region.color[2][0]=255;
+    region.color[2][1]=206;
+    region.color[2][2]=0;
 
-    /* ick */
-    ckfile = copyFilename(filename, NULL);
-    ckfile = (char*)realloc(ckfile, strlen(ckfile)+strlen(suffix)+5);
-    strcat(ckfile, "-ck.");
-    strcat(ckfile, suffix);
+    region.level[3]=98;
+    region.color[3][0]=255;
+    region.color[3][1]=255;
+    region.color[3][2]=0;
 
-    minwest=((double)min_west)+dpp;
+    region.level[4]=88;
+    region.color[4][0]=184;
+    region.color[4][1]=255;
+    region.color[4][2]=0;
 
-    if (minwest>360.0)
-        minwest-=360.0;
+    region.level[5]=78;
+    region.color[5][0]=0;
+    region.color[5][1]=255;
+    region.color[5][2]=0;
 
-    north=(double)max_north-dpp;
+    region.level[6]=68;
+    region.color[6][0]=0;
+    region.color[6][1]=208;
+    region.color[6][2]=0;
 
-    if (kml || geo)
-        south=(double)min_north;	/* No bottom legend */
-    else
-        south=(double)min_north-(30.0/ppd); /* 30 pixels for bottom legend */
+    region.level[7]=58;
+    region.color[7][0]=0;
+    region.color[7][1]=196;
+    region.color[7][2]=196;
 
-    east=(minwest<180.0?-minwest:360.0-min_west);
-    west=(double)(max_west<180?-max_west:360-max_west);
+    region.level[8]=48;
+    region.color[8][0]=0;
+    region.color[8][1]=148;
+    region.color[8][2]=255;
 
-    if (geo && !kml)
-    {
-        fd=fopen(geofile,"wb");
+    region.level[9]=38;
+    region.color[9][0]=80;
+    region.color[9][1]=80;
+    region.color[9][2]=255;
 
-        fprintf(fd,"FILENAME\t%s\n",mapfile);
-        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
-        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+    region.level[10]=28;
+    region.color[10][0]=0;
+    region.color[10][1]=38;
+    region.color[10][2]=255;
 
-        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
-        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
+    region.level[11]=18;
+    region.color[11][0]=142;
+    region.color[11][1]=63;
+    region.color[11][2]=255;
 
-        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+    region.level[12]=8;
+    region.color[12][0]=140;
+    region.color[12][1]=0;
+    region.color[12][2]=128;
 
-        fclose(fd);
-    }
+    region.levels=13;
 
-    if (kml && !geo)
-    {   
-        fd=fopen(kmlfile,"wb");
+    fd=fopen("splat.scf","r");
 
+    if (fd==NULL)
+        fd=fopen(filename,"r");
+
+    if (fd==NULL)
+    {
+        fd=fopen(filename,"w");
+
+        fprintf(fd,"; SPLAT! Auto-generated Signal Color Definition (\"%s\") File\n",filename);
+        fprintf(fd,";\n; Format for the parameters held in this file is as follows:\n;\n");
+        fprintf(fd,";	dBuV/m: red, green, blue\n;\n");
+        fprintf(fd,"; ...where \"dBuV/m\" is the signal strength (in dBuV/m) and\n");
+        fprintf(fd,"; \"red\", \"green\", and \"blue\" are the corresponding RGB color\n");
+        fprintf(fd,"; definitions ranging from 0 to 255 for the region specified.\n");
+        fprintf(fd,";\n; The following parameters may be edited and/or expanded\n");
+        fprintf(fd,"; for future runs of SPLAT!  A total of 32 contour regions\n");
+        fprintf(fd,"; may be defined in this file.\n;\n;\n");
+
+        for (x=0; x<region.levels; x++)
+            fprintf(fd,"%3d: %3d, %3d, %3d\n",region.level[x], region.color[x][0], region.color[x][1], region.color[x][2]);
+
+        fclose(fd);
+    }
+    else
+    {
+        x=0;
+        fgets(buf,MAX_LINE_LEN,fd);
+
+        while (x<32 && feof(fd)==0)
+        {
+            pointer=strchr(buf,';');
+
+            if (pointer!=NULL)
+                *pointer=0;
+
+            ok=sscanf(buf,"%d: %d, %d, %d", &val[0], &val[1], &val[2], &val[3]);
+
+            if (ok==4)
+            {
+                for (y=0; y<4; y++)
+                {
+                    if (val[y]>255)
+                        val[y]=255;
+
+                    if (val[y]<0)
+                        val[y]=0;
+                }
+
+                region.level[x]=val[0];
+                region.color[x][0]=val[1];
+                region.color[x][1]=val[2];
+                region.color[x][2]=val[3];
+                x++;
+            }
+
+            fgets(buf,MAX_LINE_LEN,fd);
+        }
+
+        fclose(fd);
+        region.levels=x;
+    }
+
+    free(filename);
+}
+
+/* Load signal-loss color values for use when plotting maps.
+ */
+void LoadLossColors(Site xmtr)
+{
+    int x, y, ok, val[4];
+    char *filename, buf[MAX_LINE_LEN], *pointer=NULL;
+    FILE *fd=NULL;
+
+    filename = copyFilename(xmtr.filename, "lcf");
+
+    /* Default values */
+
+    region.level[0]=80;
+    region.color[0][0]=255;
+    region.color[0][1]=0;
+    region.color[0][2]=0;
+
+    region.level[1]=90;
+    region.color[1][0]=255;
+    region.color[1][1]=128;
+    region.color[1][2]=0;
+
+    region.level[2]=100;
+    region.color[2][0]=255;
+    region.color[2][1]=165;
+    region.color[2][2]=0;
+
+    region.level[3]=110;
+    region.color[3][0]=255;
+    region.color[3][1]=206;
+    region.color[3][2]=0;
+
+    region.level[4]=120;
+    region.color[4][0]=255;
+    region.color[4][1]=255;
+    region.color[4][2]=0;
+
+    region.level[5]=130;
+    region.color[5][0]=184;
+    region.color[5][1]=255;
+    region.color[5][2]=0;
+
+    region.level[6]=140;
+    region.color[6][0]=0;
+    region.color[6][1]=255;
+    region.color[6][2]=0;
+
+    region.level[7]=150;
+    region.color[7][0]=0;
+    region.color[7][1]=208;
+    region.color[7][2]=0;
+
+    region.level[8]=160;
+    region.color[8][0]=0;
+    region.color[8][1]=196;
+    region.color[8][2]=196;
+
+    region.level[9]=170;
+    region.color[9][0]=0;
+    region.color[9][1]=148;
+    region.color[9][2]=255;
+
+    region.level[10]=180;
+    region.color[10][0]=80;
+    region.color[10][1]=80;
+    region.color[10][2]=255;
+
+    region.level[11]=190;
+    region.color[11][0]=0;
+    region.color[11][1]=38;
+    region.color[11][2]=255;
+
+    region.level[12]=200;
+    region.color[12][0]=142;
+    region.color[12][1]=63;
+    region.color[12][2]=255;
+
+    region.level[13]=210;
+    region.color[13][0]=196;
+    region.color[13][1]=54;
+    region.color[13][2]=255;
+
+    region.level[14]=220;
+    region.color[14][0]=255;
+    region.color[14][1]=0;
+    region.color[14][2]=255;
+
+    region.level[15]=230;
+    region.color[15][0]=255;
+    region.color[15][1]=194;
+    region.color[15][2]=204;
+
+    region.levels=16;
+
+    fd=fopen("splat.lcf","r");
+
+    if (fd==NULL)
+        fd=fopen(filename,"r");
+
+    if (fd==NULL)
+    {
+        fd=fopen(filename,"w");
+
+        fprintf(fd,"; SPLAT! Auto-generated Path-Loss Color Definition (\"%s\") File\n",filename);
+        fprintf(fd,";\n; Format for the parameters held in this file is as follows:\n;\n");
+        fprintf(fd,";	dB: red, green, blue\n;\n");
+        fprintf(fd,"; ...where \"dB\" is the path loss (in dB) and\n");
+        fprintf(fd,"; \"red\", \"green\", and \"blue\" are the corresponding RGB color\n");
+        fprintf(fd,"; definitions ranging from 0 to 255 for the region specified.\n");
+        fprintf(fd,";\n; The following parameters may be edited and/or expanded\n");
+        fprintf(fd,"; for future runs of SPLAT!  A total of 32 contour regions\n");
+        fprintf(fd,"; may be defined in this file.\n;\n;\n");
+
+        for (x=0; x<region.levels; x++)
+            fprintf(fd,"%3d: %3d, %3d, %3d\n",region.level[x], region.color[x][0], region.color[x][1], region.color[x][2]);
+
+        fclose(fd);
+    }
+
+    else
+    {
+        x=0;
+        fgets(buf,MAX_LINE_LEN,fd);
+
+        while (x<32 && feof(fd)==0)
+        {
+            pointer=strchr(buf,';');
+
+            if (pointer!=NULL)
+                *pointer=0;
+
+            ok=sscanf(buf,"%d: %d, %d, %d", &val[0], &val[1], &val[2], &val[3]);
+
+            if (ok==4)
+            {
+                for (y=0; y<4; y++)
+                {
+                    if (val[y]>255)
+                        val[y]=255;
+
+                    if (val[y]<0)
+                        val[y]=0;
+                }
+
+                region.level[x]=val[0];
+                region.color[x][0]=val[1];
+                region.color[x][1]=val[2];
+                region.color[x][2]=val[3];
+                x++;
+            }
+
+            fgets(buf,MAX_LINE_LEN,fd);
+        }
+
+        fclose(fd);
+        region.levels=x;
+    }
+
+    free(filename);
+}
+
+/* Load signal-strength (dBm) color values for use when plotting maps.
+ */
+void LoadDBMColors(Site xmtr)
+{
+    int x, y, ok, val[4];
+    char *filename, buf[MAX_LINE_LEN], *pointer=NULL;
+    FILE *fd=NULL;
+
+    filename = copyFilename(xmtr.filename, "dcf");
+
+    /* Default values */
+
+    region.level[0]=0;
+    region.color[0][0]=255;
+    region.color[0][1]=0;
+    region.color[0][2]=0;
+
+    region.level[1]=-10;
+    region.color[1][0]=255;
+    region.color[1][1]=128;
+    region.color[1][2]=0;
+
+    region.level[2]=-20;
+    region.color[2][0]=255;
+    region.color[2][1]=165;
+    region.color[2][2]=0;
+
+    region.level[3]=-30;
+    region.color[3][0]=255;
+    region.color[3][1]=206;
+    region.color[3][2]=0;
+
+    region.level[4]=-40;
+    region.color[4][0]=255;
+    region.color[4][1]=255;
+    region.color[4][2]=0;
+
+    region.level[5]=-50;
+    region.color[5][0]=184;
+    region.color[5][1]=255;
+    region.color[5][2]=0;
+
+    region.level[6]=-60;
+    region.color[6][0]=0;
+    region.color[6][1]=255;
+    region.color[6][2]=0;
+
+    region.level[7]=-70;
+    region.color[7][0]=0;
+    region.color[7][1]=208;
+    region.color[7][2]=0;
+
+    region.level[8]=-80;
+    region.color[8][0]=0;
+    region.color[8][1]=196;
+    region.color[8][2]=196;
+
+    region.level[9]=-90;
+    region.color[9][0]=0;
+    region.color[9][1]=148;
+    region.color[9][2]=255;
+
+    region.level[10]=-100;
+    region.color[10][0]=80;
+    region.color[10][1]=80;
+    region.color[10][2]=255;
+
+    region.level[11]=-110;
+    region.color[11][0]=0;
+    region.color[11][1]=38;
+    region.color[11][2]=255;
+
+    region.level[12]=-120;
+    region.color[12][0]=142;
+    region.color[12][1]=63;
+    region.color[12][2]=255;
+
+    region.level[13]=-130;
+    region.color[13][0]=196;
+    region.color[13][1]=54;
+    region.color[13][2]=255;
+
+    region.level[14]=-140;
+    region.color[14][0]=255;
+    region.color[14][1]=0;
+    region.color[14][2]=255;
+
+    region.level[15]=-150;
+    region.color[15][0]=255;
+    region.color[15][1]=194;
+    region.color[15][2]=204;
+
+    region.levels=16;
+
+    fd=fopen("splat.dcf","r");
+
+    if (fd==NULL)
+        fd=fopen(filename,"r");
+
+    if (fd==NULL)
+    {
+        fd=fopen(filename,"w");
+
+        fprintf(fd,"; SPLAT! Auto-generated DBM Signal Level Color Definition (\"%s\") File\n",filename);
+        fprintf(fd,";\n; Format for the parameters held in this file is as follows:\n;\n");
+        fprintf(fd,";	dBm: red, green, blue\n;\n");
+        fprintf(fd,"; ...where \"dBm\" is the received signal power level between +40 dBm\n");
+        fprintf(fd,"; and -200 dBm, and \"red\", \"green\", and \"blue\" are the corresponding\n");
+        fprintf(fd,"; RGB color definitions ranging from 0 to 255 for the region specified.\n");
+        fprintf(fd,";\n; The following parameters may be edited and/or expanded\n");
+        fprintf(fd,"; for future runs of SPLAT!  A total of 32 contour regions\n");
+        fprintf(fd,"; may be defined in this file.\n;\n;\n");
+
+        for (x=0; x<region.levels; x++)
+            fprintf(fd,"%+4d: %3d, %3d, %3d\n",region.level[x], region.color[x][0], region.color[x][1], region.color[x][2]);
+
+        fclose(fd);
+    }
+
+    else
+    {
+        x=0;
+        fgets(buf,MAX_LINE_LEN,fd);
+
+        while (x<32 && feof(fd)==0)
+        {
+            pointer=strchr(buf,';');
+
+            if (pointer!=NULL)
+                *pointer=0;
+
+            ok=sscanf(buf,"%d: %d, %d, %d", &val[0], &val[1], &val[2], &val[3]);
+
+            if (ok==4)
+            {
+                if (val[0]<-200)
+                    val[0]=-200;
+
+                if (val[0]>+40)
+                    val[0]=+40;
+
+                region.level[x]=val[0];
+
+                for (y=1; y<4; y++)
+                {
+                    if (val[y]>255)
+                        val[y]=255;
+
+                    if (val[y]<0)
+                        val[y]=0;
+                }
+
+                region.color[x][0]=val[1];
+                region.color[x][1]=val[2];
+                region.color[x][2]=val[3];
+                x++;
+            }
+
+            fgets(buf,MAX_LINE_LEN,fd);
+        }
+
+        fclose(fd);
+        region.levels=x;
+    }
+
+    free(filename);
+}
+
+/* Shared rendering engine for the WriteImage* family.
+ *
+ * The four writers used to be near-clones that each walked the raster one
+ * pixel at a time on the main thread; only the colorization differed, so
+ * the raster walk now lives here, parameterized by a colorize() callback.
+ * Rows are colorized in bands on a worker pool while the previous band's
+ * finished rows are handed to the ImageWriter in order, so the (serial)
+ * image encoder runs concurrently with the (parallel) colorization.
+ *
+ * colorize() receives the DEM page and indices of each pixel and must be
+ * safe to call concurrently; pixels that fall outside every loaded page
+ * are painted black. Worker threads resolve pages through the same
+ * FindDEM() the serial walk used -- the thread-local last-tile probe
+ * makes that O(1) per pixel along a scanline.
+ */
+static void RenderRaster(ImageWriter *iw, unsigned width, unsigned height,
+                         bool multithread,
+                         const std::function<Pixel(DEM *, int, int)> &colorize)
+{
+    unsigned char *bands[2];
+    double north;
+    int nrows, b, i, y, n, prev_n;
+
+    DEMCacheNewPhase();
+
+    north=(double)max_north-dpp;
+
+    auto renderrow=[&](unsigned char *row, int y) {
+        DEM *dem;
+        double lat, lon;
+        int x, x0=0, y0=0;
+        Pixel pixel;
+
+        lat=north-(dpp*(double)y);
+
+        for (x=0, lon=(double)max_west; x<(int)width; x++, lon=(double)max_west-(dpp*(double)x))
+        {
+            if (lon<0.0)
+                lon+=360.0;
+
+            dem = FindDEM(lat, lon, x0, y0);
+
+            if (dem)
+                pixel=colorize(dem,x0,y0);
+            else
+                /* We should never get here, but if */
+                /* we do, display the region as black */
+                pixel=COLOR_BLACK;
+
+            *row++=GetRValue(pixel);
+            *row++=GetGValue(pixel);
+            *row++=GetBValue(pixel);
+        }
+    };
+
+    if (!multithread)
+    {
+        bands[0]=(unsigned char*)malloc((size_t)3*width);
+        assert(bands[0]!=NULL);
+
+        for (y=0; y<(int)height; y++)
+        {
+            renderrow(bands[0],y);
+            ImageWriterEmitRow(iw,bands[0]);
+        }
+
+        free(bands[0]);
+        return;
+    }
+
+    /* Deep enough bands to keep every worker busy, shallow enough that
+       even an HD multi-page raster stages only a few megabytes. The two
+       buffers alternate: the workers fill one while the main thread
+       feeds the other to the encoder. */
+
+    nrows=16*WorkQueue::maxWorkers();
+
+    if (nrows>(int)height)
+        nrows=(int)height;
+
+    bands[0]=(unsigned char*)malloc((size_t)nrows*3*width);
+    bands[1]=(unsigned char*)malloc((size_t)nrows*3*width);
+    assert(bands[0]!=NULL && bands[1]!=NULL);
+
+    WorkQueue wq;
+
+    prev_n=0;
+
+    for (b=0, y=0; y<(int)height || prev_n>0; b^=1)
+    {
+        n=(int)height-y;
+
+        if (n>nrows)
+            n=nrows;
+
+        if (n>0)
+        {
+            unsigned char *band=bands[b];
+            int ybase=y;
+
+            wq.submitRange(y,y+n,[&renderrow,band,ybase,width](int yy) {
+                renderrow(band+(size_t)(yy-ybase)*3*width,yy);
+            });
+        }
+
+        /* While the workers colorize this band, encode the previous one */
+
+        for (i=0; i<prev_n; i++)
+            ImageWriterEmitRow(iw,bands[b^1]+(size_t)i*3*width);
+
+        wq.drain();
+
+        prev_n=n;
+        y+=n;
+    }
+
+    wq.waitForCompletion();
+    RecordPoolStats(wq);
+
+    free(bands[0]);
+    free(bands[1]);
+}
+
+/* Generates a topographic map image based on logarithmically scaled
+ * topology data as well as the content of flags held in the mask[][] array.
+ * The image created is rotated counter-clockwise 90 degrees from its
+ * representation in DEM[][] so that north points up and east points right.
+ */
+void WriteImage(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites, bool multithread)
+{
+    const char *suffix;
+    char *mapfile, *geofile, *kmlfile;
+#if DO_KMZ
+    char *kmzfile;
+#endif
+    struct zip_t *kmz=NULL;
+    unsigned width, height;
+    double conversion, one_over_gamma,
+           north, south, east, west, minwest;
+    FILE *fd;
+
+    ImageWriter iw;
+
+    double stats_t0=StatsSeconds();
+
+    one_over_gamma=1.0/GAMMA;
+    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+
+    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
+    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+
+    if (!filename || filename[0]=='\0')
+    {
+        filename = xmtr[0].filename;
+    }
+
+    switch (imagetype) {
+        default:
+#ifdef HAVE_LIBPNG
+        case IMAGETYPE_PNG:
+            suffix = "png";
+            break;
+#endif
+#ifdef HAVE_LIBJPEG
+        case IMAGETYPE_JPG:
+            suffix = "jpg";
+            break;
+#endif
+        case IMAGETYPE_PPM:
+            suffix = "ppm";
+            break;
+    }
+    mapfile = copyFilename(filename, suffix);
+    geofile = copyFilename(filename, "geo");
+    kmlfile = copyFilename(filename, "kml");
+#if DO_KMZ
+    kmzfile = copyFilename(filename, "kmz");
+#endif
+
+    minwest=((double)min_west)+dpp;
+
+    if (minwest>360.0)
+        minwest-=360.0;
+
+    north=(double)max_north-dpp;
+    south=(double)min_north;
+    east=(minwest<180.0?-minwest:360.0-min_west);
+    west=(double)(max_west<180?-max_west:360-max_west);
+
+    if (!kml && geo)
+    {
+        fd=fopen(geofile,"wb");
+
+        fprintf(fd,"FILENAME\t%s\n",mapfile);
+        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
+        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
+        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
+        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+
+        fclose(fd);
+    }
+
+#if DO_KMZ
+    if (kml)
+        kmz=zip_open(kmzfile,ZIP_DEFAULT_COMPRESSION_LEVEL,'w');
+#endif
+
+    if (kml && !geo)
+    {
+        KmlSink ks;
+
+        KmlOpen(&ks,kmz,kmlfile);
+
+        KmlPrintf(&ks,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        KmlPrintf(&ks,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
+        KmlPrintf(&ks,"  <Folder>\n");
+        KmlPrintf(&ks,"   <name>%s</name>\n",SPLAT_NAME);
+        KmlPrintf(&ks,"	 <description>Line-of-Sight Contour</description>\n");
+        KmlPrintf(&ks,"	   <GroundOverlay>\n");
+        KmlPrintf(&ks,"		  <name>%s Line-of-Sight Contour</name>\n",SPLAT_NAME);
+        KmlPrintf(&ks,"		  <description>SPLAT! Coverage</description>\n");
+        KmlPrintf(&ks,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
+        KmlPrintf(&ks,"		  <Icon>\n");
+        KmlPrintf(&ks,"			  <href>%s</href>\n",mapfile);
+        KmlPrintf(&ks,"		</Icon>\n");
+        /* KmlPrintf(&ks,"			<opacity>128</opacity>\n"); */
+        KmlPrintf(&ks,"			<LatLonBox>\n");
+        KmlPrintf(&ks,"			   <north>%.5f</north>\n",north);
+        KmlPrintf(&ks,"			   <south>%.5f</south>\n",south);
+        KmlPrintf(&ks,"			   <east>%.5f</east>\n",east);
+        KmlPrintf(&ks,"			   <west>%.5f</west>\n",west);
+        KmlPrintf(&ks,"			   <rotation>0.0</rotation>\n");
+        KmlPrintf(&ks,"			</LatLonBox>\n");
+        KmlPrintf(&ks,"	   </GroundOverlay>\n");
+
+        for (unsigned int x=0; x<txsites; x++)
+        {
+            KmlPrintf(&ks,"	 <Placemark>\n");
+            KmlPrintf(&ks,"	   <name>%s</name>\n",xmtr[x].name);
+            KmlPrintf(&ks,"	   <visibility>1</visibility>\n");
+            KmlPrintf(&ks,"	   <Style>\n");
+            KmlPrintf(&ks,"	   <IconStyle>\n");
+            KmlPrintf(&ks,"		<Icon>\n");
+            KmlPrintf(&ks,"		  <href>root://icons/palette-5.png</href>\n");
+            KmlPrintf(&ks,"		  <x>224</x>\n");
+            KmlPrintf(&ks,"		  <y>224</y>\n");
+            KmlPrintf(&ks,"		  <w>32</w>\n");
+            KmlPrintf(&ks,"		  <h>32</h>\n");
+            KmlPrintf(&ks,"		</Icon>\n");
+            KmlPrintf(&ks,"	   </IconStyle>\n");
+            KmlPrintf(&ks,"	   </Style>\n");
+            KmlPrintf(&ks,"	  <Point>\n");
+            KmlPrintf(&ks,"		<extrude>1</extrude>\n");
+            KmlPrintf(&ks,"		<altitudeMode>relativeToGround</altitudeMode>\n");
+            KmlPrintf(&ks,"		<coordinates>%f,%f,%f</coordinates>\n",(xmtr[x].lon<180.0?-xmtr[x].lon:360.0-xmtr[x].lon), xmtr[x].lat, xmtr[x].alt);
+            KmlPrintf(&ks,"	  </Point>\n");
+            KmlPrintf(&ks,"	 </Placemark>\n");
+        }
+
+        KmlPrintf(&ks,"  </Folder>\n");
+        KmlPrintf(&ks,"</kml>\n");
+
+        KmlClose(&ks);
+    }
+
+    fprintf(stdout,"Writing \"%s\" (%ux%u image)...\n",mapfile,width,height);
+    fflush(stdout);
+
+    if (MapImageInit(&iw,kmz,mapfile,imagetype,width,height)<0) {
+        fprintf(stdout,"\nError writing \"%s\"!\n",mapfile);
+        fflush(stdout);
+        return;
+    }
+
+    RenderRaster(&iw,width,height,multithread,
+        [&](DEM *dem, int x0, int y0) -> Pixel {
+            unsigned char mask;
+            unsigned terrain;
+            Pixel pixel=0;
+
+            {
+                mask=DEMMask(dem,x0,y0);
+
+                if (mask&2)
+                    /* Text Labels: Red */
+                    pixel=COLOR_RED;
+
+                else if (mask&4)
+                    /* County Boundaries: Light Cyan */
+                    pixel=COLOR_LIGHTCYAN;
+
+                else switch (mask&57)
+                {
+                    case 1:
+                        /* TX1: Green */
+                        pixel=COLOR_GREEN;
+                        break;
+
+                    case 8:
+                        /* TX2: Cyan */
+                        pixel=COLOR_CYAN;
+                        break;
+
+                    case 9:
+                        /* TX1 + TX2: Yellow */
+                        pixel=COLOR_YELLOW;
+                        break;
+
+                    case 16:
+                        /* TX3: Medium Violet */
+                        pixel=COLOR_MEDIUMVIOLET;
+                        break;
+
+                    case 17:
+                        /* TX1 + TX3: Pink */
+                        pixel=COLOR_PINK;
+                        break;
+
+                    case 24:
+                        /* TX2 + TX3: Orange */
+                        pixel=COLOR_ORANGE;
+                        break;
+
+                    case 25:
+                        /* TX1 + TX2 + TX3: Dark Green */
+                        pixel=COLOR_DARKGREEN;
+                        break;
+
+                    case 32:
+                        /* TX4: Sienna 1 */
+                        pixel=COLOR_SIENNA;
+                        break;
+
+                    case 33:
+                        /* TX1 + TX4: Green Yellow */
+                        pixel=COLOR_GREENYELLOW;
+                        break;
+
+                    case 40:
+                        /* TX2 + TX4: Dark Sea Green 1 */
+                        pixel=COLOR_DARKSEAGREEN1;
+                        break;
+
+                    case 41:
+                        /* TX1 + TX2 + TX4: Blanched Almond */
+                        pixel=COLOR_BLANCHEDALMOND;
+                        break;
+
+                    case 48:
+                        /* TX3 + TX4: Dark Turquoise */
+                        pixel=COLOR_DARKTURQUOISE;
+                        break;
+
+                    case 49:
+                        /* TX1 + TX3 + TX4: Medium Spring Green */
+                        pixel=COLOR_MEDIUMSPRINGGREEN;
+                        break;
+
+                    case 56:
+                        /* TX2 + TX3 + TX4: Tan */
+                        pixel=COLOR_TAN;
+                        break;
+
+                    case 57:
+                        /* TX1 + TX2 + TX3 + TX4: Gold2 */
+                        pixel=COLOR_GOLD2;
+                        break;
+
+                    default:
+                        if (ngs)  /* No terrain */
+                            pixel=COLOR_WHITE;
+                        else
+                        {
+                            /* Sea-level: Medium Blue */
+                            if (DEMData(dem,x0,y0)==0)
+                                pixel = COLOR_MEDIUMBLUE;
+                            else
+                            {
+                                /* Elevation: Greyscale */
+                                terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
+                                pixel=RGB(terrain,terrain,terrain);
+                            }
+                        }
+                }
+            }
+
+            return pixel;
+        });
+
+    MapImageFinish(&iw,kmz);
+
+#if DO_KMZ
+    if (kmz) {
+        zip_close(kmz);
+        fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
+    } else if (kml)
+        fprintf(stdout, "\nCouldn't create KMZ file.\n");
+#endif
+
+    free(mapfile);
+    free(geofile);
+    free(kmlfile);
+#if DO_KMZ
+    free(kmzfile);
+#endif
+
+    threadStats.s.image_s += StatsSeconds()-stats_t0;
+
+    fprintf(stdout,"Done!\n");
+    fflush(stdout);
+}
+
+/* Generates a topographic map based on the content of flags held in the mask[][] 
+ * array (only). The image created is rotated counter-clockwise 90 degrees from
+ * its representation in DEM[][] so that north points up and east points right.
+ */
+void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites, bool multithread)
+{
+    const char *suffix;
+    char *mapfile, *geofile, *kmlfile, *ckfile;
+#if DO_KMZ
+    char *kmzfile;
+#endif
+    struct zip_t *kmz=NULL;
+    unsigned int width, height, red, green, blue;
+    unsigned int imgheight, imgwidth;
+    int indx, x, colorwidth, x0, y0, level,
+        hundreds, tens, units;
+    double conversion, one_over_gamma,
+           north, south, east, west, minwest;
+    FILE *fd;
+
+    Pixel pixel = 0;
+    ImageWriter iw;
+
+    double stats_t0=StatsSeconds();
+
+    one_over_gamma=1.0/GAMMA;
+    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+
+    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
+    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+
+    LoadLossColors(xmtr[0]);
+
+    if (!filename || filename[0]=='\0')
+    {
+        filename = xmtr[0].filename;
+    }
+
+    switch (imagetype) {
+        default:
+#ifdef HAVE_LIBPNG
+        case IMAGETYPE_PNG:
+            suffix = "png";
+            break;
+#endif
+#ifdef HAVE_LIBJPEG
+        case IMAGETYPE_JPG:
+            suffix = "jpg";
+            break;
+#endif
+        case IMAGETYPE_PPM:
+            suffix = "ppm";
+            break;
+    }
+    mapfile = copyFilename(filename, suffix);
+    geofile = copyFilename(filename, "geo");
+    kmlfile = copyFilename(filename, "kml");
+#if DO_KMZ
+    kmzfile = copyFilename(filename, "kmz");
+#endif
+
+    /* ick */
+    ckfile = copyFilename(filename, NULL);
+    ckfile = (char*)realloc(ckfile, strlen(ckfile)+strlen(suffix)+5);
+    strcat(ckfile, "-ck.");
+    strcat(ckfile, suffix);
+
+    minwest=((double)min_west)+dpp;
+
+    if (minwest>360.0)
+        minwest-=360.0;
+
+    north=(double)max_north-dpp;
+
+    if (kml || geo)
+        south=(double)min_north;	/* No bottom legend */
+    else
+        south=(double)min_north-(30.0/ppd); /* 30 pixels for bottom legend */
+
+    east=(minwest<180.0?-minwest:360.0-min_west);
+    west=(double)(max_west<180?-max_west:360-max_west);
+
+    if (geo && !kml)
+    {
+        fd=fopen(geofile,"wb");
+
+        fprintf(fd,"FILENAME\t%s\n",mapfile);
+        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
+        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+
+        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
+        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
+
+        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+
+        fclose(fd);
+    }
+
+#if DO_KMZ
+    if (kml)
+        kmz=zip_open(kmzfile,ZIP_DEFAULT_COMPRESSION_LEVEL,'w');
+#endif
+
+    if (kml && !geo)
+    {   
+        KmlSink ks;
+
+        KmlOpen(&ks,kmz,kmlfile);
+
+
+        KmlPrintf(&ks,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        KmlPrintf(&ks,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
+        KmlPrintf(&ks,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME,SPLAT_VERSION);
+        KmlPrintf(&ks,"  <Folder>\n");
+        KmlPrintf(&ks,"   <name>%s</name>\n",SPLAT_NAME);
+        KmlPrintf(&ks,"	 <description>%s Transmitter Path Loss Overlay</description>\n",xmtr[0].name);
+        KmlPrintf(&ks,"	   <GroundOverlay>\n");
+        KmlPrintf(&ks,"		  <name>SPLAT! Path Loss Overlay</name>\n");
+        KmlPrintf(&ks,"		  <description>SPLAT! Coverage</description>\n");
+        KmlPrintf(&ks,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
+        KmlPrintf(&ks,"		  <Icon>\n");
+        KmlPrintf(&ks,"			  <href>%s</href>\n",basename_s(mapfile));
+        KmlPrintf(&ks,"		  </Icon>\n");
+        /* KmlPrintf(&ks,"			<opacity>128</opacity>\n"); */
+        KmlPrintf(&ks,"			<LatLonBox>\n");
+        KmlPrintf(&ks,"			   <north>%.5f</north>\n",north);
+        KmlPrintf(&ks,"			   <south>%.5f</south>\n",south);
+        KmlPrintf(&ks,"			   <east>%.5f</east>\n",east);
+        KmlPrintf(&ks,"			   <west>%.5f</west>\n",west);
+        KmlPrintf(&ks,"			   <rotation>0.0</rotation>\n");
+        KmlPrintf(&ks,"			</LatLonBox>\n");
+        KmlPrintf(&ks,"	   </GroundOverlay>\n");
+        KmlPrintf(&ks,"	   <ScreenOverlay>\n");
+        KmlPrintf(&ks,"		  <name>Color Key</name>\n");
+        KmlPrintf(&ks,"		  <description>Contour Color Key</description>\n");
+        KmlPrintf(&ks,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
+        KmlPrintf(&ks,"		  <Icon>\n");
+        KmlPrintf(&ks,"			<href>%s</href>\n",basename_s(ckfile));
+        KmlPrintf(&ks,"		  </Icon>\n");
+        KmlPrintf(&ks,"		  <overlayXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"		  <screenXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"		  <rotationXY x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"		  <size x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"	   </ScreenOverlay>\n");
+
+        for (unsigned int i=0; i<txsites; i++)
+        {
+            KmlPrintf(&ks,"	 <Placemark>\n");
+            KmlPrintf(&ks,"	   <name>%s</name>\n",xmtr[i].name);
+            KmlPrintf(&ks,"	   <visibility>1</visibility>\n");
+            KmlPrintf(&ks,"	   <Style>\n");
+            KmlPrintf(&ks,"	   <IconStyle>\n");
+            KmlPrintf(&ks,"		<Icon>\n");
+            KmlPrintf(&ks,"		  <href>root://icons/palette-5.png</href>\n");
+            KmlPrintf(&ks,"		  <x>224</x>\n");
+            KmlPrintf(&ks,"		  <y>224</y>\n");
+            KmlPrintf(&ks,"		  <w>32</w>\n");
+            KmlPrintf(&ks,"		  <h>32</h>\n");
+            KmlPrintf(&ks,"		</Icon>\n");
+            KmlPrintf(&ks,"	   </IconStyle>\n");
+            KmlPrintf(&ks,"	   </Style>\n");
+            KmlPrintf(&ks,"	  <Point>\n");
+            KmlPrintf(&ks,"		<extrude>1</extrude>\n");
+            KmlPrintf(&ks,"		<altitudeMode>relativeToGround</altitudeMode>\n");
+            KmlPrintf(&ks,"		<coordinates>%f,%f,%f</coordinates>\n",(xmtr[i].lon<180.0?-xmtr[i].lon:360.0-xmtr[i].lon), xmtr[i].lat, xmtr[i].alt);
+            KmlPrintf(&ks,"	  </Point>\n");
+            KmlPrintf(&ks,"	 </Placemark>\n");
+        }
+
+        KmlPrintf(&ks,"  </Folder>\n");
+        KmlPrintf(&ks,"</kml>\n");
+
+        KmlClose(&ks);
+    }
+
+    if (kml || geo)
+    {
+        /* No bottom legend */
+        imgwidth = width;
+        imgheight = height;
+    }
+    else
+    {
+        /* Allow space for bottom legend */
+        imgwidth = width;
+        imgheight = height + 30;
+    }
+
+    fprintf(stdout,"\nWriting LR map \"%s\" (%ux%u image)... ",mapfile,imgwidth,imgheight);
+    fflush(stdout);
+
+    if (MapImageInit(&iw,kmz,mapfile,imagetype,imgwidth,imgheight)<0) {
+        fprintf(stdout,"\nError writing \"%s\"!\n",mapfile);
+        fflush(stdout);
+        return;
+    }
+
+    RenderRaster(&iw,width,height,multithread,
+        [&](DEM *dem, int x0, int y0) -> Pixel {
+            unsigned char mask;
+            unsigned int red, green, blue, terrain;
+            int z, loss, match;
+            Pixel pixel=0;
+
+            {
+                mask=DEMMask(dem,x0,y0);
+                loss=(DEMSignal(dem,x0,y0));
+
+                match=255;
+
+                red=0;
+                green=0;
+                blue=0;
+
+                if (loss<=region.level[0])
+                    match=0;
+                else
+                {
+                    for (z=1; (z<region.levels && match==255); z++)
+                    {
+                        if (loss>=region.level[z-1] && loss<region.level[z])
+                            match=z;
+                    }
+                }
+
+                if (match<region.levels)
+                {
+                    if (smooth_contours && match>0)
+                    {
+                        red=(unsigned)interpolate(region.color[match-1][0],region.color[match][0],region.level[match-1],region.level[match],loss);
+                        green=(unsigned)interpolate(region.color[match-1][1],region.color[match][1],region.level[match-1],region.level[match],loss);
+                        blue=(unsigned)interpolate(region.color[match-1][2],region.color[match][2],region.level[match-1],region.level[match],loss);
+                    }
+
+                    else
+                    {
+                        red=region.color[match][0];
+                        green=region.color[match][1];
+                        blue=region.color[match][2];
+                    }
+                }
+
+                if (mask&2)
+                {
+                    /* Text Labels: Red or otherwise */
+
+                    if (red>=180 && green<=75 && blue<=75 && loss!=0)
+                        pixel=RGB(255^red,255^green,255^blue);
+                    else
+                        pixel=COLOR_RED;
+                }
+                else if (mask&4)
+                {
+                    /* County Boundaries: Black */
+                    pixel=COLOR_BLACK;
+                }
+                else
+                {
+                    if (loss==0 || (contour_threshold!=0 && loss>abs(contour_threshold)))
+                    {
+                        if (ngs)  /* No terrain */
+                            pixel=COLOR_WHITE;
+                        else
+                        {
+                            /* Display land or sea elevation */
+
+                            if (DEMData(dem,x0,y0)==0)
+                                pixel=COLOR_MEDIUMBLUE;
+                            else
+                            {
+                                terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
+                                pixel=RGB(terrain,terrain,terrain);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        /* Plot path loss in color */
+
+                        if (red!=0 || green!=0 || blue!=0)
+                            pixel=RGB(red,green,blue);
+
+                        else  /* terrain / sea-level */
+                        {
+                            if (DEMData(dem,x0,y0)==0)
+                                pixel=COLOR_MEDIUMBLUE;
+                            else
+                            {
+                                /* Elevation: Greyscale */
+                                terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
+                                pixel=RGB(terrain,terrain,terrain);
+                            }
+                        }
+                    }
+                }
+            }
+
+            return pixel;
+        });
+
+    if (!kml && !geo)
+    {
+        /* Display legend along bottom of image
+         * if not generating .kml or .geo output.
+         */
+
+        colorwidth=(int)rint((float)width/(float)region.levels);
+
+        for (y0=0; y0<30; y0++)
+        {
+            for (x0=0; x0<(int)width; x0++)
+            {
+                indx=x0/colorwidth;
+                x=x0%colorwidth;
+                level=region.level[indx];
+
+                hundreds=level/100;
+
+                if (hundreds>0)
+                    level-=(hundreds*100);
+
+                tens=level/10;
+
+                if (tens>0)
+                    level-=(tens*10);
+
+                units=level;
+
+                if (y0>=8 && y0<=23)
+                {  
+                    if (hundreds>0)
+                    {
+                        if (x>=11 && x<=18)	 
+                            if (fontdata[16*(hundreds+'0')+(y0-8)]&(128>>(x-11)))
+                                indx=255; 
+                    }
+
+                    if (tens>0 || hundreds>0)
+                    {
+                        if (x>=19 && x<=26)	 
+                            if (fontdata[16*(tens+'0')+(y0-8)]&(128>>(x-19)))
+                                indx=255;
+                    }
+
+                    if (x>=27 && x<=34)
+                        if (fontdata[16*(units+'0')+(y0-8)]&(128>>(x-27)))
+                            indx=255;
+
+                    if (x>=42 && x<=49)
+                        if (fontdata[16*('d')+(y0-8)]&(128>>(x-42)))
+                            indx=255;
+
+                    if (x>=50 && x<=57)
+                        if (fontdata[16*('B')+(y0-8)]&(128>>(x-50)))
+                            indx=255;
+                }
+
+                if (indx>region.levels)
+                    pixel=COLOR_BLACK;
+                else
+                {
+                    red=region.color[indx][0];
+                    green=region.color[indx][1];
+                    blue=region.color[indx][2];
+
+                    pixel=RGB(red,green,blue);
+                }
+
+                ImageWriterAppendPixel(&iw, pixel);
+            }
+
+            ImageWriterEmitLine(&iw);
+        }
+    }
+
+    MapImageFinish(&iw,kmz);
+
+    if (kml)
+    {
+        /* Write colorkey image file */
+
+        height=30*region.levels;
+        width=100;
+
+        if (MapImageInit(&iw,kmz,ckfile,imagetype,width,height)<0) {
+            fprintf(stdout,"\nError writing \"%s\"!\n",ckfile);
+            fflush(stdout);
+            return;
+        }
+
+        for (y0=0; y0<(int)height; y0++)
+        {
+            for (x0=0; x0<(int)width; x0++)
+            {
+                indx=y0/30;
+                x=x0;
+                level=region.level[indx];
+
+                hundreds=level/100;
+
+                if (hundreds>0)
+                    level-=(hundreds*100);
+
+                tens=level/10;
+
+                if (tens>0)
+                    level-=(tens*10);
+
+                units=level;
+
+                if ((y0%30)>=8 && (y0%30)<=23)
+                {  
+                    if (hundreds>0)
+                    {
+                        if (x>=11 && x<=18)	 
+                            if (fontdata[16*(hundreds+'0')+((y0%30)-8)]&(128>>(x-11)))
+                                indx=255; 
+                    }
+
+                    if (tens>0 || hundreds>0)
+                    {
+                        if (x>=19 && x<=26)	 
+                            if (fontdata[16*(tens+'0')+((y0%30)-8)]&(128>>(x-19)))
+                                indx=255;
+                    }
+
+                    if (x>=27 && x<=34)
+                        if (fontdata[16*(units+'0')+((y0%30)-8)]&(128>>(x-27)))
+                            indx=255;
+
+                    if (x>=42 && x<=49)
+                        if (fontdata[16*('d')+((y0%30)-8)]&(128>>(x-42)))
+                            indx=255;
+
+                    if (x>=50 && x<=57)
+                        if (fontdata[16*('B')+((y0%30)-8)]&(128>>(x-50)))
+                            indx=255;
+                }
+
+                if (indx>region.levels) {
+                    pixel=COLOR_BLACK;
+                }
+                else
+                {
+                    red=region.color[indx][0];
+                    green=region.color[indx][1];
+                    blue=region.color[indx][2];
+
+                    pixel=RGB(red,green,blue);
+                }
+
+                ImageWriterAppendPixel(&iw, pixel);
+            } 
+
+            ImageWriterEmitLine(&iw);
+        }
+
+        MapImageFinish(&iw,kmz);
+
+#if DO_KMZ
+        if (kmz) {
+            zip_close(kmz);
+            fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
+        } else
+            fprintf(stdout, "\nCouldn't create KMZ file.\n");
+#endif
+    }
+
+    free(mapfile);
+    free(geofile);
+    free(kmlfile);
+    free(ckfile);
+#if DO_KMZ
+    free(kmzfile);
+#endif
+
+    threadStats.s.image_s += StatsSeconds()-stats_t0;
+
+    fprintf(stdout,"Done!\n");
+    fflush(stdout);
+}
+
+/* Generates a topographic map based on the signal strength values held in the
+ * signal[][] array. The image created is rotated counter-clockwise 90 degrees
+ * from its representation in dem[][] so that north points up and east points
+ * right.
+ *
+ * In this version of the WriteImage function the signal strength is
+ *  plotted (vs the power level, plotted by WriteImageDBM).
+ */
+void WriteImageSS(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites, bool multithread)
+{
+    const char *suffix;
+    char *mapfile, *geofile, *kmlfile, *ckfile;
+#if DO_KMZ
+    char *kmzfile;
+#endif
+    struct zip_t *kmz=NULL;
+    unsigned width, height, red, green, blue;
+    unsigned int imgheight, imgwidth;
+    int indx, x, x0, y0, level, hundreds,
+        tens, units, colorwidth;
+    double conversion, one_over_gamma,
+           north, south, east, west, minwest;
+    FILE *fd;
+
+    Pixel pixel = 0;
+    ImageWriter iw;
+
+    double stats_t0=StatsSeconds();
+
+    one_over_gamma=1.0/GAMMA;
+    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+
+    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
+    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+
+    LoadSignalColors(xmtr[0]);
+
+    if (!filename || filename[0]=='\0')
+    {
+        filename = xmtr[0].filename;
+    }
+
+    switch (imagetype) {
+        default:
+#ifdef HAVE_LIBPNG
+        case IMAGETYPE_PNG:
+            suffix = "png";
+            break;
+#endif
+#ifdef HAVE_LIBJPEG
+        case IMAGETYPE_JPG:
+            suffix = "jpg";
+            break;
+#endif
+        case IMAGETYPE_PPM:
+            suffix = "ppm";
+            break;
+    }
+    mapfile = copyFilename(filename, suffix);
+    geofile = copyFilename(filename, "geo");
+    kmlfile = copyFilename(filename, "kml");
+#if DO_KMZ
+    kmzfile = copyFilename(filename, "kmz");
+#endif
+
+    /* ick */
+    ckfile = copyFilename(filename, NULL);
+    ckfile = (char*)realloc(ckfile, strlen(ckfile)+strlen(suffix)+5);
+    strcat(ckfile, "-ck.");
+    strcat(ckfile, suffix);
+
+    minwest=((double)min_west)+dpp;
+
+    if (minwest>360.0)
+        minwest-=360.0;
+
+    north=(double)max_north-dpp;
+
+    if (kml || geo)
+        south=(double)min_north;	/* No bottom legend */
+    else
+        south=(double)min_north-(30.0/ppd);	/* 30 pixels for bottom legend */
+
+    east=(minwest<180.0?-minwest:360.0-min_west);
+    west=(double)(max_west<180?-max_west:360-max_west);
+
+    if (geo && !kml)
+    {
+        fd=fopen(geofile,"wb");
+
+        fprintf(fd,"FILENAME\t%s\n",mapfile);
+        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
+        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+
+        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
+        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
+
+        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+
+        fclose(fd);
+    }
+
+#if DO_KMZ
+    if (kml)
+        kmz=zip_open(kmzfile,ZIP_DEFAULT_COMPRESSION_LEVEL,'w');
+#endif
+
+    if (kml && !geo)
+    {   
+        KmlSink ks;
+
+        KmlOpen(&ks,kmz,kmlfile);
+
+        KmlPrintf(&ks,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+        KmlPrintf(&ks,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
+        KmlPrintf(&ks,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME,SPLAT_VERSION);
+        KmlPrintf(&ks,"  <Folder>\n");
+        KmlPrintf(&ks,"   <name>%s</name>\n",SPLAT_NAME);
+        KmlPrintf(&ks,"	 <description>%s Transmitter Contours</description>\n",xmtr[0].name);
+        KmlPrintf(&ks,"	   <GroundOverlay>\n");
+        KmlPrintf(&ks,"		 <name>SPLAT! Signal Strength Contours</name>\n");
+        KmlPrintf(&ks,"		 <description>SPLAT! Coverage</description>\n");
+        KmlPrintf(&ks,"		 <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
+        KmlPrintf(&ks,"		 <Icon>\n");
+        KmlPrintf(&ks,"			  <href>%s</href>\n",basename_s(mapfile));
+        KmlPrintf(&ks,"		 </Icon>\n");
+        /* KmlPrintf(&ks,"			<opacity>128</opacity>\n"); */
+        KmlPrintf(&ks,"			<LatLonBox>\n");
+        KmlPrintf(&ks,"			   <north>%.5f</north>\n",north);
+        KmlPrintf(&ks,"			   <south>%.5f</south>\n",south);
+        KmlPrintf(&ks,"			   <east>%.5f</east>\n",east);
+        KmlPrintf(&ks,"			   <west>%.5f</west>\n",west);
+        KmlPrintf(&ks,"			   <rotation>0.0</rotation>\n");
+        KmlPrintf(&ks,"			</LatLonBox>\n");
+        KmlPrintf(&ks,"	   </GroundOverlay>\n");
+        KmlPrintf(&ks,"	   <ScreenOverlay>\n");
+        KmlPrintf(&ks,"		  <name>Color Key</name>\n");
+        KmlPrintf(&ks,"		  <description>Contour Color Key</description>\n");
+        KmlPrintf(&ks,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
+        KmlPrintf(&ks,"		  <Icon>\n");
+        KmlPrintf(&ks,"			<href>%s</href>\n",basename_s(ckfile));
+        KmlPrintf(&ks,"		  </Icon>\n");
+        KmlPrintf(&ks,"		  <overlayXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"		  <screenXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"		  <rotationXY x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"		  <size x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
+        KmlPrintf(&ks,"	   </ScreenOverlay>\n");
+
+        for (unsigned int i=0; i<txsites; i++)
+        {
+            KmlPrintf(&ks,"	 <Placemark>\n");
+            KmlPrintf(&ks,"	   <name>%s</name>\n",xmtr[i].name);
+            KmlPrintf(&ks,"	   <visibility>1</visibility>\n");
+            KmlPrintf(&ks,"	   <Style>\n");
+            KmlPrintf(&ks,"	   <IconStyle>\n");
+            KmlPrintf(&ks,"		<Icon>\n");
+            KmlPrintf(&ks,"		  <href>root://icons/palette-5.png</href>\n");
+            KmlPrintf(&ks,"		  <x>224</x>\n");
+            KmlPrintf(&ks,"		  <y>224</y>\n");
+            KmlPrintf(&ks,"		  <w>32</w>\n");
+            KmlPrintf(&ks,"		  <h>32</h>\n");
+            KmlPrintf(&ks,"		</Icon>\n");
+            KmlPrintf(&ks,"	   </IconStyle>\n");
+            KmlPrintf(&ks,"	   </Style>\n");
+            KmlPrintf(&ks,"	  <Point>\n");
+            KmlPrintf(&ks,"		<extrude>1</extrude>\n");
+            KmlPrintf(&ks,"		<altitudeMode>relativeToGround</altitudeMode>\n");
+            KmlPrintf(&ks,"		<coordinates>%f,%f,%f</coordinates>\n",(xmtr[i].lon<180.0?-xmtr[i].lon:360.0-xmtr[i].lon), xmtr[i].lat, xmtr[i].alt);
+            KmlPrintf(&ks,"	  </Point>\n");
+            KmlPrintf(&ks,"	 </Placemark>\n");
+        }
+
+        KmlPrintf(&ks,"  </Folder>\n");
+        KmlPrintf(&ks,"</kml>\n");
+
+        KmlClose(&ks);
+    }
+
+    if (kml || geo)
+    {
+        /* No bottom legend */
+        imgwidth = width;
+        imgheight = height;
+    }
+    else
+    {
+        /* Allow space for bottom legend */
+        imgwidth = width;
+        imgheight = height + 30;
+    }
+
+    fprintf(stdout,"\nWriting Signal Strength map \"%s\" (%ux%u image)... ",mapfile,imgwidth,imgheight);
+    fflush(stdout);
+
+    if (MapImageInit(&iw,kmz,mapfile,imagetype,imgwidth,imgheight)<0) {
+        fprintf(stdout,"\nError writing \"%s\"!\n",mapfile);
+        fflush(stdout);
+        return;
+    }
+
+    RenderRaster(&iw,width,height,multithread,
+        [&](DEM *dem, int x0, int y0) -> Pixel {
+            unsigned char mask;
+            unsigned red, green, blue, terrain;
+            int z, signal, match;
+            Pixel pixel=0;
+
+            {
+                mask=DEMMask(dem,x0,y0);
+                signal=(DEMSignal(dem,x0,y0))-100;
+
+                match=255;
+
+                red=0;
+                green=0;
+                blue=0;
+
+                if (signal>=region.level[0])
+                    match=0;
+                else
+                {
+                    for (z=1; (z<region.levels && match==255); z++)
+                    {
+                        if (signal<region.level[z-1] && signal>=region.level[z])
+                            match=z;
+                    }
+                }
+
+                if (match<region.levels)
+                {
+                    if (smooth_contours && match>0)
+                    {
+                        red=(unsigned)interpolate(region.color[match][0],region.color[match-1][0],region.level[match],region.level[match-1],signal);
+                        green=(unsigned)interpolate(region.color[match][1],region.color[match-1][1],region.level[match],region.level[match-1],signal);
+                        blue=(unsigned)interpolate(region.color[match][2],region.color[match-1][2],region.level[match],region.level[match-1],signal);
+                    }
+
+                    else
+                    {
+                        red=region.color[match][0];
+                        green=region.color[match][1];
+                        blue=region.color[match][2];
+                    }
+                }
+
+                if (mask&2) 
+                {
+                    /* Text Labels: Red or otherwise */
+
+                    if (red>=180 && green<=75 && blue<=75)
+                        pixel=RGB(255^red,255^green,255^blue);
+                    else
+                        pixel=COLOR_RED;
+                }
+                else if (mask&4)
+                {
+                    /* County Boundaries: Black */
+                    pixel=COLOR_BLACK;
+                } 
+                else
+                {
+                    if (contour_threshold!=0 && signal<contour_threshold)
+                    {
+                        if (ngs)  /* No terrain */
+                            pixel=COLOR_WHITE;
+                        else
+                        {
+                            /* Display land or sea elevation */
+
+                            if (DEMData(dem,x0,y0)==0)
+                                pixel=COLOR_MEDIUMBLUE;
+                            else
+                            {
+                                terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
+                                pixel=RGB(terrain,terrain,terrain);
+                            }
+                        }
+                    }
+
+                    else
+                    {
+                        /* Plot field strength regions in color */
+
+                        if (red!=0 || green!=0 || blue!=0)
+                            pixel=RGB(red,green,blue);
+
+                        else  /* terrain / sea-level */
+                        {
+                            if (ngs)
+                                pixel=COLOR_WHITE;
+                            else
+                            {
+                                if (DEMData(dem,x0,y0)==0)
+                                    pixel=COLOR_MEDIUMBLUE;
+                                else
+                                {
+                                    /* Elevation: Greyscale */
+                                    terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
+                                    pixel=RGB(terrain,terrain,terrain);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            return pixel;
+        });
+
+    if (!kml && !geo)
+    {
+        /* Display legend along bottom of image
+         * if not generating .kml or .geo output.
+         */
+
+        colorwidth=(int)rint((float)width/(float)region.levels);
+
+        for (y0=0; y0<30; y0++)
+        {
+            for (x0=0; x0<(int)width; x0++)
+            {
+                indx=x0/colorwidth;
+                x=x0%colorwidth;
+                level=region.level[indx];
+
+                hundreds=level/100;
+
+                if (hundreds>0)
+                    level-=(hundreds*100);
+
+                tens=level/10;
+
+                if (tens>0)
+                    level-=(tens*10);
+
+                units=level;
+
+                if (y0>=8 && y0<=23)
+                {  
+                    if (hundreds>0)
+                    {
+                        if (x>=5 && x<=12)	 
+                            if (fontdata[16*(hundreds+'0')+(y0-8)]&(128>>(x-5)))
+                                indx=255; 
+                    }
+
+                    if (tens>0 || hundreds>0)
+                    {
+                        if (x>=13 && x<=20)	 
+                            if (fontdata[16*(tens+'0')+(y0-8)]&(128>>(x-13)))
+                                indx=255;
+                    }
+
+                    if (x>=21 && x<=28)
+                        if (fontdata[16*(units+'0')+(y0-8)]&(128>>(x-21)))
+                            indx=255;
+
+                    if (x>=36 && x<=43)
+                        if (fontdata[16*('d')+(y0-8)]&(128>>(x-36)))
+                            indx=255;
+
+                    if (x>=44 && x<=51)
+                        if (fontdata[16*('B')+(y0-8)]&(128>>(x-44)))
+                            indx=255;
+
+                    if (x>=52 && x<=59)
+                        if (fontdata[16*(230)+(y0-8)]&(128>>(x-52)))
+                            indx=255;
+
+                    if (x>=60 && x<=67)
+                        if (fontdata[16*('V')+(y0-8)]&(128>>(x-60)))
+                            indx=255;
+
+                    if (x>=68 && x<=75)
+                        if (fontdata[16*('/')+(y0-8)]&(128>>(x-68)))
+                            indx=255;
+
+                    if (x>=76 && x<=83)
+                        if (fontdata[16*('m')+(y0-8)]&(128>>(x-76)))
+                            indx=255;
+                }
+
+                if (indx>region.levels)
+                    pixel=COLOR_BLACK;
+                else
+                {
+                    red=region.color[indx][0];
+                    green=region.color[indx][1];
+                    blue=region.color[indx][2];
+
+                    pixel=RGB(red,green,blue);
+                }
+
+                ImageWriterAppendPixel(&iw, pixel);
+            }
+
+            ImageWriterEmitLine(&iw);
+        }
+    }
+
+    MapImageFinish(&iw,kmz);
+
+    if (kml)
+    {
+        /* Write colorkey image file */
+
+        height=30*region.levels;
+        width=100;
+
+        if (MapImageInit(&iw,kmz,ckfile,imagetype,width,height)<0) {
+            fprintf(stdout,"\nError writing \"%s\"!\n",ckfile);
+            fflush(stdout);
+            return;
+        }
+
+        for (y0=0; y0<(int)height; y0++)
+        {
+            for (x0=0; x0<(int)width; x0++)
+            {
+                indx=y0/30;
+                x=x0;
+
+                level=region.level[indx];
+
+                hundreds=level/100;
+
+                if (hundreds>0)
+                    level-=(hundreds*100);
+
+                tens=level/10;
+
+                if (tens>0)
+                    level-=(tens*10);
+
+                units=level;
+
+                if ((y0%30)>=8 && (y0%30)<=23)
+                {  
+                    if (hundreds>0)
+                    {
+                        if (x>=5 && x<=12)	 
+                            if (fontdata[16*(hundreds+'0')+((y0%30)-8)]&(128>>(x-5)))
+                                indx=255; 
+                    }
+
+                    if (tens>0 || hundreds>0)
+                    {
+                        if (x>=13 && x<=20)	 
+                            if (fontdata[16*(tens+'0')+((y0%30)-8)]&(128>>(x-13)))
+                                indx=255;
+                    }
+
+                    if (x>=21 && x<=28)
+                        if (fontdata[16*(units+'0')+((y0%30)-8)]&(128>>(x-21)))
+                            indx=255;
+
+                    if (x>=36 && x<=43)
+                        if (fontdata[16*('d')+((y0%30)-8)]&(128>>(x-36)))
+                            indx=255;
+
+                    if (x>=44 && x<=51)
+                        if (fontdata[16*('B')+((y0%30)-8)]&(128>>(x-44)))
+                            indx=255;
+
+                    if (x>=52 && x<=59)
+                        if (fontdata[16*(230)+((y0%30)-8)]&(128>>(x-52)))
+                            indx=255;
+
+                    if (x>=60 && x<=67)
+                        if (fontdata[16*('V')+((y0%30)-8)]&(128>>(x-60)))
+                            indx=255;
+
+                    if (x>=68 && x<=75)
+                        if (fontdata[16*('/')+((y0%30)-8)]&(128>>(x-68)))
+                            indx=255;
+
+                    if (x>=76 && x<=83)
+                        if (fontdata[16*('m')+((y0%30)-8)]&(128>>(x-76)))
+                            indx=255;
+                }
+
+                if (indx>region.levels) {
+                    pixel=COLOR_BLACK;
+                }
+                else
+                {
+                    red=region.color[indx][0];
+                    green=region.color[indx][1];
+                    blue=region.color[indx][2];
+
+                    pixel=RGB(red,green,blue);
+                }
+
+                ImageWriterAppendPixel(&iw, pixel);
+            } 
+
+            ImageWriterEmitLine(&iw);
+        }
+
+        MapImageFinish(&iw,kmz);
+
+#if DO_KMZ
+        if (kmz) {
+            zip_close(kmz);
+            fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
+        } else
+            fprintf(stdout, "\nCouldn't create KMZ file.\n");
+#endif
+    }
+
+    free(mapfile);
+    free(geofile);
+    free(kmlfile);
+    free(ckfile);
+#if DO_KMZ
+    free(kmzfile);
+#endif
+
+    threadStats.s.image_s += StatsSeconds()-stats_t0;
+
+    fprintf(stdout,"Done!\n");
+    fflush(stdout);
+}
+
+/* Generates a topographic map based on the signal strength values held in the
+ * signal[][] array. The image created is rotated counter-clockwise 90 degrees
+ * from its representation in dem[][] so that north points up and east points
+ * right.
+ *
+ * In this version of the WriteImage function the power level is
+ *  plotted (vs the signal strength, plotted by WriteImageDBM).
+ */
+void WriteImageDBM(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites, bool multithread)
+{
+    const char *suffix;
+    char *mapfile, *geofile, *kmlfile, *ckfile;
+    unsigned width, height, red, green, blue;
+    unsigned int imgheight, imgwidth;
+    int indx, x, x0, y0, level, hundreds,
+        tens, units, colorwidth;
+    double conversion, one_over_gamma,
+           north, south, east, west, minwest;
+    FILE *fd;
+
+    Pixel pixel = 0;
+    ImageWriter iw;
+
+    double stats_t0=StatsSeconds();
+
+    one_over_gamma=1.0/GAMMA;
+    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+
+    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
+    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+
+    LoadDBMColors(xmtr[0]);
+
+    if (!filename || filename[0]=='\0')
+    {
+        filename = xmtr[0].filename;
+    }
+
+    switch (imagetype) {
+        default:
+#ifdef HAVE_LIBPNG
+        case IMAGETYPE_PNG:
+            suffix = "png";
+            break;
+#endif
+#ifdef HAVE_LIBJPEG
+        case IMAGETYPE_JPG:
+            suffix = "jpg";
+            break;
+#endif
+        case IMAGETYPE_PPM:
+            suffix = "ppm";
+            break;
+    }
+    mapfile = copyFilename(filename, suffix);
+    geofile = copyFilename(filename, "geo");
+    kmlfile = copyFilename(filename, "kml");
+
+    /* ick */
+    ckfile = copyFilename(filename, NULL);
+    ckfile = (char*)realloc(ckfile, strlen(ckfile)+strlen(suffix)+5);
+    strcat(ckfile, "-ck.");
+    strcat(ckfile, suffix);
+
+    minwest=((double)min_west)+dpp;
+
+    if (minwest>360.0)
+        minwest-=360.0;
+
+    north=(double)max_north-dpp;
+
+    if (kml || geo)
+        south=(double)min_north;	/* No bottom legend */
+    else
+        south=(double)min_north-(30.0/ppd);	/* 30 pixels for bottom legend */
+
+    east=(minwest<180.0?-minwest:360.0-min_west);
+    west=(double)(max_west<180?-max_west:360-max_west);
+
+    if (geo && !kml)
+    {
+        fd=fopen(geofile,"wb");
+
+        fprintf(fd,"FILENAME\t%s\n",mapfile);
+        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
+        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+
+        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
+        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
+
+        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+
+        fclose(fd);
+    }
+
+    if (kml && !geo)
+    {
+        fd=fopen(kmlfile,"wb");
 
         fprintf(fd,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
         fprintf(fd,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
         fprintf(fd,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME,SPLAT_VERSION);
         fprintf(fd,"  <Folder>\n");
         fprintf(fd,"   <name>%s</name>\n",SPLAT_NAME);
-        fprintf(fd,"	 <description>%s Transmitter Path Loss Overlay</description>\n",xmtr[0].name);
+        fprintf(fd,"	 <description>%s Transmitter Contours</description>\n",xmtr[0].name);
         fprintf(fd,"	   <GroundOverlay>\n");
-        fprintf(fd,"		  <name>SPLAT! Path Loss Overlay</name>\n");
-        fprintf(fd,"		  <description>SPLAT! Coverage</description>\n");
-        fprintf(fd,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
-        fprintf(fd,"		  <Icon>\n");
+        fprintf(fd,"		 <name>SPLAT! Signal Power Level Contours</name>\n");
+        fprintf(fd,"		 <description>SPLAT! Coverage</description>\n");
+        fprintf(fd,"		 <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
+        fprintf(fd,"		 <Icon>\n");
         fprintf(fd,"			  <href>%s</href>\n",basename_s(mapfile));
-        fprintf(fd,"		  </Icon>\n");
+        fprintf(fd,"		 </Icon>\n");
         /* fprintf(fd,"			<opacity>128</opacity>\n"); */
         fprintf(fd,"			<LatLonBox>\n");
         fprintf(fd,"			   <north>%.5f</north>\n",north);
@@ -4957,7 +8540,7 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
         imgheight = height + 30;
     }
 
-    fprintf(stdout,"\nWriting LR map \"%s\" (%ux%u image)... ",mapfile,imgwidth,imgheight);
+    fprintf(stdout,"\nWriting Power Level (dBm) map \"%s\" (%ux%u image)... ",mapfile,imgwidth,imgheight);
     fflush(stdout);
 
     if (ImageWriterInit(&iw,mapfile,imagetype,imgwidth,imgheight)<0) {
@@ -4966,18 +8549,16 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
         return;
     }
 
-    for (y=0, lat=north; y<(int)height; y++, lat=north-(dpp*(double)y))
-    {
-        for (x=0, lon=max_west; x<(int)width; x++, lon=max_west-(dpp*(double)x))
-        {
-            if (lon<0.0)
-                lon+=360.0;
+    RenderRaster(&iw,width,height,multithread,
+        [&](DEM *dem, int x0, int y0) -> Pixel {
+            unsigned char mask;
+            unsigned red, green, blue, terrain;
+            int z, dBm, match;
+            Pixel pixel=0;
 
-            dem = FindDEM(lat, lon, x0, y0);
-            if (dem)
             {
-                mask=dem->mask[x0][y0];
-                loss=(dem->signal[x0][y0]);
+                mask=DEMMask(dem,x0,y0);
+                dBm=(DEMSignal(dem,x0,y0))-200;
 
                 match=255;
 
@@ -4985,13 +8566,13 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                 green=0;
                 blue=0;
 
-                if (loss<=region.level[0])
+                if (dBm>=region.level[0])
                     match=0;
                 else
                 {
                     for (z=1; (z<region.levels && match==255); z++)
                     {
-                        if (loss>=region.level[z-1] && loss<region.level[z])
+                        if (dBm<region.level[z-1] && dBm>=region.level[z])
                             match=z;
                     }
                 }
@@ -5000,9 +8581,9 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                 {
                     if (smooth_contours && match>0)
                     {
-                        red=(unsigned)interpolate(region.color[match-1][0],region.color[match][0],region.level[match-1],region.level[match],loss);
-                        green=(unsigned)interpolate(region.color[match-1][1],region.color[match][1],region.level[match-1],region.level[match],loss);
-                        blue=(unsigned)interpolate(region.color[match-1][2],region.color[match][2],region.level[match-1],region.level[match],loss);
+                        red=(unsigned)interpolate(region.color[match][0],region.color[match-1][0],region.level[match],region.level[match-1],dBm);
+                        green=(unsigned)interpolate(region.color[match][1],region.color[match-1][1],region.level[match],region.level[match-1],dBm);
+                        blue=(unsigned)interpolate(region.color[match][2],region.color[match-1][2],region.level[match],region.level[match-1],dBm);
                     }
 
                     else
@@ -5013,11 +8594,11 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                     }
                 }
 
-                if (mask&2)
+                if (mask&2) 
                 {
                     /* Text Labels: Red or otherwise */
 
-                    if (red>=180 && green<=75 && blue<=75 && loss!=0)
+                    if (red>=180 && green<=75 && blue<=75 && dBm!=0)
                         pixel=RGB(255^red,255^green,255^blue);
                     else
                         pixel=COLOR_RED;
@@ -5029,62 +8610,58 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                 }
                 else
                 {
-                    if (loss==0 || (contour_threshold!=0 && loss>abs(contour_threshold)))
+                    if (contour_threshold!=0 && dBm<contour_threshold)
                     {
-                        if (ngs)  /* No terrain */
+                        if (ngs) /* No terrain */
                             pixel=COLOR_WHITE;
                         else
                         {
                             /* Display land or sea elevation */
 
-                            if (dem->data[x0][y0]==0)
+                            if (DEMData(dem,x0,y0)==0)
                                 pixel=COLOR_MEDIUMBLUE;
                             else
                             {
-                                terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
+                                terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
                                 pixel=RGB(terrain,terrain,terrain);
                             }
                         }
                     }
+
                     else
                     {
-                        /* Plot path loss in color */
+                        /* Plot signal power level regions in color */
 
                         if (red!=0 || green!=0 || blue!=0)
                             pixel=RGB(red,green,blue);
 
                         else  /* terrain / sea-level */
                         {
-                            if (dem->data[x0][y0]==0)
-                                pixel=COLOR_MEDIUMBLUE;
+                            if (ngs)
+                                pixel=COLOR_WHITE;
                             else
                             {
-                                /* Elevation: Greyscale */
-                                terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
-                                pixel=RGB(terrain,terrain,terrain);
+                                if (DEMData(dem,x0,y0)==0)
+                                    pixel=COLOR_MEDIUMBLUE;
+                                else
+                                {
+                                    /* Elevation: Greyscale */
+                                    terrain=(unsigned)(0.5+pow((double)(DEMData(dem,x0,y0)-min_elevation),one_over_gamma)*conversion);
+                                    pixel=RGB(terrain,terrain,terrain);
+                                }
                             }
                         }
                     }
                 }
             }
-            else
-            {
-                /* We should never get here, but if */
-                /* we do, display the region as black */
-                pixel=COLOR_BLACK;
-            }
-
-            ImageWriterAppendPixel(&iw, pixel);
-        }
 
-        ImageWriterEmitLine(&iw);
-    }
+            return pixel;
+        });
 
     if (!kml && !geo)
     {
         /* Display legend along bottom of image
-         * if not generating .kml or .geo output.
-         */
+           if not generating .kml or .geo output. */
 
         colorwidth=(int)rint((float)width/(float)region.levels);
 
@@ -5094,7 +8671,8 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
             {
                 indx=x0/colorwidth;
                 x=x0%colorwidth;
-                level=region.level[indx];
+
+                level=abs(region.level[indx]);
 
                 hundreds=level/100;
 
@@ -5109,31 +8687,83 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                 units=level;
 
                 if (y0>=8 && y0<=23)
-                {  
+                {
                     if (hundreds>0)
                     {
-                        if (x>=11 && x<=18)	 
-                            if (fontdata[16*(hundreds+'0')+(y0-8)]&(128>>(x-11)))
+                        if (region.level[indx]<0)
+                        {
+                            if (x>=5 && x<=12)
+                                if (fontdata[16*('-')+(y0-8)]&(128>>(x-5)))
+                                    indx=255;
+                        }
+
+                        else
+                        {
+                            if (x>=5 && x<=12)
+                                if (fontdata[16*('+')+(y0-8)]&(128>>(x-5)))
+                                    indx=255;
+                        }
+
+                        if (x>=13 && x<=20)	 
+                            if (fontdata[16*(hundreds+'0')+(y0-8)]&(128>>(x-13)))
                                 indx=255; 
                     }
 
                     if (tens>0 || hundreds>0)
                     {
-                        if (x>=19 && x<=26)	 
-                            if (fontdata[16*(tens+'0')+(y0-8)]&(128>>(x-19)))
+                        if (hundreds==0)
+                        {
+                            if (region.level[indx]<0)
+                            {
+                                if (x>=13 && x<=20)
+                                    if (fontdata[16*('-')+(y0-8)]&(128>>(x-13)))
+                                        indx=255;
+                            }
+
+                            else
+                            {
+                                if (x>=13 && x<=20)
+                                    if (fontdata[16*('+')+(y0-8)]&(128>>(x-13)))
+                                        indx=255;
+                            }
+                        }
+
+                        if (x>=21 && x<=28)	 
+                            if (fontdata[16*(tens+'0')+(y0-8)]&(128>>(x-21)))
                                 indx=255;
                     }
 
-                    if (x>=27 && x<=34)
-                        if (fontdata[16*(units+'0')+(y0-8)]&(128>>(x-27)))
+                    if (hundreds==0 && tens==0)
+                    {
+                        if (region.level[indx]<0)
+                        {
+                            if (x>=21 && x<=28)
+                                if (fontdata[16*('-')+(y0-8)]&(128>>(x-21)))
+                                    indx=255;
+                        }
+
+                        else
+                        {
+                            if (x>=21 && x<=28)
+                                if (fontdata[16*('+')+(y0-8)]&(128>>(x-21)))
+                                    indx=255;
+                        }
+                    }
+
+                    if (x>=29 && x<=36)
+                        if (fontdata[16*(units+'0')+(y0-8)]&(128>>(x-29)))
                             indx=255;
 
-                    if (x>=42 && x<=49)
-                        if (fontdata[16*('d')+(y0-8)]&(128>>(x-42)))
+                    if (x>=37 && x<=44)
+                        if (fontdata[16*('d')+(y0-8)]&(128>>(x-37)))
                             indx=255;
 
-                    if (x>=50 && x<=57)
-                        if (fontdata[16*('B')+(y0-8)]&(128>>(x-50)))
+                    if (x>=45 && x<=52)
+                        if (fontdata[16*('B')+(y0-8)]&(128>>(x-45)))
+                            indx=255;
+
+                    if (x>=53 && x<=60)
+                        if (fontdata[16*('m')+(y0-8)]&(128>>(x-53)))
                             indx=255;
                 }
 
@@ -5149,7 +8779,7 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                 }
 
                 ImageWriterAppendPixel(&iw, pixel);
-            }
+            } 
 
             ImageWriterEmitLine(&iw);
         }
@@ -5160,7 +8790,6 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
     if (kml)
     {
         /* Write colorkey image file */
-
         height=30*region.levels;
         width=100;
 
@@ -5176,7 +8805,8 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
             {
                 indx=y0/30;
                 x=x0;
-                level=region.level[indx];
+
+                level=abs(region.level[indx]);
 
                 hundreds=level/100;
 
@@ -5190,32 +8820,85 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
 
                 units=level;
 
+
                 if ((y0%30)>=8 && (y0%30)<=23)
-                {  
+                {
                     if (hundreds>0)
                     {
-                        if (x>=11 && x<=18)	 
-                            if (fontdata[16*(hundreds+'0')+((y0%30)-8)]&(128>>(x-11)))
+                        if (region.level[indx]<0)
+                        {
+                            if (x>=5 && x<=12)
+                                if (fontdata[16*('-')+((y0%30)-8)]&(128>>(x-5)))
+                                    indx=255;
+                        }
+
+                        else
+                        {
+                            if (x>=5 && x<=12)
+                                if (fontdata[16*('+')+((y0%30)-8)]&(128>>(x-5)))
+                                    indx=255;
+                        }
+
+                        if (x>=13 && x<=20)	 
+                            if (fontdata[16*(hundreds+'0')+((y0%30)-8)]&(128>>(x-13)))
                                 indx=255; 
                     }
 
                     if (tens>0 || hundreds>0)
                     {
-                        if (x>=19 && x<=26)	 
-                            if (fontdata[16*(tens+'0')+((y0%30)-8)]&(128>>(x-19)))
+                        if (hundreds==0)
+                        {
+                            if (region.level[indx]<0)
+                            {
+                                if (x>=13 && x<=20)
+                                    if (fontdata[16*('-')+((y0%30)-8)]&(128>>(x-13)))
+                                        indx=255;
+                            }
+
+                            else
+                            {
+                                if (x>=13 && x<=20)
+                                    if (fontdata[16*('+')+((y0%30)-8)]&(128>>(x-13)))
+                                        indx=255;
+                            }
+                        }
+
+                        if (x>=21 && x<=28)	 
+                            if (fontdata[16*(tens+'0')+((y0%30)-8)]&(128>>(x-21)))
                                 indx=255;
                     }
 
-                    if (x>=27 && x<=34)
-                        if (fontdata[16*(units+'0')+((y0%30)-8)]&(128>>(x-27)))
+                    if (hundreds==0 && tens==0)
+                    {
+                        if (region.level[indx]<0)
+                        {
+                            if (x>=21 && x<=28)
+                                if (fontdata[16*('-')+((y0%30)-8)]&(128>>(x-21)))
+                                    indx=255;
+                        }
+
+                        else
+                        {
+                            if (x>=21 && x<=28)
+                                if (fontdata[16*('+')+((y0%30)-8)]&(128>>(x-21)))
+                                    indx=255;
+                        }
+                    }
+
+                    if (x>=29 && x<=36)
+                        if (fontdata[16*(units+'0')+((y0%30)-8)]&(128>>(x-29)))
                             indx=255;
 
-                    if (x>=42 && x<=49)
-                        if (fontdata[16*('d')+((y0%30)-8)]&(128>>(x-42)))
+                    if (x>=37 && x<=44)
+                        if (fontdata[16*('d')+((y0%30)-8)]&(128>>(x-37)))
                             indx=255;
 
-                    if (x>=50 && x<=57)
-                        if (fontdata[16*('B')+((y0%30)-8)]&(128>>(x-50)))
+                    if (x>=45 && x<=52)
+                        if (fontdata[16*('B')+((y0%30)-8)]&(128>>(x-45)))
+                            indx=255;
+
+                    if (x>=53 && x<=60)
+                        if (fontdata[16*('m')+((y0%30)-8)]&(128>>(x-53)))
                             indx=255;
                 }
 
@@ -5232,52 +8915,12 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
                 }
 
                 ImageWriterAppendPixel(&iw, pixel);
-            } 
+            }
 
             ImageWriterEmitLine(&iw);
         }
 
         ImageWriterFinish(&iw);
-
-#if DO_KMZ
-        bool success = false;
-        struct zip_t *zip = zip_open(kmzfile, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
-        if (zip) {
-            /* Pack the KML */
-            if (zip_entry_open(zip, kmlfile) == 0) {
-                if (zip_entry_fwrite(zip, kmlfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            /* Pack the -ck file */
-            if (zip_entry_open(zip, ckfile) == 0) {
-                if (zip_entry_fwrite(zip, ckfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            /* Pack the map image */
-            if (zip_entry_open(zip, mapfile) == 0) {
-                if (zip_entry_fwrite(zip, mapfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            zip_close(zip);
-        }
-
-        if (success) {
-            unlink(mapfile);
-            unlink(kmlfile);
-            unlink(ckfile);
-            fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
-        } else {
-            unlink(kmzfile);
-            fprintf(stdout, "\nCouldn't create KMZ file.\n");
-        }
-        free(kmzfile);
-#endif
     }
 
     free(mapfile);
@@ -5285,3244 +8928,3829 @@ void WriteImageLR(char *filename, ImageType imagetype, bool geo, bool kml, bool
     free(kmlfile);
     free(ckfile);
 
+    threadStats.s.image_s += StatsSeconds()-stats_t0;
+
     fprintf(stdout,"Done!\n");
     fflush(stdout);
 }
 
-/* Generates a topographic map based on the signal strength values held in the
- * signal[][] array. The image created is rotated counter-clockwise 90 degrees
- * from its representation in dem[][] so that north points up and east points
- * right.
- *
- * In this version of the WriteImage function the signal strength is
- *  plotted (vs the power level, plotted by WriteImageDBM).
- */
-void WriteImageSS(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites)
+/*****************************
+ * In-process profile charts. Each graph used to cost four disk round
+ * trips and a fork: write the series to temp .gp files, write a
+ * splat.gp script, shell out to gnuplot, and have gnuplot re-read it
+ * all. For the raster formats the ImageWriter already encodes (png,
+ * jpg, ppm) the chart is now drawn in-process; anything else (e.g.
+ * postscript) still goes through the old gnuplot path, which the
+ * graph functions keep intact as a fallback.
+ *****************************/
+
+#define CHART_WIDTH          800
+#define CHART_HEIGHT         600
+#define CHART_MARGIN_LEFT     78
+#define CHART_MARGIN_RIGHT    78   /* symmetric; holds the y2 scale */
+#define CHART_MARGIN_TOP      58
+#define CHART_MARGIN_BOTTOM   64
+#define CHART_MAX_SERIES       6
+
+typedef struct ChartSeries {
+    const double *x;
+    const double *y;
+    int n;
+    int y2;		/* scale against the right-hand axis */
+    Pixel color;
+    char label[MAX_LINE_LEN];
+} ChartSeries;
+
+typedef struct Chart {
+    char title[MAX_PATH_LEN];	/* two lines separated by '\n' */
+    char xlabel[MAX_PATH_LEN];
+    char ylabel[MAX_PATH_LEN];	/* drawn vertically; '\n' splits columns */
+    double xmin, xmax, ymin, ymax;
+    double y2min, y2max;
+    int have_y2;
+    int nseries;
+    ChartSeries series[CHART_MAX_SERIES];
+} Chart;
+
+/* The classic gnuplot line color rotation, near enough */
+static const Pixel chartColors[CHART_MAX_SERIES]={
+    RGB(204,0,0), RGB(0,140,0), RGB(0,0,204),
+    RGB(192,0,192), RGB(0,150,150), RGB(224,140,0)
+};
+
+static void ChartAddSeries(Chart *ch, const double *x, const double *y,
+                           int n, int y2, const char *label)
 {
-    const char *suffix;
-    char *mapfile, *geofile, *kmlfile, *ckfile;
-#if DO_KMZ
-    char *kmzfile;
-#endif
-    unsigned width, height, terrain, red, green, blue;
-    unsigned int imgheight, imgwidth;
-    unsigned char mask;
-    int indx, x, y, z=1, x0, y0, signal, level, hundreds,
-        tens, units, match, colorwidth;
-    DEM *dem;
-    double conversion, one_over_gamma, lat, lon,
-           north, south, east, west, minwest;
-    FILE *fd;
+    ChartSeries *s;
 
-    Pixel pixel = 0;
-    ImageWriter iw;
+    if (ch->nseries>=CHART_MAX_SERIES)
+        return;
 
-    one_over_gamma=1.0/GAMMA;
-    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+    s=&ch->series[ch->nseries];
+    s->x=x;
+    s->y=y;
+    s->n=n;
+    s->y2=y2;
+    s->color=chartColors[ch->nseries];
+    snprintf(s->label,MAX_LINE_LEN,"%s",label);
+    ch->nseries++;
+}
 
-    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
-    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+static inline void ChartSetPixel(unsigned char *rgb, int x, int y, Pixel p)
+{
+    unsigned char *b;
 
-    LoadSignalColors(xmtr[0]);
+    if (x<0 || x>=CHART_WIDTH || y<0 || y>=CHART_HEIGHT)
+        return;
 
-    if (!filename || filename[0]=='\0')
+    b=rgb+((size_t)y*CHART_WIDTH+x)*3;
+    b[0]=GetRValue(p);
+    b[1]=GetGValue(p);
+    b[2]=GetBValue(p);
+}
+
+/* Bresenham; endpoints may lie outside the canvas (clipped per pixel) */
+static void ChartDrawLine(unsigned char *rgb, int x0, int y0, int x1, int y1, Pixel p)
+{
+    int dx=abs(x1-x0), dy=-abs(y1-y0);
+    int sx=(x0<x1)?1:-1, sy=(y0<y1)?1:-1;
+    int err=dx+dy, e2;
+
+    for (;;)
     {
-        filename = xmtr[0].filename;
+        ChartSetPixel(rgb,x0,y0,p);
+
+        if (x0==x1 && y0==y1)
+            break;
+
+        e2=2*err;
+
+        if (e2>=dy) { err+=dy; x0+=sx; }
+        if (e2<=dx) { err+=dx; y0+=sy; }
     }
+}
+
+/* The chart strings are shared with the gnuplot fallback scripts and
+ * so use Latin-1, but fontdata is the codepage 437 VGA font; remap the
+ * one non-ASCII character the graphs use (the degree sign).
+ */
+static int ChartGlyph(char c)
+{
+    return ((unsigned char)c==176?248:(unsigned char)c);
+}
+
+/* 8x16 fontdata glyphs, same bit layout PlaceMarker() uses */
+static void ChartDrawText(unsigned char *rgb, int x, int y, const char *text, Pixel p)
+{
+    int a, c;
+    unsigned char byte;
+
+    for (; *text; text++, x+=8)
+        for (a=0; a<16; a++)
+        {
+            byte=fontdata[16*ChartGlyph(*text)+a];
+
+            for (c=0; c<8; c++)
+                if (byte&(128>>c))
+                    ChartSetPixel(rgb,x+c,y+a,p);
+        }
+}
+
+/* Same, rotated a quarter turn counterclockwise for the y-axis label */
+static void ChartDrawTextV(unsigned char *rgb, int x, int y, const char *text, Pixel p)
+{
+    int a, c;
+    unsigned char byte;
+
+    for (; *text; text++, y-=8)
+        for (a=0; a<16; a++)
+        {
+            byte=fontdata[16*ChartGlyph(*text)+a];
+
+            for (c=0; c<8; c++)
+                if (byte&(128>>c))
+                    ChartSetPixel(rgb,x+a,y-c,p);
+        }
+}
+
+/* A "nice" tick spacing (1, 2 or 5 times a power of ten) giving about
+ * six intervals across the range.
+ */
+static double ChartTickStep(double range)
+{
+    double step=pow(10.0,floor(log10(range/6.0)));
+
+    if (range/step>30.0)
+        step*=5.0;
+    else if (range/step>12.0)
+        step*=2.0;
+
+    return step;
+}
+
+static int ChartMapX(const Chart *ch, double x)
+{
+    return CHART_MARGIN_LEFT+(int)rint((x-ch->xmin)/(ch->xmax-ch->xmin)*
+           (double)(CHART_WIDTH-CHART_MARGIN_LEFT-CHART_MARGIN_RIGHT));
+}
+
+static int ChartMapY(const Chart *ch, double y, int y2)
+{
+    double lo=y2?ch->y2min:ch->ymin;
+    double hi=y2?ch->y2max:ch->ymax;
+
+    return (CHART_HEIGHT-CHART_MARGIN_BOTTOM)-(int)rint((y-lo)/(hi-lo)*
+           (double)(CHART_HEIGHT-CHART_MARGIN_TOP-CHART_MARGIN_BOTTOM));
+}
+
+/* Renders the chart to basename.ext if ext is a raster format the
+ * ImageWriter can encode. Returns 0 on success and -1 when the format
+ * isn't ours, in which case the caller falls back to gnuplot.
+ */
+static int ChartRender(Chart *ch, const char *basename, const char *ext)
+{
+    int i, j, px, py, x0, y0, x1, y1, len;
+    double v, step;
+    char filename[MAX_PATH_LEN+20], buf[64], *line2;
+    unsigned char *rgb;
+    ImageType it;
+    ImageWriter iw;
+    const Pixel black=COLOR_BLACK, grey=RGB(208,208,208), frame=RGB(96,96,96);
+    const int left=CHART_MARGIN_LEFT, right=CHART_WIDTH-CHART_MARGIN_RIGHT;
+    const int top=CHART_MARGIN_TOP, bottom=CHART_HEIGHT-CHART_MARGIN_BOTTOM;
 
-    switch (imagetype) {
-        default:
 #ifdef HAVE_LIBPNG
-        case IMAGETYPE_PNG:
-            suffix = "png";
-            break;
+    if (strcmp(ext,"png")==0)
+        it=IMAGETYPE_PNG;
+    else
 #endif
 #ifdef HAVE_LIBJPEG
-        case IMAGETYPE_JPG:
-            suffix = "jpg";
-            break;
+    if (strcmp(ext,"jpg")==0 || strcmp(ext,"jpeg")==0)
+        it=IMAGETYPE_JPG;
+    else
 #endif
-        case IMAGETYPE_PPM:
-            suffix = "ppm";
-            break;
+    if (strcmp(ext,"ppm")==0)
+        it=IMAGETYPE_PPM;
+    else
+        return -1;
+
+    if (ch->xmax<=ch->xmin || ch->ymax<=ch->ymin ||
+        (ch->have_y2 && ch->y2max<=ch->y2min))
+        return -1;
+
+    rgb=(unsigned char *)malloc((size_t)CHART_WIDTH*CHART_HEIGHT*3);
+
+    if (rgb==NULL)
+        return -1;
+
+    memset(rgb,255,(size_t)CHART_WIDTH*CHART_HEIGHT*3);
+
+    /* Grid and tick labels */
+
+    step=ChartTickStep(ch->xmax-ch->xmin);
+
+    for (v=step*ceil(ch->xmin/step); v<=ch->xmax+step/1e6; v+=step)
+    {
+        px=ChartMapX(ch,v);
+
+        for (py=top; py<=bottom; py++)
+            ChartSetPixel(rgb,px,py,grey);
+
+        snprintf(buf,sizeof(buf),"%g",step*rint(v/step));
+        ChartDrawText(rgb,px-(int)(4*strlen(buf)),bottom+6,buf,black);
     }
-    mapfile = copyFilename(filename, suffix);
-    geofile = copyFilename(filename, "geo");
-    kmlfile = copyFilename(filename, "kml");
-#if DO_KMZ
-    kmzfile = copyFilename(filename, "kmz");
-#endif
 
-    /* ick */
-    ckfile = copyFilename(filename, NULL);
-    ckfile = (char*)realloc(ckfile, strlen(ckfile)+strlen(suffix)+5);
-    strcat(ckfile, "-ck.");
-    strcat(ckfile, suffix);
+    step=ChartTickStep(ch->ymax-ch->ymin);
 
-    minwest=((double)min_west)+dpp;
+    for (v=step*ceil(ch->ymin/step); v<=ch->ymax+step/1e6; v+=step)
+    {
+        py=ChartMapY(ch,v,0);
 
-    if (minwest>360.0)
-        minwest-=360.0;
+        for (px=left; px<=right; px++)
+            ChartSetPixel(rgb,px,py,grey);
+
+        snprintf(buf,sizeof(buf),"%g",step*rint(v/step));
+        ChartDrawText(rgb,left-8-8*(int)strlen(buf),py-8,buf,black);
+    }
+
+    if (ch->have_y2)
+    {
+        step=ChartTickStep(ch->y2max-ch->y2min);
+
+        for (v=step*ceil(ch->y2min/step); v<=ch->y2max+step/1e6; v+=step)
+        {
+            py=ChartMapY(ch,v,1);
+
+            snprintf(buf,sizeof(buf),"%g",step*rint(v/step));
+            ChartDrawText(rgb,right+8,py-8,buf,black);
+        }
+    }
+
+    /* Plot frame */
+
+    for (px=left; px<=right; px++)
+    {
+        ChartSetPixel(rgb,px,top,frame);
+        ChartSetPixel(rgb,px,bottom,frame);
+    }
+
+    for (py=top; py<=bottom; py++)
+    {
+        ChartSetPixel(rgb,left,py,frame);
+        ChartSetPixel(rgb,right,py,frame);
+    }
 
-    north=(double)max_north-dpp;
+    /* Title (up to two lines), axis labels */
 
-    if (kml || geo)
-        south=(double)min_north;	/* No bottom legend */
-    else
-        south=(double)min_north-(30.0/ppd);	/* 30 pixels for bottom legend */
+    line2=strchr(ch->title,'\n');
 
-    east=(minwest<180.0?-minwest:360.0-min_west);
-    west=(double)(max_west<180?-max_west:360-max_west);
+    if (line2!=NULL)
+        *line2++=0;
 
-    if (geo && !kml)
+    len=(int)strlen(ch->title);
+    ChartDrawText(rgb,(CHART_WIDTH-8*len)/2,line2?8:16,ch->title,black);
+
+    if (line2!=NULL)
     {
-        fd=fopen(geofile,"wb");
+        len=(int)strlen(line2);
+        ChartDrawText(rgb,(CHART_WIDTH-8*len)/2,26,line2,black);
+    }
 
-        fprintf(fd,"FILENAME\t%s\n",mapfile);
-        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
-        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+    len=(int)strlen(ch->xlabel);
+    ChartDrawText(rgb,(CHART_WIDTH-8*len)/2,CHART_HEIGHT-26,ch->xlabel,black);
 
-        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
-        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
+    line2=strchr(ch->ylabel,'\n');
 
-        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+    if (line2!=NULL)
+        *line2++=0;
 
-        fclose(fd);
+    len=(int)strlen(ch->ylabel);
+    ChartDrawTextV(rgb,line2?2:10,(CHART_HEIGHT+8*len)/2,ch->ylabel,black);
+
+    if (line2!=NULL)
+    {
+        len=(int)strlen(line2);
+        ChartDrawTextV(rgb,20,(CHART_HEIGHT+8*len)/2,line2,black);
     }
 
-    if (kml && !geo)
-    {   
-        fd=fopen(kmlfile,"wb");
+    /* Series polylines, clipped per pixel by ChartSetPixel() */
 
-        fprintf(fd,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-        fprintf(fd,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
-        fprintf(fd,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME,SPLAT_VERSION);
-        fprintf(fd,"  <Folder>\n");
-        fprintf(fd,"   <name>%s</name>\n",SPLAT_NAME);
-        fprintf(fd,"	 <description>%s Transmitter Contours</description>\n",xmtr[0].name);
-        fprintf(fd,"	   <GroundOverlay>\n");
-        fprintf(fd,"		 <name>SPLAT! Signal Strength Contours</name>\n");
-        fprintf(fd,"		 <description>SPLAT! Coverage</description>\n");
-        fprintf(fd,"		 <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
-        fprintf(fd,"		 <Icon>\n");
-        fprintf(fd,"			  <href>%s</href>\n",basename_s(mapfile));
-        fprintf(fd,"		 </Icon>\n");
-        /* fprintf(fd,"			<opacity>128</opacity>\n"); */
-        fprintf(fd,"			<LatLonBox>\n");
-        fprintf(fd,"			   <north>%.5f</north>\n",north);
-        fprintf(fd,"			   <south>%.5f</south>\n",south);
-        fprintf(fd,"			   <east>%.5f</east>\n",east);
-        fprintf(fd,"			   <west>%.5f</west>\n",west);
-        fprintf(fd,"			   <rotation>0.0</rotation>\n");
-        fprintf(fd,"			</LatLonBox>\n");
-        fprintf(fd,"	   </GroundOverlay>\n");
-        fprintf(fd,"	   <ScreenOverlay>\n");
-        fprintf(fd,"		  <name>Color Key</name>\n");
-        fprintf(fd,"		  <description>Contour Color Key</description>\n");
-        fprintf(fd,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
-        fprintf(fd,"		  <Icon>\n");
-        fprintf(fd,"			<href>%s</href>\n",basename_s(ckfile));
-        fprintf(fd,"		  </Icon>\n");
-        fprintf(fd,"		  <overlayXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"		  <screenXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"		  <rotationXY x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"		  <size x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"	   </ScreenOverlay>\n");
+    for (i=0; i<ch->nseries; i++)
+    {
+        const ChartSeries *s=&ch->series[i];
 
-        for (unsigned int i=0; i<txsites; i++)
+        for (j=1; j<s->n; j++)
         {
-            fprintf(fd,"	 <Placemark>\n");
-            fprintf(fd,"	   <name>%s</name>\n",xmtr[i].name);
-            fprintf(fd,"	   <visibility>1</visibility>\n");
-            fprintf(fd,"	   <Style>\n");
-            fprintf(fd,"	   <IconStyle>\n");
-            fprintf(fd,"		<Icon>\n");
-            fprintf(fd,"		  <href>root://icons/palette-5.png</href>\n");
-            fprintf(fd,"		  <x>224</x>\n");
-            fprintf(fd,"		  <y>224</y>\n");
-            fprintf(fd,"		  <w>32</w>\n");
-            fprintf(fd,"		  <h>32</h>\n");
-            fprintf(fd,"		</Icon>\n");
-            fprintf(fd,"	   </IconStyle>\n");
-            fprintf(fd,"	   </Style>\n");
-            fprintf(fd,"	  <Point>\n");
-            fprintf(fd,"		<extrude>1</extrude>\n");
-            fprintf(fd,"		<altitudeMode>relativeToGround</altitudeMode>\n");
-            fprintf(fd,"		<coordinates>%f,%f,%f</coordinates>\n",(xmtr[i].lon<180.0?-xmtr[i].lon:360.0-xmtr[i].lon), xmtr[i].lat, xmtr[i].alt);
-            fprintf(fd,"	  </Point>\n");
-            fprintf(fd,"	 </Placemark>\n");
-        }
+            x0=ChartMapX(ch,s->x[j-1]);
+            y0=ChartMapY(ch,s->y[j-1],s->y2);
+            x1=ChartMapX(ch,s->x[j]);
+            y1=ChartMapY(ch,s->y[j],s->y2);
 
-        fprintf(fd,"  </Folder>\n");
-        fprintf(fd,"</kml>\n");
+            if ((y0<top && y1<top) || (y0>bottom && y1>bottom))
+                continue;
 
-        fclose(fd);
+            if (y0<top) y0=top;
+            if (y1<top) y1=top;
+            if (y0>bottom) y0=bottom;
+            if (y1>bottom) y1=bottom;
+
+            ChartDrawLine(rgb,x0,y0,x1,y1,s->color);
+        }
     }
 
-    if (kml || geo)
+    /* Legend, stacked inside the upper right of the plot frame */
+
+    for (i=0, py=top+8; i<ch->nseries; i++)
     {
-        /* No bottom legend */
-        imgwidth = width;
-        imgheight = height;
+        if (ch->series[i].label[0]==0)
+            continue;
+
+        len=(int)strlen(ch->series[i].label);
+        px=right-8*len-40;
+
+        for (j=0; j<24; j++)
+        {
+            ChartSetPixel(rgb,right-34+j,py+7,ch->series[i].color);
+            ChartSetPixel(rgb,right-34+j,py+8,ch->series[i].color);
+        }
+
+        ChartDrawText(rgb,px,py,ch->series[i].label,black);
+        py+=18;
     }
-    else
+
+    snprintf(filename,sizeof(filename),"%s.%s",basename,ext);
+
+    if (ImageWriterInit(&iw,filename,it,CHART_WIDTH,CHART_HEIGHT)<0)
     {
-        /* Allow space for bottom legend */
-        imgwidth = width;
-        imgheight = height + 30;
+        free(rgb);
+        return -1;
     }
 
-    fprintf(stdout,"\nWriting Signal Strength map \"%s\" (%ux%u image)... ",mapfile,imgwidth,imgheight);
-    fflush(stdout);
+    for (py=0; py<CHART_HEIGHT; py++)
+        ImageWriterEmitRow(&iw,rgb+(size_t)py*CHART_WIDTH*3);
 
-    if (ImageWriterInit(&iw,mapfile,imagetype,imgwidth,imgheight)<0) {
-        fprintf(stdout,"\nError writing \"%s\"!\n",mapfile);
-        fflush(stdout);
+    ImageWriterFinish(&iw);
+    free(rgb);
+
+    return 0;
+}
+
+/* Invokes gnuplot to generate a file indicating the terrain profile between
+ * the source and destination locations.
+ * "basename" is the name assigned to the output file generated by gnuplot.
+ * The filename extension is used to set gnuplot's terminal setting
+ * and output file type.
+ * If no extension is found, .png is assumed.
+ */
+void GraphTerrain(Site source, Site destination, char *name)
+{
+    int	x, n;
+    char	basename[MAX_PATH_LEN], term[30], ext[20], label[MAX_LINE_LEN];
+    double	minheight=100000.0, maxheight=-100000.0;
+    double	*dist, *prof, *clut=NULL;
+    FILE	*fd=NULL, *fd1=NULL;
+    Chart	chart;
+
+    Path *path = GetReportPath(destination,source);
+    if (!path) {
+        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
         return;
     }
 
-    for (y=0, lat=north; y<(int)height; y++, lat=north-(dpp*(double)y))
-    {
-        for (x=0, lon=max_west; x<(int)width; x++, lon=max_west-(dpp*(double)x))
-        {
-            if (lon<0.0)
-                lon+=360.0;
+    n=path->length;
+    dist=(double *)malloc(n*sizeof(double));
+    prof=(double *)malloc(n*sizeof(double));
 
-            dem = FindDEM(lat, lon, x0, y0);
-            if (dem)
-            {
-                mask=dem->mask[x0][y0];
-                signal=(dem->signal[x0][y0])-100;
+    if (clutter>0.0)
+        clut=(double *)malloc(n*sizeof(double));
 
-                match=255;
+    for (x=0; x<n; x++)
+    {
+        if ((path->elevation[x]+clutter)>maxheight)
+            maxheight=path->elevation[x]+clutter;
 
-                red=0;
-                green=0;
-                blue=0;
+        if (path->elevation[x]<minheight)
+            minheight=path->elevation[x];
 
-                if (signal>=region.level[0])
-                    match=0;
-                else
-                {
-                    for (z=1; (z<region.levels && match==255); z++)
-                    {
-                        if (signal<region.level[z-1] && signal>=region.level[z])
-                            match=z;
-                    }
-                }
+        if (metric)
+        {
+            dist[x]=KM_PER_MILE*path->distance[x];
+            prof[x]=METERS_PER_FOOT*path->elevation[x];
 
-                if (match<region.levels)
-                {
-                    if (smooth_contours && match>0)
-                    {
-                        red=(unsigned)interpolate(region.color[match][0],region.color[match-1][0],region.level[match],region.level[match-1],signal);
-                        green=(unsigned)interpolate(region.color[match][1],region.color[match-1][1],region.level[match],region.level[match-1],signal);
-                        blue=(unsigned)interpolate(region.color[match][2],region.color[match-1][2],region.level[match],region.level[match-1],signal);
-                    }
+            if (clut!=NULL)
+                clut[x]=METERS_PER_FOOT*(path->elevation[x]==0.0?path->elevation[x]:(path->elevation[x]+clutter));
+        }
 
-                    else
-                    {
-                        red=region.color[match][0];
-                        green=region.color[match][1];
-                        blue=region.color[match][2];
-                    }
-                }
+        else
+        {
+            dist[x]=path->distance[x];
+            prof[x]=path->elevation[x];
 
-                if (mask&2) 
-                {
-                    /* Text Labels: Red or otherwise */
+            if (clut!=NULL)
+                clut[x]=(path->elevation[x]==0.0?path->elevation[x]:(path->elevation[x]+clutter));
+        }
+    }
 
-                    if (red>=180 && green<=75 && blue<=75)
-                        pixel=RGB(255^red,255^green,255^blue);
-                    else
-                        pixel=COLOR_RED;
-                }
-                else if (mask&4)
-                {
-                    /* County Boundaries: Black */
-                    pixel=COLOR_BLACK;
-                } 
-                else
-                {
-                    if (contour_threshold!=0 && signal<contour_threshold)
-                    {
-                        if (ngs)  /* No terrain */
-                            pixel=COLOR_WHITE;
-                        else
-                        {
-                            /* Display land or sea elevation */
+    if (name[0]=='.')
+    {
+        /* Default filename and output file type */
+        strcpy(basename,"profile");
+        strcpy(ext,"png");
+    }
+    else
+    {
+        /* Extract extension and terminal type from "name" */
+        strncpy(basename, name, MAX_PATH_LEN-1);
+        stripExtension(basename, ext, 20);
+        convertBackslashes(basename);
+        if (strlen(ext) == 0)
+        {
+            strcpy(ext,"png");
+        }
+    }
+    strcpy(term,ext);
 
-                            if (dem->data[x0][y0]==0)
-                                pixel=COLOR_MEDIUMBLUE;
-                            else
-                            {
-                                terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
-                                pixel=RGB(terrain,terrain,terrain);
-                            }
-                        }
-                    }
+    /* Either .ps or .postscript may be used
+       as an extension for postscript output. */
 
-                    else
-                    {
-                        /* Plot field strength regions in color */
+    if (strncmp(term,"postscript",10)==0)
+        strcpy(ext,"ps");
 
-                        if (red!=0 || green!=0 || blue!=0)
-                            pixel=RGB(red,green,blue);
+    else if (strncmp(ext,"ps",2)==0)
+        strcpy(term,"postscript enhanced color");
 
-                        else  /* terrain / sea-level */
-                        {
-                            if (ngs)
-                                pixel=COLOR_WHITE;
-                            else
-                            {
-                                if (dem->data[x0][y0]==0)
-                                    pixel=COLOR_MEDIUMBLUE;
-                                else
-                                {
-                                    /* Elevation: Greyscale */
-                                    terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
-                                    pixel=RGB(terrain,terrain,terrain);
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    if (maxheight<1.0)
+    {
+        maxheight=1.0;	/* Avoid a gnuplot y-range error */
+        minheight=-1.0;	/* over a completely sea-level path */
+    }
+
+    else
+        minheight-=(0.01*maxheight);
 
-            else
-            {
-                /* We should never get here, but if */
-                /* we do, display the region as black */
+    /* Try the in-process renderer first */
 
-                pixel=COLOR_BLACK;
-            }
+    memset(&chart,0,sizeof(chart));
 
-            ImageWriterAppendPixel(&iw, pixel);
-        }
+    snprintf(chart.title,MAX_PATH_LEN,"%s Terrain Profile Between %s and %s (%.2f%c Azimuth)",
+             SPLAT_NAME,destination.name,source.name,Azimuth(destination,source),176);
 
-        ImageWriterEmitLine(&iw);
+    if (metric)
+    {
+        snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f kilometers)",destination.name,source.name,KM_PER_MILE*Distance(source,destination));
+        snprintf(chart.ylabel,MAX_PATH_LEN,"Ground Elevation Above Sea Level (meters)");
     }
 
-    if (!kml && !geo)
+    else
     {
-        /* Display legend along bottom of image
-         * if not generating .kml or .geo output.
-         */
+        snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f miles)",destination.name,source.name,Distance(source,destination));
+        snprintf(chart.ylabel,MAX_PATH_LEN,"Ground Elevation Above Sea Level (feet)");
+    }
 
-        colorwidth=(int)rint((float)width/(float)region.levels);
+    chart.xmin=dist[0];
+    chart.xmax=dist[n-1];
+    chart.ymin=(metric?minheight*METERS_PER_FOOT:minheight);
+    chart.ymax=(metric?maxheight*METERS_PER_FOOT:maxheight);
 
-        for (y0=0; y0<30; y0++)
-        {
-            for (x0=0; x0<(int)width; x0++)
-            {
-                indx=x0/colorwidth;
-                x=x0%colorwidth;
-                level=region.level[indx];
+    ChartAddSeries(&chart,dist,prof,n,0,(clut!=NULL?"Terrain Profile":""));
 
-                hundreds=level/100;
+    if (clut!=NULL)
+    {
+        snprintf(label,MAX_LINE_LEN,"Clutter Profile (%.2f %s)",
+                 (metric?clutter*METERS_PER_FOOT:clutter),(metric?"meters":"feet"));
+        ChartAddSeries(&chart,dist+1,clut+1,n-3,0,label);
+    }
 
-                if (hundreds>0)
-                    level-=(hundreds*100);
+    if (ChartRender(&chart,basename,ext)==0)
+    {
+        fprintf(stdout,"Terrain plot written to: \"%s.%s\"\n",basename,ext);
+        fflush(stdout);
 
-                tens=level/10;
+        free(dist);
+        free(prof);
+        free(clut);
+        return;
+    }
 
-                if (tens>0)
-                    level-=(tens*10);
+    /* Formats we don't rasterize ourselves still go through gnuplot */
 
-                units=level;
+    fd=fopen("profile.gp","wb");
 
-                if (y0>=8 && y0<=23)
-                {  
-                    if (hundreds>0)
-                    {
-                        if (x>=5 && x<=12)	 
-                            if (fontdata[16*(hundreds+'0')+(y0-8)]&(128>>(x-5)))
-                                indx=255; 
-                    }
+    if (clut!=NULL)
+        fd1=fopen("clutter.gp","wb");
 
-                    if (tens>0 || hundreds>0)
-                    {
-                        if (x>=13 && x<=20)	 
-                            if (fontdata[16*(tens+'0')+(y0-8)]&(128>>(x-13)))
-                                indx=255;
-                    }
+    for (x=0; x<n; x++)
+    {
+        fprintf(fd,"%f\t%f\n",dist[x],prof[x]);
 
-                    if (x>=21 && x<=28)
-                        if (fontdata[16*(units+'0')+(y0-8)]&(128>>(x-21)))
-                            indx=255;
+        if (fd1!=NULL && x>0 && x<n-2)
+            fprintf(fd1,"%f\t%f\n",dist[x],clut[x]);
+    }
 
-                    if (x>=36 && x<=43)
-                        if (fontdata[16*('d')+(y0-8)]&(128>>(x-36)))
-                            indx=255;
+    fclose(fd);
 
-                    if (x>=44 && x<=51)
-                        if (fontdata[16*('B')+(y0-8)]&(128>>(x-44)))
-                            indx=255;
+    if (fd1!=NULL)
+        fclose(fd1);
 
-                    if (x>=52 && x<=59)
-                        if (fontdata[16*(230)+(y0-8)]&(128>>(x-52)))
-                            indx=255;
+    fd=fopen("splat.gp","w");
+    fprintf(fd,"set grid\n");
+    fprintf(fd,"set yrange [%2.3f to %2.3f]\n", metric?minheight*METERS_PER_FOOT:minheight, metric?maxheight*METERS_PER_FOOT:maxheight);
+    fprintf(fd,"set encoding iso_8859_1\n");
+    fprintf(fd,"set term %s\n",term);
+    fprintf(fd,"set title \"%s Terrain Profile Between %s and %s (%.2f%c Azimuth)\"\n",SPLAT_NAME,destination.name, source.name, Azimuth(destination,source),176);
 
-                    if (x>=60 && x<=67)
-                        if (fontdata[16*('V')+(y0-8)]&(128>>(x-60)))
-                            indx=255;
+    if (metric)
+    {
+        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*Distance(source,destination));
+        fprintf(fd,"set ylabel \"Ground Elevation Above Sea Level (meters)\"\n");
+    }
 
-                    if (x>=68 && x<=75)
-                        if (fontdata[16*('/')+(y0-8)]&(128>>(x-68)))
-                            indx=255;
+    else
+    {
+        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,Distance(source,destination));
+        fprintf(fd,"set ylabel \"Ground Elevation Above Sea Level (feet)\"\n");
+    }
 
-                    if (x>=76 && x<=83)
-                        if (fontdata[16*('m')+(y0-8)]&(128>>(x-76)))
-                            indx=255;
-                }
+    fprintf(fd,"set output \"%s.%s\"\n",basename,ext);
 
-                if (indx>region.levels)
-                    pixel=COLOR_BLACK;
-                else
-                {
-                    red=region.color[indx][0];
-                    green=region.color[indx][1];
-                    blue=region.color[indx][2];
+    if (clutter>0.0)
+    {
+        if (metric)
+            fprintf(fd,"plot \"profile.gp\" title \"Terrain Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f meters)\" with lines\n",clutter*METERS_PER_FOOT);
+        else
+            fprintf(fd,"plot \"profile.gp\" title \"Terrain Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f feet)\" with lines\n",clutter);
+    }
 
-                    pixel=RGB(red,green,blue);
-                }
+    else
+        fprintf(fd,"plot \"profile.gp\" title \"\" with lines\n");
 
-                ImageWriterAppendPixel(&iw, pixel);
-            }
+    fclose(fd);
 
-            ImageWriterEmitLine(&iw);
+    x=system("gnuplot splat.gp");
+
+    if (x!=-1)
+    {
+        if (!gpsav)
+        {
+            unlink("splat.gp");
+            unlink("profile.gp");
         }
+
+        fprintf(stdout,"Terrain plot written to: \"%s.%s\"\n",basename,ext);
+        fflush(stdout);
     }
 
-    ImageWriterFinish(&iw);
+    else
+        fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
 
-    if (kml)
-    {
-        /* Write colorkey image file */
+    free(dist);
+    free(prof);
+    free(clut);
+}
 
-        height=30*region.levels;
-        width=100;
+/* Invokes gnuplot to generate a file indicating the terrain elevation profile
+ * between the source and destination locations.
+ * "basename" is the name assigned to the output file generated by gnuplot.
+ * The filename extension is used to set gnuplot's terminal setting
+ * and output file type.
+ * If no extension is found, .png is assumed.
+ */
+void GraphElevation(Site source, Site destination, char *name)
+{
+    int	x, n;
+    char	basename[MAX_PATH_LEN], term[30], ext[20], label[MAX_LINE_LEN];
+    double	angle, clutter_angle=0.0, refangle, maxangle=-90.0,
+            minangle=90.0, distance;
+    double	*dist, *ang, *clut=NULL, *ref;
+    Site	remote, remote2;
+    FILE	*fd=NULL, *fd1=NULL, *fd2=NULL;
+    Chart	chart;
 
-        if (ImageWriterInit(&iw,ckfile,imagetype,width,height)<0) {
-            fprintf(stdout,"\nError writing \"%s\"!\n",ckfile);
-            fflush(stdout);
-            return;
-        }
+    Path *path = GetReportPath(destination,source);  /* destination=RX, source=TX */
+    if (!path) {
+        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
+        return;
+    }
+    refangle=ElevationAngle(destination,source);
+    distance=Distance(source,destination);
 
-        for (y0=0; y0<(int)height; y0++)
+    n=path->length-1;	/* x=1..length-2 plus the final reference point */
+    dist=(double *)malloc(n*sizeof(double));
+    ang=(double *)malloc(n*sizeof(double));
+    ref=(double *)malloc(n*sizeof(double));
+
+    if (clutter>0.0)
+        clut=(double *)malloc(n*sizeof(double));
+
+    for (x=1; x<path->length-1; x++)
+    {
+        remote.lat=path->lat[x];
+        remote.lon=path->lon[x];
+        remote.alt=0.0;
+        angle=ElevationAngle(destination,remote);
+
+        if (clutter>0.0)
         {
-            for (x0=0; x0<(int)width; x0++)
-            {
-                indx=y0/30;
-                x=x0;
+            remote2.lat=path->lat[x];
+            remote2.lon=path->lon[x];
 
-                level=region.level[indx];
+            if (path->elevation[x]!=0.0)
+                remote2.alt=clutter;
+            else
+                remote2.alt=0.0;
 
-                hundreds=level/100;
+            clutter_angle=ElevationAngle(destination,remote2);
+        }
 
-                if (hundreds>0)
-                    level-=(hundreds*100);
+        dist[x-1]=(metric?KM_PER_MILE*path->distance[x]:path->distance[x]);
+        ang[x-1]=angle;
+        ref[x-1]=refangle;
 
-                tens=level/10;
+        if (clut!=NULL)
+            clut[x-1]=clutter_angle;
 
-                if (tens>0)
-                    level-=(tens*10);
+        if (angle>maxangle)
+            maxangle=angle;
 
-                units=level;
+        if (clutter_angle>maxangle)
+            maxangle=clutter_angle;
 
-                if ((y0%30)>=8 && (y0%30)<=23)
-                {  
-                    if (hundreds>0)
-                    {
-                        if (x>=5 && x<=12)	 
-                            if (fontdata[16*(hundreds+'0')+((y0%30)-8)]&(128>>(x-5)))
-                                indx=255; 
-                    }
+        if (angle<minangle)
+            minangle=angle;
+    }
 
-                    if (tens>0 || hundreds>0)
-                    {
-                        if (x>=13 && x<=20)	 
-                            if (fontdata[16*(tens+'0')+((y0%30)-8)]&(128>>(x-13)))
-                                indx=255;
-                    }
+    dist[n-1]=(metric?KM_PER_MILE*path->distance[path->length-1]:path->distance[path->length-1]);
+    ang[n-1]=refangle;
+    ref[n-1]=refangle;
 
-                    if (x>=21 && x<=28)
-                        if (fontdata[16*(units+'0')+((y0%30)-8)]&(128>>(x-21)))
-                            indx=255;
+    if (name[0]=='.')
+    {
+        /* Default filename and output file type */
+        strcpy(basename,"profile");
+        strcpy(ext,"png");
+    }
+    else
+    {
+        /* Extract extension and terminal type from "name" */
+        strncpy(basename, name, MAX_PATH_LEN-1);
+        stripExtension(basename, ext, 20);
+        convertBackslashes(basename);
+        if (strlen(ext) == 0)
+        {
+            strcpy(ext,"png");
+        }
+    }
 
-                    if (x>=36 && x<=43)
-                        if (fontdata[16*('d')+((y0%30)-8)]&(128>>(x-36)))
-                            indx=255;
+    strcpy(term,ext);
 
-                    if (x>=44 && x<=51)
-                        if (fontdata[16*('B')+((y0%30)-8)]&(128>>(x-44)))
-                            indx=255;
+    /* Either .ps or .postscript may be used
+       as an extension for postscript output. */
 
-                    if (x>=52 && x<=59)
-                        if (fontdata[16*(230)+((y0%30)-8)]&(128>>(x-52)))
-                            indx=255;
+    if (strncmp(term,"postscript",10)==0)
+        strcpy(ext,"ps");
 
-                    if (x>=60 && x<=67)
-                        if (fontdata[16*('V')+((y0%30)-8)]&(128>>(x-60)))
-                            indx=255;
+    else if (strncmp(ext,"ps",2)==0)
+        strcpy(term,"postscript enhanced color");
+
+    /* Try the in-process renderer first */
 
-                    if (x>=68 && x<=75)
-                        if (fontdata[16*('/')+((y0%30)-8)]&(128>>(x-68)))
-                            indx=255;
+    memset(&chart,0,sizeof(chart));
 
-                    if (x>=76 && x<=83)
-                        if (fontdata[16*('m')+((y0%30)-8)]&(128>>(x-76)))
-                            indx=255;
-                }
+    snprintf(chart.title,MAX_PATH_LEN,"%s Elevation Profile Between %s and %s (%.2f%c azimuth)",
+             SPLAT_NAME,destination.name,source.name,Azimuth(destination,source),176);
 
-                if (indx>region.levels) {
-                    pixel=COLOR_BLACK;
-                }
-                else
-                {
-                    red=region.color[indx][0];
-                    green=region.color[indx][1];
-                    blue=region.color[indx][2];
+    if (metric)
+        snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f kilometers)",destination.name,source.name,KM_PER_MILE*distance);
+    else
+        snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f miles)",destination.name,source.name,distance);
 
-                    pixel=RGB(red,green,blue);
-                }
+    snprintf(chart.ylabel,MAX_PATH_LEN,"Elevation Angle Along LOS Path Between\n%s and %s (degrees)",destination.name,source.name);
 
-                ImageWriterAppendPixel(&iw, pixel);
-            } 
+    chart.xmin=dist[0];
+    chart.xmax=dist[n-1];
 
-            ImageWriterEmitLine(&iw);
-        }
+    if (distance>2.0)
+    {
+        chart.ymin=-fabs(refangle)-0.25;
+        chart.ymax=maxangle+0.25;
+    }
 
-        ImageWriterFinish(&iw);
+    else
+    {
+        chart.ymin=minangle;
+        chart.ymax=refangle+(-minangle/8.0);
+    }
 
-#if DO_KMZ
-        bool success = false;
-        struct zip_t *zip = zip_open(kmzfile, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
-        if (zip) {
-            /* Pack the KML */
-            if (zip_entry_open(zip, kmlfile) == 0) {
-                if (zip_entry_fwrite(zip, kmlfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            /* Pack the -ck file */
-            if (zip_entry_open(zip, ckfile) == 0) {
-                if (zip_entry_fwrite(zip, ckfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            /* Pack the map image */
-            if (zip_entry_open(zip, mapfile) == 0) {
-                if (zip_entry_fwrite(zip, mapfile) == 0) {
-                    success = true;
-                }
-                zip_entry_close(zip);
-            }
-            zip_close(zip);
-        }
+    ChartAddSeries(&chart,dist,ang,n,0,"Real Earth Profile");
 
-        if (success) {
-            unlink(mapfile);
-            unlink(kmlfile);
-            unlink(ckfile);
-            fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
-        } else {
-            unlink(kmzfile);
-            fprintf(stdout, "\nCouldn't create KMZ file.\n");
-        }
-        free(kmzfile);
-#endif
+    if (clut!=NULL)
+    {
+        snprintf(label,MAX_LINE_LEN,"Clutter Profile (%.2f %s)",
+                 (metric?clutter*METERS_PER_FOOT:clutter),(metric?"meters":"feet"));
+        ChartAddSeries(&chart,dist,clut,n-1,0,label);
     }
 
-    free(mapfile);
-    free(geofile);
-    free(kmlfile);
-    free(ckfile);
+    snprintf(label,MAX_LINE_LEN,"Line of Sight Path (%.2f%c elevation)",refangle,176);
+    ChartAddSeries(&chart,dist,ref,n,0,label);
 
-    fprintf(stdout,"Done!\n");
-    fflush(stdout);
-}
+    if (ChartRender(&chart,basename,ext)==0)
+    {
+        fprintf(stdout,"Elevation plot written to: \"%s.%s\"\n",basename,ext);
+        fflush(stdout);
 
-/* Generates a topographic map based on the signal strength values held in the
- * signal[][] array. The image created is rotated counter-clockwise 90 degrees
- * from its representation in dem[][] so that north points up and east points
- * right.
- *
- * In this version of the WriteImage function the power level is
- *  plotted (vs the signal strength, plotted by WriteImageDBM).
- */
-void WriteImageDBM(char *filename, ImageType imagetype, bool geo, bool kml, bool ngs, Site *xmtr, unsigned int txsites)
-{
-    const char *suffix;
-    char *mapfile, *geofile, *kmlfile, *ckfile;
-    unsigned width, height, terrain, red, green, blue;
-    unsigned int imgheight, imgwidth;
-    unsigned char mask;
-    DEM *dem;
-    int indx, x, y, z=1, x0, y0, dBm, level, hundreds,
-        tens, units, match, colorwidth;
-    double conversion, one_over_gamma, lat, lon,
-           north, south, east, west, minwest;
-    FILE *fd;
+        free(dist);
+        free(ang);
+        free(ref);
+        free(clut);
+        return;
+    }
 
-    Pixel pixel = 0;
-    ImageWriter iw;
+    /* Formats we don't rasterize ourselves still go through gnuplot */
 
-    one_over_gamma=1.0/GAMMA;
-    conversion=255.0/pow((double)(max_elevation-min_elevation),one_over_gamma);
+    fd=fopen("profile.gp","wb");
 
-    width=(unsigned)(ippd*ReduceAngle(max_west-min_west));
-    height=(unsigned)(ippd*ReduceAngle(max_north-min_north));
+    if (clut!=NULL)
+        fd1=fopen("clutter.gp","wb");
 
-    LoadDBMColors(xmtr[0]);
+    fd2=fopen("reference.gp","wb");
 
-    if (!filename || filename[0]=='\0')
+    for (x=0; x<n; x++)
     {
-        filename = xmtr[0].filename;
-    }
+        fprintf(fd,"%f\t%f\n",dist[x],ang[x]);
 
-    switch (imagetype) {
-        default:
-#ifdef HAVE_LIBPNG
-        case IMAGETYPE_PNG:
-            suffix = "png";
-            break;
-#endif
-#ifdef HAVE_LIBJPEG
-        case IMAGETYPE_JPG:
-            suffix = "jpg";
-            break;
-#endif
-        case IMAGETYPE_PPM:
-            suffix = "ppm";
-            break;
+        if (fd1!=NULL && x<n-1)
+            fprintf(fd1,"%f\t%f\n",dist[x],clut[x]);
+
+        fprintf(fd2,"%f\t%f\n",dist[x],ref[x]);
     }
-    mapfile = copyFilename(filename, suffix);
-    geofile = copyFilename(filename, "geo");
-    kmlfile = copyFilename(filename, "kml");
 
-    /* ick */
-    ckfile = copyFilename(filename, NULL);
-    ckfile = (char*)realloc(ckfile, strlen(ckfile)+strlen(suffix)+5);
-    strcat(ckfile, "-ck.");
-    strcat(ckfile, suffix);
+    fclose(fd);
 
-    minwest=((double)min_west)+dpp;
+    if (fd1!=NULL)
+        fclose(fd1);
 
-    if (minwest>360.0)
-        minwest-=360.0;
+    fclose(fd2);
 
-    north=(double)max_north-dpp;
+    fd=fopen("splat.gp","w");
 
-    if (kml || geo)
-        south=(double)min_north;	/* No bottom legend */
-    else
-        south=(double)min_north-(30.0/ppd);	/* 30 pixels for bottom legend */
+    fprintf(fd,"set grid\n");
 
-    east=(minwest<180.0?-minwest:360.0-min_west);
-    west=(double)(max_west<180?-max_west:360-max_west);
+    if (distance>2.0)
+        fprintf(fd,"set yrange [%2.3f to %2.3f]\n", (-fabs(refangle)-0.25), maxangle+0.25);
+    else
+        fprintf(fd,"set yrange [%2.3f to %2.3f]\n", minangle, refangle+(-minangle/8.0));
 
-    if (geo && !kml)
-    {
-        fd=fopen(geofile,"wb");
+    fprintf(fd,"set encoding iso_8859_1\n");
+    fprintf(fd,"set term %s\n",term);
+    fprintf(fd,"set title \"%s Elevation Profile Between %s and %s (%.2f%c azimuth)\"\n",SPLAT_NAME,destination.name,source.name,Azimuth(destination,source),176);
 
-        fprintf(fd,"FILENAME\t%s\n",mapfile);
-        fprintf(fd,"#\t\tX\tY\tLong\t\tLat\n");
-        fprintf(fd,"TIEPOINT\t0\t0\t%.3f\t\t%.3f\n",west,north);
+    if (metric)
+        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*distance);
+    else
+        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,distance);
 
-        fprintf(fd,"TIEPOINT\t%u\t%u\t%.3f\t\t%.3f\n",width-1,height-1,east,south);
-        fprintf(fd,"IMAGESIZE\t%u\t%u\n",width,height);
 
-        fprintf(fd,"#\n# Auto Generated by %s v%s\n#\n",SPLAT_NAME,SPLAT_VERSION);
+    fprintf(fd,"set ylabel \"Elevation Angle Along LOS Path Between\\n%s and %s (degrees)\"\n",destination.name,source.name);
+    fprintf(fd,"set output \"%s.%s\"\n",basename,ext);
 
-        fclose(fd);
+    if (clutter>0.0)
+    {
+        if (metric)
+            fprintf(fd,"plot \"profile.gp\" title \"Real Earth Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f meters)\" with lines, \"reference.gp\" title \"Line of Sight Path (%.2f%c elevation)\" with lines\n",clutter*METERS_PER_FOOT,refangle,176);
+        else
+            fprintf(fd,"plot \"profile.gp\" title \"Real Earth Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f feet)\" with lines, \"reference.gp\" title \"Line of Sight Path (%.2f%c elevation)\" with lines\n",clutter,refangle,176);
     }
 
-    if (kml && !geo)
-    {
-        fd=fopen(kmlfile,"wb");
+    else
+        fprintf(fd,"plot \"profile.gp\" title \"Real Earth Profile\" with lines, \"reference.gp\" title \"Line of Sight Path (%.2f%c elevation)\" with lines\n",refangle,176);
 
-        fprintf(fd,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-        fprintf(fd,"<kml xmlns=\"http://earth.google.com/kml/2.1\">\n");
-        fprintf(fd,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME,SPLAT_VERSION);
-        fprintf(fd,"  <Folder>\n");
-        fprintf(fd,"   <name>%s</name>\n",SPLAT_NAME);
-        fprintf(fd,"	 <description>%s Transmitter Contours</description>\n",xmtr[0].name);
-        fprintf(fd,"	   <GroundOverlay>\n");
-        fprintf(fd,"		 <name>SPLAT! Signal Power Level Contours</name>\n");
-        fprintf(fd,"		 <description>SPLAT! Coverage</description>\n");
-        fprintf(fd,"		 <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
-        fprintf(fd,"		 <Icon>\n");
-        fprintf(fd,"			  <href>%s</href>\n",basename_s(mapfile));
-        fprintf(fd,"		 </Icon>\n");
-        /* fprintf(fd,"			<opacity>128</opacity>\n"); */
-        fprintf(fd,"			<LatLonBox>\n");
-        fprintf(fd,"			   <north>%.5f</north>\n",north);
-        fprintf(fd,"			   <south>%.5f</south>\n",south);
-        fprintf(fd,"			   <east>%.5f</east>\n",east);
-        fprintf(fd,"			   <west>%.5f</west>\n",west);
-        fprintf(fd,"			   <rotation>0.0</rotation>\n");
-        fprintf(fd,"			</LatLonBox>\n");
-        fprintf(fd,"	   </GroundOverlay>\n");
-        fprintf(fd,"	   <ScreenOverlay>\n");
-        fprintf(fd,"		  <name>Color Key</name>\n");
-        fprintf(fd,"		  <description>Contour Color Key</description>\n");
-        fprintf(fd,"		  <color>8cffffff</color>\n"); /* transparency level, higher is clearer */
-        fprintf(fd,"		  <Icon>\n");
-        fprintf(fd,"			<href>%s</href>\n",basename_s(ckfile));
-        fprintf(fd,"		  </Icon>\n");
-        fprintf(fd,"		  <overlayXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"		  <screenXY x=\"0\" y=\"1\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"		  <rotationXY x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"		  <size x=\"0\" y=\"0\" xunits=\"fraction\" yunits=\"fraction\"/>\n");
-        fprintf(fd,"	   </ScreenOverlay>\n");
+    fclose(fd);
 
-        for (unsigned int i=0; i<txsites; i++)
+    x=system("gnuplot splat.gp");
+
+    if (x!=-1)
+    {
+        if (!gpsav)
         {
-            fprintf(fd,"	 <Placemark>\n");
-            fprintf(fd,"	   <name>%s</name>\n",xmtr[i].name);
-            fprintf(fd,"	   <visibility>1</visibility>\n");
-            fprintf(fd,"	   <Style>\n");
-            fprintf(fd,"	   <IconStyle>\n");
-            fprintf(fd,"		<Icon>\n");
-            fprintf(fd,"		  <href>root://icons/palette-5.png</href>\n");
-            fprintf(fd,"		  <x>224</x>\n");
-            fprintf(fd,"		  <y>224</y>\n");
-            fprintf(fd,"		  <w>32</w>\n");
-            fprintf(fd,"		  <h>32</h>\n");
-            fprintf(fd,"		</Icon>\n");
-            fprintf(fd,"	   </IconStyle>\n");
-            fprintf(fd,"	   </Style>\n");
-            fprintf(fd,"	  <Point>\n");
-            fprintf(fd,"		<extrude>1</extrude>\n");
-            fprintf(fd,"		<altitudeMode>relativeToGround</altitudeMode>\n");
-            fprintf(fd,"		<coordinates>%f,%f,%f</coordinates>\n",(xmtr[i].lon<180.0?-xmtr[i].lon:360.0-xmtr[i].lon), xmtr[i].lat, xmtr[i].alt);
-            fprintf(fd,"	  </Point>\n");
-            fprintf(fd,"	 </Placemark>\n");
+            unlink("splat.gp");
+            unlink("profile.gp");
+            unlink("reference.gp");
+
+            if (clutter>0.0)
+                unlink("clutter.gp");
         }
 
-        fprintf(fd,"  </Folder>\n");
-        fprintf(fd,"</kml>\n");
+        fprintf(stdout,"Elevation plot written to: \"%s.%s\"\n",basename,ext);
+        fflush(stdout);
+    }
+
+    else
+        fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
+
+    free(dist);
+    free(ang);
+    free(ref);
+    free(clut);
+}
+
+/* Invokes gnuplot to generate a file indicating the terrain height profile
+ * between the source and destination locations referenced to the lint-of-sight
+ * path between the receive and transmit sites.
+ * "basename" is the name assigned to the output file generated by gnuplot.
+ * The filename extension is used to set gnuplot's terminal setting
+ * and output file type.
+ * If no extension is found, .png is assumed.
+ */
+void GraphHeight(Site source, Site destination, char *name, bool fresnel_plot, bool normalized)
+{
+    int	x, n, do_fresnel;
+    char	basename[MAX_PATH_LEN], term[30], ext[20], label[MAX_LINE_LEN];
+    double	a, b, c, height=0.0, refangle, cangle, maxheight=-100000.0,
+            minheight=100000.0, lambda=0.0, f_zone=0.0, fpt6_zone=0.0,
+            nm=0.0, nb=0.0, ed=0.0, es=0.0, r=0.0, d=0.0, d1=0.0,
+            terrain, azimuth, distance, dheight=0.0, minterrain=100000.0,
+            minearth=100000.0, miny, maxy, min2y, max2y;
+    double	*dist, *prof, *clut=NULL, *ref, *curv, *fres=NULL, *fres6=NULL;
+    Site	remote;
+    FILE	*fd=NULL, *fd1=NULL, *fd2=NULL, *fd3=NULL, *fd4=NULL, *fd5=NULL;
+    Chart	chart;
+
+    Path *path = GetReportPath(destination,source);  /* destination=RX, source=TX */
+    if (!path) {
+        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
+        return;
+    }
+    azimuth=Azimuth(destination,source);
+    distance=Distance(destination,source);
+    refangle=ElevationAngle(destination,source);
+
+    if (destination.amsl_flag)
+        b=destination.alt+earthradius;
+    else
+        b=GetElevation(destination)+destination.alt+earthradius;
 
-        fclose(fd);
-    }
+    /* Wavelength and path distance (great circle) in feet. */
 
-    if (kml || geo)
+    if (fresnel_plot)
     {
-        /* No bottom legend */
-        imgwidth = width;
-        imgheight = height;
+        lambda=9.8425e8/(LR.frq_mhz*1e6);
+        d=5280.0*path->distance[path->length-1];
     }
-    else
+
+    if (normalized)
     {
-        /* Allow space for bottom legend */
-        imgwidth = width;
-        imgheight = height + 30;
+        ed=GetElevation(destination);
+        es=GetElevation(source);
+        nb=-destination.alt-ed;
+        nm=(-source.alt-es-nb)/(path->distance[path->length-1]);
     }
 
-    fprintf(stdout,"\nWriting Power Level (dBm) map \"%s\" (%ux%u image)... ",mapfile,imgwidth,imgheight);
-    fflush(stdout);
+    do_fresnel=((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot);
 
-    if (ImageWriterInit(&iw,mapfile,imagetype,imgwidth,imgheight)<0) {
-        fprintf(stdout,"\nError writing \"%s\"!\n",mapfile);
-        fflush(stdout);
-        return;
+    n=path->length;	/* x=0..length-2 plus the final reference point */
+    dist=(double *)malloc(n*sizeof(double));
+    prof=(double *)malloc(n*sizeof(double));
+    ref=(double *)malloc(n*sizeof(double));
+    curv=(double *)malloc(n*sizeof(double));
+
+    if (clutter>0.0)
+        clut=(double *)malloc(n*sizeof(double));
+
+    if (do_fresnel)
+    {
+        fres=(double *)malloc(n*sizeof(double));
+        fres6=(double *)malloc(n*sizeof(double));
     }
 
-    for (y=0, lat=north; y<(int)height; y++, lat=north-(dpp*(double)y))
+    for (x=0; x<path->length-1; x++)
     {
-        for (x=0, lon=max_west; x<(int)width; x++, lon=max_west-(dpp*(double)x))
+        remote.lat=path->lat[x];
+        remote.lon=path->lon[x];
+        remote.alt=0.0;
+
+        terrain=GetElevation(remote);
+
+        if (x==0)
+            terrain+=destination.alt;  /* RX antenna spike */
+
+        a=terrain+earthradius;
+        cangle=5280.0*Distance(destination,remote)/earthradius;
+        c=b*sin(refangle*DEG2RAD+HALFPI)/sin(HALFPI-refangle*DEG2RAD-cangle);
+
+        height=a-c;
+
+        /* Per Fink and Christiansen, Electronics
+         * Engineers' Handbook, 1989:
+         *
+         *   H = sqrt(lamba * d1 * (d - d1)/d)
+         *
+         * where H is the distance from the LOS
+         * path to the first Fresnel zone boundary.
+         */
+
+        if (do_fresnel)
         {
-            if (lon<0.0)
-                lon+=360.0;
+            d1=5280.0*path->distance[x];
+            f_zone=-1.0*sqrt(lambda*d1*(d-d1)/d);
+            fpt6_zone=f_zone*fzone_clearance;
+        }
 
-            dem = FindDEM(lat, lon, x0, y0);
-            if (dem)
+        if (normalized)
+        {
+            r=-(nm*path->distance[x])-nb;
+            height+=r;
+
+            if (do_fresnel)
             {
-                mask=dem->mask[x0][y0];
-                dBm=(dem->signal[x0][y0])-200;
+                f_zone+=r;
+                fpt6_zone+=r;
+            }
+        }
 
-                match=255;
+        else
+            r=0.0;
 
-                red=0;
-                green=0;
-                blue=0;
+        if (metric)
+        {
+            dist[x]=KM_PER_MILE*path->distance[x];
+            prof[x]=METERS_PER_FOOT*height;
 
-                if (dBm>=region.level[0])
-                    match=0;
-                else
-                {
-                    for (z=1; (z<region.levels && match==255); z++)
-                    {
-                        if (dBm<region.level[z-1] && dBm>=region.level[z])
-                            match=z;
-                    }
-                }
+            if (clut!=NULL)
+                clut[x]=METERS_PER_FOOT*(terrain==0.0?height:(height+clutter));
 
-                if (match<region.levels)
-                {
-                    if (smooth_contours && match>0)
-                    {
-                        red=(unsigned)interpolate(region.color[match][0],region.color[match-1][0],region.level[match],region.level[match-1],dBm);
-                        green=(unsigned)interpolate(region.color[match][1],region.color[match-1][1],region.level[match],region.level[match-1],dBm);
-                        blue=(unsigned)interpolate(region.color[match][2],region.color[match-1][2],region.level[match],region.level[match-1],dBm);
-                    }
+            ref[x]=METERS_PER_FOOT*r;
+            curv[x]=METERS_PER_FOOT*(height-terrain);
+        }
 
-                    else
-                    {
-                        red=region.color[match][0];
-                        green=region.color[match][1];
-                        blue=region.color[match][2];
-                    }
-                }
+        else
+        {
+            dist[x]=path->distance[x];
+            prof[x]=height;
 
-                if (mask&2) 
-                {
-                    /* Text Labels: Red or otherwise */
+            if (clut!=NULL)
+                clut[x]=(terrain==0.0?height:(height+clutter));
 
-                    if (red>=180 && green<=75 && blue<=75 && dBm!=0)
-                        pixel=RGB(255^red,255^green,255^blue);
-                    else
-                        pixel=COLOR_RED;
-                }
-                else if (mask&4)
-                {
-                    /* County Boundaries: Black */
-                    pixel=COLOR_BLACK;
-                }
-                else
-                {
-                    if (contour_threshold!=0 && dBm<contour_threshold)
-                    {
-                        if (ngs) /* No terrain */
-                            pixel=COLOR_WHITE;
-                        else
-                        {
-                            /* Display land or sea elevation */
+            ref[x]=r;
+            curv[x]=height-terrain;
+        }
 
-                            if (dem->data[x0][y0]==0)
-                                pixel=COLOR_MEDIUMBLUE;
-                            else
-                            {
-                                terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
-                                pixel=RGB(terrain,terrain,terrain);
-                            }
-                        }
-                    }
+        if (do_fresnel)
+        {
+            fres[x]=(metric?METERS_PER_FOOT*f_zone:f_zone);
+            fres6[x]=(metric?METERS_PER_FOOT*fpt6_zone:fpt6_zone);
 
-                    else
-                    {
-                        /* Plot signal power level regions in color */
+            if (f_zone<minheight)
+                minheight=f_zone;
+        }
 
-                        if (red!=0 || green!=0 || blue!=0)
-                            pixel=RGB(red,green,blue);
+        if ((height+clutter)>maxheight)
+            maxheight=height+clutter;
 
-                        else  /* terrain / sea-level */
-                        {
-                            if (ngs)
-                                pixel=COLOR_WHITE;
-                            else
-                            {
-                                if (dem->data[x0][y0]==0)
-                                    pixel=COLOR_MEDIUMBLUE;
-                                else
-                                {
-                                    /* Elevation: Greyscale */
-                                    terrain=(unsigned)(0.5+pow((double)(dem->data[x0][y0]-min_elevation),one_over_gamma)*conversion);
-                                    pixel=RGB(terrain,terrain,terrain);
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+        if (height<minheight)
+            minheight=height;
 
-            else
-            {
-                /* We should never get here, but if */
-                /* we do, display the region as black */
-                pixel=COLOR_BLACK;
-            }
+        if (r>maxheight)
+            maxheight=r;
 
-            ImageWriterAppendPixel(&iw, pixel);
-        }
+        if (terrain<minterrain)
+            minterrain=terrain;
 
-        ImageWriterEmitLine(&iw);
+        if ((height-terrain)<minearth)
+            minearth=height-terrain;
     }
 
-    if (!kml && !geo)
+    if (normalized)
+        r=-(nm*path->distance[path->length-1])-nb;
+    else
+        r=0.0;
+
+    dist[n-1]=(metric?KM_PER_MILE*path->distance[path->length-1]:path->distance[path->length-1]);
+    prof[n-1]=(metric?METERS_PER_FOOT*r:r);
+    ref[n-1]=prof[n-1];
+
+    if (do_fresnel)
     {
-        /* Display legend along bottom of image
-           if not generating .kml or .geo output. */
+        fres[n-1]=prof[n-1];
+        fres6[n-1]=prof[n-1];
+    }
 
-        colorwidth=(int)rint((float)width/(float)region.levels);
+    if (r>maxheight)
+        maxheight=r;
 
-        for (y0=0; y0<30; y0++)
+    if (r<minheight)
+        minheight=r;
+
+    if (name[0]=='.')
+    {
+        /* Default filename and output file type */
+        strcpy(basename,"profile");
+        strcpy(ext,"png");
+    }
+    else
+    {
+        /* Extract extension and terminal type from "name" */
+        strncpy(basename, name, MAX_PATH_LEN-1);
+        stripExtension(basename, ext, 20);
+        convertBackslashes(basename);
+        if (strlen(ext) == 0)
         {
-            for (x0=0; x0<(int)width; x0++)
-            {
-                indx=x0/colorwidth;
-                x=x0%colorwidth;
+            strcpy(ext,"png");
+        }
+    }
+    strcpy(term,ext);
+
+    /* Either .ps or .postscript may be used
+       as an extension for postscript output. */
+
+    if (strncmp(term,"postscript",10)==0)
+        strcpy(ext,"ps");
+
+    else if (strncmp(ext,"ps",2)==0)
+        strcpy(term,"postscript enhanced color");
+
+    dheight=maxheight-minheight;
+    miny=minheight-0.15*dheight;
+    maxy=maxheight+0.05*dheight;
+
+    if (maxy<20.0)
+        maxy=20.0;
+
+    dheight=maxheight-minheight;
+    min2y=miny-minterrain+0.05*dheight;
+
+    if (minearth<min2y)
+    {
+        miny-=min2y-minearth+0.05*dheight;
+        min2y=minearth-0.05*dheight;
+    }
+
+    max2y=min2y+maxy-miny;
 
-                level=abs(region.level[indx]);
+    /* Try the in-process renderer first */
 
-                hundreds=level/100;
+    memset(&chart,0,sizeof(chart));
 
-                if (hundreds>0)
-                    level-=(hundreds*100);
+    if (do_fresnel)
+        snprintf(chart.title,MAX_PATH_LEN,"%s Path Profile Between %s and %s (%.2f%c azimuth)\nWith First Fresnel Zone",SPLAT_NAME,destination.name,source.name,azimuth,176);
+    else
+        snprintf(chart.title,MAX_PATH_LEN,"%s Height Profile Between %s and %s (%.2f%c azimuth)",SPLAT_NAME,destination.name,source.name,azimuth,176);
 
-                tens=level/10;
+    if (metric)
+        snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f kilometers)",destination.name,source.name,KM_PER_MILE*Distance(source,destination));
+    else
+        snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f miles)",destination.name,source.name,Distance(source,destination));
 
-                if (tens>0)
-                    level-=(tens*10);
+    snprintf(chart.ylabel,MAX_PATH_LEN,"%s Referenced To LOS Path Between\n%s and %s (%s)",
+             (normalized?"Normalized Height":"Height"),destination.name,source.name,(metric?"meters":"feet"));
 
-                units=level;
+    chart.xmin=-0.5;
+    chart.xmax=(metric?KM_PER_MILE*rint(distance+0.5):rint(distance+0.5));
+    chart.ymin=(metric?miny*METERS_PER_FOOT:miny);
+    chart.ymax=(metric?maxy*METERS_PER_FOOT:maxy);
+    chart.y2min=(metric?min2y*METERS_PER_FOOT:min2y);
+    chart.y2max=(metric?max2y*METERS_PER_FOOT:max2y);
+    chart.have_y2=1;
 
-                if (y0>=8 && y0<=23)
-                {
-                    if (hundreds>0)
-                    {
-                        if (region.level[indx]<0)
-                        {
-                            if (x>=5 && x<=12)
-                                if (fontdata[16*('-')+(y0-8)]&(128>>(x-5)))
-                                    indx=255;
-                        }
+    ChartAddSeries(&chart,dist,prof,n,0,"Point-to-Point Profile");
 
-                        else
-                        {
-                            if (x>=5 && x<=12)
-                                if (fontdata[16*('+')+(y0-8)]&(128>>(x-5)))
-                                    indx=255;
-                        }
+    if (clut!=NULL)
+    {
+        snprintf(label,MAX_LINE_LEN,"Ground Clutter (%.2f %s)",
+                 (metric?clutter*METERS_PER_FOOT:clutter),(metric?"meters":"feet"));
+        ChartAddSeries(&chart,dist+1,clut+1,n-3,0,label);
+    }
 
-                        if (x>=13 && x<=20)	 
-                            if (fontdata[16*(hundreds+'0')+(y0-8)]&(128>>(x-13)))
-                                indx=255; 
-                    }
+    ChartAddSeries(&chart,dist,ref,n,0,(do_fresnel?"Line of Sight Path":"Line Of Sight Path"));
+    ChartAddSeries(&chart,dist,curv,n-1,1,"Earth's Curvature Contour");
 
-                    if (tens>0 || hundreds>0)
-                    {
-                        if (hundreds==0)
-                        {
-                            if (region.level[indx]<0)
-                            {
-                                if (x>=13 && x<=20)
-                                    if (fontdata[16*('-')+(y0-8)]&(128>>(x-13)))
-                                        indx=255;
-                            }
+    if (do_fresnel)
+    {
+        snprintf(label,MAX_LINE_LEN,"First Fresnel Zone (%.3f MHz)",LR.frq_mhz);
+        ChartAddSeries(&chart,dist,fres,n,0,label);
 
-                            else
-                            {
-                                if (x>=13 && x<=20)
-                                    if (fontdata[16*('+')+(y0-8)]&(128>>(x-13)))
-                                        indx=255;
-                            }
-                        }
+        snprintf(label,MAX_LINE_LEN,"%.0f%% of First Fresnel Zone",fzone_clearance*100.0);
+        ChartAddSeries(&chart,dist,fres6,n,0,label);
+    }
 
-                        if (x>=21 && x<=28)	 
-                            if (fontdata[16*(tens+'0')+(y0-8)]&(128>>(x-21)))
-                                indx=255;
-                    }
+    if (ChartRender(&chart,basename,ext)==0)
+    {
+        fprintf(stdout,"\n%seight plot written to: \"%s.%s\"",
+                normalized?"Normalized h":"H",basename,ext);
+        fflush(stdout);
 
-                    if (hundreds==0 && tens==0)
-                    {
-                        if (region.level[indx]<0)
-                        {
-                            if (x>=21 && x<=28)
-                                if (fontdata[16*('-')+(y0-8)]&(128>>(x-21)))
-                                    indx=255;
-                        }
+        free(dist);
+        free(prof);
+        free(ref);
+        free(curv);
+        free(clut);
+        free(fres);
+        free(fres6);
+        return;
+    }
 
-                        else
-                        {
-                            if (x>=21 && x<=28)
-                                if (fontdata[16*('+')+(y0-8)]&(128>>(x-21)))
-                                    indx=255;
-                        }
-                    }
+    /* Formats we don't rasterize ourselves still go through gnuplot */
 
-                    if (x>=29 && x<=36)
-                        if (fontdata[16*(units+'0')+(y0-8)]&(128>>(x-29)))
-                            indx=255;
+    fd=fopen("profile.gp","wb");
 
-                    if (x>=37 && x<=44)
-                        if (fontdata[16*('d')+(y0-8)]&(128>>(x-37)))
-                            indx=255;
+    if (clut!=NULL)
+        fd1=fopen("clutter.gp","wb");
 
-                    if (x>=45 && x<=52)
-                        if (fontdata[16*('B')+(y0-8)]&(128>>(x-45)))
-                            indx=255;
+    fd2=fopen("reference.gp","wb");
+    fd5=fopen("curvature.gp", "wb");
 
-                    if (x>=53 && x<=60)
-                        if (fontdata[16*('m')+(y0-8)]&(128>>(x-53)))
-                            indx=255;
-                }
+    if (do_fresnel)
+    {
+        fd3=fopen("fresnel.gp", "wb");
+        fd4=fopen("fresnel_pt_6.gp", "wb");
+    }
 
-                if (indx>region.levels)
-                    pixel=COLOR_BLACK;
-                else
-                {
-                    red=region.color[indx][0];
-                    green=region.color[indx][1];
-                    blue=region.color[indx][2];
+    for (x=0; x<n; x++)
+    {
+        fprintf(fd,"%f\t%f\n",dist[x],prof[x]);
 
-                    pixel=RGB(red,green,blue);
-                }
+        if (fd1!=NULL && x>0 && x<n-2)
+            fprintf(fd1,"%f\t%f\n",dist[x],clut[x]);
 
-                ImageWriterAppendPixel(&iw, pixel);
-            } 
+        if (x<n-1)
+        {
+            fprintf(fd2,"%f\t%f\n",dist[x],ref[x]);
+            fprintf(fd5,"%f\t%f\n",dist[x],curv[x]);
+        }
 
-            ImageWriterEmitLine(&iw);
+        if (do_fresnel)
+        {
+            fprintf(fd3,"%f\t%f\n",dist[x],fres[x]);
+            fprintf(fd4,"%f\t%f\n",dist[x],fres6[x]);
         }
     }
 
-    ImageWriterFinish(&iw);
-
-    if (kml)
-    {
-        /* Write colorkey image file */
-        height=30*region.levels;
-        width=100;
+    fprintf(fd2,"%f\t%f\n",dist[n-1],ref[n-1]);
 
-        if (ImageWriterInit(&iw,ckfile,imagetype,width,height)<0) {
-            fprintf(stdout,"\nError writing \"%s\"!\n",ckfile);
-            fflush(stdout);
-            return;
-        }
+    fclose(fd);
 
-        for (y0=0; y0<(int)height; y0++)
-        {
-            for (x0=0; x0<(int)width; x0++)
-            {
-                indx=y0/30;
-                x=x0;
+    if (fd1!=NULL)
+        fclose(fd1);
 
-                level=abs(region.level[indx]);
+    fclose(fd2);
+    fclose(fd5);
 
-                hundreds=level/100;
+    if (do_fresnel)
+    {
+        fclose(fd3);
+        fclose(fd4);
+    }
 
-                if (hundreds>0)
-                    level-=(hundreds*100);
+    fd=fopen("splat.gp","w");
 
-                tens=level/10;
+    fprintf(fd,"set grid\n");
+    fprintf(fd,"set yrange [%2.3f to %2.3f]\n", metric?miny*METERS_PER_FOOT:miny, metric?maxy*METERS_PER_FOOT:maxy);
+    fprintf(fd,"set y2range [%2.3f to %2.3f]\n", metric?min2y*METERS_PER_FOOT:min2y, metric?max2y*METERS_PER_FOOT:max2y);
+    fprintf(fd,"set xrange [-0.5 to %2.3f]\n",metric?KM_PER_MILE*rint(distance+0.5):rint(distance+0.5));
+    fprintf(fd,"set encoding iso_8859_1\n");
+    fprintf(fd,"set term %s\n",term);
 
-                if (tens>0)
-                    level-=(tens*10);
+    if (do_fresnel)
+        fprintf(fd,"set title \"%s Path Profile Between %s and %s (%.2f%c azimuth)\\nWith First Fresnel Zone\"\n",SPLAT_NAME, destination.name, source.name, azimuth,176);
 
-                units=level;
+    else
+        fprintf(fd,"set title \"%s Height Profile Between %s and %s (%.2f%c azimuth)\"\n",SPLAT_NAME, destination.name, source.name, azimuth,176);
 
+    if (metric)
+        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*Distance(source,destination));
+    else
+        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,Distance(source,destination));
 
-                if ((y0%30)>=8 && (y0%30)<=23)
-                {
-                    if (hundreds>0)
-                    {
-                        if (region.level[indx]<0)
-                        {
-                            if (x>=5 && x<=12)
-                                if (fontdata[16*('-')+((y0%30)-8)]&(128>>(x-5)))
-                                    indx=255;
-                        }
+    if (normalized)
+    {
+        if (metric)
+            fprintf(fd,"set ylabel \"Normalized Height Referenced To LOS Path Between\\n%s and %s (meters)\"\n",destination.name,source.name);
 
-                        else
-                        {
-                            if (x>=5 && x<=12)
-                                if (fontdata[16*('+')+((y0%30)-8)]&(128>>(x-5)))
-                                    indx=255;
-                        }
+        else
+            fprintf(fd,"set ylabel \"Normalized Height Referenced To LOS Path Between\\n%s and %s (feet)\"\n",destination.name,source.name);
 
-                        if (x>=13 && x<=20)	 
-                            if (fontdata[16*(hundreds+'0')+((y0%30)-8)]&(128>>(x-13)))
-                                indx=255; 
-                    }
+    }
 
-                    if (tens>0 || hundreds>0)
-                    {
-                        if (hundreds==0)
-                        {
-                            if (region.level[indx]<0)
-                            {
-                                if (x>=13 && x<=20)
-                                    if (fontdata[16*('-')+((y0%30)-8)]&(128>>(x-13)))
-                                        indx=255;
-                            }
+    else
+    {
+        if (metric)
+            fprintf(fd,"set ylabel \"Height Referenced To LOS Path Between\\n%s and %s (meters)\"\n",destination.name,source.name);
 
-                            else
-                            {
-                                if (x>=13 && x<=20)
-                                    if (fontdata[16*('+')+((y0%30)-8)]&(128>>(x-13)))
-                                        indx=255;
-                            }
-                        }
+        else
+            fprintf(fd,"set ylabel \"Height Referenced To LOS Path Between\\n%s and %s (feet)\"\n",destination.name,source.name);
+    }
 
-                        if (x>=21 && x<=28)	 
-                            if (fontdata[16*(tens+'0')+((y0%30)-8)]&(128>>(x-21)))
-                                indx=255;
-                    }
+    fprintf(fd,"set output \"%s.%s\"\n",basename,ext);
 
-                    if (hundreds==0 && tens==0)
-                    {
-                        if (region.level[indx]<0)
-                        {
-                            if (x>=21 && x<=28)
-                                if (fontdata[16*('-')+((y0%30)-8)]&(128>>(x-21)))
-                                    indx=255;
-                        }
+    if (do_fresnel)
+    {
+        if (clutter>0.0)
+        {
+            if (metric)
+                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f meters)\" with lines, \"reference.gp\" title \"Line of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines, \"fresnel.gp\" axes x1y1 title \"First Fresnel Zone (%.3f MHz)\" with lines, \"fresnel_pt_6.gp\" title \"%.0f%% of First Fresnel Zone\" with lines\n",clutter*METERS_PER_FOOT,LR.frq_mhz,fzone_clearance*100.0);
+            else
+                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f feet)\" with lines, \"reference.gp\" title \"Line of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines, \"fresnel.gp\" axes x1y1 title \"First Fresnel Zone (%.3f MHz)\" with lines, \"fresnel_pt_6.gp\" title \"%.0f%% of First Fresnel Zone\" with lines\n",clutter,LR.frq_mhz,fzone_clearance*100.0);
+        }
 
-                        else
-                        {
-                            if (x>=21 && x<=28)
-                                if (fontdata[16*('+')+((y0%30)-8)]&(128>>(x-21)))
-                                    indx=255;
-                        }
-                    }
+        else
+            fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"reference.gp\" title \"Line of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines, \"fresnel.gp\" axes x1y1 title \"First Fresnel Zone (%.3f MHz)\" with lines, \"fresnel_pt_6.gp\" title \"%.0f%% of First Fresnel Zone\" with lines\n",LR.frq_mhz,fzone_clearance*100.0);
+    }
 
-                    if (x>=29 && x<=36)
-                        if (fontdata[16*(units+'0')+((y0%30)-8)]&(128>>(x-29)))
-                            indx=255;
+    else
+    {
+        if (clutter>0.0)
+        {
+            if (metric)
+                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f meters)\" with lines, \"reference.gp\" title \"Line Of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines\n",clutter*METERS_PER_FOOT);
+            else
+                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f feet)\" with lines, \"reference.gp\" title \"Line Of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines\n",clutter);
+        }
 
-                    if (x>=37 && x<=44)
-                        if (fontdata[16*('d')+((y0%30)-8)]&(128>>(x-37)))
-                            indx=255;
+        else
+            fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"reference.gp\" title \"Line Of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines\n");
 
-                    if (x>=45 && x<=52)
-                        if (fontdata[16*('B')+((y0%30)-8)]&(128>>(x-45)))
-                            indx=255;
+    }
 
-                    if (x>=53 && x<=60)
-                        if (fontdata[16*('m')+((y0%30)-8)]&(128>>(x-53)))
-                            indx=255;
-                }
+    fclose(fd);
 
-                if (indx>region.levels) {
-                    pixel=COLOR_BLACK;
-                }
-                else
-                {
-                    red=region.color[indx][0];
-                    green=region.color[indx][1];
-                    blue=region.color[indx][2];
+    x=system("gnuplot splat.gp");
 
-                    pixel=RGB(red,green,blue);
-                }
+    if (x!=-1)
+    {
+        if (!gpsav)
+        {
+            unlink("splat.gp");
+            unlink("profile.gp");
+            unlink("reference.gp");
+            unlink("curvature.gp");
 
-                ImageWriterAppendPixel(&iw, pixel);
-            }
+            if (fd1!=NULL)
+                unlink("clutter.gp");
 
-            ImageWriterEmitLine(&iw);
+            if (do_fresnel)
+            {
+                unlink("fresnel.gp");
+                unlink("fresnel_pt_6.gp");
+            }
         }
 
-        ImageWriterFinish(&iw);
+        fprintf(stdout,"\n%seight plot written to: \"%s.%s\"",
+                normalized?"Normalized h":"H",basename,ext);
+        fflush(stdout);
     }
 
-    free(mapfile);
-    free(geofile);
-    free(kmlfile);
-    free(ckfile);
+    else
+        fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
 
-    fprintf(stdout,"Done!\n");
-    fflush(stdout);
+    free(dist);
+    free(prof);
+    free(ref);
+    free(curv);
+    free(clut);
+    free(fres);
+    free(fres6);
 }
 
-/* Invokes gnuplot to generate a file indicating the terrain profile between
- * the source and destination locations.
- * "basename" is the name assigned to the output file generated by gnuplot.
- * The filename extension is used to set gnuplot's terminal setting
- * and output file type.
- * If no extension is found, .png is assumed.
+/* Performs an obstruction analysis along the path between receiver
+ * and transmitter.
  */
-void GraphTerrain(Site source, Site destination, char *name)
+void ObstructionAnalysis(Site xmtr, Site rcvr, double f, FILE *outfile)
 {
     int	x;
-    char	basename[MAX_PATH_LEN], term[30], ext[20];
-    double	minheight=100000.0, maxheight=-100000.0;
-    FILE	*fd=NULL, *fd1=NULL;
+    Site site_x;
+    double	h_r, h_t, h_x, h_r_orig, cos_tx_angle, cos_test_angle,
+            cos_tx_angle_f1, cos_tx_angle_fpt6, d_tx, d_x,
+            h_r_f1, h_r_fpt6, h_f, h_los, lambda=0.0;
+    char	buf[MAX_PATH_LEN], buf_fpt6[MAX_PATH_LEN], buf_f1[MAX_PATH_LEN];
 
-    Path *path = AllocatePath();
+    Path *path = GetReportPath(xmtr,rcvr);
     if (!path) {
         fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
         return;
     }
-    ReadPath(destination,source,path); 
 
-    fd=fopen("profile.gp","wb");
+    if (rcvr.amsl_flag)
+        h_r=rcvr.alt+earthradius;
+    else
+        h_r=GetElevation(rcvr)+rcvr.alt+earthradius;
+
+    h_r_f1=h_r;
+    h_r_fpt6=h_r;
+    h_r_orig=h_r;
+
+    if (xmtr.amsl_flag)
+        h_t=xmtr.alt+earthradius;
+    else
+        h_t=GetElevation(xmtr)+xmtr.alt+earthradius;
+
+    d_tx=5280.0*Distance(rcvr,xmtr);
+    cos_tx_angle=((h_r*h_r)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r*d_tx);
+    cos_tx_angle_f1=cos_tx_angle;
+    cos_tx_angle_fpt6=cos_tx_angle;
+
+    if (f)
+        lambda=9.8425e8/(f*1e6);
 
     if (clutter>0.0)
-        fd1=fopen("clutter.gp","wb");
+    {
+        fprintf(outfile,"Terrain has been raised by");
 
-    for (x=0; x<path->length; x++)
+        if (metric)
+            fprintf(outfile," %.2f meters",METERS_PER_FOOT*clutter);
+        else
+            fprintf(outfile," %.2f feet",clutter);
+
+        fprintf(outfile," to account for ground clutter.\n\n");
+    }
+
+    /* At each point along the path calculate the cosine
+       of a sort of "inverse elevation angle" at the receiver.
+       From the antenna, 0 deg. looks at the ground, and 90 deg.
+       is parallel to the ground.
+
+       Start at the receiver.  If this is the lowest antenna,
+       then terrain obstructions will be nearest to it.  (Plus,
+       that's the way SPLAT!'s original los() did it.)
+
+       Calculate cosines only.  That's sufficient to compare
+       angles and it saves the extra computational burden of
+       acos().  However, note the inverted comparison: if
+       acos(A) > acos(B), then B > A. */
+
+    for (x=path->length-1; x>0; x--)
     {
-        if ((path->elevation[x]+clutter)>maxheight)
-            maxheight=path->elevation[x]+clutter;
+        site_x.lat=path->lat[x];
+        site_x.lon=path->lon[x];
+        site_x.alt=0.0;
 
-        if (path->elevation[x]<minheight)
-            minheight=path->elevation[x];
+        h_x=GetElevation(site_x)+earthradius+clutter;
+        d_x=5280.0*Distance(rcvr,site_x);
+
+        /* Deal with the LOS path first. */
+
+        cos_test_angle=((h_r*h_r)+(d_x*d_x)-(h_x*h_x))/(2.0*h_r*d_x);
+
+        if (cos_tx_angle>cos_test_angle)
+        {
+            if (h_r==h_r_orig)
+                fprintf(outfile,"Between %s and %s, %s detected obstructions at:\n\n",rcvr.name,xmtr.name,SPLAT_NAME);
+
+            if (site_x.lat>=0.0)
+            {
+                if (metric)
+                    fprintf(outfile,"   %8.4f N,%9.4f W, %5.2f kilometers, %6.2f meters AMSL\n",site_x.lat, site_x.lon, KM_PER_MILE*(d_x/5280.0), METERS_PER_FOOT*(h_x-earthradius));
+                else
+                    fprintf(outfile,"   %8.4f N,%9.4f W, %5.2f miles, %6.2f feet AMSL\n",site_x.lat, site_x.lon, d_x/5280.0, h_x-earthradius);
+            }
+
+            else
+            {
+                if (metric)
+                    fprintf(outfile,"   %8.4f S,%9.4f W, %5.2f kilometers, %6.2f meters AMSL\n",-site_x.lat, site_x.lon, KM_PER_MILE*(d_x/5280.0), METERS_PER_FOOT*(h_x-earthradius));
+                else
+
+                    fprintf(outfile,"   %8.4f S,%9.4f W, %5.2f miles, %6.2f feet AMSL\n",-site_x.lat, site_x.lon, d_x/5280.0, h_x-earthradius);
+            }
+        }
+
+        while (cos_tx_angle>cos_test_angle)
+        {
+            h_r+=1;
+            cos_test_angle=((h_r*h_r)+(d_x*d_x)-(h_x*h_x))/(2.0*h_r*d_x);
+            cos_tx_angle=((h_r*h_r)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r*d_tx);
+        }
+
+        if (f)
+        {
+            /* Now clear the first Fresnel zone... */
+
+            cos_tx_angle_f1=((h_r_f1*h_r_f1)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_f1*d_tx);
+            h_los=sqrt(h_r_f1*h_r_f1+d_x*d_x-2*h_r_f1*d_x*cos_tx_angle_f1);
+            h_f=h_los-sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
+
+            while (h_f<h_x)
+            {
+                h_r_f1+=1;
+                cos_tx_angle_f1=((h_r_f1*h_r_f1)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_f1*d_tx);
+                h_los=sqrt(h_r_f1*h_r_f1+d_x*d_x-2*h_r_f1*d_x*cos_tx_angle_f1);
+                h_f=h_los-sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
+            }
+
+            /* and clear the 60% F1 zone. */
+
+            cos_tx_angle_fpt6=((h_r_fpt6*h_r_fpt6)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_fpt6*d_tx);
+            h_los=sqrt(h_r_fpt6*h_r_fpt6+d_x*d_x-2*h_r_fpt6*d_x*cos_tx_angle_fpt6);
+            h_f=h_los-fzone_clearance*sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
+
+            while (h_f<h_x)
+            {
+                h_r_fpt6+=1;
+                cos_tx_angle_fpt6=((h_r_fpt6*h_r_fpt6)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_fpt6*d_tx);
+                h_los=sqrt(h_r_fpt6*h_r_fpt6+d_x*d_x-2*h_r_fpt6*d_x*cos_tx_angle_fpt6);
+                h_f=h_los-fzone_clearance*sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
+            }
+        }
+    }
 
+    if (h_r>h_r_orig)
+    {
         if (metric)
+            snprintf(buf,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f meters AGL\nto clear all obstructions detected by %s.\n",rcvr.name, METERS_PER_FOOT*(h_r-GetElevation(rcvr)-earthradius),SPLAT_NAME);
+        else
+            snprintf(buf,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f feet AGL\nto clear all obstructions detected by %s.\n",rcvr.name, h_r-GetElevation(rcvr)-earthradius,SPLAT_NAME);
+    }
+
+    else
+        snprintf(buf,MAX_PATH_LEN,"\nNo obstructions to LOS path due to terrain were detected by %s\n",SPLAT_NAME);
+
+    if (f)
+    {
+        if (h_r_fpt6>h_r_orig)
         {
-            fprintf(fd,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*path->elevation[x]);
+            if (metric)
+                snprintf(buf_fpt6,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f meters AGL\nto clear %.0f%c of the first Fresnel zone.\n",rcvr.name, METERS_PER_FOOT*(h_r_fpt6-GetElevation(rcvr)-earthradius),fzone_clearance*100.0,37);
 
-            if (fd1!=NULL && x>0 && x<path->length-2)
-                fprintf(fd1,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*(path->elevation[x]==0.0?path->elevation[x]:(path->elevation[x]+clutter)));
+            else
+                snprintf(buf_fpt6,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f feet AGL\nto clear %.0f%c of the first Fresnel zone.\n",rcvr.name, h_r_fpt6-GetElevation(rcvr)-earthradius,fzone_clearance*100.0,37);
         }
 
         else
+            snprintf(buf_fpt6,MAX_PATH_LEN,"\n%.0f%c of the first Fresnel zone is clear.\n",fzone_clearance*100.0,37);
+
+        if (h_r_f1>h_r_orig)
         {
-            fprintf(fd,"%f\t%f\n",path->distance[x],path->elevation[x]);
+            if (metric)
+                snprintf(buf_f1,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f meters AGL\nto clear the first Fresnel zone.\n",rcvr.name, METERS_PER_FOOT*(h_r_f1-GetElevation(rcvr)-earthradius));
+
+            else
+                snprintf(buf_f1,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f feet AGL\nto clear the first Fresnel zone.\n",rcvr.name, h_r_f1-GetElevation(rcvr)-earthradius);
 
-            if (fd1!=NULL && x>0 && x<path->length-2)
-                fprintf(fd1,"%f\t%f\n",path->distance[x],(path->elevation[x]==0.0?path->elevation[x]:(path->elevation[x]+clutter)));
         }
+
+        else
+            snprintf(buf_f1,MAX_PATH_LEN,"\nThe first Fresnel zone is clear.\n");
     }
 
-    fclose(fd);
+    fprintf(outfile,"%s",buf);
 
-    if (fd1!=NULL)
-        fclose(fd1);
+    if (f)
+    {
+        fprintf(outfile,"%s",buf_f1);
+        fprintf(outfile,"%s",buf_fpt6);
+    }
+}
+
+/* Writes a SPLAT! Path Report (source.name-to-dest.name.txt) to the filesystem.
+ * If (graph_it == true), then gnuplot is invoked to generate an appropriate output
+ * file indicating the ITM/ITWOM model loss between the source and destination
+ * locations. You don't get a choice in the name of the text report, but "name"
+ * is the name assigned to the output file generated by gnuplot.
+ * The filename extension is used to set gnuplot's terminal setting and output
+ * file type. If no extension is found, .png is assumed.
+ */
+void PathReport(Site source, Site destination, char *name, bool graph_it)
+{
+    int	x, y, n=0, errnum;
+    char	basename[MAX_PATH_LEN], term[30], ext[20], strmode[100],
+            report_name[MAX_PATH_LEN], block=0, propbuf[20];
+    double	maxloss=-100000.0, minloss=100000.0, loss, haavt,
+            angle1, angle2, azimuth, pattern=1.0, patterndB=0.0,
+            total_loss=0.0, cos_xmtr_angle, cos_test_angle=0.0,
+            source_alt, test_alt, dest_alt, source_alt2, dest_alt2,
+            distance, elevation, four_thirds_earth, field_strength,
+            free_space_loss=0.0, eirp=0.0, voltage, rxp, dBm,
+            power_density;
+    double	*gdist=NULL, *gloss=NULL;
+    FILE	*fd=NULL, *fd2=NULL;
+    Chart	chart;
+
+    snprintf(report_name,MAX_PATH_LEN,"%s-to-%s.txt",source.name,destination.name);
 
-    if (name[0]=='.')
-    {
-        /* Default filename and output file type */
-        strcpy(basename,"profile");
-        strcpy(ext,"png");
-    }
-    else
-    {
-        /* Extract extension and terminal type from "name" */
-        strncpy(basename, name, MAX_PATH_LEN-1);
-        stripExtension(basename, ext, 20);
-        convertBackslashes(basename);
-        if (strlen(ext) == 0)
-        {
-            strcpy(ext,"png");
-        }
+    Path *path = GetReportPath(source,destination);
+    if (!path) {
+        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path!\n");
+        return;
     }
-    strcpy(term,ext);
 
-    /* Either .ps or .postscript may be used
-       as an extension for postscript output. */
+    four_thirds_earth=FOUR_THIRDS*EARTHRADIUS;
 
-    if (strncmp(term,"postscript",10)==0)
-        strcpy(ext,"ps");
+    for (x=0; report_name[x]!=0; x++)
+        if (report_name[x]==32 || report_name[x]==17 || report_name[x]==92 || report_name[x]==42 || report_name[x]==47)
+            report_name[x]='_';
 
-    else if (strncmp(ext,"ps",2)==0)
-        strcpy(term,"postscript enhanced color");
+    fd2=fopen(report_name,"w");
 
-    if (maxheight<1.0)
+    fprintf(fd2,"\n\t\t--==[ %s v%s Path Analysis ]==--\n\n",SPLAT_NAME,SPLAT_VERSION);
+    fprintf(fd2,"%s\n\n",dashes);
+    fprintf(fd2,"Transmitter site: %s\n",source.name);
+
+    if (source.lat>=0.0)
     {
-        maxheight=1.0;	/* Avoid a gnuplot y-range error */ 
-        minheight=-1.0;	/* over a completely sea-level path */
+        fprintf(fd2,"Site location: %.4f North / %.4f West",source.lat, source.lon);
+        fprintf(fd2, " (%s N / ", dec2dms(source.lat));
     }
 
     else
-        minheight-=(0.01*maxheight);
+    {
 
-    fd=fopen("splat.gp","w");
-    fprintf(fd,"set grid\n");
-    fprintf(fd,"set yrange [%2.3f to %2.3f]\n", metric?minheight*METERS_PER_FOOT:minheight, metric?maxheight*METERS_PER_FOOT:maxheight);
-    fprintf(fd,"set encoding iso_8859_1\n");
-    fprintf(fd,"set term %s\n",term);
-    fprintf(fd,"set title \"%s Terrain Profile Between %s and %s (%.2f%c Azimuth)\"\n",SPLAT_NAME,destination.name, source.name, Azimuth(destination,source),176);
+        fprintf(fd2,"Site location: %.4f South / %.4f West",-source.lat, source.lon);
+        fprintf(fd2, " (%s S / ", dec2dms(source.lat));
+    }
+
+    fprintf(fd2, "%s W)\n", dec2dms(source.lon));
 
     if (metric)
     {
-        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*Distance(source,destination));
-        fprintf(fd,"set ylabel \"Ground Elevation Above Sea Level (meters)\"\n");
+        if (source.amsl_flag)
+            fprintf(fd2,"Antenna height: %.2f meters AMSL\n",METERS_PER_FOOT*source.alt);
+        else
+        {
+            fprintf(fd2,"Ground elevation: %.2f meters AMSL\n",METERS_PER_FOOT*GetElevation(source));
+            fprintf(fd2,"Antenna height: %.2f meters AGL / %.2f meters AMSL\n",METERS_PER_FOOT*source.alt,METERS_PER_FOOT*(source.alt+GetElevation(source)));
+        }
     }
-
     else
     {
-        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,Distance(source,destination));
-        fprintf(fd,"set ylabel \"Ground Elevation Above Sea Level (feet)\"\n");
+        if (source.amsl_flag)
+            fprintf(fd2,"Antenna height: %.2f feet AMSL\n",source.alt);
+        else
+        {
+            fprintf(fd2,"Ground elevation: %.2f feet AMSL\n",GetElevation(source));
+            fprintf(fd2,"Antenna height: %.2f feet AGL / %.2f feet AMSL\n",source.alt, source.alt+GetElevation(source));
+        }
     }
 
-    fprintf(fd,"set output \"%s.%s\"\n",basename,ext);
+    haavt=haat(source);
 
-    if (clutter>0.0)
+    if (haavt>-4999.0)
     {
         if (metric)
-            fprintf(fd,"plot \"profile.gp\" title \"Terrain Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f meters)\" with lines\n",clutter*METERS_PER_FOOT);
+            fprintf(fd2,"Antenna height above average terrain: %.2f meters\n",METERS_PER_FOOT*haavt);
         else
-            fprintf(fd,"plot \"profile.gp\" title \"Terrain Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f feet)\" with lines\n",clutter);
+            fprintf(fd2,"Antenna height above average terrain: %.2f feet\n",haavt);
     }
 
-    else
-        fprintf(fd,"plot \"profile.gp\" title \"\" with lines\n");
+    azimuth=Azimuth(source,destination);
+    angle1=ElevationAngle(source,destination);
+    angle2=ElevationAngle2(source,destination,earthradius);
 
-    fclose(fd);
+    if (got_azimuth_pattern || got_elevation_pattern)
+    {
+        x=(int)rint(10.0*(10.0-angle2));
 
-    x=system("gnuplot splat.gp");
+        if (x>=0 && x<=1000) {
+            patterndB=(double)LR.antenna_pattern[(int)rint(azimuth)][x];
 
-    if (x!=-1)
-    {
-        if (!gpsav)
-        {
-            unlink("splat.gp");
-            unlink("profile.gp");
+            if (patterndB==ANTENNA_NULL_DB)
+                patterndB=-9999;
+            else
+                pattern=pow(10.0,patterndB/20.0);
         }
-
-        fprintf(stdout,"Terrain plot written to: \"%s.%s\"\n",basename,ext);
-        fflush(stdout);
     }
 
+    if (metric)
+        fprintf(fd2,"Distance to %s: %.2f kilometers\n",destination.name,KM_PER_MILE*Distance(source,destination));
+
     else
-        fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
+        fprintf(fd2,"Distance to %s: %.2f miles\n",destination.name,Distance(source,destination));
 
-    DestroyPath(path);
-}
+    fprintf(fd2,"Azimuth to %s: %.2f degrees\n",destination.name,azimuth);
 
-/* Invokes gnuplot to generate a file indicating the terrain elevation profile
- * between the source and destination locations.
- * "basename" is the name assigned to the output file generated by gnuplot.
- * The filename extension is used to set gnuplot's terminal setting
- * and output file type.
- * If no extension is found, .png is assumed.
- */
-void GraphElevation(Site source, Site destination, char *name)
-{
-    int	x;
-    char	basename[MAX_PATH_LEN], term[30], ext[20];
-    double	angle, clutter_angle=0.0, refangle, maxangle=-90.0,
-            minangle=90.0, distance;
-    Site	remote, remote2;
-    FILE	*fd=NULL, *fd1=NULL, *fd2=NULL;
+    if (angle1>=0.0)
+        fprintf(fd2,"Elevation angle to %s: %+.4f degrees\n",destination.name,angle1);
 
-    Path *path = AllocatePath();
-    if (!path) {
-        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
-        return;
+    else
+        fprintf(fd2,"Depression angle to %s: %+.4f degrees\n",destination.name,angle1);
+
+    if ((angle2-angle1)>0.0001)
+    {
+        if (angle2<0.0)
+            fprintf(fd2,"Depression");
+        else
+            fprintf(fd2,"Elevation");
+
+        fprintf(fd2," angle to the first obstruction: %+.4f degrees\n",angle2);
     }
-    ReadPath(destination,source,path);  /* destination=RX, source=TX */
-    refangle=ElevationAngle(destination,source);
-    distance=Distance(source,destination);
 
-    fd=fopen("profile.gp","wb");
+    fprintf(fd2,"\n%s\n\n",dashes);
 
-    if (clutter>0.0)
-        fd1=fopen("clutter.gp","wb");
+    /* Receiver */
 
-    fd2=fopen("reference.gp","wb");
+    fprintf(fd2,"Receiver site: %s\n",destination.name);
 
-    for (x=1; x<path->length-1; x++)
+    if (destination.lat>=0.0)
     {
-        remote.lat=path->lat[x];
-        remote.lon=path->lon[x];
-        remote.alt=0.0;
-        angle=ElevationAngle(destination,remote);
+        fprintf(fd2,"Site location: %.4f North / %.4f West",destination.lat, destination.lon);
+        fprintf(fd2, " (%s N / ", dec2dms(destination.lat));
+    }
 
-        if (clutter>0.0)
-        {
-            remote2.lat=path->lat[x];
-            remote2.lon=path->lon[x];
+    else
+    {
+        fprintf(fd2,"Site location: %.4f South / %.4f West",-destination.lat, destination.lon);
+        fprintf(fd2, " (%s S / ", dec2dms(destination.lat));
+    }
 
-            if (path->elevation[x]!=0.0)
-                remote2.alt=clutter;
-            else
-                remote2.alt=0.0;
+    fprintf(fd2, "%s W)\n", dec2dms(destination.lon));
 
-            clutter_angle=ElevationAngle(destination,remote2);
-        }
+    if (metric)
+    {
+        if (destination.amsl_flag)
+            fprintf(fd2,"Antenna height: %.2f meters AMSL\n", METERS_PER_FOOT*destination.alt);
 
-        if (metric)
+        else
         {
-            fprintf(fd,"%f\t%f\n",KM_PER_MILE*path->distance[x],angle);
-
-            if (fd1!=NULL)
-                fprintf(fd1,"%f\t%f\n",KM_PER_MILE*path->distance[x],clutter_angle);
-
-            fprintf(fd2,"%f\t%f\n",KM_PER_MILE*path->distance[x],refangle);
+            fprintf(fd2,"Ground elevation: %.2f meters AMSL\n",METERS_PER_FOOT*GetElevation(destination));
+            fprintf(fd2,"Antenna height: %.2f meters AGL / %.2f meters AMSL\n",METERS_PER_FOOT*destination.alt, METERS_PER_FOOT*(destination.alt+GetElevation(destination)));
         }
-
+    }
+    else
+    {
+        if (destination.amsl_flag)
+            fprintf(fd2,"Antenna height: %.2f feet AMSL\n", destination.alt);
         else
         {
-            fprintf(fd,"%f\t%f\n",path->distance[x],angle);
-
-            if (fd1!=NULL)
-                fprintf(fd1,"%f\t%f\n",path->distance[x],clutter_angle);
-
-            fprintf(fd2,"%f\t%f\n",path->distance[x],refangle);
+            fprintf(fd2,"Ground elevation: %.2f feet AMSL\n",GetElevation(destination));
+            fprintf(fd2,"Antenna height: %.2f feet AGL / %.2f feet AMSL\n",destination.alt, destination.alt+GetElevation(destination));
         }
+    }
 
-        if (angle>maxangle)
-            maxangle=angle;
-
-        if (clutter_angle>maxangle)
-            maxangle=clutter_angle;
+    haavt=haat(destination);
 
-        if (angle<minangle)
-            minangle=angle;
+    if (haavt>-4999.0)
+    {
+        if (metric)
+            fprintf(fd2,"Antenna height above average terrain: %.2f meters\n",METERS_PER_FOOT*haavt);
+        else
+            fprintf(fd2,"Antenna height above average terrain: %.2f feet\n",haavt);
     }
 
     if (metric)
-    {
-        fprintf(fd,"%f\t%f\n",KM_PER_MILE*path->distance[path->length-1],refangle);
-        fprintf(fd2,"%f\t%f\n",KM_PER_MILE*path->distance[path->length-1],refangle);
-    }
+        fprintf(fd2,"Distance to %s: %.2f kilometers\n",source.name,KM_PER_MILE*Distance(source,destination));
+
+    else
+        fprintf(fd2,"Distance to %s: %.2f miles\n",source.name,Distance(source,destination));
+
+    azimuth=Azimuth(destination,source);
+
+    angle1=ElevationAngle(destination,source);
+    angle2=ElevationAngle2(destination,source,earthradius);
+
+    fprintf(fd2,"Azimuth to %s: %.2f degrees\n",source.name,azimuth);
+
+    if (angle1>=0.0)
+        fprintf(fd2,"Elevation angle to %s: %+.4f degrees\n",source.name,angle1);
 
     else
+        fprintf(fd2,"Depression angle to %s: %+.4f degrees\n",source.name,angle1);
+
+    if ((angle2-angle1)>0.0001)
     {
-        fprintf(fd,"%f\t%f\n",path->distance[path->length-1],refangle);
-        fprintf(fd2,"%f\t%f\n",path->distance[path->length-1],refangle);
+        if (angle2<0.0)
+            fprintf(fd2,"Depression");
+        else
+            fprintf(fd2,"Elevation");
+
+        fprintf(fd2," angle to the first obstruction: %+.4f degrees\n",angle2);
     }
 
-    fclose(fd);
+    fprintf(fd2,"\n%s\n\n",dashes);
+
+    if (LR.frq_mhz>0.0)
+    {
+        if (itwom)
+            fprintf(fd2,"ITWOM Version %.1f Parameters Used In This Analysis:\n\n",ITWOMVersion());
+        else
+            fprintf(fd2,"Longley-Rice Parameters Used In This Analysis:\n\n");
+
+        fprintf(fd2,"Earth's Dielectric Constant: %.3lf\n",LR.eps_dielect);
+        fprintf(fd2,"Earth's Conductivity: %.3lf Siemens/meter\n",LR.sgm_conductivity);
+        fprintf(fd2,"Atmospheric Bending Constant (N-units): %.3lf ppm\n",LR.eno_ns_surfref);
+        fprintf(fd2,"Frequency: %.3lf MHz\n",LR.frq_mhz);
+        fprintf(fd2,"Radio Climate: %d (",LR.radio_climate);
+
+        switch (LR.radio_climate)
+        {
+            case 1:
+                fprintf(fd2,"Equatorial");
+                break;
+
+            case 2:
+                fprintf(fd2,"Continental Subtropical");
+                break;
 
-    if (fd1!=NULL)
-        fclose(fd1);
+            case 3:
+                fprintf(fd2,"Maritime Subtropical");
+                break;
 
-    fclose(fd2);
+            case 4:
+                fprintf(fd2,"Desert");
+                break;
 
-    if (name[0]=='.')
-    {
-        /* Default filename and output file type */
-        strcpy(basename,"profile");
-        strcpy(ext,"png");
-    }
-    else
-    {
-        /* Extract extension and terminal type from "name" */
-        strncpy(basename, name, MAX_PATH_LEN-1);
-        stripExtension(basename, ext, 20);
-        convertBackslashes(basename);
-        if (strlen(ext) == 0)
-        {
-            strcpy(ext,"png");
-        }
-    }
+            case 5:
+                fprintf(fd2,"Continental Temperate");
+                break;
 
-    strcpy(term,ext);
+            case 6:
+                fprintf(fd2,"Martitime Temperate, Over Land");
+                break;
 
-    /* Either .ps or .postscript may be used
-       as an extension for postscript output. */
+            case 7:
+                fprintf(fd2,"Maritime Temperate, Over Sea");
+                break;
 
-    if (strncmp(term,"postscript",10)==0)
-        strcpy(ext,"ps");
+            default:
+                fprintf(fd2,"Unknown");
+        }
 
-    else if (strncmp(ext,"ps",2)==0)
-        strcpy(term,"postscript enhanced color");
+        fprintf(fd2,")\nPolarization: %d (",LR.pol);
 
-    fd=fopen("splat.gp","w");
+        if (LR.pol==0)
+            fprintf(fd2,"Horizontal");
 
-    fprintf(fd,"set grid\n");
+        if (LR.pol==1)
+            fprintf(fd2,"Vertical");
 
-    if (distance>2.0)
-        fprintf(fd,"set yrange [%2.3f to %2.3f]\n", (-fabs(refangle)-0.25), maxangle+0.25);
-    else
-        fprintf(fd,"set yrange [%2.3f to %2.3f]\n", minangle, refangle+(-minangle/8.0));
+        fprintf(fd2,")\nFraction of Situations: %.1lf%c\n",LR.conf*100.0,37);
+        fprintf(fd2,"Fraction of Time: %.1lf%c\n",LR.rel*100.0,37);
 
-    fprintf(fd,"set encoding iso_8859_1\n");
-    fprintf(fd,"set term %s\n",term);
-    fprintf(fd,"set title \"%s Elevation Profile Between %s and %s (%.2f%c azimuth)\"\n",SPLAT_NAME,destination.name,source.name,Azimuth(destination,source),176);
+        if (LR.erp!=0.0)
+        {
+            fprintf(fd2,"Transmitter ERP: ");
 
-    if (metric)
-        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*distance);
-    else
-        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,distance);
+            if (LR.erp<1.0)
+                fprintf(fd2,"%.1lf milliwatts",1000.0*LR.erp);
 
+            if (LR.erp>=1.0 && LR.erp<10.0)
+                fprintf(fd2,"%.1lf Watts",LR.erp);
 
-    fprintf(fd,"set ylabel \"Elevation Angle Along LOS Path Between\\n%s and %s (degrees)\"\n",destination.name,source.name);
-    fprintf(fd,"set output \"%s.%s\"\n",basename,ext);
+            if (LR.erp>=10.0 && LR.erp<10.0e3)
+                fprintf(fd2,"%.0lf Watts",LR.erp);
 
-    if (clutter>0.0)
-    {
-        if (metric)
-            fprintf(fd,"plot \"profile.gp\" title \"Real Earth Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f meters)\" with lines, \"reference.gp\" title \"Line of Sight Path (%.2f%c elevation)\" with lines\n",clutter*METERS_PER_FOOT,refangle,176);
-        else
-            fprintf(fd,"plot \"profile.gp\" title \"Real Earth Profile\" with lines, \"clutter.gp\" title \"Clutter Profile (%.2f feet)\" with lines, \"reference.gp\" title \"Line of Sight Path (%.2f%c elevation)\" with lines\n",clutter,refangle,176);
-    }
+            if (LR.erp>=10.0e3)
+                fprintf(fd2,"%.3lf kilowatts",LR.erp/1.0e3);
 
-    else
-        fprintf(fd,"plot \"profile.gp\" title \"Real Earth Profile\" with lines, \"reference.gp\" title \"Line of Sight Path (%.2f%c elevation)\" with lines\n",refangle,176);
+            dBm=10.0*(log10(LR.erp*1000.0));
+            fprintf(fd2," (%+.2f dBm)\n",dBm);
 
-    fclose(fd);
+            /* EIRP = ERP + 2.14 dB */
 
-    x=system("gnuplot splat.gp");
+            fprintf(fd2,"Transmitter EIRP: ");
 
-    if (x!=-1)
-    {
-        if (!gpsav)
-        {
-            unlink("splat.gp");
-            unlink("profile.gp");
-            unlink("reference.gp");
+            eirp=LR.erp*1.636816521;
 
-            if (clutter>0.0)
-                unlink("clutter.gp");
-        }
+            if (eirp<1.0)
+                fprintf(fd2,"%.1lf milliwatts",1000.0*eirp);
 
-        fprintf(stdout,"Elevation plot written to: \"%s.%s\"\n",basename,ext);
-        fflush(stdout);
-    }
+            if (eirp>=1.0 && eirp<10.0)
+                fprintf(fd2,"%.1lf Watts",eirp);
 
-    else
-        fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
+            if (eirp>=10.0 && eirp<10.0e3)
+                fprintf(fd2,"%.0lf Watts",eirp);
 
-    DestroyPath(path);
-}
+            if (eirp>=10.0e3)
+                fprintf(fd2,"%.3lf kilowatts",eirp/1.0e3);
 
-/* Invokes gnuplot to generate a file indicating the terrain height profile
- * between the source and destination locations referenced to the lint-of-sight
- * path between the receive and transmit sites.
- * "basename" is the name assigned to the output file generated by gnuplot.
- * The filename extension is used to set gnuplot's terminal setting
- * and output file type.
- * If no extension is found, .png is assumed.
- */
-void GraphHeight(Site source, Site destination, char *name, bool fresnel_plot, bool normalized)
-{
-    int	x;
-    char	basename[MAX_PATH_LEN], term[30], ext[20];
-    double	a, b, c, height=0.0, refangle, cangle, maxheight=-100000.0,
-            minheight=100000.0, lambda=0.0, f_zone=0.0, fpt6_zone=0.0,
-            nm=0.0, nb=0.0, ed=0.0, es=0.0, r=0.0, d=0.0, d1=0.0,
-            terrain, azimuth, distance, dheight=0.0, minterrain=100000.0,
-            minearth=100000.0, miny, maxy, min2y, max2y;
-    Site	remote;
-    FILE	*fd=NULL, *fd1=NULL, *fd2=NULL, *fd3=NULL, *fd4=NULL, *fd5=NULL;
+            dBm=10.0*(log10(eirp*1000.0));
+            fprintf(fd2," (%+.2f dBm)\n",dBm);
+        }
 
-    Path *path = AllocatePath();
-    if (!path) {
-        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
-        return;
-    }
-    ReadPath(destination,source,path);  /* destination=RX, source=TX */
-    azimuth=Azimuth(destination,source);
-    distance=Distance(destination,source);
-    refangle=ElevationAngle(destination,source);
+        fprintf(fd2,"\n%s\n\n",dashes);
 
-    if (destination.amsl_flag)
-        b=destination.alt+earthradius;
-    else
-        b=GetElevation(destination)+destination.alt+earthradius;
+        fprintf(fd2,"Summary For The Link Between %s and %s:\n\n",source.name, destination.name);
 
-    /* Wavelength and path distance (great circle) in feet. */
+        if (patterndB!=0.0) {
+            if (patterndB == -9999) {
+                fprintf(fd2,"%s antenna pattern towards %s: -infinity (blocked)\n", source.name, destination.name);
+            } else {
+                fprintf(fd2,"%s antenna pattern towards %s: %.3f (%.2f dB)\n", source.name, destination.name, pattern, patterndB);
+            }
+        }
 
-    if (fresnel_plot)
-    {
-        lambda=9.8425e8/(LR.frq_mhz*1e6);
-        d=5280.0*path->distance[path->length-1];
-    }
+        /* path already holds the TX-to-RX profile from GetReportPath() above */
 
-    if (normalized)
-    {
-        ed=GetElevation(destination);
-        es=GetElevation(source);
-        nb=-destination.alt-ed;
-        nm=(-source.alt-es-nb)/(path->distance[path->length-1]);
-    }
+        elev_t *elev = (elev_t*)calloc(path->arysize + 10, sizeof(elev_t));
 
-    fd=fopen("profile.gp","wb");
+        /* Copy elevations plus clutter along
+           path into the elev[] array. */
 
-    if (clutter>0.0)
-        fd1=fopen("clutter.gp","wb");
+        for (x=1; x<path->length-1; x++)
+            elev[x+2]=METERS_PER_FOOT*(path->elevation[x]==0.0?(elev_t)(path->elevation[x]):(elev_t)(clutter+path->elevation[x]));
 
-    fd2=fopen("reference.gp","wb");
-    fd5=fopen("curvature.gp", "wb");
+        /* Copy ending points without clutter */
 
-    if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-    {
-        fd3=fopen("fresnel.gp", "wb");
-        fd4=fopen("fresnel_pt_6.gp", "wb");
-    }
+        elev[2]=(elev_t)(path->elevation[0]*METERS_PER_FOOT);
+        elev[path->length+1]=(elev_t)(path->elevation[path->length-1]*METERS_PER_FOOT);
 
-    for (x=0; x<path->length-1; x++)
-    {
-        remote.lat=path->lat[x];
-        remote.lon=path->lon[x];
-        remote.alt=0.0;
+        /* Capture the per-path invariants for the point_to_point calls below. */
 
-        terrain=GetElevation(remote);
+        p2p_sweep_state sweep;
+        point_to_point_sweep_init(&sweep,source.alt*METERS_PER_FOOT,
+                                  destination.alt*METERS_PER_FOOT, LR.eps_dielect,
+                                  LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
+                                  LR.radio_climate, LR.pol, LR.conf, LR.rel);
 
-        if (x==0)
-            terrain+=destination.alt;  /* RX antenna spike */
+        gdist=(double *)malloc(path->length*sizeof(double));
+        gloss=(double *)malloc(path->length*sizeof(double));
 
-        a=terrain+earthradius;
-        cangle=5280.0*Distance(destination,remote)/earthradius;
-        c=b*sin(refangle*DEG2RAD+HALFPI)/sin(HALFPI-refangle*DEG2RAD-cangle);
+        azimuth=rint(Azimuth(source,destination));
 
-        height=a-c;
+        for (y=2; y<(path->length-1); y++)  /* path->length-1 avoids LR error */
+        {
+            distance=5280.0*path->distance[y];
 
-        /* Per Fink and Christiansen, Electronics
-         * Engineers' Handbook, 1989:
-         *
-         *   H = sqrt(lamba * d1 * (d - d1)/d)
-         *
-         * where H is the distance from the LOS
-         * path to the first Fresnel zone boundary.
-         */
+            if (source.amsl_flag)
+                source_alt=four_thirds_earth+source.alt;
+            else
+                source_alt=four_thirds_earth+source.alt+path->elevation[0];
 
-        if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-        {
-            d1=5280.0*path->distance[x];
-            f_zone=-1.0*sqrt(lambda*d1*(d-d1)/d);
-            fpt6_zone=f_zone*fzone_clearance;
-        }
+            /***
+              if (destination.amsl_flag)
+              dest_alt=four_thirds_earth+destination.alt;
+              else
+             ***/
+            dest_alt=four_thirds_earth+destination.alt+path->elevation[y];
 
-        if (normalized)
-        {
-            r=-(nm*path->distance[x])-nb;
-            height+=r;
+            dest_alt2=dest_alt*dest_alt;
+            source_alt2=source_alt*source_alt;
 
-            if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-            {
-                f_zone+=r;
-                fpt6_zone+=r;
-            }
-        }
+            /* Calculate the cosine of the elevation of
+               the receiver as seen by the transmitter. */
 
-        else
-            r=0.0;
+            cos_xmtr_angle=((source_alt2)+(distance*distance)-(dest_alt2))/(2.0*source_alt*distance);
 
-        if (metric)
-        {
-            fprintf(fd,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*height);
+            if (got_elevation_pattern)
+            {
+                /* If an antenna elevation pattern is available, the
+                   following code determines the elevation angle to
+                   the first obstruction along the path-> */
 
-            if (fd1!=NULL && x>0 && x<path->length-2)
-                fprintf(fd1,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*(terrain==0.0?height:(height+clutter)));
+                for (x=2, block=0; x<y && block==0; x++)
+                {
+                    distance=5280.0*(path->distance[y]-path->distance[x]);
+                    test_alt=four_thirds_earth+path->elevation[x];
 
-            fprintf(fd2,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*r);
-            fprintf(fd5,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*(height-terrain));
-        }
+                    /* Calculate the cosine of the elevation
+                       angle of the terrain (test point)
+                       as seen by the transmitter. */
 
-        else
-        {
-            fprintf(fd,"%f\t%f\n",path->distance[x],height);
+                    cos_test_angle=((source_alt2)+(distance*distance)-(test_alt*test_alt))/(2.0*source_alt*distance);
 
-            if (fd1!=NULL && x>0 && x<path->length-2)
-                fprintf(fd1,"%f\t%f\n",path->distance[x],(terrain==0.0?height:(height+clutter)));
+                    /* Compare these two angles to determine if
+                       an obstruction exists.  Since we're comparing
+                       the cosines of these angles rather than
+                       the angles themselves, the sense of the
+                       following "if" statement is reversed from
+                       what it would be if the angles themselves
+                       were compared. */
 
-            fprintf(fd2,"%f\t%f\n",path->distance[x],r);
-            fprintf(fd5,"%f\t%f\n",path->distance[x],height-terrain);
-        }
+                    if (cos_xmtr_angle>=cos_test_angle)
+                        block=1;
+                }
 
-        if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-        {
-            if (metric)
-            {
-                fprintf(fd3,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*f_zone);
-                fprintf(fd4,"%f\t%f\n",KM_PER_MILE*path->distance[x],METERS_PER_FOOT*fpt6_zone);
+                /* At this point, we have the elevation angle
+                   to the first obstruction (if it exists). */
             }
 
-            else
-            {
-                fprintf(fd3,"%f\t%f\n",path->distance[x],f_zone);
-                fprintf(fd4,"%f\t%f\n",path->distance[x],fpt6_zone);
-            }
+            /* Determine path loss for each point along
+               the path using ITWOM's point_to_point mode
+               starting at x=2 (number_of_points = 1), the
+               shortest distance terrain can play a role in
+               path loss. */
 
-            if (f_zone<minheight)
-                minheight=f_zone;
-        }
+            elev[0]=(elev_t)(y-1);	/* (number of points - 1) */
 
-        if ((height+clutter)>maxheight)
-            maxheight=height+clutter;
+            /* Distance between elevation samples */
 
-        if (height<minheight)
-            minheight=height;
+            elev[1]=(elev_t)(METERS_PER_MILE*(path->distance[y]-path->distance[y-1]));
 
-        if (r>maxheight)
-            maxheight=r;
+            if (itwom)
+                point_to_point_sweep(&sweep,elev,&loss,strmode,&errnum);
+            else
+                point_to_point_ITM_sweep(&sweep,elev,&loss,strmode,&errnum);
 
-        if (terrain<minterrain)
-            minterrain=terrain;
+            if (block)
+                elevation=((acos(cos_test_angle))/DEG2RAD)-90.0;
+            else
+                elevation=((acos(cos_xmtr_angle))/DEG2RAD)-90.0;
 
-        if ((height-terrain)<minearth)
-            minearth=height-terrain;
-    }
+            /* Integrate the antenna's radiation
+               pattern into the overall path loss. */
 
-    if (normalized)
-        r=-(nm*path->distance[path->length-1])-nb;
-    else
-        r=0.0;
+            x=(int)rint(10.0*(10.0-elevation));
 
-    if (metric)
-    {
-        fprintf(fd,"%f\t%f\n",KM_PER_MILE*path->distance[path->length-1],METERS_PER_FOOT*r);
-        fprintf(fd2,"%f\t%f\n",KM_PER_MILE*path->distance[path->length-1],METERS_PER_FOOT*r);
-    }
+            if (x>=0 && x<=1000)
+            {
+                pattern=(double)LR.antenna_pattern[(int)azimuth][x];
 
-    else
-    {
-        fprintf(fd,"%f\t%f\n",path->distance[path->length-1],r);
-        fprintf(fd2,"%f\t%f\n",path->distance[path->length-1],r);
-    }
+                if (pattern==ANTENNA_NULL_DB)
+                    loss-=9999;
+                else
+                    patterndB=pattern;
+            }
+            else
+                patterndB=0.0;
 
-    if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-    {
-        if (metric)
-        {
-            fprintf(fd3,"%f\t%f\n",KM_PER_MILE*path->distance[path->length-1],METERS_PER_FOOT*r);
-            fprintf(fd4,"%f\t%f\n",KM_PER_MILE*path->distance[path->length-1],METERS_PER_FOOT*r);
-        }
+            total_loss=loss-patterndB;
 
-        else
-        {
-            fprintf(fd3,"%f\t%f\n",path->distance[path->length-1],r);
-            fprintf(fd4,"%f\t%f\n",path->distance[path->length-1],r);
-        }
-    }
+            gdist[n]=(metric?KM_PER_MILE*path->distance[y]:path->distance[y]);
+            gloss[n]=total_loss;
+            n++;
 
-    if (r>maxheight)
-        maxheight=r;
+            if (total_loss>maxloss)
+                maxloss=total_loss;
 
-    if (r<minheight)
-        minheight=r;
+            if (total_loss<minloss)
+                minloss=total_loss;
+        }
 
-    fclose(fd);
+        point_to_point_sweep_done(&sweep);
 
-    if (fd1!=NULL)
-        fclose(fd1);
+        free(elev);
 
-    fclose(fd2);
-    fclose(fd5);
+        distance=Distance(source,destination);
 
-    if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-    {
-        fclose(fd3);
-        fclose(fd4);
-    }
 
-    if (name[0]=='.')
-    {
-        /* Default filename and output file type */
-        strcpy(basename,"profile");
-        strcpy(ext,"png");
-    }
-    else
-    {
-        /* Extract extension and terminal type from "name" */
-        strncpy(basename, name, MAX_PATH_LEN-1);
-        stripExtension(basename, ext, 20);
-        convertBackslashes(basename);
-        if (strlen(ext) == 0)
+        if (distance!=0.0)
         {
-            strcpy(ext,"png");
-        }
-    }
-    strcpy(term,ext);
-
-    /* Either .ps or .postscript may be used
-       as an extension for postscript output. */
+            free_space_loss=36.6+(20.0*log10(LR.frq_mhz))+(20.0*log10(distance));
 
-    if (strncmp(term,"postscript",10)==0)
-        strcpy(ext,"ps");
+            fprintf(fd2,"Free space path loss: %.2f dB\n",free_space_loss);
+        }
 
-    else if (strncmp(ext,"ps",2)==0)
-        strcpy(term,"postscript enhanced color");
+        if (itwom)
+            fprintf(fd2,"ITWOM Version %.1f path loss: %.2f dB\n",ITWOMVersion(),loss);
+        else
+            fprintf(fd2,"Longley-Rice path loss: %.2f dB\n",loss);
 
-    fd=fopen("splat.gp","w");
+        if (free_space_loss!=0.0)
+            fprintf(fd2,"Attenuation due to terrain shielding: %.2f dB\n",loss-free_space_loss);
 
-    dheight=maxheight-minheight;
-    miny=minheight-0.15*dheight;
-    maxy=maxheight+0.05*dheight;
+        if (patterndB!=0.0)
+            fprintf(fd2,"Total path loss including %s antenna pattern: %.2f dB\n",source.name,total_loss);
 
-    if (maxy<20.0)
-        maxy=20.0;
+        if (LR.erp!=0.0)
+        {
+            field_strength=(139.4+(20.0*log10(LR.frq_mhz))-total_loss)+(10.0*log10(LR.erp/1000.0));
 
-    dheight=maxheight-minheight;
-    min2y=miny-minterrain+0.05*dheight;
+            /* dBm is referenced to EIRP */
 
-    if (minearth<min2y)
-    {
-        miny-=min2y-minearth+0.05*dheight;
-        min2y=minearth-0.05*dheight;
-    }
+            rxp=eirp/(pow(10.0,(total_loss/10.0)));
+            dBm=10.0*(log10(rxp*1000.0));
+            power_density=(eirp/(pow(10.0,(total_loss-free_space_loss)/10.0)));
+            /* divide by 4*PI*distance_in_meters squared */
+            power_density/=(4.0*PI*distance*distance*2589988.11);
 
-    max2y=min2y+maxy-miny;
+            fprintf(fd2,"Field strength at %s: %.2f dBuV/meter\n", destination.name,field_strength);
+            fprintf(fd2,"Signal power level at %s: %+.2f dBm\n",destination.name,dBm);
+            fprintf(fd2,"Signal power density at %s: %+.2f dBW per square meter\n",destination.name,10.0*log10(power_density));
+            voltage=1.0e6*sqrt(50.0*(eirp/(pow(10.0,(total_loss-2.14)/10.0))));
+            fprintf(fd2,"Voltage across a 50 ohm dipole at %s: %.2f uV (%.2f dBuV)\n",destination.name,voltage,20.0*log10(voltage));
 
-    fprintf(fd,"set grid\n");
-    fprintf(fd,"set yrange [%2.3f to %2.3f]\n", metric?miny*METERS_PER_FOOT:miny, metric?maxy*METERS_PER_FOOT:maxy);
-    fprintf(fd,"set y2range [%2.3f to %2.3f]\n", metric?min2y*METERS_PER_FOOT:min2y, metric?max2y*METERS_PER_FOOT:max2y);
-    fprintf(fd,"set xrange [-0.5 to %2.3f]\n",metric?KM_PER_MILE*rint(distance+0.5):rint(distance+0.5));
-    fprintf(fd,"set encoding iso_8859_1\n");
-    fprintf(fd,"set term %s\n",term);
+            voltage=1.0e6*sqrt(75.0*(eirp/(pow(10.0,(total_loss-2.14)/10.0))));
+            fprintf(fd2,"Voltage across a 75 ohm dipole at %s: %.2f uV (%.2f dBuV)\n",destination.name,voltage,20.0*log10(voltage));
+        }
 
-    if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-        fprintf(fd,"set title \"%s Path Profile Between %s and %s (%.2f%c azimuth)\\nWith First Fresnel Zone\"\n",SPLAT_NAME, destination.name, source.name, azimuth,176);
+        fprintf(fd2,"Mode of propagation: ");
 
-    else
-        fprintf(fd,"set title \"%s Height Profile Between %s and %s (%.2f%c azimuth)\"\n",SPLAT_NAME, destination.name, source.name, azimuth,176);
+        if (itwom)
+        {
+            if (strcmp(strmode,"L-o-S")==0)
+                fprintf(fd2,"Line of Sight\n");
 
-    if (metric)
-        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*Distance(source,destination));
-    else
-        fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,Distance(source,destination));
+            if (strncmp(strmode,"1_Hrzn",6)==0)
+                fprintf(fd2,"Single Horizon ");
 
-    if (normalized)
-    {
-        if (metric)
-            fprintf(fd,"set ylabel \"Normalized Height Referenced To LOS Path Between\\n%s and %s (meters)\"\n",destination.name,source.name);
+            if (strncmp(strmode,"2_Hrzn",6)==0)
+                fprintf(fd2,"Double Horizon ");
 
-        else
-            fprintf(fd,"set ylabel \"Normalized Height Referenced To LOS Path Between\\n%s and %s (feet)\"\n",destination.name,source.name);
+            y= (int)strlen(strmode);
 
-    }
+            if (y>19)
+                y=19;
 
-    else
-    {
-        if (metric)
-            fprintf(fd,"set ylabel \"Height Referenced To LOS Path Between\\n%s and %s (meters)\"\n",destination.name,source.name);
+            for (x=6; x<y; x++)
+                propbuf[x-6]=strmode[x];
 
-        else
-            fprintf(fd,"set ylabel \"Height Referenced To LOS Path Between\\n%s and %s (feet)\"\n",destination.name,source.name);
-    }
+            propbuf[x]=0;
 
-    fprintf(fd,"set output \"%s.%s\"\n",basename,ext);
+            if (strncmp(propbuf,"_Diff",5)==0)
+                fprintf(fd2,"Diffraction Dominant\n");
 
-    if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-    {
-        if (clutter>0.0)
-        {
-            if (metric)
-                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f meters)\" with lines, \"reference.gp\" title \"Line of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines, \"fresnel.gp\" axes x1y1 title \"First Fresnel Zone (%.3f MHz)\" with lines, \"fresnel_pt_6.gp\" title \"%.0f%% of First Fresnel Zone\" with lines\n",clutter*METERS_PER_FOOT,LR.frq_mhz,fzone_clearance*100.0);
-            else
-                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f feet)\" with lines, \"reference.gp\" title \"Line of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines, \"fresnel.gp\" axes x1y1 title \"First Fresnel Zone (%.3f MHz)\" with lines, \"fresnel_pt_6.gp\" title \"%.0f%% of First Fresnel Zone\" with lines\n",clutter,LR.frq_mhz,fzone_clearance*100.0);
-        }
+            if (strncmp(propbuf,"_Tropo",6)==0)
+                fprintf(fd2,"Troposcatter Dominant\n");
 
-        else
-            fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"reference.gp\" title \"Line of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines, \"fresnel.gp\" axes x1y1 title \"First Fresnel Zone (%.3f MHz)\" with lines, \"fresnel_pt_6.gp\" title \"%.0f%% of First Fresnel Zone\" with lines\n",LR.frq_mhz,fzone_clearance*100.0);
-    }
+            if (strncmp(propbuf,"_Peak",5)==0)
+                fprintf(fd2,"RX at Peak Terrain Along Path\n");
 
-    else
-    {
-        if (clutter>0.0)
-        {
-            if (metric)
-                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f meters)\" with lines, \"reference.gp\" title \"Line Of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines\n",clutter*METERS_PER_FOOT);
-            else
-                fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"clutter.gp\" title \"Ground Clutter (%.2f feet)\" with lines, \"reference.gp\" title \"Line Of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines\n",clutter);
+            fprintf(fd2,"ITWOM error number: %d",errnum);
         }
-
         else
-            fprintf(fd,"plot \"profile.gp\" title \"Point-to-Point Profile\" with lines, \"reference.gp\" title \"Line Of Sight Path\" with lines, \"curvature.gp\" axes x1y2 title \"Earth's Curvature Contour\" with lines\n");
-
-    }
-
-    fclose(fd);
-
-    x=system("gnuplot splat.gp");
-
-    if (x!=-1)
-    {
-        if (!gpsav)
         {
-            unlink("splat.gp");
-            unlink("profile.gp");
-            unlink("reference.gp");
-            unlink("curvature.gp");
+            fprintf(fd2,"%s\n",strmode);
+            fprintf(fd2,"Longley-Rice model error number: %d",errnum);
+        }
 
-            if (fd1!=NULL)
-                unlink("clutter.gp");
 
-            if ((LR.frq_mhz>=20.0) && (LR.frq_mhz<=20000.0) && fresnel_plot)
-            {
-                unlink("fresnel.gp");
-                unlink("fresnel_pt_6.gp");
-            }
-        }
+        switch (errnum)
+        {
+            case 0:
+                fprintf(fd2," (No error)\n");
+                break;
 
-        fprintf(stdout,"\n%seight plot written to: \"%s.%s\"",
-                normalized?"Normalized h":"H",basename,ext);
-        fflush(stdout);
-    }
+            case 1:
+                fprintf(fd2,"\n  Warning: Some parameters are nearly out of range.\n");
+                fprintf(fd2,"  Results should be used with caution.\n");
+                break;
 
-    else
-        fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
+            case 2:
+                fprintf(fd2,"\n  Note: Default parameters have been substituted for impossible ones.\n");
+                break;
 
-    DestroyPath(path);
-}
+            case 3:
+                fprintf(fd2,"\n  Warning: A combination of parameters is out of range.\n");
+                fprintf(fd2,"  Results are probably invalid.\n");
+                break;
 
-/* Performs an obstruction analysis along the path between receiver
- * and transmitter.
- */
-void ObstructionAnalysis(Site xmtr, Site rcvr, double f, FILE *outfile)
-{
-    int	x;
-    Site site_x;
-    double	h_r, h_t, h_x, h_r_orig, cos_tx_angle, cos_test_angle,
-            cos_tx_angle_f1, cos_tx_angle_fpt6, d_tx, d_x,
-            h_r_f1, h_r_fpt6, h_f, h_los, lambda=0.0;
-    char	buf[MAX_PATH_LEN], buf_fpt6[MAX_PATH_LEN], buf_f1[MAX_PATH_LEN];
+            default:
+                fprintf(fd2,"\n  Warning: Some parameters are out of range.\n");
+                fprintf(fd2,"  Results are probably invalid.\n");
+        }
 
-    Path *path = AllocatePath();
-    if (!path) {
-        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
-        return;
+        fprintf(fd2,"\n%s\n\n",dashes);
     }
-    ReadPath(xmtr,rcvr,path);
 
-    if (rcvr.amsl_flag)
-        h_r=rcvr.alt+earthradius;
-    else
-        h_r=GetElevation(rcvr)+rcvr.alt+earthradius;
-
-    h_r_f1=h_r;
-    h_r_fpt6=h_r;
-    h_r_orig=h_r;
+    fprintf(stdout,"\nPath Loss Report written to: \"%s\"\n",report_name);
+    fflush(stdout);
 
-    if (xmtr.amsl_flag)
-        h_t=xmtr.alt+earthradius;
-    else
-        h_t=GetElevation(xmtr)+xmtr.alt+earthradius;
+    ObstructionAnalysis(source, destination, LR.frq_mhz, fd2);
 
-    d_tx=5280.0*Distance(rcvr,xmtr);
-    cos_tx_angle=((h_r*h_r)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r*d_tx);
-    cos_tx_angle_f1=cos_tx_angle;
-    cos_tx_angle_fpt6=cos_tx_angle;
+    fclose(fd2);
 
-    if (f)
-        lambda=9.8425e8/(f*1e6);
+    /* Skip plotting the graph if ONLY a path-loss report is needed. */
 
-    if (clutter>0.0)
+    if (graph_it)
     {
-        fprintf(outfile,"Terrain has been raised by");
-
-        if (metric)
-            fprintf(outfile," %.2f meters",METERS_PER_FOOT*clutter);
+        if (name[0]=='.')
+        {
+            /* Default filename and output file type */
+            strcpy(basename,"profile");
+            strcpy(ext,"png");
+        }
         else
-            fprintf(outfile," %.2f feet",clutter);
-
-        fprintf(outfile," to account for ground clutter.\n\n");
-    }
+        {
+            /* Extract extension and terminal type from "name" */
+            strncpy(basename, name, MAX_PATH_LEN-1);
+            stripExtension(basename, ext, 20);
+            convertBackslashes(basename);
+            if (strlen(ext) == 0)
+            {
+                strcpy(ext,"png");
+            }
+        }
+        strcpy(term,ext);
 
-    /* At each point along the path calculate the cosine
-       of a sort of "inverse elevation angle" at the receiver.
-       From the antenna, 0 deg. looks at the ground, and 90 deg.
-       is parallel to the ground.
+        /* Either .ps or .postscript may be used
+           as an extension for postscript output. */
 
-       Start at the receiver.  If this is the lowest antenna,
-       then terrain obstructions will be nearest to it.  (Plus,
-       that's the way SPLAT!'s original los() did it.)
+        if (strncmp(term,"postscript",10)==0)
+            strcpy(ext,"ps0");
 
-       Calculate cosines only.  That's sufficient to compare
-       angles and it saves the extra computational burden of
-       acos().  However, note the inverted comparison: if
-       acos(A) > acos(B), then B > A. */
+        else if (strncmp(ext,"ps",2)==0)
+            strcpy(term,"postscript enhanced color0");
 
-    for (x=path->length-1; x>0; x--)
-    {
-        site_x.lat=path->lat[x];
-        site_x.lon=path->lon[x];
-        site_x.alt=0.0;
+        /* Try the in-process renderer first */
 
-        h_x=GetElevation(site_x)+earthradius+clutter;
-        d_x=5280.0*Distance(rcvr,site_x);
+        memset(&chart,0,sizeof(chart));
 
-        /* Deal with the LOS path first. */
+        snprintf(chart.title,MAX_PATH_LEN,"%s Loss Profile Along Path Between %s and %s (%.2f%c azimuth)",
+                 SPLAT_NAME,destination.name,source.name,Azimuth(destination,source),176);
 
-        cos_test_angle=((h_r*h_r)+(d_x*d_x)-(h_x*h_x))/(2.0*h_r*d_x);
+        if (metric)
+            snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f kilometers)",destination.name,source.name,KM_PER_MILE*Distance(destination,source));
+        else
+            snprintf(chart.xlabel,MAX_PATH_LEN,"Distance Between %s and %s (%.2f miles)",destination.name,source.name,Distance(destination,source));
 
-        if (cos_tx_angle>cos_test_angle)
+        if (got_azimuth_pattern || got_elevation_pattern)
+            snprintf(chart.ylabel,MAX_PATH_LEN,"Total Path Loss (including TX antenna pattern) (dB)");
+        else
         {
-            if (h_r==h_r_orig)
-                fprintf(outfile,"Between %s and %s, %s detected obstructions at:\n\n",rcvr.name,xmtr.name,SPLAT_NAME);
-
-            if (site_x.lat>=0.0)
-            {
-                if (metric)
-                    fprintf(outfile,"   %8.4f N,%9.4f W, %5.2f kilometers, %6.2f meters AMSL\n",site_x.lat, site_x.lon, KM_PER_MILE*(d_x/5280.0), METERS_PER_FOOT*(h_x-earthradius));
-                else
-                    fprintf(outfile,"   %8.4f N,%9.4f W, %5.2f miles, %6.2f feet AMSL\n",site_x.lat, site_x.lon, d_x/5280.0, h_x-earthradius);
-            }
-
+            if (itwom)
+                snprintf(chart.ylabel,MAX_PATH_LEN,"ITWOM Version %.1f Path Loss (dB)",ITWOMVersion());
             else
-            {
-                if (metric)
-                    fprintf(outfile,"   %8.4f S,%9.4f W, %5.2f kilometers, %6.2f meters AMSL\n",-site_x.lat, site_x.lon, KM_PER_MILE*(d_x/5280.0), METERS_PER_FOOT*(h_x-earthradius));
-                else
-
-                    fprintf(outfile,"   %8.4f S,%9.4f W, %5.2f miles, %6.2f feet AMSL\n",-site_x.lat, site_x.lon, d_x/5280.0, h_x-earthradius);
-            }
+                snprintf(chart.ylabel,MAX_PATH_LEN,"Longley-Rice Path Loss (dB)");
         }
 
-        while (cos_tx_angle>cos_test_angle)
+        chart.xmin=gdist[0];
+        chart.xmax=gdist[n-1];
+        chart.ymin=minloss;
+        chart.ymax=maxloss;
+
+        ChartAddSeries(&chart,gdist,gloss,n,0,"Path Loss");
+
+        if (n>1 && ChartRender(&chart,basename,ext)==0)
         {
-            h_r+=1;
-            cos_test_angle=((h_r*h_r)+(d_x*d_x)-(h_x*h_x))/(2.0*h_r*d_x);
-            cos_tx_angle=((h_r*h_r)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r*d_tx);
+            fprintf(stdout,"Path loss plot written to: \"%s.%s\"\n",basename,ext);
+            fflush(stdout);
+
+            free(gdist);
+            free(gloss);
+            return;
         }
 
-        if (f)
-        {
-            /* Now clear the first Fresnel zone... */
+        /* Formats we don't rasterize ourselves still go through gnuplot */
 
-            cos_tx_angle_f1=((h_r_f1*h_r_f1)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_f1*d_tx);
-            h_los=sqrt(h_r_f1*h_r_f1+d_x*d_x-2*h_r_f1*d_x*cos_tx_angle_f1);
-            h_f=h_los-sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
+        fd=fopen("profile.gp","w");
 
-            while (h_f<h_x)
-            {
-                h_r_f1+=1;
-                cos_tx_angle_f1=((h_r_f1*h_r_f1)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_f1*d_tx);
-                h_los=sqrt(h_r_f1*h_r_f1+d_x*d_x-2*h_r_f1*d_x*cos_tx_angle_f1);
-                h_f=h_los-sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
-            }
+        for (x=0; x<n; x++)
+            fprintf(fd,"%f\t%f\n",gdist[x],gloss[x]);
 
-            /* and clear the 60% F1 zone. */
+        fclose(fd);
 
-            cos_tx_angle_fpt6=((h_r_fpt6*h_r_fpt6)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_fpt6*d_tx);
-            h_los=sqrt(h_r_fpt6*h_r_fpt6+d_x*d_x-2*h_r_fpt6*d_x*cos_tx_angle_fpt6);
-            h_f=h_los-fzone_clearance*sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
+        fd=fopen("splat.gp","w");
 
-            while (h_f<h_x)
-            {
-                h_r_fpt6+=1;
-                cos_tx_angle_fpt6=((h_r_fpt6*h_r_fpt6)+(d_tx*d_tx)-(h_t*h_t))/(2.0*h_r_fpt6*d_tx);
-                h_los=sqrt(h_r_fpt6*h_r_fpt6+d_x*d_x-2*h_r_fpt6*d_x*cos_tx_angle_fpt6);
-                h_f=h_los-fzone_clearance*sqrt(lambda*d_x*(d_tx-d_x)/d_tx);
-            }
-        }
-    }
+        fprintf(fd,"set grid\n");
+        fprintf(fd,"set yrange [%2.3f to %2.3f]\n", minloss, maxloss);
+        fprintf(fd,"set encoding iso_8859_1\n");
+        fprintf(fd,"set term %s\n",term);
+        fprintf(fd,"set title \"%s Loss Profile Along Path Between %s and %s (%.2f%c azimuth)\"\n",SPLAT_NAME, destination.name, source.name, Azimuth(destination,source),176);
 
-    if (h_r>h_r_orig)
-    {
         if (metric)
-            snprintf(buf,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f meters AGL\nto clear all obstructions detected by %s.\n",rcvr.name, METERS_PER_FOOT*(h_r-GetElevation(rcvr)-earthradius),SPLAT_NAME);
+            fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*Distance(destination,source));
         else
-            snprintf(buf,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f feet AGL\nto clear all obstructions detected by %s.\n",rcvr.name, h_r-GetElevation(rcvr)-earthradius,SPLAT_NAME);
-    }
-
-    else
-        snprintf(buf,MAX_PATH_LEN,"\nNo obstructions to LOS path due to terrain were detected by %s\n",SPLAT_NAME);
+            fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,Distance(destination,source));
 
-    if (f)
-    {
-        if (h_r_fpt6>h_r_orig)
+        if (got_azimuth_pattern || got_elevation_pattern)
+            fprintf(fd,"set ylabel \"Total Path Loss (including TX antenna pattern) (dB)");
+        else
         {
-            if (metric)
-                snprintf(buf_fpt6,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f meters AGL\nto clear %.0f%c of the first Fresnel zone.\n",rcvr.name, METERS_PER_FOOT*(h_r_fpt6-GetElevation(rcvr)-earthradius),fzone_clearance*100.0,37);
-
+            if (itwom)
+                fprintf(fd,"set ylabel \"ITWOM Version %.1f Path Loss (dB)",ITWOMVersion());
             else
-                snprintf(buf_fpt6,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f feet AGL\nto clear %.0f%c of the first Fresnel zone.\n",rcvr.name, h_r_fpt6-GetElevation(rcvr)-earthradius,fzone_clearance*100.0,37);
+                fprintf(fd,"set ylabel \"Longley-Rice Path Loss (dB)");
         }
 
-        else
-            snprintf(buf_fpt6,MAX_PATH_LEN,"\n%.0f%c of the first Fresnel zone is clear.\n",fzone_clearance*100.0,37);
-
-        if (h_r_f1>h_r_orig)
-        {
-            if (metric)
-                snprintf(buf_f1,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f meters AGL\nto clear the first Fresnel zone.\n",rcvr.name, METERS_PER_FOOT*(h_r_f1-GetElevation(rcvr)-earthradius));
-
-            else
-                snprintf(buf_f1,MAX_PATH_LEN,"\nAntenna at %s must be raised to at least %.2f feet AGL\nto clear the first Fresnel zone.\n",rcvr.name, h_r_f1-GetElevation(rcvr)-earthradius);
+        fprintf(fd,"\"\nset output \"%s.%s\"\n",basename,ext);
+        fprintf(fd,"plot \"profile.gp\" title \"Path Loss\" with lines\n");
 
-        }
+        fclose(fd);
 
-        else
-            snprintf(buf_f1,MAX_PATH_LEN,"\nThe first Fresnel zone is clear.\n");
-    }
+        x=system("gnuplot splat.gp");
 
-    fprintf(outfile,"%s",buf);
+        if (x!=-1)
+        {
+            if (!gpsav)
+            {
+                unlink("splat.gp");
+                unlink("profile.gp");
+                unlink("reference.gp");
+            }
 
-    if (f)
-    {
-        fprintf(outfile,"%s",buf_f1);
-        fprintf(outfile,"%s",buf_fpt6);
+            fprintf(stdout,"Path loss plot written to: \"%s.%s\"\n",basename,ext);
+            fflush(stdout);
+        }
+
+        else
+            fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
     }
 
-    DestroyPath(path);
+    if (x!=-1 && !gpsav)
+        unlink("profile.gp");
+
+    free(gdist);
+    free(gloss);
 }
 
-/* Writes a SPLAT! Path Report (source.name-to-dest.name.txt) to the filesystem.
- * If (graph_it == true), then gnuplot is invoked to generate an appropriate output
- * file indicating the ITM/ITWOM model loss between the source and destination
- * locations. You don't get a choice in the name of the text report, but "name"
- * is the name assigned to the output file generated by gnuplot.
- * The filename extension is used to set gnuplot's terminal setting and output
- * file type. If no extension is found, .png is assumed.
+/* Generates a site analysis report.
  */
-void PathReport(Site source, Site destination, char *name, bool graph_it)
+void SiteReport(Site xmtr)
 {
-    int	x, y, errnum;
-    char	basename[MAX_PATH_LEN], term[30], ext[20], strmode[100],
-            report_name[MAX_PATH_LEN], block=0, propbuf[20];
-    double	maxloss=-100000.0, minloss=100000.0, loss, haavt,
-            angle1, angle2, azimuth, pattern=1.0, patterndB=0.0,
-            total_loss=0.0, cos_xmtr_angle, cos_test_angle=0.0,
-            source_alt, test_alt, dest_alt, source_alt2, dest_alt2,
-            distance, elevation, four_thirds_earth, field_strength,
-            free_space_loss=0.0, eirp=0.0, voltage, rxp, dBm,
-            power_density;
-    FILE	*fd=NULL, *fd2=NULL;
-
-    snprintf(report_name,MAX_PATH_LEN,"%s-to-%s.txt",source.name,destination.name);
-
-    Path *path = AllocatePath();
-    if (!path) {
-        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path!\n");
-        return;
-    }
+    char	report_name[MAX_PATH_LEN];
+    double	terrain;
+    int	x, azi;
+    FILE	*fd;
 
-    four_thirds_earth=FOUR_THIRDS*EARTHRADIUS;
+    snprintf(report_name,MAX_PATH_LEN,"%s-site_report.txt",xmtr.name);
 
     for (x=0; report_name[x]!=0; x++)
         if (report_name[x]==32 || report_name[x]==17 || report_name[x]==92 || report_name[x]==42 || report_name[x]==47)
             report_name[x]='_';
 
-    fd2=fopen(report_name,"w");
+    fd=fopen(report_name,"w");
 
-    fprintf(fd2,"\n\t\t--==[ %s v%s Path Analysis ]==--\n\n",SPLAT_NAME,SPLAT_VERSION);
-    fprintf(fd2,"%s\n\n",dashes);
-    fprintf(fd2,"Transmitter site: %s\n",source.name);
+    fprintf(fd,"\n\t--==[ %s v%s Site Analysis Report For: %s ]==--\n\n",SPLAT_NAME, SPLAT_VERSION, xmtr.name);
 
-    if (source.lat>=0.0)
+    fprintf(fd,"%s\n\n",dashes);
+
+    if (xmtr.lat>=0.0)
     {
-        fprintf(fd2,"Site location: %.4f North / %.4f West",source.lat, source.lon);
-        fprintf(fd2, " (%s N / ", dec2dms(source.lat));
+        fprintf(fd,"Site location: %.4f North / %.4f West",xmtr.lat, xmtr.lon);
+        fprintf(fd, " (%s N / ",dec2dms(xmtr.lat));
     }
 
     else
     {
-
-        fprintf(fd2,"Site location: %.4f South / %.4f West",-source.lat, source.lon);
-        fprintf(fd2, " (%s S / ", dec2dms(source.lat));
+        fprintf(fd,"Site location: %.4f South / %.4f West",-xmtr.lat, xmtr.lon);
+        fprintf(fd, " (%s S / ",dec2dms(xmtr.lat));
     }
 
-    fprintf(fd2, "%s W)\n", dec2dms(source.lon));
+    fprintf(fd, "%s W)\n",dec2dms(xmtr.lon));
 
     if (metric)
     {
-        if (source.amsl_flag)
-            fprintf(fd2,"Antenna height: %.2f meters AMSL\n",METERS_PER_FOOT*source.alt);
+        if (xmtr.amsl_flag)
+            fprintf(fd,"Antenna height: %.2f meters AMSL\n",METERS_PER_FOOT*xmtr.alt);
         else
         {
-            fprintf(fd2,"Ground elevation: %.2f meters AMSL\n",METERS_PER_FOOT*GetElevation(source));
-            fprintf(fd2,"Antenna height: %.2f meters AGL / %.2f meters AMSL\n",METERS_PER_FOOT*source.alt,METERS_PER_FOOT*(source.alt+GetElevation(source)));
+            fprintf(fd,"Ground elevation: %.2f meters AMSL\n",METERS_PER_FOOT*GetElevation(xmtr));
+            fprintf(fd,"Antenna height: %.2f meters AGL / %.2f meters AMSL\n",METERS_PER_FOOT*xmtr.alt, METERS_PER_FOOT*(xmtr.alt+GetElevation(xmtr)));
         }
     }
+
     else
     {
-        if (source.amsl_flag)
-            fprintf(fd2,"Antenna height: %.2f feet AMSL\n",source.alt);
+        if (xmtr.amsl_flag)
+            fprintf(fd,"Antenna height: %.2f feet AMSL\n",xmtr.alt);
         else
         {
-            fprintf(fd2,"Ground elevation: %.2f feet AMSL\n",GetElevation(source));
-            fprintf(fd2,"Antenna height: %.2f feet AGL / %.2f feet AMSL\n",source.alt, source.alt+GetElevation(source));
+            fprintf(fd,"Ground elevation: %.2f feet AMSL\n",GetElevation(xmtr));
+            fprintf(fd,"Antenna height: %.2f feet AGL / %.2f feet AMSL\n",xmtr.alt, xmtr.alt+GetElevation(xmtr));
         }
     }
 
-    haavt=haat(source);
+    terrain=haat(xmtr);
 
-    if (haavt>-4999.0)
+    if (terrain>-4999.0)
     {
         if (metric)
-            fprintf(fd2,"Antenna height above average terrain: %.2f meters\n",METERS_PER_FOOT*haavt);
+            fprintf(fd,"Antenna height above average terrain: %.2f meters\n\n",METERS_PER_FOOT*terrain);
         else
-            fprintf(fd2,"Antenna height above average terrain: %.2f feet\n",haavt);
-    }
-
-    azimuth=Azimuth(source,destination);
-    angle1=ElevationAngle(source,destination);
-    angle2=ElevationAngle2(source,destination,earthradius);
+            fprintf(fd,"Antenna height above average terrain: %.2f feet\n\n",terrain);
 
-    if (got_azimuth_pattern || got_elevation_pattern)
-    {
-        x=(int)rint(10.0*(10.0-angle2));
+        /* Display the average terrain between 2 and 10 miles
+           from the transmitter site at azimuths of 0, 45, 90,
+           135, 180, 225, 270, and 315 degrees. */
 
-        if (x>=0 && x<=1000) {
-            pattern=(double)LR.antenna_pattern[(int)rint(azimuth)][x];
+        for (azi=0; azi<=315; azi+=45)
+        {
+            fprintf(fd,"Average terrain at %3d degrees azimuth: ",azi);
+            terrain=AverageTerrain(xmtr,(double)azi,2.0,10.0);
 
-            if (pattern > 0.0) {
-                patterndB=20.0*log10(pattern);
-            } else if (pattern != NO_ANTENNA_DATA) {
-                patterndB=-9999;
+            if (terrain>-4999.0)
+            {
+                if (metric)
+                    fprintf(fd,"%.2f meters AMSL\n",METERS_PER_FOOT*terrain);
+                else
+                    fprintf(fd,"%.2f feet AMSL\n",terrain);
             }
+
+            else
+                fprintf(fd,"No terrain\n");
         }
     }
 
-    if (metric)
-        fprintf(fd2,"Distance to %s: %.2f kilometers\n",destination.name,KM_PER_MILE*Distance(source,destination));
+    fprintf(fd,"\n%s\n\n",dashes);
+    fclose(fd);
+    fprintf(stdout,"\nSite analysis report written to: \"%s\"\n",report_name);
+}
 
-    else
-        fprintf(fd2,"Distance to %s: %.2f miles\n",destination.name,Distance(source,destination));
+/* Loads the SDF files required to cover the limits of the region
+ * specified.
+ */ 
+void LoadTopoData(int max_lon, int min_lon, int max_lat, int min_lat, bool multithread)
+{
+    int x, y, width, ymin, ymax;
 
-    fprintf(fd2,"Azimuth to %s: %.2f degrees\n",destination.name,azimuth);
+    width=ReduceAngle(max_lon-min_lon);
 
-    if (angle1>=0.0)
-        fprintf(fd2,"Elevation angle to %s: %+.4f degrees\n",destination.name,angle1);
+    /* Tiles are independent files, so hand each LoadSDF() call to the
+       pool; the DEM bookkeeping inside LoadSDF() is mutex-protected.
+       Nothing traverses pages while they load, so the page cache may
+       evict freshly appended tiles to stay inside -memlimit. */
 
-    else
-        fprintf(fd2,"Depression angle to %s: %+.4f degrees\n",destination.name,angle1);
+    demLoadActive=true;
 
-    if ((angle2-angle1)>0.0001)
+    WorkQueue wq;
+
+    if ((max_lon-min_lon)<=180.0)
     {
-        if (angle2<0.0)
-            fprintf(fd2,"Depression");
-        else
-            fprintf(fd2,"Elevation");
+        for (y=0; y<=width; y++)
+            for (x=min_lat; x<=max_lat; x++)
+            {
+                ymin=(int)(min_lon+(double)y);
 
-        fprintf(fd2," angle to the first obstruction: %+.4f degrees\n",angle2);
-    }
+                while (ymin<0)
+                    ymin+=360;
 
-    fprintf(fd2,"\n%s\n\n",dashes);
+                while (ymin>=360)
+                    ymin-=360;
 
-    /* Receiver */
+                ymax=ymin+1;
 
-    fprintf(fd2,"Receiver site: %s\n",destination.name);
+                while (ymax<0)
+                    ymax+=360;
 
-    if (destination.lat>=0.0)
-    {
-        fprintf(fd2,"Site location: %.4f North / %.4f West",destination.lat, destination.lon);
-        fprintf(fd2, " (%s N / ", dec2dms(destination.lat));
-    }
+                while (ymax>=360)
+                    ymax-=360;
 
-    else
-    {
-        fprintf(fd2,"Site location: %.4f South / %.4f West",-destination.lat, destination.lon);
-        fprintf(fd2, " (%s S / ", dec2dms(destination.lat));
+                if (multithread) {
+                    wq.submit(std::bind(LoadSDF, x, x+1, ymin, ymax, (ippd==3600)));
+                } else {
+                    LoadSDF(x, x+1, ymin, ymax, (ippd==3600));
+                }
+            }
     }
 
-    fprintf(fd2, "%s W)\n", dec2dms(destination.lon));
-
-    if (metric)
-    {
-        if (destination.amsl_flag)
-            fprintf(fd2,"Antenna height: %.2f meters AMSL\n", METERS_PER_FOOT*destination.alt);
-
-        else
-        {
-            fprintf(fd2,"Ground elevation: %.2f meters AMSL\n",METERS_PER_FOOT*GetElevation(destination));
-            fprintf(fd2,"Antenna height: %.2f meters AGL / %.2f meters AMSL\n",METERS_PER_FOOT*destination.alt, METERS_PER_FOOT*(destination.alt+GetElevation(destination)));
-        }
-    }
     else
     {
-        if (destination.amsl_flag)
-            fprintf(fd2,"Antenna height: %.2f feet AMSL\n", destination.alt);
-        else
-        {
-            fprintf(fd2,"Ground elevation: %.2f feet AMSL\n",GetElevation(destination));
-            fprintf(fd2,"Antenna height: %.2f feet AGL / %.2f feet AMSL\n",destination.alt, destination.alt+GetElevation(destination));
-        }
-    }
-
-    haavt=haat(destination);
+        for (y=0; y<=width; y++)
+            for (x=min_lat; x<=max_lat; x++)
+            {
+                ymin=max_lon+y;
 
-    if (haavt>-4999.0)
-    {
-        if (metric)
-            fprintf(fd2,"Antenna height above average terrain: %.2f meters\n",METERS_PER_FOOT*haavt);
-        else
-            fprintf(fd2,"Antenna height above average terrain: %.2f feet\n",haavt);
-    }
+                while (ymin<0)
+                    ymin+=360;
 
-    if (metric)
-        fprintf(fd2,"Distance to %s: %.2f kilometers\n",source.name,KM_PER_MILE*Distance(source,destination));
+                while (ymin>=360)
+                    ymin-=360;
 
-    else
-        fprintf(fd2,"Distance to %s: %.2f miles\n",source.name,Distance(source,destination));
+                ymax=ymin+1;
 
-    azimuth=Azimuth(destination,source);
+                while (ymax<0)
+                    ymax+=360;
 
-    angle1=ElevationAngle(destination,source);
-    angle2=ElevationAngle2(destination,source,earthradius);
+                while (ymax>=360)
+                    ymax-=360;
 
-    fprintf(fd2,"Azimuth to %s: %.2f degrees\n",source.name,azimuth);
+                if (multithread) {
+                    wq.submit(std::bind(LoadSDF, x, x+1, ymin, ymax, (ippd==3600)));
+                } else {
+                    LoadSDF(x, x+1, ymin, ymax, (ippd==3600));
+                }
+            }
+    }
 
-    if (angle1>=0.0)
-        fprintf(fd2,"Elevation angle to %s: %+.4f degrees\n",source.name,angle1);
+    wq.waitForCompletion();
 
-    else
-        fprintf(fd2,"Depression angle to %s: %+.4f degrees\n",source.name,angle1);
+    demLoadActive=false;
+    DEMCacheNewPhase();
+}
 
-    if ((angle2-angle1)>0.0001)
+/* Reads a SPLAT! alphanumeric output file (-ani option) for analysis
+ * and/or map generation.
+ */
+/* Applies a single ANO point to the signal grid, honoring the contour
+ * threshold. Shared by the text and binary readers in LoadANO().
+ */
+void PlotANOPoint(double latitude, double longitude, double ano)
+{
+    if (LR.erp==0.0)
     {
-        if (angle2<0.0)
-            fprintf(fd2,"Depression");
-        else
-            fprintf(fd2,"Elevation");
+        /* Path loss */
 
-        fprintf(fd2," angle to the first obstruction: %+.4f degrees\n",angle2);
-    }
+        if (contour_threshold==0 || (fabs(ano)<=(double)contour_threshold))
+        {
+            ano=fabs(ano);
 
-    fprintf(fd2,"\n%s\n\n",dashes);
+            if (ano>255.0)
+                ano=255.0;
 
-    if (LR.frq_mhz>0.0)
-    {
-        if (itwom)
-            fprintf(fd2,"ITWOM Version %.1f Parameters Used In This Analysis:\n\n",ITWOMVersion());
-        else
-            fprintf(fd2,"Longley-Rice Parameters Used In This Analysis:\n\n");
+            PutSignal(latitude,longitude,((unsigned char)round(ano)));
+        }
+    }
 
-        fprintf(fd2,"Earth's Dielectric Constant: %.3lf\n",LR.eps_dielect);
-        fprintf(fd2,"Earth's Conductivity: %.3lf Siemens/meter\n",LR.sgm_conductivity);
-        fprintf(fd2,"Atmospheric Bending Constant (N-units): %.3lf ppm\n",LR.eno_ns_surfref);
-        fprintf(fd2,"Frequency: %.3lf MHz\n",LR.frq_mhz);
-        fprintf(fd2,"Radio Climate: %d (",LR.radio_climate);
+    if (LR.erp!=0.0 && dbm)
+    {
+        /* signal power level in dBm */
 
-        switch (LR.radio_climate)
+        if (contour_threshold==0 || (ano>=(double)contour_threshold))
         {
-            case 1:
-                fprintf(fd2,"Equatorial");
-                break;
+            ano=200.0+rint(ano);
 
-            case 2:
-                fprintf(fd2,"Continental Subtropical");
-                break;
+            if (ano<0.0)
+                ano=0.0;
 
-            case 3:
-                fprintf(fd2,"Maritime Subtropical");
-                break;
+            if (ano>255.0)
+                ano=255.0;
 
-            case 4:
-                fprintf(fd2,"Desert");
-                break;
+            PutSignal(latitude,longitude,((unsigned char)round(ano)));
+        }
+    }
 
-            case 5:
-                fprintf(fd2,"Continental Temperate");
-                break;
+    if (LR.erp!=0.0 && !dbm)
+    {
+        /* field strength dBuV/m */
 
-            case 6:
-                fprintf(fd2,"Martitime Temperate, Over Land");
-                break;
+        if (contour_threshold==0 || (ano>=(double)contour_threshold))
+        {
+            ano=100.0+rint(ano);
 
-            case 7:
-                fprintf(fd2,"Maritime Temperate, Over Sea");
-                break;
+            if (ano<0.0)
+                ano=0.0;
 
-            default:
-                fprintf(fd2,"Unknown");
+            if (ano>255.0)
+                ano=255.0;
+
+            PutSignal(latitude,longitude,((unsigned char)round(ano)));
         }
+    }
+}
 
-        fprintf(fd2,")\nPolarization: %d (",LR.pol);
+/* The ingest below hands the file to the workers one large block at a
+ * time: the main thread does nothing but fread() while the parsing (the
+ * actual bottleneck on the text format) runs in parallel. The points
+ * land in the signal planes through PlotANOPoint()'s relaxed atomic
+ * stores, and .ano files are written in raster order, so concurrent
+ * blocks touch disjoint pixels anyway.
+ */
 
-        if (LR.pol==0)
-            fprintf(fd2,"Horizontal");
+#define ANO_READ_BLOCK (4*1024*1024)
 
-        if (LR.pol==1)
-            fprintf(fd2,"Vertical");
+/* Parses one block of ANO text -- whole "lat, lon, azimuth, elevation,
+ * value" lines, NUL-terminated at len -- and plots each point. Takes
+ * ownership of buf.
+ */
+static void ParseANOBlock(char *buf, size_t len)
+{
+    char	*line, *end=buf+len, *nl;
+    double	latitude, longitude, azimuth, elevation, ano;
 
-        fprintf(fd2,")\nFraction of Situations: %.1lf%c\n",LR.conf*100.0,37);
-        fprintf(fd2,"Fraction of Time: %.1lf%c\n",LR.rel*100.0,37);
+    for (line=buf; line<end; line=(nl==NULL?end:nl+1))
+    {
+        nl=(char *)memchr(line,'\n',(size_t)(end-line));
 
-        if (LR.erp!=0.0)
-        {
-            fprintf(fd2,"Transmitter ERP: ");
+        if (nl!=NULL)
+            *nl=0;
 
-            if (LR.erp<1.0)
-                fprintf(fd2,"%.1lf milliwatts",1000.0*LR.erp);
+        if (sscanf(line,"%lf, %lf, %lf, %lf, %lf",&latitude, &longitude, &azimuth, &elevation, &ano)==5)
+            PlotANOPoint(latitude,longitude,ano);
+    }
 
-            if (LR.erp>=1.0 && LR.erp<10.0)
-                fprintf(fd2,"%.1lf Watts",LR.erp);
+    free(buf);
+}
 
-            if (LR.erp>=10.0 && LR.erp<10.0e3)
-                fprintf(fd2,"%.0lf Watts",LR.erp);
+/* Binary-format counterpart: plots a block of records. Takes ownership
+ * of recs.
+ */
+static void PlotANORecords(AnoRecord *recs, size_t n)
+{
+    size_t i;
 
-            if (LR.erp>=10.0e3)
-                fprintf(fd2,"%.3lf kilowatts",LR.erp/1.0e3);
+    for (i=0; i<n; i++)
+        PlotANOPoint(recs[i].lat,recs[i].lon,(double)recs[i].value);
 
-            dBm=10.0*(log10(LR.erp*1000.0));
-            fprintf(fd2," (%+.2f dBm)\n",dBm);
+    free(recs);
+}
 
-            /* EIRP = ERP + 2.14 dB */
+int LoadANO(char *filename, bool multithread)
+{
+    int	error=0, max_west, min_west, max_north, min_north;
+    char	buf[MAX_LINE_LEN], *pointer=NULL;
+    AnoHeader hdr;
+    FILE	*fd;
 
-            fprintf(fd2,"Transmitter EIRP: ");
+    fd=fopen(filename,"rb");
 
-            eirp=LR.erp*1.636816521;
+    if (fd!=NULL)
+    {
+        WorkQueue wq;
 
-            if (eirp<1.0)
-                fprintf(fd2,"%.1lf milliwatts",1000.0*eirp);
+        /* A binary (.bano) file is recognized by its magic header,
+           whatever filename it was given. */
 
-            if (eirp>=1.0 && eirp<10.0)
-                fprintf(fd2,"%.1lf Watts",eirp);
+        if (fread(&hdr,sizeof(hdr),1,fd)==1 && hdr.magic==ANO_MAGIC)
+        {
+            size_t n, blockrecs=ANO_READ_BLOCK/sizeof(AnoRecord);
+            AnoRecord *recs;
 
-            if (eirp>=10.0 && eirp<10.0e3)
-                fprintf(fd2,"%.0lf Watts",eirp);
+            max_west=hdr.max_west;
+            min_west=hdr.min_west;
+            max_north=hdr.max_north;
+            min_north=hdr.min_north;
 
-            if (eirp>=10.0e3)
-                fprintf(fd2,"%.3lf kilowatts",eirp/1.0e3);
+            LoadTopoData(max_west-1, min_west, max_north-1, min_north, multithread);
 
-            dBm=10.0*(log10(eirp*1000.0));
-            fprintf(fd2," (%+.2f dBm)\n",dBm);
-        }
+            fprintf(stdout,"\nReading \"%s\"... ",filename);
+            fflush(stdout);
 
-        fprintf(fd2,"\n%s\n\n",dashes);
+            while (1)
+            {
+                recs=(AnoRecord *)malloc(blockrecs*sizeof(AnoRecord));
+                assert(recs!=NULL);
 
-        fprintf(fd2,"Summary For The Link Between %s and %s:\n\n",source.name, destination.name);
+                n=fread(recs,sizeof(AnoRecord),blockrecs,fd);
 
-        if (patterndB!=0.0) {
-            if (patterndB == -9999) {
-                fprintf(fd2,"%s antenna pattern towards %s: -infinity (blocked)\n", source.name, destination.name);
-            } else {
-                fprintf(fd2,"%s antenna pattern towards %s: %.3f (%.2f dB)\n", source.name, destination.name, pattern, patterndB);
+                if (n==0)
+                {
+                    free(recs);
+                    break;
+                }
+
+                if (multithread)
+                    wq.submit(std::bind(PlotANORecords,recs,n));
+                else
+                    PlotANORecords(recs,n);
             }
-        }
 
-        ReadPath(source,destination,path);  /* source=TX, destination=RX */
+            wq.waitForCompletion();
 
-        elev_t *elev = (elev_t*)calloc(path->arysize + 10, sizeof(elev_t));
+            fclose(fd);
 
-        /* Copy elevations plus clutter along
-           path into the elev[] array. */
+            fprintf(stdout," Done!\n");
+            fflush(stdout);
 
-        for (x=1; x<path->length-1; x++)
-            elev[x+2]=METERS_PER_FOOT*(path->elevation[x]==0.0?(elev_t)(path->elevation[x]):(elev_t)(clutter+path->elevation[x]));
+            return 0;
+        }
 
-        /* Copy ending points without clutter */
+        rewind(fd);
 
-        elev[2]=(elev_t)(path->elevation[0]*METERS_PER_FOOT);
-        elev[path->length+1]=(elev_t)(path->elevation[path->length-1]*METERS_PER_FOOT);
+        fgets(buf,MAX_LINE_LEN,fd);
+        pointer=strchr(buf,';');
 
-        fd=fopen("profile.gp","w");
+        if (pointer!=NULL)
+            *pointer=0;
 
-        azimuth=rint(Azimuth(source,destination));
+        sscanf(buf,"%d, %d",&max_west, &min_west);
 
-        for (y=2; y<(path->length-1); y++)  /* path->length-1 avoids LR error */
-        {
-            distance=5280.0*path->distance[y];
+        fgets(buf,MAX_LINE_LEN,fd);
+        pointer=strchr(buf,';');
 
-            if (source.amsl_flag)
-                source_alt=four_thirds_earth+source.alt;
-            else
-                source_alt=four_thirds_earth+source.alt+path->elevation[0];
+        if (pointer!=NULL)
+            *pointer=0;
 
-            /***
-              if (destination.amsl_flag)
-              dest_alt=four_thirds_earth+destination.alt;
-              else
-             ***/
-            dest_alt=four_thirds_earth+destination.alt+path->elevation[y];
+        sscanf(buf,"%d, %d",&max_north, &min_north);
 
-            dest_alt2=dest_alt*dest_alt;
-            source_alt2=source_alt*source_alt;
+        fgets(buf,MAX_LINE_LEN,fd);
+        pointer=strchr(buf,';');
 
-            /* Calculate the cosine of the elevation of
-               the receiver as seen by the transmitter. */
+        if (pointer!=NULL)
+            *pointer=0;
 
-            cos_xmtr_angle=((source_alt2)+(distance*distance)-(dest_alt2))/(2.0*source_alt*distance);
+        LoadTopoData(max_west-1, min_west, max_north-1, min_north, multithread);
 
-            if (got_elevation_pattern)
+        fprintf(stdout,"\nReading \"%s\"... ",filename);
+        fflush(stdout);
+
+        {
+            char	leftover[MAX_LINE_LEN];
+            char	*block, *nl;
+            size_t	len, carry=0;
+
+            while (feof(fd)==0)
             {
-                /* If an antenna elevation pattern is available, the
-                   following code determines the elevation angle to
-                   the first obstruction along the path-> */
+                block=(char *)malloc(ANO_READ_BLOCK+carry+1);
+                assert(block!=NULL);
 
-                for (x=2, block=0; x<y && block==0; x++)
-                {
-                    distance=5280.0*(path->distance[y]-path->distance[x]);
-                    test_alt=four_thirds_earth+path->elevation[x];
+                memcpy(block,leftover,carry);
+                len=carry+fread(block+carry,1,ANO_READ_BLOCK,fd);
+                carry=0;
 
-                    /* Calculate the cosine of the elevation
-                       angle of the terrain (test point)
-                       as seen by the transmitter. */
+                if (len==0)
+                {
+                    free(block);
+                    break;
+                }
 
-                    cos_test_angle=((source_alt2)+(distance*distance)-(test_alt*test_alt))/(2.0*source_alt*distance);
+                if (feof(fd)==0)
+                {
+                    /* Hold the partial line at the end of the block back
+                       for the next read so every job sees whole lines. */
 
-                    /* Compare these two angles to determine if
-                       an obstruction exists.  Since we're comparing
-                       the cosines of these angles rather than
-                       the angles themselves, the sense of the
-                       following "if" statement is reversed from
-                       what it would be if the angles themselves
-                       were compared. */
+                    for (nl=block+len-1; nl>=block && *nl!='\n'; nl--);
 
-                    if (cos_xmtr_angle>=cos_test_angle)
-                        block=1;
+                    if (nl>=block && (len-(size_t)(nl-block)-1)<MAX_LINE_LEN)
+                    {
+                        carry=len-(size_t)(nl-block)-1;
+                        memcpy(leftover,nl+1,carry);
+                        len=(size_t)(nl-block)+1;
+                    }
                 }
 
-                /* At this point, we have the elevation angle
-                   to the first obstruction (if it exists). */
+                block[len]=0;
+
+                if (multithread)
+                    wq.submit(std::bind(ParseANOBlock,block,len));
+                else
+                    ParseANOBlock(block,len);
             }
 
-            /* Determine path loss for each point along
-               the path using ITWOM's point_to_point mode
-               starting at x=2 (number_of_points = 1), the
-               shortest distance terrain can play a role in
-               path loss. */
+            wq.waitForCompletion();
+        }
 
-            elev[0]=(elev_t)(y-1);	/* (number of points - 1) */
+        fclose(fd);
 
-            /* Distance between elevation samples */
+        fprintf(stdout," Done!\n");
+        fflush(stdout);
+    }
 
-            elev[1]=(elev_t)(METERS_PER_MILE*(path->distance[y]-path->distance[y-1]));
+    else
+        error=1;
 
-            if (itwom)
-                point_to_point(elev,source.alt*METERS_PER_FOOT, 
-                               destination.alt*METERS_PER_FOOT, LR.eps_dielect,
-                               LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
-                               LR.radio_climate, LR.pol, LR.conf, LR.rel, &loss,
-                               strmode, &errnum);
-            else
-                point_to_point_ITM(elev,source.alt*METERS_PER_FOOT, 
-                                   destination.alt*METERS_PER_FOOT, LR.eps_dielect,
-                                   LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
-                                   LR.radio_climate, LR.pol, LR.conf, LR.rel, &loss,
-                                   strmode, &errnum);
+    return error;
+}
 
-            if (block)
-                elevation=((acos(cos_test_angle))/DEG2RAD)-90.0;
-            else
-                elevation=((acos(cos_xmtr_angle))/DEG2RAD)-90.0;
+/*****************************
+ * Coverage checkpoint engine (-ckpt). Snapshots the per-page mask and
+ * signal planes plus the run parameters after each transmitter's sweep,
+ * so a killed multi-hour run resumes where it left off and a moved
+ * transmitter costs only its own recompute. Resume relies on the
+ * per-pixel ownership check in PlotLRPath()/the tiled sweep: replotting
+ * a transmitter whose pixels are already in the planes skips the
+ * propagation model for every one of them, so a completed site costs
+ * only its ReadPath() sweeps.
+ *****************************/
 
-            /* Integrate the antenna's radiation
-               pattern into the overall path loss. */
+#define CKPT_MAGIC   0x504B4353u    /* "SCKP" */
+#define CKPT_VERSION 1
 
-            x=(int)rint(10.0*(10.0-elevation));
+typedef struct CkptHeader {
+    unsigned int magic;
+    unsigned int version;
+    int ippd;
+    int max_west;
+    int min_west;
+    int max_north;
+    int min_north;
+    int pages;
+    unsigned int sites;
+    int itwom;
+    double max_range;
+    double clutter;
+    double eps_dielect;
+    double sgm_conductivity;
+    double eno_ns_surfref;
+    double frq_mhz;
+    double conf;
+    double rel;
+    double erp;
+    int radio_climate;
+    int pol;
+} CkptHeader;
 
-            if (x>=0 && x<=1000)
-            {
-                pattern=(double)LR.antenna_pattern[(int)azimuth][x];
+typedef struct CkptSite {
+    double lat;
+    double lon;
+    double alt;
+    char name[MAX_SITE_NAME_LEN];
+    unsigned char done;
+    unsigned char pad[7];
+} CkptSite;
 
-                if (pattern > 0.0) {
-                    patterndB=20.0*log10(pattern);
-                } else if (pattern != NO_ANTENNA_DATA) {
-                    loss-=9999;
-                }
-            }
-            else
-                patterndB=0.0;
+typedef struct CkptPage {
+    int min_north;
+    int max_north;
+    int min_west;
+    int max_west;
+} CkptPage;
+
+/* Makes an evicted page's planes addressable again before the
+ * checkpoint code walks them directly (everything else goes through
+ * FindDEM(), which faults on its own).
+ */
+static void CkptEnsureResident(DEM *dem)
+{
+    if (demMemBudget!=0)
+    {
+        std::lock_guard<std::mutex> lock(demMutex);
+
+        /* These walks touch one page at a time from the main thread, so
+           each page gets a phase of its own: the page is pinned against
+           eviction while its planes are read or written, and becomes
+           evictable again the moment the walk moves on. The page must
+           be marked before enforcing, or a tight budget could evict the
+           very page just faulted in. */
+
+        demPhase++;
+        dem->lastuse=++demClock;
+        dem->lastphase=demPhase;
+
+        if (!dem->resident)
+            DEMCacheFault(dem);
+
+        DEMCacheEnforce();
+    }
+}
+
+/* Fills a checkpoint header from the current run state. Kept in one
+ * place so save and load can't drift apart on what "matching" means.
+ */
+static void CkptFillHeader(CkptHeader *hdr, unsigned int txsites)
+{
+    memset(hdr,0,sizeof(CkptHeader));
+
+    hdr->magic=CKPT_MAGIC;
+    hdr->version=CKPT_VERSION;
+    hdr->ippd=ippd;
+    hdr->max_west=max_west;
+    hdr->min_west=min_west;
+    hdr->max_north=max_north;
+    hdr->min_north=min_north;
+    hdr->pages=demCount;
+    hdr->sites=txsites;
+    hdr->itwom=(itwom?1:0);
+    hdr->max_range=max_range;
+    hdr->clutter=clutter;
+    hdr->eps_dielect=LR.eps_dielect;
+    hdr->sgm_conductivity=LR.sgm_conductivity;
+    hdr->eno_ns_surfref=LR.eno_ns_surfref;
+    hdr->frq_mhz=LR.frq_mhz;
+    hdr->conf=LR.conf;
+    hdr->rel=LR.rel;
+    hdr->erp=LR.erp;
+    hdr->radio_climate=LR.radio_climate;
+    hdr->pol=LR.pol;
+}
+
+/* Snapshots the planes and parameters. Written to a temp name and
+ * renamed into place so an interrupted save can't eat the previous
+ * checkpoint. sites_done counts the leading transmitters whose sweeps
+ * have completed.
+ */
+int CkptSave(char *filename, Site *xmtr, unsigned int txsites, unsigned int sites_done)
+{
+    int i;
+    unsigned int x;
+    unsigned long n;
+    char tmpname[MAX_PATH_LEN+8];
+    CkptHeader hdr;
+    CkptSite site;
+    CkptPage page;
+    FILE *fd;
+
+    snprintf(tmpname,sizeof(tmpname),"%s.tmp",filename);
+
+    if ((fd=fopen(tmpname,"wb"))==NULL)
+    {
+        fprintf(stderr,"\n*** ERROR: Couldn't write checkpoint \"%s\"!\n",tmpname);
+        return -1;
+    }
 
-            total_loss=loss-patterndB;
+    CkptFillHeader(&hdr,txsites);
+    fwrite(&hdr,sizeof(hdr),1,fd);
 
-            if (metric)
-                fprintf(fd,"%f\t%f\n",KM_PER_MILE*path->distance[y],total_loss);
-            else
-                fprintf(fd,"%f\t%f\n",path->distance[y],total_loss);
+    for (x=0; x<txsites; x++)
+    {
+        memset(&site,0,sizeof(site));
+        site.lat=xmtr[x].lat;
+        site.lon=xmtr[x].lon;
+        site.alt=xmtr[x].alt;
+        strncpy(site.name,xmtr[x].name,MAX_SITE_NAME_LEN-1);
+        site.done=(x<sites_done?1:0);
+        fwrite(&site,sizeof(site),1,fd);
+    }
 
-            if (total_loss>maxloss)
-                maxloss=total_loss;
+    /* Page directory first, then the plane blobs in the same order */
 
-            if (total_loss<minloss)
-                minloss=total_loss;
-        }
+    for (i=0; i<demCount; i++)
+    {
+        page.min_north=aDEM[i]->min_north;
+        page.max_north=aDEM[i]->max_north;
+        page.min_west=aDEM[i]->min_west;
+        page.max_west=aDEM[i]->max_west;
+        fwrite(&page,sizeof(page),1,fd);
+    }
 
-        fclose(fd);
+    for (i=0; i<demCount; i++)
+    {
+        CkptEnsureResident(aDEM[i]);
 
-        free(elev);
+        n=aDEM[i]->arysize*aDEM[i]->arysize;
 
-        distance=Distance(source,destination);
+        if (fwrite(aDEM[i]->mask,sizeof(unsigned char),n,fd)!=n ||
+            fwrite(aDEM[i]->signal,sizeof(unsigned char),n,fd)!=n)
+        {
+            fprintf(stderr,"\n*** ERROR: Checkpoint write failed (disk full?)\n");
+            fclose(fd);
+            unlink(tmpname);
+            return -1;
+        }
+    }
 
+    fclose(fd);
 
-        if (distance!=0.0)
-        {
-            free_space_loss=36.6+(20.0*log10(LR.frq_mhz))+(20.0*log10(distance));
+    if (rename(tmpname,filename)!=0)
+    {
+        fprintf(stderr,"\n*** ERROR: Couldn't move checkpoint into place!\n");
+        unlink(tmpname);
+        return -1;
+    }
 
-            fprintf(fd2,"Free space path loss: %.2f dB\n",free_space_loss);
-        }
+    return 0;
+}
 
-        if (itwom)
-            fprintf(fd2,"ITWOM Version %.1f path loss: %.2f dB\n",ITWOMVersion(),loss);
-        else
-            fprintf(fd2,"Longley-Rice path loss: %.2f dB\n",loss);
+/* Clears one transmitter's contribution from the planes: every pixel
+ * whose ownership bits carry this site's id loses its mask ownership
+ * and signal value, so the next sweep recomputes it. site_id is the
+ * 1-based order the site is plotted in (the value PlotLRPath() stores
+ * in the top five mask bits). Pixels a moved site used to own but was
+ * later overplotted on keep the later site's values, the same
+ * last-writer-wins rule the full sweep applies.
+ */
+void CkptClearSite(int site_id)
+{
+    int i;
+    unsigned long j, n;
+    DEM *dem;
 
-        if (free_space_loss!=0.0)
-            fprintf(fd2,"Attenuation due to terrain shielding: %.2f dB\n",loss-free_space_loss);
+    for (i=0; i<demCount; i++)
+    {
+        dem=aDEM[i];
+        CkptEnsureResident(dem);
 
-        if (patterndB!=0.0)
-            fprintf(fd2,"Total path loss including %s antenna pattern: %.2f dB\n",source.name,total_loss);
+        n=dem->arysize*dem->arysize;
 
-        if (LR.erp!=0.0)
+        for (j=0; j<n; j++)
         {
-            field_strength=(139.4+(20.0*log10(LR.frq_mhz))-total_loss)+(10.0*log10(LR.erp/1000.0));
+            if ((dem->mask[j]&248)==(site_id<<3))
+            {
+                dem->mask[j]&=7;
+                dem->signal[j]=0;
+            }
+        }
+    }
+}
 
-            /* dBm is referenced to EIRP */
+/* Loads a checkpoint written by an earlier run of the same job. If the
+ * global parameters don't match, the file is ignored and the run starts
+ * fresh. Sites are compared by position in the transmitter list: a site
+ * whose coordinates or height changed has its old contribution cleared
+ * so the sweep recomputes just that site. Returns the number of sites
+ * that were already complete, or -1 if no usable checkpoint was found.
+ */
+int CkptLoad(char *filename, Site *xmtr, unsigned int txsites)
+{
+    int i, complete=0;
+    unsigned int x;
+    unsigned long n;
+    CkptHeader hdr, want;
+    CkptSite *sites=NULL;
+    CkptPage *pages=NULL;
+    DEM **dems=NULL;
+    FILE *fd;
 
-            rxp=eirp/(pow(10.0,(total_loss/10.0)));
-            dBm=10.0*(log10(rxp*1000.0));
-            power_density=(eirp/(pow(10.0,(total_loss-free_space_loss)/10.0)));
-            /* divide by 4*PI*distance_in_meters squared */
-            power_density/=(4.0*PI*distance*distance*2589988.11);
+    if ((fd=fopen(filename,"rb"))==NULL)
+        return -1;
 
-            fprintf(fd2,"Field strength at %s: %.2f dBuV/meter\n", destination.name,field_strength);
-            fprintf(fd2,"Signal power level at %s: %+.2f dBm\n",destination.name,dBm);
-            fprintf(fd2,"Signal power density at %s: %+.2f dBW per square meter\n",destination.name,10.0*log10(power_density));
-            voltage=1.0e6*sqrt(50.0*(eirp/(pow(10.0,(total_loss-2.14)/10.0))));
-            fprintf(fd2,"Voltage across a 50 ohm dipole at %s: %.2f uV (%.2f dBuV)\n",destination.name,voltage,20.0*log10(voltage));
+    CkptFillHeader(&want,txsites);
 
-            voltage=1.0e6*sqrt(75.0*(eirp/(pow(10.0,(total_loss-2.14)/10.0))));
-            fprintf(fd2,"Voltage across a 75 ohm dipole at %s: %.2f uV (%.2f dBuV)\n",destination.name,voltage,20.0*log10(voltage));
-        }
+    if (fread(&hdr,sizeof(hdr),1,fd)!=1 ||
+        memcmp(&hdr,&want,sizeof(hdr))!=0)
+    {
+        fprintf(stdout,"Checkpoint \"%s\" doesn't match this run; starting fresh.\n",filename);
+        fclose(fd);
+        return -1;
+    }
 
-        fprintf(fd2,"Mode of propagation: ");
+    sites=(CkptSite *)calloc(txsites,sizeof(CkptSite));
+    pages=(CkptPage *)calloc(demCount,sizeof(CkptPage));
+    dems=(DEM **)calloc(demCount,sizeof(DEM *));
+    assert(sites!=NULL && pages!=NULL && dems!=NULL);
 
-        if (itwom)
-        {
-            if (strcmp(strmode,"L-o-S")==0)
-                fprintf(fd2,"Line of Sight\n");
+    /* Validate the whole directory before touching any plane, so a
+       truncated or stale file can't leave the grids half-applied. */
 
-            if (strncmp(strmode,"1_Hrzn",6)==0)
-                fprintf(fd2,"Single Horizon ");
+    do
+    {
+        if (fread(sites,sizeof(CkptSite),txsites,fd)!=txsites)
+            break;
 
-            if (strncmp(strmode,"2_Hrzn",6)==0)
-                fprintf(fd2,"Double Horizon ");
+        if (fread(pages,sizeof(CkptPage),demCount,fd)!=(size_t)demCount)
+            break;
 
-            y= (int)strlen(strmode);
+        for (i=0; i<demCount; i++)
+        {
+            dems[i]=FindDEM_Explicit(pages[i].min_north,pages[i].min_west,
+                                     pages[i].max_north,pages[i].max_west);
+            if (dems[i]==NULL)
+                break;
+        }
 
-            if (y>19)
-                y=19;
+        if (i<demCount)
+            break;
 
-            for (x=6; x<y; x++)
-                propbuf[x-6]=strmode[x];
+        for (i=0; i<demCount; i++)
+        {
+            CkptEnsureResident(dems[i]);
 
-            propbuf[x]=0;
+            n=dems[i]->arysize*dems[i]->arysize;
 
-            if (strncmp(propbuf,"_Diff",5)==0)
-                fprintf(fd2,"Diffraction Dominant\n");
+            if (fread(dems[i]->mask,sizeof(unsigned char),n,fd)!=n ||
+                fread(dems[i]->signal,sizeof(unsigned char),n,fd)!=n)
+            {
+                /* Half-applied; wipe the coverage state back to clean */
 
-            if (strncmp(propbuf,"_Tropo",6)==0)
-                fprintf(fd2,"Troposcatter Dominant\n");
+                fprintf(stderr,"\n*** ERROR: Checkpoint \"%s\" is truncated!\n",filename);
 
-            if (strncmp(propbuf,"_Peak",5)==0)
-                fprintf(fd2,"RX at Peak Terrain Along Path\n");
+                for (i=0; i<demCount; i++)
+                {
+                    CkptEnsureResident(aDEM[i]);
+                    n=aDEM[i]->arysize*aDEM[i]->arysize;
+                    memset(aDEM[i]->mask,0,n);
+                    memset(aDEM[i]->signal,0,n);
+                }
 
-            fprintf(fd2,"ITWOM error number: %d",errnum);
+                free(sites);
+                free(pages);
+                free(dems);
+                fclose(fd);
+                return -1;
+            }
         }
-        else
+
+        for (x=0; x<txsites; x++)
         {
-            fprintf(fd2,"%s\n",strmode);
-            fprintf(fd2,"Longley-Rice model error number: %d",errnum);
+            if (sites[x].lat!=xmtr[x].lat || sites[x].lon!=xmtr[x].lon ||
+                sites[x].alt!=xmtr[x].alt ||
+                strncmp(sites[x].name,xmtr[x].name,MAX_SITE_NAME_LEN)!=0)
+            {
+                fprintf(stdout,"Transmitter \"%s\" changed; clearing its old coverage.\n",
+                        xmtr[x].name);
+                CkptClearSite((int)x+1);
+            }
+
+            else if (sites[x].done)
+                complete++;
         }
 
+        fprintf(stdout,"Resuming from checkpoint \"%s\" (%d of %u sites complete).\n",
+                filename,complete,txsites);
 
-        switch (errnum)
-        {
-            case 0:
-                fprintf(fd2," (No error)\n");
-                break;
+        free(sites);
+        free(pages);
+        free(dems);
+        fclose(fd);
+        return complete;
 
-            case 1:
-                fprintf(fd2,"\n  Warning: Some parameters are nearly out of range.\n");
-                fprintf(fd2,"  Results should be used with caution.\n");
-                break;
+    } while (0);
 
-            case 2:
-                fprintf(fd2,"\n  Note: Default parameters have been substituted for impossible ones.\n");
-                break;
+    fprintf(stdout,"Checkpoint \"%s\" doesn't match this run; starting fresh.\n",filename);
 
-            case 3:
-                fprintf(fd2,"\n  Warning: A combination of parameters is out of range.\n");
-                fprintf(fd2,"  Results are probably invalid.\n");
-                break;
+    free(sites);
+    free(pages);
+    free(dems);
+    fclose(fd);
+    return -1;
+}
 
-            default:
-                fprintf(fd2,"\n  Warning: Some parameters are out of range.\n");
-                fprintf(fd2,"  Results are probably invalid.\n");
-        }
+/* Folds one shard's checkpoint grid into the current planes
+ * (-mergegrids). The file must match the run the same way a resume
+ * checkpoint does: shard grids cover the full region bounds, only the
+ * boundary rays computed differ, so the header and transmitter list
+ * comparisons from CkptLoad() apply unchanged. A pixel the file owns
+ * but the planes don't yet takes the file's ownership bits and signal;
+ * the low three mask bits are OR'd either way. Where two shards overlap
+ * (the rays near a transmitter) both computed the same values, so the
+ * first grid in wins. Returns 0, or -1 if the file was unusable.
+ */
+int CkptMerge(char *filename, Site *xmtr, unsigned int txsites)
+{
+    int i;
+    unsigned int x;
+    unsigned long j, n;
+    long pos;
+    unsigned char m;
+    unsigned char *mbuf=NULL, *sbuf=NULL;
+    CkptHeader hdr, want;
+    CkptSite *sites=NULL;
+    CkptPage *pages=NULL;
+    DEM **dems=NULL;
+    FILE *fd;
 
-        fprintf(fd2,"\n%s\n\n",dashes);
+    if ((fd=fopen(filename,"rb"))==NULL)
+    {
+        fprintf(stderr,"\n*** ERROR: Couldn't read shard grid \"%s\"!\n",filename);
+        return -1;
     }
 
-    fprintf(stdout,"\nPath Loss Report written to: \"%s\"\n",report_name);
-    fflush(stdout);
+    CkptFillHeader(&want,txsites);
 
-    ObstructionAnalysis(source, destination, LR.frq_mhz, fd2);
+    if (fread(&hdr,sizeof(hdr),1,fd)!=1 ||
+        memcmp(&hdr,&want,sizeof(hdr))!=0)
+    {
+        fprintf(stderr,"\n*** ERROR: Shard grid \"%s\" doesn't match this run; skipping it.\n",filename);
+        fclose(fd);
+        return -1;
+    }
 
-    fclose(fd2);
+    sites=(CkptSite *)calloc(txsites,sizeof(CkptSite));
+    pages=(CkptPage *)calloc(demCount,sizeof(CkptPage));
+    dems=(DEM **)calloc(demCount,sizeof(DEM *));
+    assert(sites!=NULL && pages!=NULL && dems!=NULL);
 
-    /* Skip plotting the graph if ONLY a path-loss report is needed. */
+    /* Validate the directory and the sites before merging anything:
+       unlike a resume load there's no clean state to fall back to once
+       another shard's pixels are already in the planes. */
 
-    if (graph_it)
+    do
     {
-        if (name[0]=='.')
-        {
-            /* Default filename and output file type */
-            strcpy(basename,"profile");
-            strcpy(ext,"png");
-        }
-        else
+        if (fread(sites,sizeof(CkptSite),txsites,fd)!=txsites)
+            break;
+
+        if (fread(pages,sizeof(CkptPage),demCount,fd)!=(size_t)demCount)
+            break;
+
+        for (i=0; i<demCount; i++)
         {
-            /* Extract extension and terminal type from "name" */
-            strncpy(basename, name, MAX_PATH_LEN-1);
-            stripExtension(basename, ext, 20);
-            convertBackslashes(basename);
-            if (strlen(ext) == 0)
-            {
-                strcpy(ext,"png");
-            }
+            dems[i]=FindDEM_Explicit(pages[i].min_north,pages[i].min_west,
+                                     pages[i].max_north,pages[i].max_west);
+            if (dems[i]==NULL)
+                break;
         }
-        strcpy(term,ext);
-
-        /* Either .ps or .postscript may be used
-           as an extension for postscript output. */
 
-        if (strncmp(term,"postscript",10)==0)
-            strcpy(ext,"ps0");
+        if (i<demCount)
+            break;
 
-        else if (strncmp(ext,"ps",2)==0)
-            strcpy(term,"postscript enhanced color0");
+        for (x=0; x<txsites; x++)
+            if (sites[x].lat!=xmtr[x].lat || sites[x].lon!=xmtr[x].lon ||
+                sites[x].alt!=xmtr[x].alt ||
+                strncmp(sites[x].name,xmtr[x].name,MAX_SITE_NAME_LEN)!=0)
+                break;
 
-        fd=fopen("splat.gp","w");
+        if (x<txsites)
+            break;
 
-        fprintf(fd,"set grid\n");
-        fprintf(fd,"set yrange [%2.3f to %2.3f]\n", minloss, maxloss);
-        fprintf(fd,"set encoding iso_8859_1\n");
-        fprintf(fd,"set term %s\n",term);
-        fprintf(fd,"set title \"%s Loss Profile Along Path Between %s and %s (%.2f%c azimuth)\"\n",SPLAT_NAME, destination.name, source.name, Azimuth(destination,source),176);
+        n=dems[0]->arysize*dems[0]->arysize;
 
-        if (metric)
-            fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f kilometers)\"\n",destination.name,source.name,KM_PER_MILE*Distance(destination,source));
-        else
-            fprintf(fd,"set xlabel \"Distance Between %s and %s (%.2f miles)\"\n",destination.name,source.name,Distance(destination,source));
+        /* The plane blobs can't be un-merged, so make sure they're all
+           there before touching the first one. */
 
-        if (got_azimuth_pattern || got_elevation_pattern)
-            fprintf(fd,"set ylabel \"Total Path Loss (including TX antenna pattern) (dB)");
-        else
-        {
-            if (itwom)
-                fprintf(fd,"set ylabel \"ITWOM Version %.1f Path Loss (dB)",ITWOMVersion());
-            else
-                fprintf(fd,"set ylabel \"Longley-Rice Path Loss (dB)");
-        }
+        pos=ftell(fd);
+        fseek(fd,0L,SEEK_END);
 
-        fprintf(fd,"\"\nset output \"%s.%s\"\n",basename,ext);
-        fprintf(fd,"plot \"profile.gp\" title \"Path Loss\" with lines\n");
+        if (ftell(fd)-pos!=(long)(2*n*(unsigned long)demCount))
+            break;
 
-        fclose(fd);
+        fseek(fd,pos,SEEK_SET);
 
-        x=system("gnuplot splat.gp");
+        mbuf=(unsigned char *)malloc(n);
+        sbuf=(unsigned char *)malloc(n);
+        assert(mbuf!=NULL && sbuf!=NULL);
 
-        if (x!=-1)
+        for (i=0; i<demCount; i++)
         {
-            if (!gpsav)
+            if (fread(mbuf,sizeof(unsigned char),n,fd)!=n ||
+                fread(sbuf,sizeof(unsigned char),n,fd)!=n)
+                break;
+
+            CkptEnsureResident(dems[i]);
+
+            for (j=0; j<n; j++)
             {
-                unlink("splat.gp");
-                unlink("profile.gp");
-                unlink("reference.gp");
-            }
+                m=mbuf[j];
 
-            fprintf(stdout,"Path loss plot written to: \"%s.%s\"\n",basename,ext);
-            fflush(stdout);
+                if ((dems[i]->mask[j]&248)==0 && (m&248)!=0)
+                {
+                    dems[i]->mask[j]=(dems[i]->mask[j]&7)|(m&248);
+                    dems[i]->signal[j]=sbuf[j];
+                }
+
+                dems[i]->mask[j]|=(m&7);
+            }
         }
 
-        else
-            fprintf(stderr,"\n*** ERROR: Error occurred invoking gnuplot!\n");
-    }
+        if (i<demCount)
+            break;
 
-    if (x!=-1 && !gpsav)
-        unlink("profile.gp");
+        fprintf(stdout,"Merged shard grid \"%s\".\n",filename);
 
-    DestroyPath(path);
+        free(mbuf);
+        free(sbuf);
+        free(sites);
+        free(pages);
+        free(dems);
+        fclose(fd);
+        return 0;
+
+    } while (0);
 
+    fprintf(stderr,"\n*** ERROR: Shard grid \"%s\" doesn't match this run; skipping it.\n",filename);
+
+    free(mbuf);
+    free(sbuf);
+    free(sites);
+    free(pages);
+    free(dems);
+    fclose(fd);
+    return -1;
 }
 
-/* Generates a site analysis report.
+/* Writes a KML file plotting the path between source and destination.
  */
-void SiteReport(Site xmtr)
+void WriteKML(Site source, Site destination)
 {
-    char	report_name[MAX_PATH_LEN];
-    double	terrain;
-    int	x, azi;
-    FILE	*fd;
+    int	x, y;
+    char	block;
+    char report_name[MAX_PATH_LEN-4], kmlfile[MAX_PATH_LEN];
+#if DO_KMZ
+    char kmzfile[MAX_PATH_LEN];
+#endif
+    double	distance, rx_alt, tx_alt, cos_xmtr_angle,
+            azimuth, cos_test_angle, test_alt;
+    struct zip_t *zip=NULL;
+    KmlSink ks;
+
+    Path *path = GetReportPath(source,destination);
+    if (!path) {
+        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
+        return;
+    }
 
-    snprintf(report_name,MAX_PATH_LEN,"%s-site_report.txt",xmtr.name);
+    snprintf(report_name,MAX_PATH_LEN-4,"%s-to-%s",source.name,destination.name);
 
     for (x=0; report_name[x]!=0; x++)
         if (report_name[x]==32 || report_name[x]==17 || report_name[x]==92 || report_name[x]==42 || report_name[x]==47)
             report_name[x]='_';
 
-    fd=fopen(report_name,"w");
+    snprintf(kmlfile, MAX_PATH_LEN, "%s.kml", report_name);
 
-    fprintf(fd,"\n\t--==[ %s v%s Site Analysis Report For: %s ]==--\n\n",SPLAT_NAME, SPLAT_VERSION, xmtr.name);
+#if DO_KMZ
+    /* Stream the document straight into the archive; the .kml only
+       lands on disk if the archive can't be created. */
+    snprintf(kmzfile, MAX_PATH_LEN, "%s.kmz", report_name);
+    zip=zip_open(kmzfile, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
+#endif
 
-    fprintf(fd,"%s\n\n",dashes);
+    KmlOpen(&ks,zip,kmlfile);
 
-    if (xmtr.lat>=0.0)
-    {
-        fprintf(fd,"Site location: %.4f North / %.4f West",xmtr.lat, xmtr.lon);
-        fprintf(fd, " (%s N / ",dec2dms(xmtr.lat));
-    }
+    KmlPrintf(&ks,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    KmlPrintf(&ks,"<kml xmlns=\"http://earth.google.com/kml/2.0\">\n");
+    KmlPrintf(&ks,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME, SPLAT_VERSION);
+    KmlPrintf(&ks,"<Folder>\n");
+    KmlPrintf(&ks,"<name>SPLAT! Path</name>\n");
+    KmlPrintf(&ks,"<open>1</open>\n");
+    KmlPrintf(&ks,"<description>Path Between %s and %s</description>\n",source.name,destination.name);
+
+    KmlPrintf(&ks,"<Placemark>\n");
+    KmlPrintf(&ks,"	<name>%s</name>\n",source.name);
+    KmlPrintf(&ks,"	<description>\n");
+    KmlPrintf(&ks,"	   Transmit Site\n");
 
+    if (source.lat>=0.0)
+        KmlPrintf(&ks,"	   <BR>%s North</BR>\n",dec2dms(source.lat));
     else
-    {
-        fprintf(fd,"Site location: %.4f South / %.4f West",-xmtr.lat, xmtr.lon);
-        fprintf(fd, " (%s S / ",dec2dms(xmtr.lat));
-    }
+        KmlPrintf(&ks,"	   <BR>%s South</BR>\n",dec2dms(source.lat));
 
-    fprintf(fd, "%s W)\n",dec2dms(xmtr.lon));
+    KmlPrintf(&ks,"	   <BR>%s West</BR>\n",dec2dms(source.lon));
+
+    azimuth=Azimuth(source,destination);
+    distance=Distance(source,destination);
 
     if (metric)
-    {
-        if (xmtr.amsl_flag)
-            fprintf(fd,"Antenna height: %.2f meters AMSL\n",METERS_PER_FOOT*xmtr.alt);
-        else
-        {
-            fprintf(fd,"Ground elevation: %.2f meters AMSL\n",METERS_PER_FOOT*GetElevation(xmtr));
-            fprintf(fd,"Antenna height: %.2f meters AGL / %.2f meters AMSL\n",METERS_PER_FOOT*xmtr.alt, METERS_PER_FOOT*(xmtr.alt+GetElevation(xmtr)));
-        }
-    }
+        KmlPrintf(&ks,"	   <BR>%.2f km",distance*KM_PER_MILE);
+    else
+        KmlPrintf(&ks,"	   <BR>%.2f miles",distance);
+
+    KmlPrintf(&ks," to %s</BR>\n	   <BR>toward an azimuth of %.2f%c</BR>\n",destination.name,azimuth,176);
+
+    KmlPrintf(&ks,"	</description>\n");
+    KmlPrintf(&ks,"	<visibility>1</visibility>\n");
+    KmlPrintf(&ks,"	<Style>\n");
+    KmlPrintf(&ks,"	  <IconStyle>\n");
+    KmlPrintf(&ks,"		<Icon>\n");
+    KmlPrintf(&ks,"		  <href>root://icons/palette-5.png</href>\n");
+    KmlPrintf(&ks,"		  <x>224</x>\n");
+    KmlPrintf(&ks,"		  <y>224</y>\n");
+    KmlPrintf(&ks,"		  <w>32</w>\n");
+    KmlPrintf(&ks,"		  <h>32</h>\n");
+    KmlPrintf(&ks,"		</Icon>\n");
+    KmlPrintf(&ks,"	  </IconStyle>\n");
+    KmlPrintf(&ks,"	</Style>\n");
+    KmlPrintf(&ks,"	<Point>\n");
+    KmlPrintf(&ks,"	  <extrude>1</extrude>\n");
+    KmlPrintf(&ks,"	  <altitudeMode>relativeToGround</altitudeMode>\n");
+    KmlPrintf(&ks,"	  <coordinates>%f,%f,30</coordinates>\n",(source.lon<180.0?-source.lon:360.0-source.lon),source.lat);
+    KmlPrintf(&ks,"	</Point>\n");
+    KmlPrintf(&ks,"</Placemark>\n");
+
+    KmlPrintf(&ks,"<Placemark>\n");
+    KmlPrintf(&ks,"	<name>%s</name>\n",destination.name);
+    KmlPrintf(&ks,"	<description>\n");
+    KmlPrintf(&ks,"	   Receive Site\n");
 
+    if (destination.lat>=0.0)
+        KmlPrintf(&ks,"	   <BR>%s North</BR>\n",dec2dms(destination.lat));
     else
-    {
-        if (xmtr.amsl_flag)
-            fprintf(fd,"Antenna height: %.2f feet AMSL\n",xmtr.alt);
-        else
-        {
-            fprintf(fd,"Ground elevation: %.2f feet AMSL\n",GetElevation(xmtr));
-            fprintf(fd,"Antenna height: %.2f feet AGL / %.2f feet AMSL\n",xmtr.alt, xmtr.alt+GetElevation(xmtr));
-        }
-    }
+        KmlPrintf(&ks,"	   <BR>%s South</BR>\n",dec2dms(destination.lat));
 
-    terrain=haat(xmtr);
+    KmlPrintf(&ks,"	   <BR>%s West</BR>\n",dec2dms(destination.lon));
 
-    if (terrain>-4999.0)
-    {
-        if (metric)
-            fprintf(fd,"Antenna height above average terrain: %.2f meters\n\n",METERS_PER_FOOT*terrain);
-        else
-            fprintf(fd,"Antenna height above average terrain: %.2f feet\n\n",terrain);
+    if (metric)
+        KmlPrintf(&ks,"	   <BR>%.2f km",distance*KM_PER_MILE);
+    else
+        KmlPrintf(&ks,"	   <BR>%.2f miles",distance);
+
+    KmlPrintf(&ks," to %s</BR>\n	   <BR>toward an azimuth of %.2f%c</BR>\n",source.name,Azimuth(destination,source),176);
+
+    KmlPrintf(&ks,"	</description>\n");
+    KmlPrintf(&ks,"	<visibility>1</visibility>\n");
+    KmlPrintf(&ks,"	<Style>\n");
+    KmlPrintf(&ks,"	  <IconStyle>\n");
+    KmlPrintf(&ks,"		<Icon>\n");
+    KmlPrintf(&ks,"		  <href>root://icons/palette-5.png</href>\n");
+    KmlPrintf(&ks,"		  <x>224</x>\n");
+    KmlPrintf(&ks,"		  <y>224</y>\n");
+    KmlPrintf(&ks,"		  <w>32</w>\n");
+    KmlPrintf(&ks,"		  <h>32</h>\n");
+    KmlPrintf(&ks,"		</Icon>\n");
+    KmlPrintf(&ks,"	  </IconStyle>\n");
+    KmlPrintf(&ks,"	</Style>\n");
+    KmlPrintf(&ks,"	<Point>\n");
+    KmlPrintf(&ks,"	  <extrude>1</extrude>\n");
+    KmlPrintf(&ks,"	  <altitudeMode>relativeToGround</altitudeMode>\n");
+    KmlPrintf(&ks,"	  <coordinates>%f,%f,30</coordinates>\n",(destination.lon<180.0?-destination.lon:360.0-destination.lon),destination.lat);
+    KmlPrintf(&ks,"	</Point>\n");
+    KmlPrintf(&ks,"</Placemark>\n");
+
+    KmlPrintf(&ks,"<Placemark>\n");
+    KmlPrintf(&ks,"<name>Point-to-Point Path</name>\n");
+    KmlPrintf(&ks,"  <visibility>1</visibility>\n");
+    KmlPrintf(&ks,"  <open>0</open>\n");
+    KmlPrintf(&ks,"  <Style>\n");
+    KmlPrintf(&ks,"	<LineStyle>\n");
+    KmlPrintf(&ks,"	  <color>7fffffff</color>\n");
+    KmlPrintf(&ks,"	</LineStyle>\n");
+    KmlPrintf(&ks,"	<PolyStyle>\n");
+    KmlPrintf(&ks,"	   <color>7fffffff</color>\n");
+    KmlPrintf(&ks,"	</PolyStyle>\n");
+    KmlPrintf(&ks,"  </Style>\n");
+    KmlPrintf(&ks,"  <LineString>\n");
+    KmlPrintf(&ks,"	<extrude>1</extrude>\n");
+    KmlPrintf(&ks,"	<tessellate>1</tessellate>\n");
+    KmlPrintf(&ks,"	<altitudeMode>relativeToGround</altitudeMode>\n");
+    KmlPrintf(&ks,"	<coordinates>\n");
 
-        /* Display the average terrain between 2 and 10 miles
-           from the transmitter site at azimuths of 0, 45, 90,
-           135, 180, 225, 270, and 315 degrees. */
+    for (x=0; x<path->length; x++)
+        KmlPrintf(&ks,"	  %f,%f,5\n",(path->lon[x]<180.0?-path->lon[x]:360.0-path->lon[x]),path->lat[x]);
+
+    KmlPrintf(&ks,"	</coordinates>\n");
+    KmlPrintf(&ks,"   </LineString>\n");
+    KmlPrintf(&ks,"</Placemark>\n");
+
+    KmlPrintf(&ks,"<Placemark>\n");
+    KmlPrintf(&ks,"<name>Line-of-Sight Path</name>\n");
+    KmlPrintf(&ks,"  <visibility>1</visibility>\n");
+    KmlPrintf(&ks,"  <open>0</open>\n");
+    KmlPrintf(&ks,"  <Style>\n");
+    KmlPrintf(&ks,"	<LineStyle>\n");
+    KmlPrintf(&ks,"	  <color>ff00ff00</color>\n");
+    KmlPrintf(&ks,"	</LineStyle>\n");
+    KmlPrintf(&ks,"	<PolyStyle>\n");
+    KmlPrintf(&ks,"	   <color>7f00ff00</color>\n");
+    KmlPrintf(&ks,"	</PolyStyle>\n");
+    KmlPrintf(&ks,"  </Style>\n");
+    KmlPrintf(&ks,"  <LineString>\n");
+    KmlPrintf(&ks,"	<extrude>1</extrude>\n");
+    KmlPrintf(&ks,"	<tessellate>1</tessellate>\n");
+    KmlPrintf(&ks,"	<altitudeMode>relativeToGround</altitudeMode>\n");
+    KmlPrintf(&ks,"	<coordinates>\n");
 
-        for (azi=0; azi<=315; azi+=45)
-        {
-            fprintf(fd,"Average terrain at %3d degrees azimuth: ",azi);
-            terrain=AverageTerrain(xmtr,(double)azi,2.0,10.0);
+    /* Walk across the "path", indentifying obstructions along the way */
 
-            if (terrain>-4999.0)
-            {
-                if (metric)
-                    fprintf(fd,"%.2f meters AMSL\n",METERS_PER_FOOT*terrain);
-                else
-                    fprintf(fd,"%.2f feet AMSL\n",terrain);
-            }
+    for (y=0; y<path->length; y++)
+    {
+        distance=5280.0*path->distance[y];
 
-            else
-                fprintf(fd,"No terrain\n");
-        }
-    }
+        if (source.amsl_flag)
+            tx_alt=earthradius+source.alt;
+        else
+            tx_alt=earthradius+source.alt+path->elevation[0];
 
-    fprintf(fd,"\n%s\n\n",dashes);
-    fclose(fd);
-    fprintf(stdout,"\nSite analysis report written to: \"%s\"\n",report_name);
-}
+        /***
+          if (destination.amsl_flag)
+          rx_alt=earthradius+destination.alt;
+          else
+         ***/
+        rx_alt=earthradius+destination.alt+path->elevation[y];
 
-/* Loads the SDF files required to cover the limits of the region
- * specified.
- */ 
-void LoadTopoData(int max_lon, int min_lon, int max_lat, int min_lat)
-{
-    int x, y, width, ymin, ymax;
+        /* Calculate the cosine of the elevation of the
+           transmitter as seen at the temp rx point. */
 
-    width=ReduceAngle(max_lon-min_lon);
+        cos_xmtr_angle=((rx_alt*rx_alt)+(distance*distance)-(tx_alt*tx_alt))/(2.0*rx_alt*distance);
 
-    if ((max_lon-min_lon)<=180.0)
-    {
-        for (y=0; y<=width; y++)
-            for (x=min_lat; x<=max_lat; x++)
-            {
-                ymin=(int)(min_lon+(double)y);
+        for (x=y, block=0; x>=0 && block==0; x--)
+        {
+            distance=5280.0*(path->distance[y]-path->distance[x]);
+            test_alt=earthradius+path->elevation[x];
 
-                while (ymin<0)
-                    ymin+=360;
+            cos_test_angle=((rx_alt*rx_alt)+(distance*distance)-(test_alt*test_alt))/(2.0*rx_alt*distance);
 
-                while (ymin>=360)
-                    ymin-=360;
+            /* Compare these two angles to determine if
+               an obstruction exists.  Since we're comparing
+               the cosines of these angles rather than
+               the angles themselves, the following "if"
+               statement is reversed from what it would
+               be if the actual angles were compared. */
 
-                ymax=ymin+1;
+            if (cos_xmtr_angle>=cos_test_angle)
+                block=1;
+        }
 
-                while (ymax<0)
-                    ymax+=360;
+        if (block)
+            KmlPrintf(&ks,"	  %f,%f,-30\n",(path->lon[y]<180.0?-path->lon[y]:360.0-path->lon[y]),path->lat[y]);
+        else
+            KmlPrintf(&ks,"	  %f,%f,5\n",(path->lon[y]<180.0?-path->lon[y]:360.0-path->lon[y]),path->lat[y]);
+    }
 
-                while (ymax>=360)
-                    ymax-=360;
+    KmlPrintf(&ks,"	</coordinates>\n");
+    KmlPrintf(&ks,"  </LineString>\n");
+    KmlPrintf(&ks,"</Placemark>\n");
 
-                LoadSDF(x, x+1, ymin, ymax, (ippd==3600));
-            }
-    }
+    KmlPrintf(&ks,"	<LookAt>\n");
+    KmlPrintf(&ks,"	  <longitude>%f</longitude>\n",(source.lon<180.0?-source.lon:360.0-source.lon));
+    KmlPrintf(&ks,"	  <latitude>%f</latitude>\n",source.lat);
+    KmlPrintf(&ks,"	  <range>300.0</range>\n");
+    KmlPrintf(&ks,"	  <tilt>45.0</tilt>\n");
+    KmlPrintf(&ks,"	  <heading>%f</heading>\n",azimuth);
+    KmlPrintf(&ks,"	</LookAt>\n");
 
-    else
-    {
-        for (y=0; y<=width; y++)
-            for (x=min_lat; x<=max_lat; x++)
-            {
-                ymin=max_lon+y;
+    KmlPrintf(&ks,"</Folder>\n");
+    KmlPrintf(&ks,"</kml>\n");
 
-                while (ymin<0)
-                    ymin+=360;
+    KmlClose(&ks);
 
-                while (ymin>=360)
-                    ymin-=360;
+#if DO_KMZ
+    if (zip) {
+        zip_close(zip);
+        fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
+    } else
+        fprintf(stdout, "\nCouldn't create KMZ file. KML file written to: \"%s\"\n", kmlfile);
+#else
+    fprintf(stdout, "\nKML file written to: \"%s\"", kmlfile);
+#endif
 
-                ymax=ymin+1;
+    fflush(stdout);
+}
 
-                while (ymax<0)
-                    ymax+=360;
+/* The benchmark (-bench, or 'make bench') runs a fixed set of scenarios
+ * and prints one machine-readable "bench: name=value" line per stage, so
+ * performance changes can be measured instead of stopwatch-timed the way
+ * the numbers in performance.txt were.
+ *
+ * Terrain comes from a synthetic tile (deterministic rolling hills over
+ * the uninhabited ocean region 0_1_152_153, so we can't collide with a
+ * real tile in the working directory); the L-R parameters, antenna
+ * pattern and color definitions come from the wnju-dt sample site in the
+ * given data directory.
+ */
 
-                while (ymax>=360)
-                    ymax-=360;
+#define BENCH_MINLAT  0
+#define BENCH_MAXLAT  1
+#define BENCH_MINLON  152
+#define BENCH_MAXLON  153
 
-                LoadSDF(x, x+1, ymin, ymax, (ippd==3600));
-            }
-    }
+/* Synthetic elevation (in meters) for grid position (x,y): rolling hills
+ * with enough ridge structure that obstruction scans do real work.
+ */
+static int BenchTerrain(int x, int y)
+{
+    return (int)(300.0+250.0*sin((double)x*0.0021)*cos((double)y*0.0017)
+                 +40.0*sin((double)(x+y)*0.013));
 }
 
-/* Reads a SPLAT! alphanumeric output file (-ani option) for analysis
- * and/or map generation.
- */
-int LoadANO(char *filename)
+static int BenchWriteTileSDF(const char *name)
 {
-    int	error=0, max_west, min_west, max_north, min_north;
-    char	buf[MAX_LINE_LEN], *pointer=NULL;
-    double	latitude=0.0, longitude=0.0, azimuth=0.0, elevation=0.0,
-            ano=0.0;
-    FILE	*fd;
+    int x, y;
+    FILE *fp;
 
-    fd=fopen(filename,"r");
+    if ((fp=fopen(name,"wb")) == NULL)
+        return -1;
 
-    if (fd!=NULL)
-    {
-        fgets(buf,MAX_LINE_LEN,fd);
-        pointer=strchr(buf,';');
+    fprintf(fp,"%d\n%d\n%d\n%d\n", BENCH_MAXLON, BENCH_MINLAT, BENCH_MINLON, BENCH_MAXLAT);
 
-        if (pointer!=NULL)
-            *pointer=0;
+    for (x=0; x<ippd; x++)
+        for (y=0; y<ippd; y++)
+            fprintf(fp,"%d\n",BenchTerrain(x,y));
 
-        sscanf(buf,"%d, %d",&max_west, &min_west);
+    fclose(fp);
+    return 0;
+}
 
-        fgets(buf,MAX_LINE_LEN,fd);
-        pointer=strchr(buf,';');
+static int BenchWriteTileBSDF(const char *name)
+{
+    int x, y;
+    BSDFHeader hdr;
+    short *row;
+    FILE *fp;
 
-        if (pointer!=NULL)
-            *pointer=0;
+    if ((fp=fopen(name,"wb")) == NULL)
+        return -1;
 
-        sscanf(buf,"%d, %d",&max_north, &min_north);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic=BSDF_MAGIC;
+    hdr.version=BSDF_VERSION;
+    hdr.max_west=BENCH_MAXLON;
+    hdr.min_north=BENCH_MINLAT;
+    hdr.min_west=BENCH_MINLON;
+    hdr.max_north=BENCH_MAXLAT;
+    hdr.ippd=ippd;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
 
-        fgets(buf,MAX_LINE_LEN,fd);
-        pointer=strchr(buf,';');
+    row=(short*)malloc(ippd*sizeof(short));
 
-        if (pointer!=NULL)
-            *pointer=0;
+    for (x=0; x<ippd; x++) {
+        for (y=0; y<ippd; y++)
+            row[y]=(short)BenchTerrain(x,y);
+        fwrite(row, sizeof(short), ippd, fp);
+    }
 
-        LoadTopoData(max_west-1, min_west, max_north-1, min_north);
+    free(row);
+    fclose(fp);
+    return 0;
+}
 
-        fprintf(stdout,"\nReading \"%s\"... ",filename);
-        fflush(stdout);
+int RunBenchmark(const char *datadir)
+{
+    const char *sdfname="0_1_152_153.sdf";
+    const char *bsdfname="0_1_152_153.bsdf";
+    const char *hdname="0_1_152_153-hd.bsdf";
+    const char *tilefiles[3]={ sdfname, bsdfname, hdname };
+    char qthfile[MAX_PATH_LEN];
+    char noano[2]="";
+    Site tx, edge;
+    double t, dt, loss;
+    long paths, samples, calls;
+    char strmode[100];
+    int i, y, errnum, np=600;
 
-        fgets(buf,MAX_LINE_LEN,fd);
-        sscanf(buf,"%lf, %lf, %lf, %lf, %lf",&latitude, &longitude, &azimuth, &elevation, &ano);
+    fprintf(stdout,"\n\t\t--==[ %s v%s benchmark ]==--\n\n", SPLAT_NAME, SPLAT_VERSION);
 
-        while (feof(fd)==0)
-        {
-            if (LR.erp==0.0)
-            {
-                /* Path loss */
+    /* The tiles are synthesized in the working directory; refuse to
+       clobber anything that's already there. */
 
-                if (contour_threshold==0 || (fabs(ano)<=(double)contour_threshold))
-                {
-                    ano=fabs(ano);
+    for (i=0; i<3; i++) {
+        FILE *fp;
+        if ((fp=fopen(tilefiles[i],"rb")) != NULL) {
+            fclose(fp);
+            fprintf(stderr,"*** ERROR: \"%s\" already exists; not overwriting it.\n",tilefiles[i]);
+            return 1;
+        }
+    }
 
-                    if (ano>255.0)
-                        ano=255.0;
+    snprintf(qthfile, MAX_PATH_LEN, "%s%cwnju-dt.qth", datadir, PATHSEP);
+    tx=LoadQTH(qthfile);
 
-                    PutSignal(latitude,longitude,((unsigned char)round(ano)));
-                }
-            }
+    if (tx.lat>90.0) {
+        fprintf(stderr,"*** ERROR: Couldn't read \"%s\".\n",qthfile);
+        return 1;
+    }
 
-            if (LR.erp!=0.0 && dbm)
-            {
-                /* signal power level in dBm */
+    /* Park the transmitter in the middle of the synthetic tile. The L-R
+       parameters, antenna pattern and color definitions still come from
+       the sample site's files via tx.filename. */
 
-                if (contour_threshold==0 || (ano>=(double)contour_threshold))
-                {
-                    ano=200.0+rint(ano);
+    tx.lat=BENCH_MINLAT+0.5;
+    tx.lon=BENCH_MINLON+0.5;
+    tx.alt=100.0;
+    tx.amsl_flag=0;
 
-                    if (ano<0.0)
-                        ano=0.0;
+    appmode=APPMODE_NORMAL;
+    ippd=AppArraySize(appmode);
+    ppd=(double)ippd;
+    dpp=1.0/ppd;
+    mpi=ippd-1;
 
-                    if (ano>255.0)
-                        ano=255.0;
+    if (InitDEMs() < 0) {
+        fprintf(stderr,"Couldn't allocate Digital Elevation Model array!\n");
+        return 1;
+    }
 
-                    PutSignal(latitude,longitude,((unsigned char)round(ano)));
-                }
-            }
+    sdf_path[0]=0;      /* the synthetic tiles live in the working directory */
+    max_range=10.0;
 
-            if (LR.erp!=0.0 && !dbm)
-            {
-                /* field strength dBuV/m */
+    /* Stage 1: tile loading, ASCII and binary */
 
-                if (contour_threshold==0 || (ano>=(double)contour_threshold))
-                {
-                    ano=100.0+rint(ano);
+    BenchWriteTileSDF(sdfname);
+    t=StatsSeconds();
+    LoadSDF(BENCH_MINLAT, BENCH_MAXLAT, BENCH_MINLON, BENCH_MAXLON, false);
+    dt=StatsSeconds()-t;
+    fprintf(stdout,"bench: tile_load_sdf_ms=%.1f\n",dt*1000.0);
 
-                    if (ano<0.0)
-                        ano=0.0;
+    BenchWriteTileBSDF(bsdfname);
+    FreeDEMs();
+    InitDEMs();
+    t=StatsSeconds();
+    LoadSDF(BENCH_MINLAT, BENCH_MAXLAT, BENCH_MINLON, BENCH_MAXLON, false);
+    dt=StatsSeconds()-t;
+    fprintf(stdout,"bench: tile_load_bsdf_ms=%.1f\n",dt*1000.0);
 
-                    if (ano>255.0)
-                        ano=255.0;
+    /* Stage 2: ReadPath() sampling throughput, 360 radials at a time */
 
-                    PutSignal(latitude,longitude,((unsigned char)round(ano)));
-                }
-            }
+    edge=tx;
+    edge.alt=30.0;
+    paths=0;
+    samples=0;
+    t=StatsSeconds();
 
-            fgets(buf,MAX_LINE_LEN,fd);
-            sscanf(buf,"%lf, %lf, %lf, %lf, %lf",&latitude, &longitude, &azimuth, &elevation, &ano);
+    do {
+        Path *path=GetThreadPath();
+
+        for (i=0; i<360; i++) {
+            edge.lat=tx.lat+0.45*cos((double)i*DEG2RAD);
+            edge.lon=tx.lon+0.45*sin((double)i*DEG2RAD);
+            ReadPath(tx,edge,path);
+            samples+=path->length;
+            paths++;
         }
 
-        fclose(fd);
+        dt=StatsSeconds()-t;
+    } while (dt<0.5);
 
-        fprintf(stdout," Done!\n");
-        fflush(stdout);
+    fprintf(stdout,"bench: readpath_paths_per_sec=%.0f\n",(double)paths/dt);
+    fprintf(stdout,"bench: readpath_samples_per_sec=%.0f\n",(double)samples/dt);
+
+    /* Stage 3: propagation model calls/sec over a synthetic profile,
+       grown a point at a time the way PlotLRPath() grows it */
+
+    if (LoadLRP(tx,1)==0) {
+        fprintf(stderr,"*** ERROR: Couldn't read the sample .lrp file.\n");
+        FreeDEMs();
+        for (i=0; i<3; i++)
+            unlink(tilefiles[i]);
+        return 1;
     }
 
-    else
-        error=1;
+    {
+        elev_t *elev=GetThreadElev(np+10);
 
-    return error;
-}
+        elev[1]=(elev_t)15.0;   /* meters between samples */
 
-/* Writes a KML file plotting the path between source and destination.
- */
-void WriteKML(Site source, Site destination)
-{
-    int	x, y;
-    char	block;
-    char report_name[MAX_PATH_LEN-4], kmlfile[MAX_PATH_LEN];
-#if DO_KMZ
-    char kmzfile[MAX_PATH_LEN];
-#endif
-    double	distance, rx_alt, tx_alt, cos_xmtr_angle,
-            azimuth, cos_test_angle, test_alt;
-    FILE	*fd=NULL;
+        for (i=0; i<np; i++)
+            elev[i+2]=(elev_t)BenchTerrain(i,0);
+
+        for (int model=0; model<2; model++) {
+            p2p_sweep_state sweep;
+            double losssum=0.0;
+
+            point_to_point_sweep_init(&sweep,tx.alt*METERS_PER_FOOT,
+                                      30.0*METERS_PER_FOOT, LR.eps_dielect,
+                                      LR.sgm_conductivity, LR.eno_ns_surfref, LR.frq_mhz,
+                                      LR.radio_climate, LR.pol, LR.conf, LR.rel);
 
-    Path *path = AllocatePath();
-    if (!path) {
-        fprintf(stderr,"\n*** ERROR: Couldn't allocate memory for Path");
-        return;
-    }
-    ReadPath(source,destination,path);
+            calls=0;
+            t=StatsSeconds();
 
-    snprintf(report_name,MAX_PATH_LEN-4,"%s-to-%s",source.name,destination.name);
+            do {
+                losssum=0.0;
 
-    for (x=0; report_name[x]!=0; x++)
-        if (report_name[x]==32 || report_name[x]==17 || report_name[x]==92 || report_name[x]==42 || report_name[x]==47)
-            report_name[x]='_';
+                for (y=2; y<np; y++) {
+                    elev[0]=(elev_t)(y-1);
 
-    snprintf(kmlfile, MAX_PATH_LEN, "%s.kml", report_name);
-    fd=fopen(report_name,"w");
+                    if (model==0)
+                        point_to_point_ITM_sweep(&sweep,elev,&loss,strmode,&errnum);
+                    else
+                        point_to_point_sweep(&sweep,elev,&loss,strmode,&errnum);
 
-    fprintf(fd,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-    fprintf(fd,"<kml xmlns=\"http://earth.google.com/kml/2.0\">\n");
-    fprintf(fd,"<!-- Generated by %s Version %s -->\n",SPLAT_NAME, SPLAT_VERSION);
-    fprintf(fd,"<Folder>\n");
-    fprintf(fd,"<name>SPLAT! Path</name>\n");
-    fprintf(fd,"<open>1</open>\n");
-    fprintf(fd,"<description>Path Between %s and %s</description>\n",source.name,destination.name);
+                    losssum+=loss;
+                    calls++;
+                }
 
-    fprintf(fd,"<Placemark>\n");
-    fprintf(fd,"	<name>%s</name>\n",source.name);
-    fprintf(fd,"	<description>\n");
-    fprintf(fd,"	   Transmit Site\n");
+                dt=StatsSeconds()-t;
+            } while (dt<0.5);
 
-    if (source.lat>=0.0)
-        fprintf(fd,"	   <BR>%s North</BR>\n",dec2dms(source.lat));
-    else
-        fprintf(fd,"	   <BR>%s South</BR>\n",dec2dms(source.lat));
+            point_to_point_sweep_done(&sweep);
 
-    fprintf(fd,"	   <BR>%s West</BR>\n",dec2dms(source.lon));
+            fprintf(stdout,"bench: p2p_%s_calls_per_sec=%.0f\n",
+                    (model==0?"itm":"itwom"),(double)calls/dt);
 
-    azimuth=Azimuth(source,destination);
-    distance=Distance(source,destination);
+            /* Mean dB over the profile set: identical inputs on every
+               pass, so a float build (the default) and an ITM_DOUBLE=1
+               build can be validated against each other by diffing
+               this line between the two. */
 
-    if (metric)
-        fprintf(fd,"	   <BR>%.2f km",distance*KM_PER_MILE);
-    else
-        fprintf(fd,"	   <BR>%.2f miles",distance);
-
-    fprintf(fd," to %s</BR>\n	   <BR>toward an azimuth of %.2f%c</BR>\n",destination.name,azimuth,176);
-
-    fprintf(fd,"	</description>\n");
-    fprintf(fd,"	<visibility>1</visibility>\n");
-    fprintf(fd,"	<Style>\n");
-    fprintf(fd,"	  <IconStyle>\n");
-    fprintf(fd,"		<Icon>\n");
-    fprintf(fd,"		  <href>root://icons/palette-5.png</href>\n");
-    fprintf(fd,"		  <x>224</x>\n");
-    fprintf(fd,"		  <y>224</y>\n");
-    fprintf(fd,"		  <w>32</w>\n");
-    fprintf(fd,"		  <h>32</h>\n");
-    fprintf(fd,"		</Icon>\n");
-    fprintf(fd,"	  </IconStyle>\n");
-    fprintf(fd,"	</Style>\n");
-    fprintf(fd,"	<Point>\n");
-    fprintf(fd,"	  <extrude>1</extrude>\n");
-    fprintf(fd,"	  <altitudeMode>relativeToGround</altitudeMode>\n");
-    fprintf(fd,"	  <coordinates>%f,%f,30</coordinates>\n",(source.lon<180.0?-source.lon:360.0-source.lon),source.lat);
-    fprintf(fd,"	</Point>\n");
-    fprintf(fd,"</Placemark>\n");
-
-    fprintf(fd,"<Placemark>\n");
-    fprintf(fd,"	<name>%s</name>\n",destination.name);
-    fprintf(fd,"	<description>\n");
-    fprintf(fd,"	   Receive Site\n");
+            fprintf(stdout,"bench: p2p_%s_mean_db=%.4f\n",
+                    (model==0?"itm":"itwom"),losssum/(double)(np-2));
+        }
+    }
 
-    if (destination.lat>=0.0)
-        fprintf(fd,"	   <BR>%s North</BR>\n",dec2dms(destination.lat));
-    else
-        fprintf(fd,"	   <BR>%s South</BR>\n",dec2dms(destination.lat));
+    /* Stage 4: a full coverage sweep at normal resolution... */
+
+    {
+        WorkQueue wq;
+
+        t=StatsSeconds();
+        PlotLRMap(tx,30.0,noano,wq,true);
+        dt=StatsSeconds()-t;
+        fprintf(stdout,"bench: lr_map_ms=%.1f\n",dt*1000.0);
+    }
 
-    fprintf(fd,"	   <BR>%s West</BR>\n",dec2dms(destination.lon));
+    /* ...with the image encoded from it... */
 
-    if (metric)
-        fprintf(fd,"	   <BR>%.2f km",distance*KM_PER_MILE);
+    t=StatsSeconds();
+    if (LR.erp==0.0)
+        WriteImageLR((char*)"bench-map",IMAGETYPE_PNG,false,false,false,&tx,1,true);
     else
-        fprintf(fd,"	   <BR>%.2f miles",distance);
-
-    fprintf(fd," to %s</BR>\n	   <BR>toward an azimuth of %.2f%c</BR>\n",source.name,Azimuth(destination,source),176);
-
-    fprintf(fd,"	</description>\n");
-    fprintf(fd,"	<visibility>1</visibility>\n");
-    fprintf(fd,"	<Style>\n");
-    fprintf(fd,"	  <IconStyle>\n");
-    fprintf(fd,"		<Icon>\n");
-    fprintf(fd,"		  <href>root://icons/palette-5.png</href>\n");
-    fprintf(fd,"		  <x>224</x>\n");
-    fprintf(fd,"		  <y>224</y>\n");
-    fprintf(fd,"		  <w>32</w>\n");
-    fprintf(fd,"		  <h>32</h>\n");
-    fprintf(fd,"		</Icon>\n");
-    fprintf(fd,"	  </IconStyle>\n");
-    fprintf(fd,"	</Style>\n");
-    fprintf(fd,"	<Point>\n");
-    fprintf(fd,"	  <extrude>1</extrude>\n");
-    fprintf(fd,"	  <altitudeMode>relativeToGround</altitudeMode>\n");
-    fprintf(fd,"	  <coordinates>%f,%f,30</coordinates>\n",(destination.lon<180.0?-destination.lon:360.0-destination.lon),destination.lat);
-    fprintf(fd,"	</Point>\n");
-    fprintf(fd,"</Placemark>\n");
-
-    fprintf(fd,"<Placemark>\n");
-    fprintf(fd,"<name>Point-to-Point Path</name>\n");
-    fprintf(fd,"  <visibility>1</visibility>\n");
-    fprintf(fd,"  <open>0</open>\n");
-    fprintf(fd,"  <Style>\n");
-    fprintf(fd,"	<LineStyle>\n");
-    fprintf(fd,"	  <color>7fffffff</color>\n");
-    fprintf(fd,"	</LineStyle>\n");
-    fprintf(fd,"	<PolyStyle>\n");
-    fprintf(fd,"	   <color>7fffffff</color>\n");
-    fprintf(fd,"	</PolyStyle>\n");
-    fprintf(fd,"  </Style>\n");
-    fprintf(fd,"  <LineString>\n");
-    fprintf(fd,"	<extrude>1</extrude>\n");
-    fprintf(fd,"	<tessellate>1</tessellate>\n");
-    fprintf(fd,"	<altitudeMode>relativeToGround</altitudeMode>\n");
-    fprintf(fd,"	<coordinates>\n");
+        WriteImageSS((char*)"bench-map",IMAGETYPE_PNG,false,false,false,&tx,1,true);
+    dt=StatsSeconds()-t;
+    fprintf(stdout,"bench: image_encode_ms=%.1f\n",dt*1000.0);
+    unlink("bench-map.png");
 
-    for (x=0; x<path->length; x++)
-        fprintf(fd,"	  %f,%f,5\n",(path->lon[x]<180.0?-path->lon[x]:360.0-path->lon[x]),path->lat[x]);
-
-    fprintf(fd,"	</coordinates>\n");
-    fprintf(fd,"   </LineString>\n");
-    fprintf(fd,"</Placemark>\n");
-
-    fprintf(fd,"<Placemark>\n");
-    fprintf(fd,"<name>Line-of-Sight Path</name>\n");
-    fprintf(fd,"  <visibility>1</visibility>\n");
-    fprintf(fd,"  <open>0</open>\n");
-    fprintf(fd,"  <Style>\n");
-    fprintf(fd,"	<LineStyle>\n");
-    fprintf(fd,"	  <color>ff00ff00</color>\n");
-    fprintf(fd,"	</LineStyle>\n");
-    fprintf(fd,"	<PolyStyle>\n");
-    fprintf(fd,"	   <color>7f00ff00</color>\n");
-    fprintf(fd,"	</PolyStyle>\n");
-    fprintf(fd,"  </Style>\n");
-    fprintf(fd,"  <LineString>\n");
-    fprintf(fd,"	<extrude>1</extrude>\n");
-    fprintf(fd,"	<tessellate>1</tessellate>\n");
-    fprintf(fd,"	<altitudeMode>relativeToGround</altitudeMode>\n");
-    fprintf(fd,"	<coordinates>\n");
+    /* ...and again at HD resolution */
 
-    /* Walk across the "path", indentifying obstructions along the way */
+    FreeDEMs();
+    appmode=APPMODE_HD;
+    ippd=AppArraySize(appmode);
+    ppd=(double)ippd;
+    dpp=1.0/ppd;
+    mpi=ippd-1;
+    InitDEMs();
+
+    BenchWriteTileBSDF(hdname);
+    LoadSDF(BENCH_MINLAT, BENCH_MAXLAT, BENCH_MINLON, BENCH_MAXLON, true);
 
-    for (y=0; y<path->length; y++)
     {
-        distance=5280.0*path->distance[y];
+        WorkQueue wq;
 
-        if (source.amsl_flag)
-            tx_alt=earthradius+source.alt;
-        else
-            tx_alt=earthradius+source.alt+path->elevation[0];
+        t=StatsSeconds();
+        PlotLRMap(tx,30.0,noano,wq,true);
+        dt=StatsSeconds()-t;
+        fprintf(stdout,"bench: lr_map_hd_ms=%.1f\n",dt*1000.0);
+    }
 
-        /***
-          if (destination.amsl_flag)
-          rx_alt=earthradius+destination.alt;
-          else
-         ***/
-        rx_alt=earthradius+destination.alt+path->elevation[y];
+    FreeDEMs();
 
-        /* Calculate the cosine of the elevation of the
-           transmitter as seen at the temp rx point. */
+    for (i=0; i<3; i++)
+        unlink(tilefiles[i]);
 
-        cos_xmtr_angle=((rx_alt*rx_alt)+(distance*distance)-(tx_alt*tx_alt))/(2.0*rx_alt*distance);
+    fflush(stdout);
+    return 0;
+}
 
-        for (x=y, block=0; x>=0 && block==0; x--)
-        {
-            distance=5280.0*(path->distance[y]-path->distance[x]);
-            test_alt=earthradius+path->elevation[x];
+/*****************************
+ * Daemon mode (-daemon). Every normal invocation pays the same fixed
+ * startup cost -- color files, antenna pattern, LRP parameters and all
+ * the SDF tiles -- before any analysis starts; for scripted parameter
+ * sweeps over the same terrain that cost dwarfs the compute. In daemon
+ * mode one long-lived process runs successive jobs read from a control
+ * pipe against the warm state: LoadSDF() skips pages that are already
+ * in memory, so everything after the first job starts with the terrain
+ * loaded.
+ *****************************/
 
-            cos_test_angle=((rx_alt*rx_alt)+(distance*distance)-(test_alt*test_alt))/(2.0*rx_alt*distance);
+static bool daemonMode=false;
 
-            /* Compare these two angles to determine if
-               an obstruction exists.  Since we're comparing
-               the cosines of these angles rather than
-               the angles themselves, the following "if"
-               statement is reversed from what it would
-               be if the actual angles were compared. */
+static int RunJob(int argc, char *argv[]);
 
-            if (cos_xmtr_angle>=cos_test_angle)
-                block=1;
+/* Restores the boot defaults of the per-job globals whose initializers
+ * live at their definitions rather than in RunJob()'s preamble, and
+ * wipes the coverage planes. The elevation data stays warm.
+ */
+static void DaemonResetState(AppMode boot_appmode)
+{
+    int i;
+    unsigned long n;
+
+    max_range=0.0;
+    verbose=1;
+    gpsav=false;
+    dbm=false;
+    smooth_contours=false;
+    itwom=false;
+    tiled=false;
+    pnglevel=6;
+    demMemBudget=0;
+    appmode=boot_appmode;
+
+    losMaskValue=1;
+    lrMaskValue=1;
+    shardIndex=0;
+    shardCount=0;
+    radialCount=0;  /* a new job may load different terrain or clutter */
+    FlushReportPaths();
+
+    /* The region is rebuilt from the pages the next job touches */
+
+    min_north=90;
+    max_north=-90;
+    min_west=360;
+    max_west=-1;
+    max_elevation=-32768;
+    min_elevation=32768;
+
+    for (i=0; i<demCount; i++)
+    {
+        /* The budget was zeroed above, so neither CkptEnsureResident()
+           nor the cache itself faults anything any more: bring any page
+           the previous job's -memlimit left spilled back in directly,
+           both for the wipe below and for the job about to run. */
+
+        if (!aDEM[i]->resident)
+        {
+            std::lock_guard<std::mutex> lock(demMutex);
+            DEMCacheFault(aDEM[i]);
         }
 
-        if (block)
-            fprintf(fd,"	  %f,%f,-30\n",(path->lon[y]<180.0?-path->lon[y]:360.0-path->lon[y]),path->lat[y]);
-        else
-            fprintf(fd,"	  %f,%f,5\n",(path->lon[y]<180.0?-path->lon[y]:360.0-path->lon[y]),path->lat[y]);
+        n=aDEM[i]->arysize*aDEM[i]->arysize;
+        memset(aDEM[i]->mask,0,n);
+        memset(aDEM[i]->signal,0,n);
     }
+}
 
-    fprintf(fd,"	</coordinates>\n");
-    fprintf(fd,"  </LineString>\n");
-    fprintf(fd,"</Placemark>\n");
+#ifndef _WIN32
+/* Reads jobs from the named control pipe (or standard input if the
+ * name is "-") and runs each against the warm state. A job is one
+ * line: a complete splat command line without the program name. The
+ * line "quit" shuts the daemon down; closing the pipe does not, so
+ * successive scripts can each open, write and close it.
+ */
+static int DaemonLoop(char *ctrlpath, char *argv0)
+{
+    int jobs=0;
+    bool use_stdin=(strcmp(ctrlpath,"-")==0);
+    char line[MAX_LINE_LEN*4];
+    char *jobv[64];
+    char *tok, *save;
+    FILE *ctrl;
+    AppMode boot_appmode=appmode;
 
-    fprintf(fd,"	<LookAt>\n");
-    fprintf(fd,"	  <longitude>%f</longitude>\n",(source.lon<180.0?-source.lon:360.0-source.lon));
-    fprintf(fd,"	  <latitude>%f</latitude>\n",source.lat);
-    fprintf(fd,"	  <range>300.0</range>\n");
-    fprintf(fd,"	  <tilt>45.0</tilt>\n");
-    fprintf(fd,"	  <heading>%f</heading>\n",azimuth);
-    fprintf(fd,"	</LookAt>\n");
+    daemonMode=true;
 
-    fprintf(fd,"</Folder>\n");
-    fprintf(fd,"</kml>\n");
+    if (!use_stdin)
+    {
+        unlink(ctrlpath);
 
-    fclose(fd);
+        if (mkfifo(ctrlpath,0600)!=0)
+        {
+            fprintf(stderr,"\n*** ERROR: Couldn't create control pipe \"%s\"!\n",ctrlpath);
+            return -1;
+        }
+    }
 
+    fprintf(stdout,"%s daemon ready; reading jobs from %s.\n",
+            SPLAT_NAME, use_stdin?"standard input":ctrlpath);
+    fflush(stdout);
 
-#if DO_KMZ
-    snprintf(kmzfile, MAX_PATH_LEN, "%s.kmz", report_name);
-    bool success = false;
+    for (;;)
+    {
+        ctrl=(use_stdin?stdin:fopen(ctrlpath,"r"));
 
-    struct zip_t *zip = zip_open(kmzfile, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
-    if (zip) {
-        if (zip_entry_open(zip, kmlfile) == 0) {
-            if (zip_entry_fwrite(zip, kmlfile) == 0) {
-                success = true;
+        if (ctrl==NULL)
+            break;
+
+        while (fgets(line,sizeof(line),ctrl)!=NULL)
+        {
+            int jobc=1;
+
+            jobv[0]=argv0;
+
+            for (tok=strtok_r(line," \t\r\n",&save);
+                 tok!=NULL && jobc<63;
+                 tok=strtok_r(NULL," \t\r\n",&save))
+                jobv[jobc++]=tok;
+
+            if (jobc==1)
+                continue;
+
+            if (strcmp(jobv[1],"quit")==0)
+            {
+                if (!use_stdin)
+                {
+                    fclose(ctrl);
+                    unlink(ctrlpath);
+                }
+
+                FreeDEMs();
+                return 0;
             }
-            zip_entry_close(zip);
+
+            if (jobs++)
+                DaemonResetState(boot_appmode);
+
+            RunJob(jobc,jobv);
+            fflush(stdout);
+            fflush(stderr);
         }
-        zip_close(zip);
-    }
 
-    if (success) {
-        unlink(kmlfile);
-        fprintf(stdout, "\nKMZ file written to: \"%s\"\n", kmzfile);
-    } else {
-        unlink(kmzfile);
-        fprintf(stdout, "\nCouldn't create KMZ file. KML file written to: \"%s\"\n", kmlfile);
+        if (use_stdin)
+            break;
+
+        /* The writer closed its end; reopen and wait for the next one */
+
+        fclose(ctrl);
     }
-#else
-    fprintf(stdout, "\nKML file written to: \"%s\"", kmlfile);
-#endif
 
-    fflush(stdout);
+    if (!use_stdin)
+        unlink(ctrlpath);
 
-    DestroyPath(path);
+    FreeDEMs();
+    return 0;
 }
+#endif
 
 int main(int argc, char *argv[])
+{
+#ifndef _WIN32
+    for (int x=1; x<argc-1; x++)
+    {
+        /* A bare "-" (standard input) is a legal control path here */
+
+        if (strcmp(argv[x],"-daemon")==0 && argv[x+1][0] &&
+            (argv[x+1][0]!='-' || argv[x+1][1]==0))
+            return DaemonLoop(argv[x+1],argv[0]);
+    }
+#endif
+
+    return RunJob(argc,argv);
+}
+
+static int RunJob(int argc, char *argv[])
 {
     int     errcount = 0;
     int		min_lat, min_lon, max_lat, max_lon,
@@ -8555,6 +12783,13 @@ int main(int argc, char *argv[])
 
     char    *env = NULL;
     char    rxsite = 0;
+    int     sdf2bsdf_arg = 0;
+    int     bench = 0;
+    char    bench_datadir[MAX_PATH_LEN] = "sample_data";
+    bool    showstats = false;
+    char    ckpt_filename[MAX_PATH_LEN] = "";
+    char    merge_file[30][MAX_PATH_LEN];
+    unsigned int mergegrids = 0;
 
     double		altitude=0.0, altitudeLR=0.0, tx_range=0.0,
                 rx_range=0.0, deg_range=0.0, deg_limit=0.0,
@@ -8613,8 +12848,10 @@ int main(int argc, char *argv[])
 #endif
         fprintf(stdout,"     -ngs display greyscale topography as white in .ppm files\n"); 
         fprintf(stdout,"     -erp override ERP in .lrp file (Watts)\n");
-        fprintf(stdout,"     -ano name of alphanumeric output file\n");
+        fprintf(stdout,"     -ano name of alphanumeric output file (.bano suffix for binary)\n");
         fprintf(stdout,"     -ani name of alphanumeric input file\n");
+        fprintf(stdout,"-sdf2bsdf convert the named .sdf/.sdf.bz2/.sdf.zst tiles to binary .bsdf tiles\n");
+        fprintf(stdout,"   -bench run the canned benchmark scenarios (see 'make bench')\n");
 #ifndef _WIN32
         fprintf(stdout,"     -udt name of user defined terrain input file\n");
 #endif
@@ -8624,6 +12861,24 @@ int main(int argc, char *argv[])
         fprintf(stdout,"     -log copy command line string to this output file\n");
         fprintf(stdout,"   -gpsav preserve gnuplot temporary working files after SPLAT! execution\n");
         fprintf(stdout,"   -itwom invoke the ITWOM model instead of using Longley-Rice\n");
+        fprintf(stdout,"   -tiled use the tiled coverage engine (faster, slightly approximate)\n");
+        fprintf(stdout,"   -stats print a run statistics report on exit\n");
+        fprintf(stdout,"   -pnglevel zlib compression effort for PNG output (0-9, default 6)\n");
+        fprintf(stdout,"   -memlimit megabytes of DEM pages kept resident; excess pages are\n");
+        fprintf(stdout,"             evicted LRU to temp files and faulted back on demand\n");
+        fprintf(stdout,"   -ckpt filename of a coverage checkpoint for -L runs: written after\n");
+        fprintf(stdout,"         each transmitter, resumed from (and moved transmitters\n");
+        fprintf(stdout,"         recomputed) when the file already exists\n");
+        fprintf(stdout,"  -shard i/n compute only the i-th of n slices of a -L region (run with\n");
+        fprintf(stdout,"         identical options on n hosts); the slice's result is saved\n");
+        fprintf(stdout,"         in the -ckpt grid and no maps are produced\n");
+        fprintf(stdout,"-mergegrids filenames of shard grids to combine in place of computing;\n");
+        fprintf(stdout,"         the maps are then produced once over the union\n");
+#ifndef _WIN32
+        fprintf(stdout,"  -daemon run as a long-lived server keeping loaded terrain warm; reads\n");
+        fprintf(stdout,"          one complete command line per job from the named control pipe\n");
+        fprintf(stdout,"          (\"-\" for standard input) until a \"quit\" line arrives\n");
+#endif
         fprintf(stdout,"  -metric employ metric rather than imperial units for all user I/O\n");
 
         fprintf(stdout,"See the documentation for more details.\n\n");
@@ -8935,6 +13190,88 @@ int main(int argc, char *argv[])
         if (strcmp(argv[x],"-itwom")==0)
             itwom=true;
 
+        if (strcmp(argv[x],"-tiled")==0)
+            tiled=true;
+
+        if (strcmp(argv[x],"-stats")==0)
+            showstats=true;
+
+        if (strcmp(argv[x],"-pnglevel")==0)
+        {
+            z=x+1;
+
+            if (z<argc && argv[z][0] && argv[z][0]!='-')
+            {
+                sscanf(argv[z],"%d",&pnglevel);
+
+                if (pnglevel<0)
+                    pnglevel=0;
+
+                if (pnglevel>9)
+                    pnglevel=9;
+            }
+        }
+
+        if (strcmp(argv[x],"-ckpt")==0)
+        {
+            z=x+1;
+
+            if (z<argc && argv[z][0] && argv[z][0]!='-')
+                strncpy(ckpt_filename,argv[z],MAX_PATH_LEN-1);
+        }
+
+        if (strcmp(argv[x],"-shard")==0)
+        {
+            z=x+1;
+
+            if (z<argc && argv[z][0] && argv[z][0]!='-')
+            {
+                shardIndex=0;
+                shardCount=0;
+                sscanf(argv[z],"%d/%d",&shardIndex,&shardCount);
+
+                if (shardIndex<1 || shardCount<2 || shardIndex>shardCount)
+                {
+                    if (shardCount!=1)	/* "1/1" is just a full run */
+                        fprintf(stdout,"Bad -shard \"%s\" (expected i/n, e.g. 2/8); computing the full region.\n",argv[z]);
+
+                    shardIndex=0;
+                    shardCount=0;
+                }
+            }
+        }
+
+        if (strcmp(argv[x],"-mergegrids")==0)
+        {
+            /* Read shard grid file(s) */
+
+            z=x+1;
+
+            while (z<argc && argv[z][0] && argv[z][0]!='-' && mergegrids<30)
+            {
+                strncpy(merge_file[mergegrids],argv[z],MAX_PATH_LEN-1);
+                mergegrids++;
+                z++;
+            }
+
+            z--;
+        }
+
+        if (strcmp(argv[x],"-memlimit")==0)
+        {
+            z=x+1;
+
+            if (z<argc && argv[z][0] && argv[z][0]!='-')
+            {
+                sscanf(argv[z],"%lld",&demMemBudget);
+
+                if (demMemBudget<0)
+                    demMemBudget=0;
+
+                demMemBudget*=1048576LL;	/* megabytes */
+            }
+        }
+
         if (strcmp(argv[x],"-N")==0)
         {
             nolospath=1;
@@ -9092,8 +13429,40 @@ int main(int argc, char *argv[])
             if (z<argc && argv[z][0] && argv[z][0]!='-')
                 strncpy(ani_filename,argv[z],253);
         }
+
+        if (strcmp(argv[x],"-sdf2bsdf")==0)
+        {
+            /* Convert SDF tiles to the binary format */
+
+            z=x+1;
+
+            if (sdf2bsdf_arg==0)
+                sdf2bsdf_arg=z;
+
+            while (z<argc && argv[z][0] && argv[z][0]!='-')
+                z++;
+
+            z--;
+        }
+
+        if (strcmp(argv[x],"-bench")==0)
+        {
+            /* Run the canned benchmark scenarios */
+
+            bench=1;
+            z=x+1;
+
+            if (z<argc && argv[z][0] && argv[z][0]!='-')
+                strncpy(bench_datadir,argv[z],MAX_PATH_LEN-1);
+        }
     }
 
+    if (sdf2bsdf_arg)
+        return ConvertSDFtoBSDF(argc, argv, sdf2bsdf_arg);
+
+    if (bench)
+        return RunBenchmark(bench_datadir);
+
     sprintf(header,"\n\t\t--==[ Welcome To %s%s v%s ]==--\n\n",
             SPLAT_NAME, (appmode==APPMODE_HD?" HD":""), SPLAT_VERSION);
 
@@ -9134,6 +13503,20 @@ int main(int argc, char *argv[])
     dpp=1.0/ppd;		/* degrees per pixel */
     mpi=ippd-1;		/* maximum pixel index per degree */
 
+    /* A daemon job can toggle -hd, and the warm pages left by the
+       previous job were sampled at the old resolution: reusing a
+       1200-sample page while indexing it with 3600-derived offsets
+       would run far past its planes. Pages at the wrong resolution
+       can't be reused, so drop them and let this job reload from disk
+       (the aDEM check below re-allocates the array). */
+
+    if (demCount>0 && aDEM[0]->arysize!=(unsigned long)ippd)
+    {
+        fprintf(stdout,"Resolution changed; reloading terrain at %d samples per degree.\n",ippd);
+        fflush(stdout);
+
+        FreeDEMs();
+    }
 
     if ((coverage+LRmap+ani_filename[0])==0 && rx_site.lat==91.0 && rx_site.lon==361.0)
     {
@@ -9155,7 +13538,7 @@ int main(int argc, char *argv[])
     /* No major errors were detected.  Whew!  :-) */
 
 
-    if (InitDEMs() < 0) {
+    if (aDEM==NULL && InitDEMs() < 0) {
         fprintf(stderr, "Couldn't allocate Digital Elevation Model array!\n");
         return -1;
     }
@@ -9204,7 +13587,7 @@ int main(int argc, char *argv[])
     if (ani_filename[0])
     {
         LoadLRP(tx_site[0],0); /* Get ERP status */
-        LoadANO(ani_filename);
+        LoadANO(ani_filename, multithread);
 
         for (unsigned int x=0; x<txsites && x<max_txsites; x++)
             PlaceMarker(tx_site[x]);
@@ -9231,16 +13614,18 @@ int main(int argc, char *argv[])
         }
 
         if (LR.erp==0.0)
-            WriteImageLR(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+            WriteImageLR(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
         else
         {
             if (dbm)
-                WriteImageDBM(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+                WriteImageDBM(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
             else
-                WriteImageSS(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+                WriteImageSS(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
         }
 
-        FreeDEMs();
+        if (!daemonMode)
+            FreeDEMs();
+
         return 0;
     }
 
@@ -9288,7 +13673,7 @@ int main(int argc, char *argv[])
 
     /* Load the required SDF files */ 
 
-    LoadTopoData(max_lon, min_lon, max_lat, min_lat);
+    LoadTopoData(max_lon, min_lon, max_lat, min_lat, multithread);
 
     if (area_mode || topomap)
     {
@@ -9377,13 +13762,11 @@ int main(int argc, char *argv[])
 
         /* Load any additional SDF files, if required */ 
 
-        LoadTopoData(max_lon, min_lon, max_lat, min_lat);
+        LoadTopoData(max_lon, min_lon, max_lat, min_lat, multithread);
     }
 
-#ifndef _WIN32
     if (udt_file[0])
         LoadUDT(udt_file);
-#endif
 
     /**** Set terrain elevation to zero for sites providing AMSL antenna heights ****
 
@@ -9527,19 +13910,107 @@ int main(int argc, char *argv[])
 
     if (area_mode && topomap==0)
     {
+        /* A shard run's product is its checkpoint grid: without -ckpt
+           there would be nothing to merge, and the tiled engine walks
+           concentric rings rather than independent boundary rays, so
+           neither combination shards. */
+
+        if (shardCount>1)
+        {
+            if (coverage)
+            {
+                fprintf(stdout,"-shard applies to -L runs only; computing the full region.\n");
+                shardIndex=0;
+                shardCount=0;
+            }
+
+            else if (ckpt_filename[0]==0)
+            {
+                fprintf(stdout,"-shard requires -ckpt to receive the shard's grid; computing the full region.\n");
+                shardIndex=0;
+                shardCount=0;
+            }
+
+            else if (tiled)
+            {
+                fprintf(stdout,"-tiled and -shard are exclusive; using the boundary sweep.\n");
+                tiled=false;
+            }
+        }
+
+        /* One worker pool serves every transmitter: the pool survives
+           from site to site instead of being torn down and respawned per
+           map, and each site's analysis report is pushed onto it so the
+           terrain statistics for site N overlap the coverage sweep of
+           site N+1. (The sweeps themselves stay ordered -- they share
+           the LR parameter set, which LoadLRP() reloads per site.) */
+
+        WorkQueue wq;
+
         for (unsigned int x=0; x<txsites && x<max_txsites; x++)
         {
             if (coverage)
-                PlotLOSMap(tx_site[x],altitude, multithread);
+                PlotLOSMap(tx_site[x],altitude, wq, multithread);
 
             else if (LoadLRP(tx_site[x],1))
-                PlotLRMap(tx_site[x],altitudeLR,ano_filename, multithread);
+            {
+                if (mergegrids>0)
+                {
+                    /* Merge mode: the shard runs already swept their
+                       slices of the perimeter, so fold their grids
+                       together in place of computing anything. The
+                       output stages below then run once over the
+                       union. */
+
+                    if (x==0)
+                    {
+                        if (ano_filename[0])
+                            fprintf(stdout,"Alphanumeric output comes from the shard runs themselves; skipping \"%s\".\n",ano_filename);
+
+                        for (unsigned int m=0; m<mergegrids; m++)
+                            CkptMerge(merge_file[m],tx_site,txsites);
+                    }
+                }
+
+                else
+                {
+                    /* With a checkpoint, completed sites' pixels are
+                       already owned in the mask plane, so their sweeps
+                       skip the propagation model pixel by pixel and
+                       cost only the ReadPath() walks. */
 
-            SiteReport(tx_site[x]);
+                    if (x==0 && ckpt_filename[0])
+                        CkptLoad(ckpt_filename,tx_site,txsites);
+
+                    if (tiled)
+                        PlotLRMapTiled(tx_site[x],altitudeLR,ano_filename, wq, multithread);
+                    else
+                        PlotLRMap(tx_site[x],altitudeLR,ano_filename, wq, multithread);
+
+                    if (ckpt_filename[0])
+                        CkptSave(ckpt_filename,tx_site,txsites,x+1);
+                }
+            }
+
+            if (multithread)
+                wq.submit(std::bind(SiteReport, tx_site[x]));
+            else
+                SiteReport(tx_site[x]);
         }
+
+        wq.waitForCompletion();
+        RecordPoolStats(wq);
+    }
+
+    if (shardCount>1)
+    {
+        /* The merge run makes the maps; this host's contribution is
+           the checkpoint grid CkptSave() just wrote. */
+
+        fprintf(stdout,"\nShard grid written to: \"%s\"\nCombine the shards with -mergegrids to produce the maps.\n",ckpt_filename);
     }
 
-    if (map || topomap)
+    else if (map || topomap)
     {
         /* Label the map */
 
@@ -9573,17 +14044,17 @@ int main(int argc, char *argv[])
         /* Plot the map */
 
         if (coverage || pt2pt_mode || topomap)
-            WriteImage(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+            WriteImage(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
 
         else
         {
             if (LR.erp==0.0)
-                WriteImageLR(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+                WriteImageLR(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
             else
                 if (dbm)
-                    WriteImageDBM(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+                    WriteImageDBM(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
                 else
-                    WriteImageSS(mapfile,imagetype,geo,kml,ngs,tx_site,txsites);
+                    WriteImageSS(mapfile,imagetype,geo,kml,ngs,tx_site,txsites,multithread);
         }
     }
 
@@ -9607,7 +14078,11 @@ int main(int argc, char *argv[])
 
     printf("\n");
 
-    FreeDEMs();
+    if (!daemonMode)
+        FreeDEMs();
+
+    if (showstats)
+        PrintRunStats();
 
     /* That's all, folks! */
 
@@ -10,21 +10,59 @@
  **              Last modification: 12-Jan-2019             **
 \**************************************************************/ 
 
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <bzlib.h>
 
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
 #define BZBUFFER 65536
+#define MAX_TILES 4096
 
 char	sdf_filename[30], sdf_path[255], replacement_flag, opened=0,
 	hgt=0, bil=0;
 char colons=0;
+char write_bz2=0, write_bsdf=0;
 
 int	srtm[3601][3601], usgs[1201][1201], max_north, max_west, n,
 	min_north, min_west, merge=0, min_elevation, bzerror, ippd, mpi;
 
+/* Conversion queue; each entry is one .hgt or .bil tile */
+
+char	*tile_files[MAX_TILES];
+int	tile_count=0;
+
+/* Binary SDF tile header; must match BSDFHeader in splat.cpp. The
+   header is followed by ippd*ippd little-endian int16 samples in the
+   same order the ASCII format uses. */
+
+#define BSDF_MAGIC   0x46445342 /* "BSDF" */
+#define BSDF_VERSION 1
+
+struct bsdf_header
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t max_west;
+	int32_t min_north;
+	int32_t min_west;
+	int32_t max_north;
+	int32_t ippd;
+	int32_t pad;	/* keeps the sample grid 8-byte aligned */
+};
+
 int ReadSRTM(char *filename)
 {
 	int x, y, byte=0;
@@ -547,7 +585,40 @@ int x, y, z;
 		srtm[y][x]=min_elevation;
 }
 
-void WriteSDF(char *filename)
+int last_good_byte=0;
+
+int NextSample(y,x)
+int x, y;
+{
+	/* Returns the output elevation for one grid point, applying the
+	   same void replacement WriteSDF() always performed: merge in
+	   USGS data when available, otherwise average the neighbors. */
+
+	int byte;
+
+	byte=srtm[y][x];
+
+	if (byte>min_elevation)
+		last_good_byte=byte;
+
+	if (byte<min_elevation)
+	{
+		if (merge)
+		{
+			if (ippd==3600)
+				return usgs[1200-(y/3)][1199-(x/3)];
+			else
+				return usgs[1200-y][1199-x];
+		}
+
+		average_terrain(y,x,last_good_byte);
+		return srtm[y][x];
+	}
+
+	return byte;
+}
+
+int WriteSDF(char *filename)
 {
 	/* Like the HGT files, the extreme southwest corner
 	 * provides the point of reference for the SDF file.
@@ -560,7 +631,7 @@ void WriteSDF(char *filename)
 	 * is it present in SDF files.
 	 */
 
-	int x, y, byte, last_good_byte=0;
+	int x, y;
 	FILE *outfile;
 
 	printf("\nWriting %s... ", filename);
@@ -568,44 +639,297 @@ void WriteSDF(char *filename)
 
 	outfile=fopen(filename,"wb");
 
+	if (outfile==NULL)
+	{
+		fprintf(stderr,"\n*** Error: Cannot open \"%s\" for writing!\n",filename);
+		return -1;
+	}
+
+	last_good_byte=0;
+
 	fprintf(outfile, "%d\n%d\n%d\n%d\n", max_west, min_north, min_west, max_north);
 
 	for (y=ippd; y>=1; y--)		/* Omit the northern most edge */
 		for (x=mpi; x>=0; x--) /* Omit the eastern most edge  */
+			fprintf(outfile,"%d\n",NextSample(y,x));
+
+	printf("Done!\n");
+
+	fclose(outfile);
+
+	return 0;
+}
+
+int WriteSDF_BZ(char *filename)
+{
+	/* Same content as WriteSDF(), bzip2-compressed on the fly so no
+	   intermediate uncompressed .sdf ever touches the disk. */
+
+	int x, y, len, bzerr;
+	char line[32];
+	FILE *outfile;
+	BZFILE *bzout;
+
+	printf("\nWriting %s... ", filename);
+	fflush(stdout);
+
+	outfile=fopen(filename,"wb");
+
+	if (outfile==NULL)
+	{
+		fprintf(stderr,"\n*** Error: Cannot open \"%s\" for writing!\n",filename);
+		return -1;
+	}
+
+	bzout=BZ2_bzWriteOpen(&bzerr,outfile,9,0,0);
+
+	if (bzerr!=BZ_OK)
+	{
+		fprintf(stderr,"\n*** Error: Cannot initialize bzip2 stream for \"%s\"!\n",filename);
+		fclose(outfile);
+		return -1;
+	}
+
+	last_good_byte=0;
+
+	len=sprintf(line, "%d\n%d\n%d\n%d\n", max_west, min_north, min_west, max_north);
+	BZ2_bzWrite(&bzerr,bzout,line,len);
+
+	for (y=ippd; (y>=1 && bzerr==BZ_OK); y--)
+		for (x=mpi; x>=0; x--)
+		{
+			len=sprintf(line,"%d\n",NextSample(y,x));
+			BZ2_bzWrite(&bzerr,bzout,line,len);
+		}
+
+	BZ2_bzWriteClose(&bzerr,bzout,0,NULL,NULL);
+
+	if (bzerr!=BZ_OK)
+	{
+		fprintf(stderr,"\n*** Error: Write error on \"%s\"!\n",filename);
+		fclose(outfile);
+		return -1;
+	}
+
+	printf("Done!\n");
+
+	fclose(outfile);
+
+	return 0;
+}
+
+int WriteSDF_BSDF(char *filename)
+{
+	/* Same sample sequence as WriteSDF(), stored as the binary tile
+	   format splat reads directly (and mmaps where it can). */
+
+	int x, y, i;
+	short row[3601];
+	struct bsdf_header header;
+	FILE *outfile;
+
+	printf("\nWriting %s... ", filename);
+	fflush(stdout);
+
+	outfile=fopen(filename,"wb");
+
+	if (outfile==NULL)
+	{
+		fprintf(stderr,"\n*** Error: Cannot open \"%s\" for writing!\n",filename);
+		return -1;
+	}
+
+	memset(&header,0,sizeof(header));
+	header.magic=BSDF_MAGIC;
+	header.version=BSDF_VERSION;
+	header.max_west=max_west;
+	header.min_north=min_north;
+	header.min_west=min_west;
+	header.max_north=max_north;
+	header.ippd=ippd;
+
+	fwrite(&header,sizeof(header),1,outfile);
+
+	last_good_byte=0;
+
+	for (y=ippd; y>=1; y--)
+	{
+		for (x=mpi, i=0; x>=0; x--, i++)
+			row[i]=(short)NextSample(y,x);
+
+		if (fwrite(row,sizeof(short),ippd,outfile)!=(size_t)ippd)
+		{
+			fprintf(stderr,"\n*** Error: Write error on \"%s\"!\n",filename);
+			fclose(outfile);
+			return -1;
+		}
+	}
+
+	printf("Done!\n");
+
+	fclose(outfile);
+
+	return 0;
+}
+
+int ConvertTile(char *filename)
+{
+	/* Converts a single .hgt/.bil tile into the selected output
+	   format.  Resets the per-tile globals first so the batch paths
+	   below can call this repeatedly. */
+
+	int x;
+	char outname[40];
+
+	hgt=0;
+	bil=0;
+	merge=0;
+	replacement_flag=0;
+	opened=0;
+	bzerror=BZ_OK;
+
+	if (ReadSRTM(filename)!=0)
+		return -1;
+
+	if (replacement_flag && sdf_path[0])
+		merge=ReadUSGS();
+
+	if (write_bsdf)
+	{
+		/* Replace the trailing ".sdf" with ".bsdf" */
+
+		x=(int)strlen(sdf_filename);
+		sprintf(outname,"%.*s.bsdf",x-4,sdf_filename);
+		return WriteSDF_BSDF(outname);
+	}
+
+	if (write_bz2)
+	{
+		sprintf(outname,"%s.bz2",sdf_filename);
+		return WriteSDF_BZ(outname);
+	}
+
+	return WriteSDF(sdf_filename);
+}
+
+int AddTile(char *filename)
+{
+	if (tile_count==MAX_TILES)
+	{
+		fprintf(stderr,"*** Error: More than %d input files!\n",MAX_TILES);
+		return -1;
+	}
+
+	tile_files[tile_count]=strdup(filename);
+	tile_count++;
+
+	return 0;
+}
+
+int CompareTileNames(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a,*(char * const *)b);
+}
+
+#ifndef _WIN32
+int AddDirectory(char *dirname)
+{
+	/* Queues every .hgt/.bil tile found in "dirname" (not recursive) */
+
+	int len, found=0;
+	char pathname[512];
+	DIR *dir;
+	struct dirent *entry;
+
+	dir=opendir(dirname);
+
+	if (dir==NULL)
+	{
+		fprintf(stderr,"*** Error: Cannot open directory \"%s\"\n",dirname);
+		return -1;
+	}
+
+	while ((entry=readdir(dir))!=NULL)
+	{
+		len=(int)strlen(entry->d_name);
+
+		if (len>4 && (strcmp(entry->d_name+len-4,".hgt")==0 ||
+		    strcmp(entry->d_name+len-4,".bil")==0))
+		{
+			snprintf(pathname,sizeof(pathname),"%s/%s",dirname,entry->d_name);
+
+			if (AddTile(pathname)!=0)
+			{
+				closedir(dir);
+				return -1;
+			}
+
+			found++;
+		}
+	}
+
+	closedir(dir);
+
+	if (found==0)
+		fprintf(stderr,"*** Warning: No .hgt or .bil files found in \"%s\"\n",dirname);
+
+	return 0;
+}
+
+int RunBatch(int jobs)
+{
+	/* Converts the queued tiles using up to "jobs" concurrent worker
+	   processes.  A process per tile keeps the workers trivially
+	   independent (the tile grids are large globals) and lets the
+	   kernel reclaim each worker's memory as soon as it finishes. */
+
+	int next=0, running=0, failures=0, status;
+	pid_t pid;
+
+	while (next<tile_count || running>0)
+	{
+		while (running<jobs && next<tile_count)
 		{
-			byte=srtm[y][x];
+			pid=fork();
 
-			if (byte>min_elevation)
-				last_good_byte=byte;
+			if (pid==0)
+				_exit(ConvertTile(tile_files[next])==0?0:1);
 
-			if (byte<min_elevation)
+			if (pid<0)
 			{
-				if (merge)
-				{
-					if (ippd==3600)
-						fprintf(outfile,"%d\n",usgs[1200-(y/3)][1199-(x/3)]);
-					else
-						fprintf(outfile,"%d\n",usgs[1200-y][1199-x]);
-				}
+				/* Can't fork; convert in-process instead */
 
-				else
-				{
-					average_terrain(y,x,last_good_byte);
-					fprintf(outfile,"%d\n",srtm[y][x]);
-				}
+				if (ConvertTile(tile_files[next])!=0)
+					failures++;
 			}
+
 			else
-				fprintf(outfile,"%d\n",byte);
+				running++;
+
+			next++;
 		}
 
-	printf("Done!\n");
+		if (running>0)
+		{
+			pid=wait(&status);
 
-	fclose(outfile);
+			if (pid>0)
+			{
+				running--;
+
+				if (!WIFEXITED(status) || WEXITSTATUS(status)!=0)
+					failures++;
+			}
+		}
+	}
+
+	return failures;
 }
+#endif
 
 int main(int argc, char **argv)
 {
-	int x, y, z=0;
+	int x, y, z=0, jobs=0;
 	char *env=NULL;
 
     sdf_path[0] = '\0';
@@ -619,10 +943,15 @@ int main(int argc, char **argv)
 		fprintf(stderr, "\t-d directory path of usgs2sdf derived SDF files\n\t    (overrides path in ~/.splat_path file)\n\n");
 		fprintf(stderr, "\t-hd Invoke in High Definition mode, working on SRTM-1 files\n\t    Without this, it expects the input files to be SRTM-3 files.\n\t    You can also invoke the binary as %s-hd\n\n", argv[0]);
 		fprintf(stderr, "\t-n elevation limit (in meters) below which SRTM data is\n\t    replaced by USGS-derived .sdf data (default = 0 meters)\n\n");
+		fprintf(stderr, "\t-j number of tiles to convert concurrently when multiple\n\t    input files or directories are given (default = CPU count)\n\n");
+		fprintf(stderr, "\t-bz2 write bzip2-compressed SDF (.sdf.bz2) directly\n\n");
+		fprintf(stderr, "\t-bsdf write binary SDF (.bsdf) directly\n\n");
+		fprintf(stderr, "Multiple input files may be given, and a directory may be given\nin place of a file to convert every .hgt/.bil tile it contains.\n\n");
 		fprintf(stderr, "Examples: %s N40W074.hgt\n",argv[0]);
 		fprintf(stderr, "          %s -d /cdrom/sdf N40W074.hgt\n",argv[0]);
 		fprintf(stderr, "          %s -d /dev/null N40W074.hgt  (prevents data replacement)\n",argv[0]);
-		fprintf(stderr, "          %s -n -5 N40W074.hgt\n\n",argv[0]);
+		fprintf(stderr, "          %s -n -5 N40W074.hgt\n",argv[0]);
+		fprintf(stderr, "          %s -bz2 -j 8 /srtm/region/\n\n",argv[0]);
 
 		return 1;
 	}
@@ -641,8 +970,8 @@ int main(int argc, char **argv)
 	{
 		if (strcmp(argv[x],"-c")==0)
 		{
-			z=x;
             colons=1;
+			continue;
 		}
 
 		if (strcmp(argv[x],"-d")==0)
@@ -650,13 +979,18 @@ int main(int argc, char **argv)
 			z=x+1;
 
 			if (z<=y && argv[z][0] && argv[z][0]!='-')
+			{
 				strncpy(sdf_path,argv[z],253);
+				x=z;
+			}
+
+			continue;
 		}
 
 		if (strcmp(argv[x],"-hd")==0)
 		{
-			z=x;
             ippd=3600;	/* High Definition (1 arc-sec) Mode */
+			continue;
 		}
 
 		if (strcmp(argv[x],"-n")==0)
@@ -669,8 +1003,56 @@ int main(int argc, char **argv)
 
 				if (min_elevation<-32767)
 					min_elevation=0;
-			}			 
+
+				x=z;
+			}
+
+			continue;
+		}
+
+		if (strcmp(argv[x],"-j")==0)
+		{
+			z=x+1;
+
+			if (z<=y && argv[z][0])
+			{
+				jobs=atoi(argv[z]);
+				x=z;
+			}
+
+			continue;
 		}
+
+		if (strcmp(argv[x],"-bz2")==0)
+		{
+			write_bz2=1;
+			continue;
+		}
+
+		if (strcmp(argv[x],"-bsdf")==0)
+		{
+			write_bsdf=1;
+			continue;
+		}
+
+		/* Anything else is an input file or a directory of tiles */
+
+#ifndef _WIN32
+		{
+			struct stat sb;
+
+			if (stat(argv[x],&sb)==0 && S_ISDIR(sb.st_mode))
+			{
+				if (AddDirectory(argv[x])!=0)
+					return 1;
+
+				continue;
+			}
+		}
+#endif
+
+		if (AddTile(argv[x])!=0)
+			return 1;
 	}
 
 	mpi=ippd-1;		/* Maximum pixel index per degree */
@@ -721,14 +1103,34 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (ReadSRTM(argv[z+1])==0)
+	if (tile_count==0)
+	{
+		fprintf(stderr,"*** Error: No input files given!\n");
+		return 1;
+	}
+
+	qsort(tile_files,tile_count,sizeof(char *),CompareTileNames);
+
+#ifndef _WIN32
+	if (jobs<1)
 	{
-		if (replacement_flag && sdf_path[0])
-			merge=ReadUSGS();
+		jobs=(int)sysconf(_SC_NPROCESSORS_ONLN);
 
-		WriteSDF(sdf_filename);
+		if (jobs<1)
+			jobs=1;
 	}
 
-	return 0;
+	if (jobs>tile_count)
+		jobs=tile_count;
+
+	if (tile_count>1 && jobs>1)
+		return (RunBatch(jobs)==0?0:1);
+#endif
+
+	for (x=0, y=0; x<tile_count; x++)
+		if (ConvertTile(tile_files[x])!=0)
+			y++;
+
+	return (y==0?0:1);
 }
 
@@ -1,8 +1,21 @@
 // Simple workqueue loosely adapted from stackexchange
 // https://codereview.stackexchange.com/questions/60363/thread-pool-worker-implementation
+//
+// Extended with per-worker queues and a chunked range-submission API. The
+// original single-deque design took the one mutex on every submit() and on
+// every dequeue; with tens of thousands of small jobs (one per boundary pixel
+// in the coverage sweeps) the workers spent a measurable fraction of their
+// time fighting over that lock and the scaling curve flattened out past a few
+// cores. Work is now spread round-robin across one deque per worker, an idle
+// worker steals from the back of its neighbors' queues, and submitRange()
+// enqueues an entire indexed range as a handful of chunks that all share a
+// single function object instead of a heap-allocated closure per index.
 
 #include <functional>
 #include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <deque>
 #include <vector>
 #include <cassert>
@@ -18,16 +31,7 @@ public:
     //
     explicit WorkQueue(int numWorkers = -1)
     {
-        if (numWorkers < 1) {
-            numWorkers = std::thread::hardware_concurrency();
-        }
-        if (numWorkers < 1) {
-            numWorkers = 1;
-        }
-
-        while (numWorkers--) {
-            m_workers.emplace_back(std::thread(&WorkQueue::doWork, this));
-        }
+        startWorkers(numWorkers);
     }
 
     // Initialize a workqueue with a worklist and a requested number of workers.
@@ -37,18 +41,13 @@ public:
     // If numWorkers is less than 0, use the number of CPU threads available on the
     // platform.
     //
-    explicit WorkQueue(std::deque<std::function<void()>> &worklist, int numWorkers = -1) :
-        m_work(worklist)
+    explicit WorkQueue(std::deque<std::function<void()>> &worklist, int numWorkers = -1)
     {
-        if (numWorkers < 1) {
-            numWorkers = std::thread::hardware_concurrency();
-        }
-        if (numWorkers < 1) {
-            numWorkers = 1;
-        }
+        startWorkers(numWorkers);
 
-        while (numWorkers--) {
-            m_workers.emplace_back(std::thread(&WorkQueue::doWork, this));
+        while (!worklist.empty()) {
+            submit(std::move(worklist.front()), false);
+            worklist.pop_front();
         }
     }
 
@@ -61,48 +60,147 @@ public:
         return std::thread::hardware_concurrency();
     }
 
+    int numWorkers() const {
+        return (int)m_queues.size();
+    }
+
+    // Lifetime counters for run statistics. busySeconds() and tasksRun()
+    // are only exact once the workers have been joined; maxQueueDepth()
+    // is a benign-race approximation of the deepest the queues got.
+    long long tasksRun() const {
+        long long n = 0;
+        for (size_t i = 0; i < m_queues.size(); ++i)
+            n += m_queues[i].tasks;
+        return n;
+    }
+
+    double busySeconds() const {
+        double s = 0;
+        for (size_t i = 0; i < m_queues.size(); ++i)
+            s += m_queues[i].busy;
+        return s;
+    }
+
+    int maxQueueDepth() const {
+        return m_depthMax;
+    }
+
     // Stop processing work right away and dispose of threads
     void abort() {
         m_exit = true;
         m_finish_work = false;
-        m_signalWaiting.notify_all();
+        wakeAll();
 
         joinAll();
 
-        {
-            std::lock_guard<std::mutex> lg(m_mutex);
-            m_work.clear();
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            std::lock_guard<std::mutex> lg(m_queues[i].m);
+            m_queues[i].q.clear();
         }
+        m_pending = 0;
     }
 
     // Finish all work and then dispose of threads afterwards
     void waitForCompletion() {
         m_exit = true;
         m_finish_work = true;
-        m_signalWaiting.notify_all();
+        wakeAll();
 
         joinAll();
     }
 
+    // Block until everything queued so far has finished, but keep the
+    // workers alive for more submissions. This is the barrier between
+    // dependent phases of a computation (e.g. successive rings of the
+    // tiled coverage sweep).
+    void drain() {
+        std::unique_lock<std::mutex> ul(m_mutex);
+        while (m_pending > 0 || m_active > 0) {
+            m_signalWorkDone.wait(ul);
+        }
+    }
+
+    // Submit a single job. If blocking is set and every worker already has
+    // work queued, wait for one of them to come free first.
     void submit(std::function<void()> job, bool blocking = true) {
-        std::unique_lock<std::mutex> ul(m_mutex); // constructed locked
         if (m_exit || !m_finish_work) {
             return;
         }
-        if (blocking && (m_work.size() >= m_workers.size())) {
+
+        if (blocking && m_pending >= (int)m_queues.size()) {
             // wait until a worker's available
             //fprintf(stderr, "Blocking until a thread is available\n");
-            m_signalWorkDone.wait(ul);
+            std::unique_lock<std::mutex> ul(m_mutex);
+            while (m_pending >= (int)m_queues.size()) {
+                m_signalWorkDone.wait(ul);
+            }
         }
 
         // Ok to add and return;
         //fprintf(stderr, "Adding job\n");
-        m_work.emplace_back(job);
-        m_signalWaiting.notify_one();
+        Task t;
+        t.job = std::move(job);
+        enqueue(std::move(t));
+        wakeOne();
+    }
+
+    // Submit the half-open index range [begin, end) as a batch: fn is invoked
+    // once per index, from the worker threads. The range is split into several
+    // chunks per worker -- small enough that uneven per-index costs still
+    // balance out through stealing, large enough that queue traffic is
+    // negligible -- and every chunk shares one heap-allocated copy of fn.
+    void submitRange(int begin, int end, std::function<void(int)> fn) {
+        if (m_exit || !m_finish_work || end <= begin) {
+            return;
+        }
+
+        std::shared_ptr<std::function<void(int)>> shared =
+            std::make_shared<std::function<void(int)>>(std::move(fn));
+
+        int chunk = (end - begin) / ((int)m_queues.size() * 8);
+        if (chunk < 1)
+            chunk = 1;
+
+        for (int b = begin; b < end; b += chunk) {
+            Task t;
+            t.rangeFn = shared;
+            t.begin = b;
+            t.end = (b + chunk < end) ? b + chunk : end;
+            enqueue(std::move(t));
+        }
+
+        wakeAll();
     }
 
 private:
-    std::deque<std::function<void()>> m_work;
+    // A task is either a plain closure or a chunk of an indexed range. The
+    // range form keeps the per-chunk payload down to a shared pointer and two
+    // ints instead of a separately allocated closure per index.
+    struct Task {
+        std::function<void()> job;
+        std::shared_ptr<std::function<void(int)>> rangeFn;
+        int begin = 0;
+        int end = 0;
+
+        void run() {
+            if (rangeFn) {
+                for (int i = begin; i < end; ++i) {
+                    (*rangeFn)(i);
+                }
+            } else {
+                job();
+            }
+        }
+    };
+
+    struct Worker {
+        std::deque<Task> q;
+        std::mutex m;
+        double busy = 0;        // written only by the owning thread
+        long long tasks = 0;
+    };
+
+    std::deque<Worker> m_queues;    // one per worker; deque because Worker can't move
     std::vector<std::thread> m_workers;
     std::mutex m_mutex;
 
@@ -111,34 +209,125 @@ private:
 
     std::atomic<bool> m_exit{ false };
     std::atomic<bool> m_finish_work{ true };  // override m_exit until the work is done
+    std::atomic<int> m_pending{ 0 };          // tasks enqueued but not yet dequeued
+    std::atomic<int> m_active{ 0 };           // tasks dequeued but not yet finished
+    std::atomic<unsigned> m_rr{ 0 };          // round-robin submission cursor
+    std::atomic<int> m_depthMax{ 0 };         // high-water mark of m_pending
+
+    void startWorkers(int numWorkers) {
+        if (numWorkers < 1) {
+            numWorkers = std::thread::hardware_concurrency();
+        }
+        if (numWorkers < 1) {
+            numWorkers = 1;
+        }
+
+        m_queues.resize(numWorkers);
+
+        for (int i = 0; i < numWorkers; ++i) {
+            m_workers.emplace_back(std::thread(&WorkQueue::doWork, this, i));
+        }
+    }
+
+    void enqueue(Task t) {
+        Worker &w = m_queues[m_rr++ % m_queues.size()];
+
+        int p = ++m_pending;
+        if (p > m_depthMax)
+            m_depthMax = p;
+
+        std::lock_guard<std::mutex> lg(w.m);
+        w.q.emplace_back(std::move(t));
+    }
+
+    // Grab the next task: the worker's own queue first, then the back of a
+    // neighbor's queue (stealing from the back keeps the owner and the thief
+    // off the same end).
+    bool getTask(int id, Task &t) {
+        {
+            Worker &w = m_queues[id];
+            std::lock_guard<std::mutex> lg(w.m);
+            if (!w.q.empty()) {
+                t = std::move(w.q.front());
+                w.q.pop_front();
+                ++m_active;     // before --m_pending, so drain() never sees both at zero mid-task
+                --m_pending;
+                return true;
+            }
+        }
+
+        for (size_t k = 1; k < m_queues.size(); ++k) {
+            Worker &w = m_queues[(id + k) % m_queues.size()];
+            std::lock_guard<std::mutex> lg(w.m);
+            if (!w.q.empty()) {
+                t = std::move(w.q.back());
+                w.q.pop_back();
+                ++m_active;
+                --m_pending;
+                return true;
+            }
+        }
+
+        return false;
+    }
 
     // Thread main loop
-    void doWork() {
-        std::unique_lock<std::mutex> ul(m_mutex); // constructed locked
-
-        while (!m_exit || (m_finish_work && !m_work.empty()) ) {
-            if (!m_work.empty()) {
-                //fprintf(stderr, "    Thr[%d]: Working.\n", myId);
-                std::function<void()> work(std::move(m_work.front()));
-                m_work.pop_front();
-                ul.unlock();
-                work();
-                ul.lock();
-                //fprintf(stderr, "    Thr[%d]: Done.\n", myId);
-                m_signalWorkDone.notify_one(); // This just notifies any blocking submits
-            } else {
-                //fprintf(stderr, "    Thr[%d]: Paused for more work.\n", myId);
-                m_signalWaiting.wait(ul);  // Wait until either new work is added or we're cleaning up
+    void doWork(int id) {
+        Task t;
+
+        while (true) {
+            if (m_exit && !m_finish_work) {
+                break;      // abort(): leave whatever is still queued
+            }
+
+            if (getTask(id, t)) {
+                //fprintf(stderr, "    Thr[%d]: Working.\n", id);
+                auto start = std::chrono::steady_clock::now();
+                t.run();
+                m_queues[id].busy += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+                m_queues[id].tasks++;
+                t = Task();     // drop the closure before possibly sleeping
+                --m_active;
+                //fprintf(stderr, "    Thr[%d]: Done.\n", id);
+                { std::lock_guard<std::mutex> lg(m_mutex); }
+                m_signalWorkDone.notify_all(); // notifies blocking submits and drain()
+                continue;
+            }
+
+            std::unique_lock<std::mutex> ul(m_mutex);
+
+            if (m_exit && (!m_finish_work || m_pending == 0)) {
+                break;
+            }
+
+            if (m_pending > 0) {
+                continue;   // something landed while we were scanning the queues
             }
+
+            //fprintf(stderr, "    Thr[%d]: Paused for more work.\n", id);
+            m_signalWaiting.wait(ul);  // Wait until either new work is added or we're cleaning up
         }
     }
 
+    // The empty critical sections below order the notify against anyone
+    // already inside a wait on m_mutex, so a wakeup can't slip into the gap
+    // between their predicate check and the wait itself.
+    void wakeOne() {
+        { std::lock_guard<std::mutex> lg(m_mutex); }
+        m_signalWaiting.notify_one();
+    }
+
+    void wakeAll() {
+        { std::lock_guard<std::mutex> lg(m_mutex); }
+        m_signalWaiting.notify_all();
+    }
+
     void joinAll() {
         for (auto& thread : m_workers){
             thread.join();
         }
         m_workers.clear();
-        m_work.clear();
     }
 
     void operator=(const WorkQueue&) = delete;